@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#
+# File: profsym.py
+#
+# Symbolizes a "profile dump" captured from the serial port against the
+# Star-$(ARCH).sym file produced by the Makefile, and prints the hottest
+# functions.
+#
+# Usage: profsym.py [--nm NM] [--top N] [--folded OUT] serial.log Star-x86_64.sym
+#
+# By default NM is $(ARCH)-elf-nm for the architecture named in the dump,
+# falling back to the host nm. --folded writes stacks in the format used by
+# flamegraph.pl.
+#
+
+import argparse
+import bisect
+import collections
+import shutil
+import subprocess
+import sys
+
+PROFILER_DUMP_VERSION = 1
+
+
+def parse(lines):
+    arch = None
+    samples = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) >= 5 and fields[0] == "PROFILE" and fields[1] == "BEGIN":
+            if int(fields[2]) != PROFILER_DUMP_VERSION:
+                sys.exit("Unsupported profile dump version %s" % fields[2])
+            arch = fields[3]
+            samples = []
+        elif len(fields) >= 3 and fields[0] == "P" and arch is not None:
+            try:
+                samples.append([int(f, 16) for f in fields[2:]])
+            except ValueError:
+                continue
+        elif len(fields) >= 2 and fields[0] == "PROFILE" and fields[1] == "END":
+            break
+
+    if arch is None:
+        sys.exit("No profile dump found")
+    return arch, samples
+
+
+def load_symbols(nm, path):
+    out = subprocess.run([nm, "-n", "--defined-only", path], check=True,
+                         stdout=subprocess.PIPE, universal_newlines=True).stdout
+    addresses = []
+    names = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or fields[1] not in "tTwW":
+            continue
+        addresses.append(int(fields[0], 16))
+        names.append(fields[2])
+    return addresses, names
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize a SydOS profile dump.")
+    parser.add_argument("--nm", help="nm to read symbols with")
+    parser.add_argument("--top", type=int, default=30, help="functions to print")
+    parser.add_argument("--folded", help="write folded stacks to this file")
+    parser.add_argument("log")
+    parser.add_argument("sym")
+    args = parser.parse_args()
+
+    with open(args.log, "r", errors="replace") as f:
+        arch, samples = parse(f)
+    if not samples:
+        sys.exit("Profile dump has no samples")
+
+    nm = args.nm or shutil.which("%s-elf-nm" % arch) or "nm"
+    addresses, names = load_symbols(nm, args.sym)
+
+    def symbolize(address):
+        i = bisect.bisect_right(addresses, address) - 1
+        if i < 0:
+            return "0x%x" % address
+        return names[i]
+
+    # Self counts use the interrupted instruction, inclusive counts use every
+    # function on the stack once.
+    self_counts = collections.Counter()
+    total_counts = collections.Counter()
+    folded = collections.Counter()
+    has_stacks = False
+    for frames in samples:
+        funcs = [symbolize(frames[0])] + [symbolize(a - 1) for a in frames[1:]]
+        has_stacks = has_stacks or len(funcs) > 1
+        self_counts[funcs[0]] += 1
+        for func in set(funcs):
+            total_counts[func] += 1
+        folded[";".join(reversed(funcs))] += 1
+
+    count = len(samples)
+    print("%u samples" % count)
+    print("%8s %7s %8s %7s  %s" % ("self", "%", "total", "%", "function"))
+    order = self_counts.most_common(args.top) if not has_stacks else \
+        sorted(total_counts.items(), key=lambda item: (-self_counts[item[0]], -item[1]))[:args.top]
+    for func, _ in order:
+        print("%8u %6.2f%% %8u %6.2f%%  %s" % (self_counts[func], 100.0 * self_counts[func] / count,
+              total_counts[func], 100.0 * total_counts[func] / count, func))
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for stack, n in folded.items():
+                f.write("%s %u\n" % (stack, n))
+
+
+if __name__ == "__main__":
+    main()
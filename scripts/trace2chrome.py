@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+#
+# File: trace2chrome.py
+#
+# Converts a "trace dump" captured from the serial port into Chrome trace JSON,
+# which can be loaded in chrome://tracing or https://ui.perfetto.dev.
+#
+# Usage: trace2chrome.py serial.log [out.json]
+#
+# Console output mixed into the log is ignored. Each processor is shown as a
+# thread of a single "SydOS" process.
+#
+
+import json
+import sys
+
+TRACE_DUMP_VERSION = 1
+
+
+def parse(lines):
+    rate = None
+    events = {}
+    records = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) >= 5 and fields[0] == "TRACE" and fields[1] == "BEGIN":
+            if int(fields[2]) != TRACE_DUMP_VERSION:
+                sys.exit("Unsupported trace dump version %s" % fields[2])
+            rate = int(fields[4])
+            events = {}
+            records = []
+        elif len(fields) == 4 and fields[0] == "TRACE" and fields[1] == "EVENT":
+            events[int(fields[2])] = fields[3]
+        elif len(fields) == 6 and fields[0] == "T" and rate is not None:
+            try:
+                cpu, ts, event, arg0, arg1 = (int(f, 16) for f in fields[1:])
+            except ValueError:
+                continue
+            records.append((ts, cpu, events.get(event, "event%u" % event), arg0, arg1))
+        elif len(fields) >= 2 and fields[0] == "TRACE" and fields[1] == "END":
+            break
+
+    if rate is None:
+        sys.exit("No trace dump found")
+    records.sort()
+    return rate, records
+
+
+def convert(rate, records):
+    out = []
+    if not records:
+        return out
+    start = records[0][0]
+
+    def us(ts):
+        return (ts - start) * 1000.0 / rate
+
+    # Open slices per processor. The timer IRQ doesn't return when it switches
+    # threads, so a switch ends any IRQ still open on that processor.
+    irqs = {}
+    threads = {}
+    disks = {}
+    for ts, cpu, name, arg0, arg1 in records:
+        base = {"pid": 0, "tid": cpu, "ts": us(ts)}
+        if name == "sched_switch":
+            for irq in irqs.pop(cpu, []):
+                out.append(dict(base, ph="E", name="IRQ%u" % irq, cat="irq"))
+            if cpu in threads:
+                out.append(dict(base, ph="E", name="thread %u" % threads[cpu], cat="sched"))
+            out.append(dict(base, ph="B", name="thread %u" % arg1, cat="sched"))
+            threads[cpu] = arg1
+        elif name == "irq_entry":
+            irqs.setdefault(cpu, []).append(arg0)
+            out.append(dict(base, ph="B", name="IRQ%u" % arg0, cat="irq"))
+        elif name == "irq_exit":
+            if arg0 in irqs.get(cpu, []):
+                irqs[cpu].remove(arg0)
+                out.append(dict(base, ph="E", name="IRQ%u" % arg0, cat="irq"))
+        elif name == "disk_start":
+            write = bool(arg0 & 0x80000000)
+            disks[cpu] = "disk %s" % ("write" if write else "read")
+            out.append(dict(base, ph="B", name=disks[cpu], cat="disk",
+                            args={"sectors": arg0 & 0x7FFFFFFF, "lba": arg1}))
+        elif name == "disk_done":
+            if cpu in disks:
+                out.append(dict(base, ph="E", name=disks.pop(cpu), cat="disk",
+                                args={"status": arg0}))
+        elif name in ("kheap_alloc", "kheap_free"):
+            out.append(dict(base, ph="i", s="t", name=name, cat="kheap",
+                            args={"size": arg0, "address": "0x%x" % arg1}))
+        elif name in ("net_rx", "net_tx"):
+            out.append(dict(base, ph="i", s="t", name=name, cat="net",
+                            args={"length": arg0}))
+        else:
+            out.append(dict(base, ph="i", s="t", name=name,
+                            args={"arg0": arg0, "arg1": arg1}))
+
+    for cpu in sorted({r[1] for r in records}):
+        out.append({"pid": 0, "tid": cpu, "ph": "M", "name": "thread_name",
+                    "args": {"name": "CPU%u" % cpu}})
+    out.append({"pid": 0, "ph": "M", "name": "process_name", "args": {"name": "SydOS"}})
+    return out
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("Usage: %s serial.log [out.json]" % sys.argv[0])
+
+    with open(sys.argv[1], "r", errors="replace") as f:
+        rate, records = parse(f)
+    trace = {"traceEvents": convert(rate, records), "displayTimeUnit": "ns"}
+
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -53,6 +53,36 @@ spinlock_lock:
     mov [eax+4], edx
 	ret
 
+global spinlock_trylock
+spinlock_trylock:
+    ; Get EFLAGS register and disable interrupts.
+    pushfd
+    pop edx
+    push edx
+    popfd
+    cli
+
+    ; Attempt to lock object once.
+    mov ecx, [esp+4]
+    lock bts dword [ecx], 0
+    jc .busy
+
+    ; Save state of interrupts and return true.
+    and edx, 0x200
+    mov [ecx+4], edx
+    mov eax, 1
+    ret
+
+.busy:
+    ; Restore interrupts and return false.
+    test edx, 0x200
+    jz .busy_ret
+    sti
+
+.busy_ret:
+    xor eax, eax
+    ret
+
 global spinlock_release
 spinlock_release:
     ; Get lock object.
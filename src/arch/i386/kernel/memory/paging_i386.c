@@ -171,6 +171,22 @@ void paging_map(uintptr_t virtual, uint64_t physical, bool kernel, bool writeabl
     paging_flush_tlb_address(virtual);
 }
 
+/**
+ * Maps a kernel page as write-combining. PWT alone selects PAT entry 1, set up by paging_pat_init().
+ */
+void paging_map_wc(uintptr_t virtual, uint64_t physical) {
+    uint64_t flags = PAGING_PAGE_PRESENT | PAGING_PAGE_READWRITE | PAGING_PAGE_WRITETHROUGH;
+
+    // Map address.
+    if (memInfo.paeEnabled)
+        paging_map_pae(virtual, physical | flags, false);
+    else
+        paging_map_std(virtual, physical | flags, false);
+
+    // Flush TLB
+    paging_flush_tlb_address(virtual);
+}
+
 void paging_unmap(uintptr_t virtual) {
     // Are we in PAE mode?
     if (memInfo.paeEnabled)
@@ -247,15 +263,62 @@ bool paging_get_phys(uintptr_t virtual, uint64_t *physOut) {
         return paging_get_phys_std(virtual, physOut);
 }
 
+static bool paging_get_flags_std(uintptr_t virtual, uint64_t *flagsOut) {
+    // Get pointer to page directory and calculate table and entry of virtual address.
+    uint32_t *directory = (uint32_t*)(PAGE_DIR_ADDRESS);
+    uint32_t tableIndex = paging_calculate_table(virtual);
+    uint32_t entryIndex = paging_calculate_entry(virtual);
+
+    // Ensure table and page are present.
+    if (MASK_PAGE_4K(directory[tableIndex]) == 0)
+        return false;
+    uint32_t *table = (uint32_t*)(PAGE_TABLES_ADDRESS + (tableIndex * PAGE_SIZE_4K));
+    if (!(table[entryIndex] & PAGING_PAGE_PRESENT))
+        return false;
+
+    // User and write access must be allowed by both the directory and table entries.
+    *flagsOut = MASK_PAGEFLAGS_4K(table[entryIndex]) & (directory[tableIndex] | ~(uint32_t)(PAGING_PAGE_USER | PAGING_PAGE_READWRITE));
+    return true;
+}
+
+static bool paging_get_flags_pae(uintptr_t virtual, uint64_t *flagsOut) {
+    // Get pointer to PDPT and calculate directory, table, entry of virtual address.
+    uint64_t *directoryPointerTable = (uint64_t*)(PAGE_PAE_PDPT_ADDRESS);
+    uint32_t dirIndex   = paging_pae_calculate_directory(virtual);
+    uint32_t tableIndex = paging_pae_calculate_table(virtual);
+    uint32_t entryIndex = paging_pae_calculate_entry(virtual);
+
+    // Ensure directory, table, and page are present.
+    if (MASK_DIRECTORY_PAE(directoryPointerTable[dirIndex]) == 0)
+        return false;
+    uint64_t *directory = (uint64_t*)paging_get_pae_directory_address(dirIndex);
+    if (MASK_PAGE_4K_64BIT(directory[tableIndex]) == 0)
+        return false;
+    uint64_t *table = (uint64_t*)(paging_get_pae_tables_address(dirIndex) + (tableIndex * PAGE_SIZE_4K));
+    if (!(table[entryIndex] & PAGING_PAGE_PRESENT))
+        return false;
+
+    // PDPT entries have no access bits, so only the directory entry can restrict the page.
+    *flagsOut = MASK_PAGEFLAGS_4K(table[entryIndex]) & (directory[tableIndex] | ~(uint64_t)(PAGING_PAGE_USER | PAGING_PAGE_READWRITE));
+    return true;
+}
+
+bool paging_get_flags(uintptr_t virtual, uint64_t *flagsOut) {
+    // Are we in PAE mode?
+    if (memInfo.paeEnabled)
+        return paging_get_flags_pae(virtual, flagsOut);
+    else
+        return paging_get_flags_std(virtual, flagsOut);
+}
+
 uintptr_t paging_create_app_copy(void) {
-    uint64_t appDirPage = pmm_pop_frame_nonlong();
+    uint64_t appDirPage = pmm_pop_zeroed_frame_nonlong();
 
     // Are we in PAE mode?
     if (memInfo.paeEnabled) {
         // PAE mode.
         // Create a new PDPT.
         uint64_t *appPointerTable = (uint64_t*)paging_device_alloc(appDirPage, appDirPage);
-        memset(appPointerTable, 0, PAGE_SIZE_4K);
 
         // Get pointer to current PDPT.
         uint64_t *directoryPointerTable = (uint64_t*)(PAGE_PAE_PDPT_ADDRESS);
@@ -265,13 +328,12 @@ uintptr_t paging_create_app_copy(void) {
         appPointerTable[dirIndex] = directoryPointerTable[dirIndex];
 
         // Create 2GB page directory.
-        uint32_t pageDirectoryAddr = pmm_pop_frame_nonlong();
+        uint32_t pageDirectoryAddr = pmm_pop_zeroed_frame_nonlong();
         appPointerTable[2] = pageDirectoryAddr | PAGING_PAGE_PRESENT;
         paging_flush_tlb();
 
-        // Zero out new directory.
+        // Map new directory.
         uint64_t *appLowPageDirectory = (uint64_t*)paging_device_alloc(pageDirectoryAddr, pageDirectoryAddr);
-        memset(appLowPageDirectory, 0, PAGE_SIZE_4K);
 
         // Map the 2GB page directory and the PDPT recursively.
         appLowPageDirectory[PAGE_PAE_DIRECTORY_SIZE - 1] = (uint64_t)pageDirectoryAddr | PAGING_PAGE_READWRITE | PAGING_PAGE_PRESENT | PAGING_PAGE_USER; // 2GB directory.
@@ -285,7 +347,6 @@ uintptr_t paging_create_app_copy(void) {
         // Standard mode.
         // Create a new paging directory.
         uint32_t *appPageDir = (uint32_t*)paging_device_alloc(appDirPage, appDirPage);
-        memset(appPageDir, 0, PAGE_SIZE_4K);
 
         // Get pointer to current page directory.
         uint32_t *directory = (uint32_t*)(PAGE_DIR_ADDRESS);
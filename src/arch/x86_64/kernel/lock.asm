@@ -30,39 +30,72 @@ section .text
 
 global spinlock_lock
 spinlock_lock:
+    ; Get RFLAGS register.
+    pushfq
+    pop rdx
+    push rdx
+    popfq
+
+    ; Disable interrupts before taking the lock, so an interrupt handler on this
+    ; processor can never spin on a lock we hold.
+    cli
+
     ; Get lock object.
     mov rax, rdi
 
 .loop:
-    ; Attemp to lock object.
+    ; Attempt to lock object.
     lock bts qword [rax], 0
     pause
 	jc .loop
 
-    ; Get RFLAGS register.
+    ; Save state of interrupts.
+    and rdx, 0x200
+    mov [rax+8], rdx
+	ret
+
+global spinlock_trylock
+spinlock_trylock:
+    ; Get RFLAGS register and disable interrupts.
     pushfq
     pop rdx
     push rdx
     popfq
+    cli
 
-    ; Save state of interrupts.
+    ; Attempt to lock object once.
+    mov rcx, rdi
+    lock bts qword [rcx], 0
+    jc .busy
+
+    ; Save state of interrupts and return true.
     and rdx, 0x200
-    mov [rax+8], rdx
+    mov [rcx+8], rdx
+    mov rax, 1
+    ret
 
-    ; Disable interrupts.
-    cli
-	ret
+.busy:
+    ; Restore interrupts and return false.
+    test rdx, 0x200
+    jz .busy_ret
+    sti
+
+.busy_ret:
+    xor rax, rax
+    ret
 
 global spinlock_release
 spinlock_release:
     ; Get lock object.
     mov rax, rdi
 
+    ; Get interrupt state before releasing, as the next owner overwrites it.
+    mov rdx, [rax+8]
+
     ; Release lock.
     mov qword [rax], 0
 
     ; Enable interrupts if they were enabled before.
-    mov rdx, [rax+8]
     cmp rdx, 0
     jz .spinlock_release_ret
     sti
@@ -139,6 +139,19 @@ void paging_map(uintptr_t virtual, uint64_t physical, bool kernel, bool writeabl
     paging_flush_tlb_address(virtual);
 }
 
+/**
+ * Maps a kernel page as write-combining. PWT alone selects PAT entry 1, set up by paging_pat_init().
+ */
+void paging_map_wc(uintptr_t virtual, uint64_t physical) {
+    uint64_t flags = PAGING_PAGE_PRESENT | PAGING_PAGE_READWRITE | PAGING_PAGE_WRITETHROUGH;
+
+    // Map address.
+    paging_map_long(virtual, physical | flags, false);
+
+    // Flush TLB
+    paging_flush_tlb_address(virtual);
+}
+
 void paging_unmap(uintptr_t virtual) {
     // Map address.
     paging_map_long(virtual, 0, true);
@@ -191,11 +204,35 @@ bool paging_get_phys(uintptr_t virtual, uint64_t *physOut) {
     return true;
 }
 
+bool paging_get_flags(uintptr_t virtual, uint64_t *flagsOut) {
+    // If the address is canonical, strip off the leading 0xFFFF.
+    if (virtual & 0xFFFF000000000000)
+        virtual &= 0x0000FFFFFFFFFFFF;
+
+    // Calculate PDPT, directory, table, entry of virtual address.
+    uint64_t *pml4Table = (uint64_t*)PAGE_LONG_PML4_ADDRESS;
+    uint32_t pdptIndex  = paging_long_calculate_pdpt(virtual);
+    uint32_t dirIndex   = paging_long_calculate_directory(virtual);
+    uint32_t tableIndex = paging_long_calculate_table(virtual);
+    uint32_t entryIndex = paging_long_calculate_entry(virtual);
+
+    // Walk each level. User and write access must be allowed at every level to be allowed for the page.
+    uint64_t *directoryPointerTable = (uint64_t*)PAGE_LONG_PDPT_ADDRESS(pdptIndex);
+    uint64_t *directory = (uint64_t*)PAGE_LONG_DIR_ADDRESS(pdptIndex, dirIndex);
+    uint64_t *table = (uint64_t*)(PAGE_LONG_TABLE_ADDRESS(pdptIndex, dirIndex, tableIndex));
+    if (MASK_PAGE_4K(pml4Table[pdptIndex]) == 0 || MASK_PAGE_4K(directoryPointerTable[dirIndex]) == 0
+        || MASK_PAGE_4K(directory[tableIndex]) == 0 || !(table[entryIndex] & PAGING_PAGE_PRESENT))
+        return false;
+
+    uint64_t accessMask = pml4Table[pdptIndex] & directoryPointerTable[dirIndex] & directory[tableIndex];
+    *flagsOut = MASK_PAGEFLAGS_4K(table[entryIndex]) & (accessMask | ~(uint64_t)(PAGING_PAGE_USER | PAGING_PAGE_READWRITE));
+    return true;
+}
+
 uintptr_t paging_create_app_copy(void) {
     // Create a new PML4 table.
-    uint64_t appPml4Page = pmm_pop_frame();
+    uint64_t appPml4Page = pmm_pop_zeroed_frame();
     uint64_t *appPml4Table = (uint64_t*)paging_device_alloc(appPml4Page, appPml4Page);
-    memset(appPml4Table, 0, PAGE_SIZE_4K);
 
     // Get current PML4 table.
     uint64_t *pml4Table = (uint64_t*)PAGE_LONG_PML4_ADDRESS;
@@ -70,6 +70,16 @@ multiboot_start:
 
 	align 8
 
+	; Framebuffer tag, optional with no preferred mode. GRUB's gfxpayload decides between text and graphics.
+	dw 5
+	dw 1
+	dd 20
+	dd 0
+	dd 0
+	dd 32
+
+	align 8
+
 	; End tag.
 	dw 0
 	dw 0
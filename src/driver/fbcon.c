@@ -0,0 +1,511 @@
+/*
+ * File: fbcon.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <string.h>
+#include <kprint.h>
+#include <kernel/lock.h>
+#include <kernel/memory/kheap.h>
+#include <kernel/memory/paging.h>
+#include <kernel/memory/pmm.h>
+#include <driver/fbcon.h>
+
+// 8x8 font for printable ASCII, bit 0 is the leftmost pixel. From the public domain font8x8 set.
+static const uint8_t fbconFont[FBCON_FONT_LAST - FBCON_FONT_FIRST + 1][FBCON_FONT_HEIGHT] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+    { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 }, // !
+    { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+    { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 }, // #
+    { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 }, // $
+    { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 }, // %
+    { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 }, // &
+    { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+    { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 }, // (
+    { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 }, // )
+    { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 }, // *
+    { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 }, // +
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, // ,
+    { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 }, // -
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, // .
+    { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 }, // /
+    { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 }, // 0
+    { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 }, // 1
+    { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 }, // 2
+    { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 }, // 3
+    { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 }, // 4
+    { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 }, // 5
+    { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 }, // 6
+    { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 }, // 7
+    { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 }, // 8
+    { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 }, // 9
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, // :
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, // ;
+    { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 }, // <
+    { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 }, // =
+    { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 }, // >
+    { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 }, // ?
+    { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 }, // @
+    { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 }, // A
+    { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 }, // B
+    { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 }, // C
+    { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 }, // D
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 }, // E
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 }, // F
+    { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 }, // G
+    { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 }, // H
+    { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // I
+    { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 }, // J
+    { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 }, // K
+    { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 }, // L
+    { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 }, // M
+    { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 }, // N
+    { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 }, // O
+    { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 }, // P
+    { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 }, // Q
+    { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 }, // R
+    { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 }, // S
+    { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // T
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 }, // U
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, // V
+    { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 }, // W
+    { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 }, // X
+    { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 }, // Y
+    { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 }, // Z
+    { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 }, // [
+    { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 }, // backslash
+    { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 }, // ]
+    { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 }, // ^
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF }, // _
+    { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+    { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 }, // a
+    { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 }, // b
+    { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 }, // c
+    { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 }, // d
+    { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 }, // e
+    { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 }, // f
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F }, // g
+    { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 }, // h
+    { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // i
+    { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E }, // j
+    { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 }, // k
+    { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // l
+    { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 }, // m
+    { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 }, // n
+    { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 }, // o
+    { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F }, // p
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 }, // q
+    { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 }, // r
+    { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 }, // s
+    { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 }, // t
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 }, // u
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, // v
+    { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 }, // w
+    { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 }, // x
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F }, // y
+    { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 }, // z
+    { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 }, // {
+    { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 }, // |
+    { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 }, // }
+    { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } // ~
+};
+
+// Pixel masks for every possible font row, so glyphs are drawn without per-pixel branches.
+static uint32_t fbconRowMasks[256][FBCON_GLYPH_WIDTH];
+
+// Standard VGA text colors, converted to the framebuffer's pixel format at init.
+static const uint8_t fbconVgaColors[16][3] = {
+    { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xAA }, { 0x00, 0xAA, 0x00 }, { 0x00, 0xAA, 0xAA },
+    { 0xAA, 0x00, 0x00 }, { 0xAA, 0x00, 0xAA }, { 0xAA, 0x55, 0x00 }, { 0xAA, 0xAA, 0xAA },
+    { 0x55, 0x55, 0x55 }, { 0x55, 0x55, 0xFF }, { 0x55, 0xFF, 0x55 }, { 0x55, 0xFF, 0xFF },
+    { 0xFF, 0x55, 0x55 }, { 0xFF, 0x55, 0xFF }, { 0xFF, 0xFF, 0x55 }, { 0xFF, 0xFF, 0xFF }
+};
+static uint32_t fbconPalette[16];
+
+static bool fbconActive = false;
+static bool fbconFound = false;
+static lock_t fbconLock = { };
+
+// Framebuffer information from the bootloader, copied before the Multiboot information is unmapped.
+static uint64_t fbconPhys;
+static uint8_t fbconFieldPositions[3];
+static uint8_t fbconFieldSizes[3];
+
+// Framebuffer, mapped write-combining.
+static uint8_t *fbconFramebuffer;
+static uint32_t fbconPitch;
+static uint32_t fbconWidth;
+static uint32_t fbconHeight;
+
+// Text grid and position.
+static uint16_t fbconColumns;
+static uint16_t fbconRows;
+static uint16_t fbconColumn = 0;
+static uint16_t fbconRow = 0;
+
+// Text history as a ring of rows of VGA-style entries (character and color). fbconTop is the
+// ring row shown at the top of the live screen.
+static uint16_t *fbconCells;
+static uint16_t fbconTop = 0;
+static uint16_t fbconHistoryRows;
+static uint16_t fbconViewOffset = 0;
+
+// Back buffer, with a band of FBCON_GLYPH_HEIGHT scanlines for each text row. The bands are a
+// ring too, so scrolling only clears a band instead of moving pixels.
+static uint32_t *fbconBack;
+static uint32_t fbconBackStride;
+static uint16_t fbconBandTop = 0;
+
+// Dirty rectangle of each text row, as a range of columns. Empty when start >= end.
+static uint16_t *fbconDirtyStart;
+static uint16_t *fbconDirtyEnd;
+
+// Cell the cursor was last drawn in.
+static uint16_t fbconCursorColumn = 0xFFFF;
+static uint16_t fbconCursorRow = 0xFFFF;
+
+bool fbcon_active(void) {
+    return fbconActive;
+}
+
+static inline uint16_t fbcon_entry(char c, uint8_t color) {
+    return (uint8_t)c | (uint16_t)color << 8;
+}
+
+static inline uint16_t *fbcon_cell_row(uint16_t row, uint16_t offset) {
+    return fbconCells + ((fbconTop + FBCON_HISTORY_ROWS - offset + row) % FBCON_HISTORY_ROWS) * fbconColumns;
+}
+
+static inline uint32_t *fbcon_band(uint16_t row) {
+    return fbconBack + ((fbconBandTop + row) % fbconRows) * FBCON_GLYPH_HEIGHT * fbconBackStride;
+}
+
+static inline void fbcon_mark_dirty(uint16_t row, uint16_t start, uint16_t end) {
+    if (start < fbconDirtyStart[row])
+        fbconDirtyStart[row] = start;
+    if (end > fbconDirtyEnd[row])
+        fbconDirtyEnd[row] = end;
+}
+
+static void fbcon_mark_all_dirty(void) {
+    for (uint16_t row = 0; row < fbconRows; row++) {
+        fbconDirtyStart[row] = 0;
+        fbconDirtyEnd[row] = fbconColumns;
+    }
+}
+
+/**
+ * Draws a cell into the back buffer.
+ * @param row       Text row on screen.
+ * @param column    Text column.
+ * @param entry     Character and color.
+ */
+static void fbcon_draw_cell(uint16_t row, uint16_t column, uint16_t entry) {
+    // Characters outside the font are shown as '?'.
+    uint8_t c = entry & 0xFF;
+    if (c < FBCON_FONT_FIRST || c > FBCON_FONT_LAST)
+        c = (c == 0) ? ' ' : '?';
+    const uint8_t *glyph = fbconFont[c - FBCON_FONT_FIRST];
+
+    // Each pixel is the background, with the bits that differ in the foreground masked in.
+    uint32_t bg = fbconPalette[(entry >> 12) & 0xF];
+    uint32_t diff = fbconPalette[(entry >> 8) & 0xF] ^ bg;
+    uint32_t *dest = fbcon_band(row) + column * FBCON_GLYPH_WIDTH;
+    for (uint8_t y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+        const uint32_t *mask = fbconRowMasks[glyph[y * FBCON_FONT_HEIGHT / FBCON_GLYPH_HEIGHT]];
+        for (uint8_t x = 0; x < FBCON_GLYPH_WIDTH; x++)
+            dest[x] = bg ^ (diff & mask[x]);
+        dest += fbconBackStride;
+    }
+}
+
+// Redraws every row on screen from the history at the current view offset.
+static void fbcon_redraw(void) {
+    for (uint16_t row = 0; row < fbconRows; row++) {
+        uint16_t *cells = fbcon_cell_row(row, fbconViewOffset);
+        for (uint16_t column = 0; column < fbconColumns; column++)
+            fbcon_draw_cell(row, column, cells[column]);
+    }
+    fbcon_mark_all_dirty();
+}
+
+static void fbcon_scroll(uint8_t color) {
+    // Move to the next row in both rings.
+    fbconTop = (fbconTop + 1) % FBCON_HISTORY_ROWS;
+    if (fbconHistoryRows < FBCON_HISTORY_ROWS)
+        fbconHistoryRows++;
+    fbconBandTop = (fbconBandTop + 1) % fbconRows;
+    fbconRow = fbconRows - 1;
+    fbconColumn = 0;
+
+    // Blank the new row.
+    uint16_t blank = fbcon_entry(' ', color);
+    uint16_t *cells = fbcon_cell_row(fbconRow, 0);
+    for (uint16_t column = 0; column < fbconColumns; column++)
+        cells[column] = blank;
+    uint32_t bg = fbconPalette[(color >> 4) & 0xF];
+    uint32_t *band = fbcon_band(fbconRow);
+    for (uint32_t i = 0; i < FBCON_GLYPH_HEIGHT * fbconBackStride; i++)
+        band[i] = bg;
+
+    // Everything on screen has moved.
+    fbcon_mark_all_dirty();
+}
+
+/**
+ * Puts a character on the console.
+ * @param c     Character to write.
+ * @param color VGA color attribute.
+ */
+void fbcon_putchar(char c, uint8_t color) {
+    spinlock_lock(&fbconLock);
+
+    // New output brings the view back to the live screen.
+    if (fbconViewOffset != 0) {
+        fbconViewOffset = 0;
+        fbcon_redraw();
+    }
+
+    if (c == '\n') {
+        // Move to new line.
+        fbconColumn = 0;
+        if (++fbconRow == fbconRows)
+            fbcon_scroll(color);
+    } else if (c == '\b' || c == 127) {
+        // Move back a position.
+        if (fbconColumn > 0)
+            fbconColumn--;
+    } else if (c == '\r') {
+        // Reset column.
+        fbconColumn = 0;
+    } else if (c != '\a') {
+        // Place normal character.
+        uint16_t entry = fbcon_entry(c, color);
+        fbcon_cell_row(fbconRow, 0)[fbconColumn] = entry;
+        fbcon_draw_cell(fbconRow, fbconColumn, entry);
+        fbcon_mark_dirty(fbconRow, fbconColumn, fbconColumn + 1);
+
+        // Scroll screen if needed.
+        if (++fbconColumn == fbconColumns) {
+            fbconColumn = 0;
+            if (++fbconRow == fbconRows)
+                fbcon_scroll(color);
+        }
+    }
+
+    spinlock_release(&fbconLock);
+}
+
+/**
+ * Moves the view through the scrollback history.
+ * @param rows  Rows to move back, or forward if negative.
+ */
+void fbcon_scrollback(int16_t rows) {
+    spinlock_lock(&fbconLock);
+    int32_t offset = fbconViewOffset + rows;
+    if (offset > fbconHistoryRows - fbconRows)
+        offset = fbconHistoryRows - fbconRows;
+    if (offset < 0)
+        offset = 0;
+
+    if (offset != fbconViewOffset) {
+        fbconViewOffset = offset;
+        fbcon_redraw();
+    }
+    spinlock_release(&fbconLock);
+}
+
+// Copies dirty rectangles and draws the cursor. Called with the lock held.
+static void fbcon_flush_locked(void) {
+
+    // Erase the cursor from where it was if it has moved, or hide it while viewing history.
+    uint16_t cursorColumn = fbconViewOffset ? 0xFFFF : fbconColumn;
+    uint16_t cursorRow = fbconViewOffset ? 0xFFFF : fbconRow;
+    if ((cursorColumn != fbconCursorColumn || cursorRow != fbconCursorRow) && fbconCursorRow < fbconRows)
+        fbcon_mark_dirty(fbconCursorRow, fbconCursorColumn, fbconCursorColumn + 1);
+
+    // Copy each row's dirty span, one scanline at a time.
+    uint32_t spanBytes;
+    for (uint16_t row = 0; row < fbconRows; row++) {
+        if (fbconDirtyStart[row] >= fbconDirtyEnd[row])
+            continue;
+
+        uint32_t *src = fbcon_band(row) + fbconDirtyStart[row] * FBCON_GLYPH_WIDTH;
+        uint8_t *dest = fbconFramebuffer + (row * FBCON_GLYPH_HEIGHT * fbconPitch) + (fbconDirtyStart[row] * FBCON_GLYPH_WIDTH * sizeof(uint32_t));
+        spanBytes = (fbconDirtyEnd[row] - fbconDirtyStart[row]) * FBCON_GLYPH_WIDTH * sizeof(uint32_t);
+        for (uint8_t y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+            memcpy(dest, (uint8_t*)src, spanBytes);
+            src += fbconBackStride;
+            dest += fbconPitch;
+        }
+
+        fbconDirtyStart[row] = fbconColumns;
+        fbconDirtyEnd[row] = 0;
+    }
+
+    // Draw the cursor over the bottom of its cell, straight into the framebuffer.
+    fbconCursorColumn = cursorColumn;
+    fbconCursorRow = cursorRow;
+    if (cursorRow < fbconRows) {
+        uint32_t color = fbconPalette[(fbcon_cell_row(cursorRow, 0)[cursorColumn] >> 8) & 0xF];
+        for (uint8_t y = FBCON_GLYPH_HEIGHT - FBCON_CURSOR_HEIGHT; y < FBCON_GLYPH_HEIGHT; y++) {
+            uint32_t *dest = (uint32_t*)(fbconFramebuffer + ((cursorRow * FBCON_GLYPH_HEIGHT + y) * fbconPitch)) + cursorColumn * FBCON_GLYPH_WIDTH;
+            for (uint8_t x = 0; x < FBCON_GLYPH_WIDTH; x++)
+                dest[x] = color;
+        }
+    }
+}
+
+/**
+ * Copies the dirty rectangles of the back buffer to the framebuffer, and draws the cursor.
+ */
+void fbcon_flush(void) {
+    if (!fbconActive)
+        return;
+    spinlock_lock(&fbconLock);
+    fbcon_flush_locked();
+    spinlock_release(&fbconLock);
+}
+
+/**
+ * Flushes like fbcon_flush() unless the console is in use. For the timer tick, which must not
+ * wait on a writer.
+ * @return True if the console was flushed.
+ */
+bool fbcon_try_flush(void) {
+    if (!fbconActive)
+        return true;
+    if (!spinlock_trylock(&fbconLock))
+        return false;
+    fbcon_flush_locked();
+    spinlock_release(&fbconLock);
+    return true;
+}
+
+// Converts an 8-bit color channel to a framebuffer field.
+static inline uint32_t fbcon_channel(uint8_t value, uint8_t position, uint8_t size) {
+    return ((uint32_t)value >> (8 - size)) << position;
+}
+
+/**
+ * Copies the framebuffer information out of the Multiboot information, if the bootloader set up a 32-bit linear framebuffer.
+ */
+void fbcon_early_init(void) {
+#ifdef PMM_MULTIBOOT2
+    // Find framebuffer tag.
+    struct multiboot_tag_framebuffer *fbTag = NULL;
+    multiboot_tag_t *tag = (multiboot_tag_t*)((uint64_t)&memInfo.mbootInfo->firstTag);
+    uint64_t end = (uint64_t)memInfo.mbootInfo + memInfo.mbootInfo->size;
+    for (; (tag->type != MULTIBOOT_TAG_TYPE_END) && ((uint64_t)tag < end); tag = (multiboot_tag_t*)((uint8_t*)tag + ((tag->size + 7) & ~7))) {
+        if (tag->type == MULTIBOOT_TAG_TYPE_FRAMEBUFFER) {
+            fbTag = (struct multiboot_tag_framebuffer*)tag;
+            break;
+        }
+    }
+
+    // Text mode framebuffers are handled by the VGA driver.
+    if (fbTag == NULL || fbTag->common.framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB)
+        return;
+    if (fbTag->common.framebuffer_bpp != FBCON_BPP) {
+        kprintf("FBCON: Unsupported framebuffer depth of %u bits!\n", fbTag->common.framebuffer_bpp);
+        return;
+    }
+
+    fbconPhys = fbTag->common.framebuffer_addr;
+    fbconWidth = fbTag->common.framebuffer_width;
+    fbconHeight = fbTag->common.framebuffer_height;
+    fbconPitch = fbTag->common.framebuffer_pitch;
+    fbconFieldPositions[0] = fbTag->framebuffer_red_field_position;
+    fbconFieldSizes[0] = fbTag->framebuffer_red_mask_size;
+    fbconFieldPositions[1] = fbTag->framebuffer_green_field_position;
+    fbconFieldSizes[1] = fbTag->framebuffer_green_mask_size;
+    fbconFieldPositions[2] = fbTag->framebuffer_blue_field_position;
+    fbconFieldSizes[2] = fbTag->framebuffer_blue_mask_size;
+    fbconFound = true;
+#endif
+}
+
+/**
+ * Starts the framebuffer console, if fbcon_early_init() found a usable framebuffer.
+ * @return True if the console is now in use.
+ */
+bool fbcon_init(void) {
+    if (!fbconFound)
+        return false;
+
+    fbconColumns = fbconWidth / FBCON_GLYPH_WIDTH;
+    fbconRows = fbconHeight / FBCON_GLYPH_HEIGHT;
+    fbconBackStride = fbconColumns * FBCON_GLYPH_WIDTH;
+    if (fbconColumns == 0 || fbconRows == 0 || fbconRows > FBCON_HISTORY_ROWS)
+        return false;
+
+    // Allocate history, back buffer, and dirty rectangles.
+    fbconCells = (uint16_t*)kheap_alloc(FBCON_HISTORY_ROWS * fbconColumns * sizeof(uint16_t));
+    fbconBack = (uint32_t*)kheap_alloc(fbconRows * FBCON_GLYPH_HEIGHT * fbconBackStride * sizeof(uint32_t));
+    fbconDirtyStart = (uint16_t*)kheap_alloc(fbconRows * sizeof(uint16_t));
+    fbconDirtyEnd = (uint16_t*)kheap_alloc(fbconRows * sizeof(uint16_t));
+    if (fbconCells == NULL || fbconBack == NULL || fbconDirtyStart == NULL || fbconDirtyEnd == NULL) {
+        kprintf("FBCON: Unable to allocate %ux%u console!\n", fbconColumns, fbconRows);
+        if (fbconCells != NULL)
+            kheap_free(fbconCells);
+        if (fbconBack != NULL)
+            kheap_free(fbconBack);
+        if (fbconDirtyStart != NULL)
+            kheap_free(fbconDirtyStart);
+        if (fbconDirtyEnd != NULL)
+            kheap_free(fbconDirtyEnd);
+        return false;
+    }
+
+    // Map framebuffer as write-combining, so the bulk copies in fbcon_flush() are not done a pixel at a time.
+    uint64_t physStart = fbconPhys & ~((uint64_t)PAGE_SIZE_4K - 1);
+    uint64_t physEnd = (fbconPhys + ((uint64_t)fbconPitch * fbconHeight) - 1) & ~((uint64_t)PAGE_SIZE_4K - 1);
+    fbconFramebuffer = (uint8_t*)paging_device_alloc_wc(physStart, physEnd) + (fbconPhys - physStart);
+
+    // Convert palette to the framebuffer's format.
+    for (uint8_t i = 0; i < 16; i++) {
+        fbconPalette[i] = 0;
+        for (uint8_t channel = 0; channel < 3; channel++)
+            fbconPalette[i] |= fbcon_channel(fbconVgaColors[i][channel], fbconFieldPositions[channel], fbconFieldSizes[channel]);
+    }
+
+    // Build row masks.
+    for (uint16_t bits = 0; bits < 256; bits++)
+        for (uint8_t x = 0; x < FBCON_GLYPH_WIDTH; x++)
+            fbconRowMasks[bits][x] = (bits & (1 << x)) ? 0xFFFFFFFF : 0;
+
+    // Clear the screen, including any margin outside the text area.
+    uint16_t blank = fbcon_entry(' ', 0x07);
+    for (uint32_t i = 0; i < FBCON_HISTORY_ROWS * fbconColumns; i++)
+        fbconCells[i] = blank;
+    fbconHistoryRows = fbconRows;
+    for (uint32_t y = 0; y < fbconHeight; y++)
+        memset(fbconFramebuffer + y * fbconPitch, 0, fbconWidth * sizeof(uint32_t));
+    fbcon_redraw();
+
+    fbconActive = true;
+    fbcon_flush();
+    kprintf("FBCON: Using %ux%u framebuffer at 0x%llX for a %ux%u console.\n", fbconWidth, fbconHeight,
+        fbconPhys, fbconColumns, fbconRows);
+    return true;
+}
@@ -24,142 +24,307 @@
 
 #include <main.h>
 #include <kprint.h>
+#include <string.h>
 #include <driver/fs/fat.h>
 #include <kernel/memory/kheap.h>
 
 #include <math.h>
 
-#include <driver/storage/floppy.h>
 #include <driver/storage/storage.h>
 
-static inline uint16_t fat_fat12_get_cluster(fat12_cluster_pair_t *clusters, uint16_t clusterNum) {
-    if (clusterNum % 2)
-        return clusters[clusterNum / 2].Cluster2;
-    else 
-        return clusters[clusterNum / 2].Cluster1;
+// Size of the boot sector read at mount time.
+#define FAT_BOOT_SECTOR_SIZE    512
+#define FAT_BOOT_SIGNATURE      0xAA55
+
+// First byte of a deleted directory entry.
+#define FAT_ENTRY_DELETED       0xE5
+
+// Mounted volumes.
+fat_volume_t *fatVolumes = NULL;
+
+static inline bool fat_is_data_cluster(fat_volume_t *fat, uint32_t cluster) {
+    return cluster >= FAT_FIRST_CLUSTER && cluster < fat->ClusterCount + FAT_FIRST_CLUSTER;
+}
+
+static inline uint64_t fat_cluster_to_byte(fat_volume_t *fat, uint32_t cluster) {
+    return ((uint64_t)fat->DataStart * fat->BytesPerSector) + (uint64_t)(cluster - FAT_FIRST_CLUSTER) * fat->BytesPerCluster;
+}
+
+static uint32_t fat_get_cluster(fat_volume_t *fat, uint32_t cluster) {
+    // Get value of next cluster from the cached FAT. Chain ends map to values that aren't data clusters.
+    switch (fat->Type) {
+        case FAT_TYPE_12: {
+            uint32_t offset = cluster + cluster / 2;
+            uint16_t value = fat->Table[offset] | (fat->Table[offset + 1] << 8);
+            return (cluster & 0x1) ? value >> 4 : value & 0xFFF;
+        }
+
+        case FAT_TYPE_16:
+            return ((uint16_t*)fat->Table)[cluster];
+
+        default:
+            return ((uint32_t*)fat->Table)[cluster] & FAT32_CLUSTER_MASK;
+    }
 }
 
-static inline uint32_t fat_fat12_get_num_clusters(fat12_t *fat, fat_dir_entry_t *entry) {
-    // Get clusters.
-    uint16_t cluster = entry->StartClusterLow;
+static bool fat_get_extents(fat_volume_t *fat, uint32_t cluster, fat_extent_t **outExtents, uint32_t *outExtentCount) {
+    // Walk the chain, joining consecutive clusters into runs.
+    fat_extent_t *extents = NULL;
+    uint32_t extentCount = 0;
+    uint32_t capacity = 0;
     uint32_t clusterCount = 0;
-    while (cluster >= 0x002 && cluster <= 0xFEF) {
-        // Get value of next cluster from FAT.
-        cluster = fat_fat12_get_cluster(fat->Table, cluster);
-        clusterCount++;
+    while (fat_is_data_cluster(fat, cluster)) {
+        // A chain longer than the volume must loop.
+        if (++clusterCount > fat->ClusterCount) {
+            kprintf("FAT: Cluster chain loops!\n");
+            kheap_free(extents);
+            return false;
+        }
+
+        if (extentCount > 0 && extents[extentCount - 1].Cluster + extents[extentCount - 1].Length == cluster) {
+            extents[extentCount - 1].Length++;
+        }
+        else {
+            if (extentCount == capacity) {
+                capacity = capacity > 0 ? capacity * 2 : 8;
+                fat_extent_t *grown = (fat_extent_t*)kheap_realloc(extents, capacity * sizeof(fat_extent_t));
+                if (grown == NULL) {
+                    kheap_free(extents);
+                    return false;
+                }
+                extents = grown;
+            }
+            extents[extentCount].Cluster = cluster;
+            extents[extentCount].Length = 1;
+            extentCount++;
+        }
+        cluster = fat_get_cluster(fat, cluster);
     }
 
-    return clusterCount;
+    *outExtents = extents;
+    *outExtentCount = extentCount;
+    return true;
 }
 
-bool fat_entry_read_fat12(fat12_t *fat, fat_dir_entry_t *entry, uint8_t *outBuffer, uint32_t length) {
-    // Ensure length isn't bigger than the entry size, if the entry size isn't zero.
-    if (entry->Length > 0 && length > entry->Length)
-        length = entry->Length;
+static bool fat_open_root(fat_volume_t *fat, fat_file_t *outFile) {
+    memset(outFile, 0, sizeof(fat_file_t));
+    outFile->Volume = fat;
+    outFile->Directory = true;
+
+    // FAT12/16 have a fixed root directory area, FAT32 keeps it in clusters.
+    if (fat->Type != FAT_TYPE_32) {
+        outFile->FixedRoot = true;
+        outFile->Size = fat->RootDirectoryLength * fat->BytesPerSector;
+        return true;
+    }
 
-    // Get the total clusters of the entry.
-    uint16_t bytesPerCluster = fat->Header.BPB.SectorsPerCluster * fat->Header.BPB.BytesPerSector;
-    uint32_t totalClusters = DIVIDE_ROUND_UP(entry->Length > 0 ? entry->Length : length, bytesPerCluster);
+    if (!fat_get_extents(fat, fat->RootDirectoryCluster, &outFile->Extents, &outFile->ExtentCount))
+        return false;
+    for (uint32_t i = 0; i < outFile->ExtentCount; i++)
+        outFile->Size += outFile->Extents[i].Length * fat->BytesPerCluster;
+    return true;
+}
 
-    // Create list of clusters.
-    uint64_t *blocks = (uint64_t*)kheap_alloc(totalClusters * sizeof(uint64_t));
-    memset(blocks, 0, totalClusters);
-    uint32_t remainingClusters = totalClusters;
-    uint32_t offset = 0;
+static bool fat_open_entry(fat_volume_t *fat, const fat_dir_entry_t *entry, fat_file_t *outFile) {
+    uint32_t cluster = entry->StartClusterLow;
+    if (fat->Type == FAT_TYPE_32)
+        cluster |= (uint32_t)entry->StartClusterHigh << 16;
 
-    // Get clusters.
-    uint16_t cluster = entry->StartClusterLow;
-    while (cluster >= 0x002 && cluster <= 0xFEF && remainingClusters) {
-        // Get value of next cluster from FAT.
-        uint16_t nextCluster = fat_fat12_get_cluster(fat->Table, cluster);
+    // A ".." entry pointing at cluster zero means the root directory.
+    if (entry->Subdirectory && cluster == 0)
+        return fat_open_root(fat, outFile);
 
-        // Add cluster to block list.
-        blocks[offset] = (fat->DataStart + cluster - 2) * bytesPerCluster;
+    memset(outFile, 0, sizeof(fat_file_t));
+    outFile->Volume = fat;
+    outFile->Directory = entry->Subdirectory;
+    if (!fat_get_extents(fat, cluster, &outFile->Extents, &outFile->ExtentCount))
+        return false;
 
-        offset++;
-        cluster = nextCluster;
-        remainingClusters--;
+    // Directories have no length of their own and span their whole chain.
+    if (outFile->Directory) {
+        for (uint32_t i = 0; i < outFile->ExtentCount; i++)
+            outFile->Size += outFile->Extents[i].Length * fat->BytesPerCluster;
+    }
+    else {
+        outFile->Size = entry->Length;
     }
+    return true;
+}
+
+/**
+ * Reads from an open file. Each cluster run in the range becomes one segment, so contiguous
+ * files are read with single large block requests.
+ * @param file      The file.
+ * @param offset    The byte offset to start reading at.
+ * @param outBuffer The buffer to read into.
+ * @param length    The number of bytes to read.
+ * @return True if the whole range was read.
+ */
+bool fat_read(fat_file_t *file, uint32_t offset, uint8_t *outBuffer, uint32_t length) {
+    fat_volume_t *fat = file->Volume;
+    if (offset > file->Size || length > file->Size - offset)
+        return false;
+    if (length == 0)
+        return true;
+
+    if (file->FixedRoot)
+        return fat->Device->Read(fat->Device, ((uint64_t)fat->RootDirectoryStart * fat->BytesPerSector) + offset, outBuffer, length);
+
+    storage_segment_t *segments = (storage_segment_t*)kheap_alloc(file->ExtentCount * sizeof(storage_segment_t));
+    if (segments == NULL)
+        return false;
 
-    // Read blocks from storage device.
-    bool result = fat->Device->ReadBlocks(fat->Device, blocks, 1, totalClusters, outBuffer, length);
+    // Map the byte range onto the extents it covers.
+    uint32_t segmentCount = 0;
+    uint64_t end = (uint64_t)offset + length;
+    uint64_t extentStart = 0;
+    for (uint32_t i = 0; i < file->ExtentCount && extentStart < end; i++) {
+        uint64_t extentEnd = extentStart + (uint64_t)file->Extents[i].Length * fat->BytesPerCluster;
+        if (extentEnd > offset) {
+            uint64_t start = extentStart > offset ? extentStart : offset;
+            uint64_t stop = extentEnd < end ? extentEnd : end;
+            segments[segmentCount].StartByte = fat_cluster_to_byte(fat, file->Extents[i].Cluster) + (start - extentStart);
+            segments[segmentCount].Length = (uint32_t)(stop - start);
+            segments[segmentCount].Buffer = outBuffer + (start - offset);
+            segmentCount++;
+        }
+        extentStart = extentEnd;
+    }
 
-    // Free cluster list.
-    kheap_free(blocks);
+    // Fail if the chain is shorter than the file claims.
+    bool result = extentStart >= end && fat->Device->ReadSegments(fat->Device, segments, segmentCount);
+    kheap_free(segments);
     return result;
 }
 
-void fat_display_entries(fat_dir_entry_t *dirEntries, uint32_t entryCount) {
-    //for (uint32_t i = 0; i < entryCount)
-        //kprintf("FAT:  %s: %s");
+/**
+ * Frees an open file.
+ * @param file  The file.
+ */
+void fat_close(fat_file_t *file) {
+    if (file->Extents != NULL)
+        kheap_free(file->Extents);
+    file->Extents = NULL;
+    file->ExtentCount = 0;
 }
 
-bool fat_get_dir_fat12(fat12_t *fat, fat_dir_entry_t *directory, fat_dir_entry_t **outDirEntries, uint32_t *outEntryCount) {
-    // Get number of clusters directory consumes.
-    uint32_t clusterCount = fat_fat12_get_num_clusters(fat, directory);
-
-    // Determine number of bytes in clusters.
-    uint16_t bytesPerCluster = fat->Header.BPB.SectorsPerCluster * fat->Header.BPB.BytesPerSector;
-    uint32_t length = clusterCount * bytesPerCluster;
-
+static bool fat_read_dir(fat_file_t *directory, fat_dir_entry_t **outDirEntries, uint32_t *outEntryCount) {
     // Allocate space for directory bytes.
-    fat_dir_entry_t *directoryEntries = (fat_dir_entry_t*)kheap_alloc(length);
-    memset(directoryEntries, 0, length);
+    fat_dir_entry_t *directoryEntries = (fat_dir_entry_t*)kheap_alloc(directory->Size);
+    if (directoryEntries == NULL)
+        return false;
 
     // Read from storage.
-    bool result = fat_entry_read_fat12(fat, directory, (uint8_t*)directoryEntries, length);
-    if (!result) {
+    if (!fat_read(directory, 0, (uint8_t*)directoryEntries, directory->Size)) {
         kheap_free(directoryEntries);
         return false;
     }
-    
-    // Count up entries.
+
+    // Count up entries, which end at the first unused one.
     uint32_t entryCount = 0;
-    for (uint32_t i = 0; i < length / sizeof(fat_dir_entry_t) && directoryEntries[i].FileName[0] != 0; i++)
+    for (uint32_t i = 0; i < directory->Size / sizeof(fat_dir_entry_t) && directoryEntries[i].FileName[0] != 0; i++)
         entryCount++;
 
-    // Reduce size of directory array.
-    directoryEntries = (fat_dir_entry_t*)kheap_realloc(directoryEntries, entryCount * sizeof(fat_dir_entry_t));
-
     // Get outputs.
     *outDirEntries = directoryEntries;
     *outEntryCount = entryCount;
     return true;
 }
 
-bool fat_get_root_dir(fat12_t *fat, fat_dir_entry_t **outDirEntries, uint32_t *outEntryCount) {
-    // Allocate space for directory bytes.
-    const uint32_t rootDirLength = sizeof(fat_dir_entry_t) * fat->Header.BPB.MaxRootDirectoryEntries;
-    fat_dir_entry_t *rootDirEntries = (fat_dir_entry_t*)kheap_alloc(rootDirLength);
-    memset(rootDirEntries, 0, rootDirLength);
+static inline bool fat_entry_visible(const fat_dir_entry_t *entry) {
+    // Skip deleted entries, and volume labels, which long file name entries also claim to be.
+    return (uint8_t)entry->FileName[0] != FAT_ENTRY_DELETED && !entry->VolumeLabel;
+}
 
-    // Read from storage.
-    bool result = fat->Device->Read(fat->Device, fat->RootDirectoryStart * fat->Header.BPB.BytesPerSector, rootDirEntries, rootDirLength);
-    if (!result) {
-        kheap_free(rootDirEntries);
-        return false;
+static void fat_get_short_name(const char *name, uint32_t length, char *outName) {
+    // Convert a path component into a padded 8.3 name. "." and ".." are stored as they are.
+    memset(outName, ' ', 11);
+    uint32_t i = 0;
+    if (name[0] == '.') {
+        for (; i < length && i < 11; i++)
+            outName[i] = name[i];
+        return;
     }
 
-    // Count up entries.
-    uint32_t entryCount = 0;
-    for (uint32_t i = 0; i < rootDirLength / sizeof(fat_dir_entry_t) && rootDirEntries[i].FileName[0] != 0; i++)
-        entryCount++;
+    for (uint32_t o = 0; i < length && name[i] != '.'; i++)
+        if (o < 8)
+            outName[o++] = toupper(name[i]);
+    for (uint32_t o = 8, j = i + 1; i < length && j < length && o < 11; j++)
+        outName[o++] = toupper(name[j]);
+}
+
+/**
+ * Opens a file or directory by path, such as "/DIR/FILE.TXT". Components are matched as 8.3 names.
+ * @param fat       The volume.
+ * @param path      The path.
+ * @param outFile   The opened file, to be closed with fat_close().
+ * @return True if the path was found.
+ */
+bool fat_open(fat_volume_t *fat, const char *path, fat_file_t *outFile) {
+    fat_file_t current;
+    if (!fat_open_root(fat, &current))
+        return false;
 
-    // Reduce size of directory array.
-    rootDirEntries = (fat_dir_entry_t*)kheap_realloc(rootDirEntries, entryCount * sizeof(fat_dir_entry_t));
+    while (true) {
+        while (*path == '/')
+            path++;
+        if (*path == '\0') {
+            *outFile = current;
+            return true;
+        }
 
-    // Get outputs.
-    *outDirEntries = rootDirEntries;
-    *outEntryCount = entryCount;
-    return true;
+        const char *end = path;
+        while (*end != '\0' && *end != '/')
+            end++;
+
+        // Look up the next component in the current directory.
+        char name[11];
+        fat_get_short_name(path, end - path, name);
+        fat_dir_entry_t *directoryEntries = NULL;
+        uint32_t entryCount = 0;
+        bool found = false;
+        fat_file_t next;
+        if (current.Directory && fat_read_dir(&current, &directoryEntries, &entryCount)) {
+            for (uint32_t i = 0; i < entryCount && !found; i++) {
+                if (fat_entry_visible(&directoryEntries[i]) && memcmp(directoryEntries[i].FileName, name, 11) == 0) {
+                    if (!fat_open_entry(fat, &directoryEntries[i], &next))
+                        break;
+                    found = true;
+                }
+            }
+            kheap_free(directoryEntries);
+        }
+
+        fat_close(&current);
+        if (!found)
+            return false;
+        current = next;
+        path = end;
+    }
 }
 
-void fat_print_dir(fat12_t *fat, fat_dir_entry_t *directoryEntries, uint32_t directoryEntriesCount, uint32_t level) {
+/**
+ * Prints the entries of a directory.
+ * @param fat   The volume.
+ * @param path  The path of the directory.
+ * @return True if the directory was found.
+ */
+bool fat_print_dir(fat_volume_t *fat, const char *path) {
+    fat_file_t directory;
+    if (!fat_open(fat, path, &directory))
+        return false;
+
+    fat_dir_entry_t *directoryEntries;
+    uint32_t directoryEntriesCount = 0;
+    bool result = directory.Directory && fat_read_dir(&directory, &directoryEntries, &directoryEntriesCount);
+    fat_close(&directory);
+    if (!result)
+        return false;
+
     for (uint32_t i = 0; i < directoryEntriesCount; i++) {
+        if (!fat_entry_visible(&directoryEntries[i]))
+            continue;
         kprintf("FAT:  ");
-        for (uint32_t p = 0; p < level; p++)
-            kprintf(" ");
-        
 
         // Get file name and extension.
         char fileName[9];
@@ -175,74 +340,165 @@ void fat_print_dir(fat12_t *fat, fat_dir_entry_t *directoryEntries, uint32_t dir
         else
             kprintf("%s: %s (%u bytes)\n", directoryEntries[i].Subdirectory ? "DIR " : "FILE", fileName, directoryEntries[i].Length);
 
-       /* if (directoryEntries[i].Subdirectory && directoryEntries[i].FileName[0] != '.') {
-            fat_dir_entry_t *subEntries;
-            uint32_t subCount = 0;
-            fat_get_dir_fat12(fat, directoryEntries+i, &subEntries, &subCount);
-            fat_print_dir(fat, subEntries, subCount, level+1);
-            kheap_free(subEntries);
-        }*/
-
         if (strcmp(fileName, "BEEMOVIE") == 0) {
-            uint8_t *bees = (uint8_t*)kheap_alloc(directoryEntries[i].Length + 1);
-            fat_entry_read_fat12(fat, directoryEntries+i, bees, directoryEntries[i].Length);
-            bees[directoryEntries[i].Length] ='\0';
-            kprintf(bees);
-            kheap_free(bees);
+            fat_file_t bees;
+            if (fat_open_entry(fat, directoryEntries + i, &bees)) {
+                uint8_t *beeText = (uint8_t*)kheap_alloc(bees.Size + 1);
+                if (beeText != NULL && fat_read(&bees, 0, beeText, bees.Size)) {
+                    beeText[bees.Size] = '\0';
+                    kprintf("%s", beeText);
+                }
+                if (beeText != NULL)
+                    kheap_free(beeText);
+                fat_close(&bees);
+            }
         }
     }
+
+    kheap_free(directoryEntries);
+    return true;
 }
 
-bool fat_init(storage_device_t *storageDevice) {
-    // Get header.
-    fat12_header_t *fatHeader = (fat12_header_t*)kheap_alloc(sizeof(fat12_header_t));
-    memset(fatHeader, 0, sizeof(fat12_header_t));
+static bool fat_header_valid(const uint8_t *sector) {
+    const fat_bpb_header_t *bpb = (const fat_bpb_header_t*)sector;
+    if (*(const uint16_t*)(sector + 510) != FAT_BOOT_SIGNATURE)
+        return false;
 
-    storageDevice->Read(storageDevice, 0, fatHeader, sizeof(fat12_header_t));
+    // Sector and cluster sizes must be powers of two.
+    if (bpb->BytesPerSector < 512 || bpb->BytesPerSector > 4096 || (bpb->BytesPerSector & (bpb->BytesPerSector - 1)))
+        return false;
+    if (bpb->SectorsPerCluster == 0 || (bpb->SectorsPerCluster & (bpb->SectorsPerCluster - 1)))
+        return false;
+    return bpb->ReservedSectorsCount > 0 && bpb->TableCount > 0;
+}
 
-    // Create FAT object.
-    fat12_t *fatVolume = (fat12_t*)kheap_alloc(sizeof(fat12_t));
-    memset(fatVolume, 0, sizeof(fat12_t));
+/**
+ * Mounts a FAT12, FAT16 or FAT32 volume and keeps its FAT in memory until unmounted.
+ * @param storageDevice The device holding the volume, such as a partition.
+ * @return The volume, or NULL if the device doesn't hold a FAT volume.
+ */
+fat_volume_t *fat_mount(storage_device_t *storageDevice) {
+    // Mounting the same device again returns the existing volume.
+    for (fat_volume_t *fat = fatVolumes; fat != NULL; fat = fat->Next)
+        if (fat->Device == storageDevice)
+            return fat;
+
+    // Get header.
+    uint8_t *sector = (uint8_t*)kheap_alloc(FAT_BOOT_SECTOR_SIZE);
+    if (sector == NULL)
+        return NULL;
+    if (!storageDevice->Read(storageDevice, 0, sector, FAT_BOOT_SECTOR_SIZE) || !fat_header_valid(sector)) {
+        kprintf("FAT: No FAT volume found.\n");
+        kheap_free(sector);
+        return NULL;
+    }
 
-    // Populate.
+    // Create FAT object.
+    fat_volume_t *fatVolume = (fat_volume_t*)kheap_alloc(sizeof(fat_volume_t));
+    if (fatVolume == NULL) {
+        kheap_free(sector);
+        return NULL;
+    }
+    memset(fatVolume, 0, sizeof(fat_volume_t));
+    memcpy((uint8_t*)&fatVolume->Header, sector, sizeof(fat_header_t));
+    kheap_free(sector);
+
+    // Populate. FAT32 keeps the table size and sector count in 32-bit fields.
+    fat_bpb_header_t *bpb = &fatVolume->Header.BPB;
+    uint32_t tableSize = bpb->TableSize ? bpb->TableSize : fatVolume->Header.Fat32.TableSize32;
+    uint32_t totalSectors = bpb->TotalSectors ? bpb->TotalSectors : bpb->TotalSectors32;
     fatVolume->Device = storageDevice;
-    fatVolume->Header = *fatHeader;
-    fatVolume->TableStart = fatVolume->Header.BPB.ReservedSectorsCount;
-    fatVolume->TableLength = fatVolume->Header.BPB.TableSize;
-    fatVolume->RootDirectoryStart = fatVolume->TableStart + (fatVolume->Header.BPB.TableSize * fatVolume->Header.BPB.TableCount);
-    fatVolume->RootDirectoryLength = ((fatVolume->Header.BPB.MaxRootDirectoryEntries * sizeof(fat_dir_entry_t)) + (fatVolume->Header.BPB.BytesPerSector - 1)) / fatVolume->Header.BPB.BytesPerSector;
+    fatVolume->BytesPerSector = bpb->BytesPerSector;
+    fatVolume->BytesPerCluster = bpb->BytesPerSector * bpb->SectorsPerCluster;
+    fatVolume->TableStart = bpb->ReservedSectorsCount;
+    fatVolume->TableLength = tableSize;
+    fatVolume->RootDirectoryStart = fatVolume->TableStart + (tableSize * bpb->TableCount);
+    fatVolume->RootDirectoryLength = ((bpb->MaxRootDirectoryEntries * sizeof(fat_dir_entry_t)) + (bpb->BytesPerSector - 1)) / bpb->BytesPerSector;
     fatVolume->DataStart = fatVolume->RootDirectoryStart + fatVolume->RootDirectoryLength;
-    fatVolume->DataLength = fatVolume->Header.BPB.TotalSectors - fatVolume->DataStart;
-    kheap_free(fatHeader);
+    if (tableSize == 0 || totalSectors <= fatVolume->DataStart) {
+        kprintf("FAT: Invalid volume layout.\n");
+        kheap_free(fatVolume);
+        return NULL;
+    }
+    fatVolume->DataLength = totalSectors - fatVolume->DataStart;
+    fatVolume->ClusterCount = fatVolume->DataLength / bpb->SectorsPerCluster;
+
+    // The FAT type is determined by the cluster count alone.
+    uint32_t tableBytes;
+    if (fatVolume->ClusterCount <= FAT12_MAX_CLUSTERS) {
+        fatVolume->Type = FAT_TYPE_12;
+        tableBytes = DIVIDE_ROUND_UP((fatVolume->ClusterCount + FAT_FIRST_CLUSTER) * 3, 2);
+    }
+    else if (fatVolume->ClusterCount <= FAT16_MAX_CLUSTERS) {
+        fatVolume->Type = FAT_TYPE_16;
+        tableBytes = (fatVolume->ClusterCount + FAT_FIRST_CLUSTER) * sizeof(uint16_t);
+    }
+    else {
+        fatVolume->Type = FAT_TYPE_32;
+        fatVolume->RootDirectoryCluster = fatVolume->Header.Fat32.RootDirectoryCluster;
+        tableBytes = (fatVolume->ClusterCount + FAT_FIRST_CLUSTER) * sizeof(uint32_t);
+    }
+
+    // Read the first FAT in one request, covering only the clusters that exist.
+    tableBytes = DIVIDE_ROUND_UP(tableBytes, fatVolume->BytesPerSector) * fatVolume->BytesPerSector;
+    if (tableBytes > tableSize * fatVolume->BytesPerSector) {
+        kprintf("FAT: FAT is too small for %u clusters.\n", fatVolume->ClusterCount);
+        kheap_free(fatVolume);
+        return NULL;
+    }
+    fatVolume->Table = (uint8_t*)kheap_alloc(tableBytes);
+    storage_segment_t tableSegment = { (uint64_t)fatVolume->TableStart * fatVolume->BytesPerSector, tableBytes, fatVolume->Table };
+    if (fatVolume->Table == NULL || !storageDevice->ReadSegments(storageDevice, &tableSegment, 1)) {
+        kprintf("FAT: Failed to read the FAT.\n");
+        if (fatVolume->Table != NULL)
+            kheap_free(fatVolume->Table);
+        kheap_free(fatVolume);
+        return NULL;
+    }
 
     char tempVolName[12];
-    strncpy(tempVolName, fatVolume->Header.VolumeLabel, 11);
+    strncpy(tempVolName, fatVolume->Type == FAT_TYPE_32 ? fatVolume->Header.Fat32.VolumeLabel : fatVolume->Header.Fat16.VolumeLabel, 11);
     tempVolName[11] = '\0';
 
-    char fatType[9];
-    strncpy(fatType, fatVolume->Header.FileSystemType, 8);
-    fatType[8] = '\0';
-
     // Get total sectors.
-    kprintf("FAT: Volume \"%s\" | %u bytes | %u sectors per cluster\n", tempVolName, fatVolume->Header.BPB.TotalSectors * fatVolume->Header.BPB.BytesPerSector, fatVolume->Header.BPB.SectorsPerCluster);
-    kprintf("FAT:   FAT type: %s | Serial number: 0x%X\n", fatType, fatVolume->Header.SerialNumber);
+    kprintf("FAT: Volume \"%s\" | %u bytes | %u sectors per cluster\n", tempVolName, totalSectors * fatVolume->BytesPerSector, bpb->SectorsPerCluster);
+    kprintf("FAT:   FAT type: FAT%u | %u clusters\n", fatVolume->Type, fatVolume->ClusterCount);
     kprintf("FAT:   FAT start: sector %u | Length: %u sectors\n", fatVolume->TableStart, fatVolume->TableLength);
-    kprintf("FAT:   Root Dir start: sector %u | Length: %u sectors\n", fatVolume->RootDirectoryStart, fatVolume->RootDirectoryLength);
+    if (fatVolume->Type == FAT_TYPE_32)
+        kprintf("FAT:   Root Dir start: cluster %u\n", fatVolume->RootDirectoryCluster);
+    else
+        kprintf("FAT:   Root Dir start: sector %u | Length: %u sectors\n", fatVolume->RootDirectoryStart, fatVolume->RootDirectoryLength);
     kprintf("FAT:   Data start: sector %u | Length: %u sectors\n", fatVolume->DataStart, fatVolume->DataLength);
-    kprintf("FAT:   Total sectors: %u\n", fatVolume->Header.BPB.TotalSectors);
-
-    // Get the FAT.
-    uint32_t fat12ClustersLength = fatVolume->TableLength * fatVolume->Header.BPB.BytesPerSector;
-    fatVolume->Table = (fat12_cluster_pair_t*)kheap_alloc(fat12ClustersLength);
-    memset(fatVolume->Table, 0, fat12ClustersLength);
-    storageDevice->Read(storageDevice, fatVolume->TableStart * fatVolume->Header.BPB.BytesPerSector, fatVolume->Table, fat12ClustersLength);
-
-    // Get root dir.
-    fat_dir_entry_t *rootDirEntries;
-    uint32_t rootDirEntriesCount = 0;
-    fat_get_root_dir(fatVolume, &rootDirEntries, &rootDirEntriesCount);
-    fat_print_dir(fatVolume, rootDirEntries, rootDirEntriesCount, 0);
-    kheap_free(rootDirEntries);
-    kheap_free(fatVolume->Table);
-    kheap_free(fatVolume);
+
+    // Add to mounted volumes.
+    fatVolume->Next = fatVolumes;
+    fatVolumes = fatVolume;
+    return fatVolume;
+}
+
+/**
+ * Unmounts a volume and frees its cached FAT. Files opened on it must be closed first.
+ * @param fat   The volume.
+ */
+void fat_unmount(fat_volume_t *fat) {
+    fat_volume_t **link = &fatVolumes;
+    while (*link != NULL && *link != fat)
+        link = &(*link)->Next;
+    if (*link != NULL)
+        *link = fat->Next;
+
+    kheap_free(fat->Table);
+    kheap_free(fat);
+}
+
+/**
+ * Mounts a volume and prints its root directory.
+ * @param storageDevice The device holding the volume.
+ * @return True if the volume was mounted.
+ */
+bool fat_init(storage_device_t *storageDevice) {
+    fat_volume_t *fat = fat_mount(storageDevice);
+    if (fat == NULL)
+        return false;
+    return fat_print_dir(fat, "/");
 }
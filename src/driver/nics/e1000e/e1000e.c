@@ -25,6 +25,7 @@
 #include <main.h>
 #include <io.h>
 #include <kprint.h>
+#include <klog.h>
 #include <tools.h>
 #include <kernel/lock.h>
 #include <driver/nics/e1000e.h>
@@ -100,7 +101,7 @@ static inline uint32_t e1000e_phy_read(e1000e_t *e1000eDevice, uint16_t reg) {
     uint32_t timeout = 100;
     while (!(e1000e_read(e1000eDevice, E1000E_REG_MDIC) & E1000E_PHY_READY)) {
         if (!timeout) {
-            kprintf("E1000E: PHY read timeout!\n");
+            klog_warn(E1000E, "PHY read timeout!\n");
             break;
         }
         sleep(1);
@@ -132,9 +133,9 @@ static bool e1000e_send_bytes(e1000e_t *e1000eDevice, const void *data, uint16_t
 
     while (!(e1000eDevice->TransmitDescs[descIndex].Status & 0xFF)) {
         sleep(1000);
-        kprintf("status 0x%X\n", e1000eDevice->TransmitDescs[descIndex].Status);
+        klog_trace(E1000E, "status 0x%X\n", e1000eDevice->TransmitDescs[descIndex].Status);
     }
-    kprintf("E1000E: sent 0x%X\n", e1000eDevice->TransmitDescs[descIndex].Status);
+    klog_trace(E1000E, "sent 0x%X\n", e1000eDevice->TransmitDescs[descIndex].Status);
     return true;
 }
 
@@ -158,20 +159,17 @@ void e1000e_reset(e1000e_t *e1000eDevice) {
     sleep(20);
 }
 
-static bool e1000e_callback(pci_device_t *pciDevice) {
-    // Get value of interrupt register.
-    uint32_t intReg = e1000e_read((e1000e_t*)pciDevice->DriverObject, E1000E_REG_ICR);
-
-    // If no interrupt bits are set, this device wasn't the one that raised the interrupt.
-    if (intReg == 0)
-        return false;
+static void e1000e_interrupt_work(void *arg) {
+    e1000e_t *e1000eDevice = (e1000e_t*)arg;
 
-    kprintf("E1000E: IRQ raised (0x%X)!\n", intReg);
+    // Take all interrupt causes raised since the last run.
+    uint32_t intReg = __atomic_exchange_n(&e1000eDevice->PendingInterrupts, 0, __ATOMIC_ACQ_REL);
+    klog_trace(E1000E, "IRQ raised (0x%X)!\n", intReg);
 
     // Link change.
     if (intReg & E1000E_INT_LSC) {
         // Get status register.
-        uint32_t status = e1000e_read((e1000e_t*)pciDevice->DriverObject, E1000E_REG_STATUS);
+        uint32_t status = e1000e_read(e1000eDevice, E1000E_REG_STATUS);
         if (status & E1000E_STATUS_LU) {
             char *speed = "10 Mbps";    
             if (status & E1000E_STATUS_SPEED_100)
@@ -189,9 +187,21 @@ static bool e1000e_callback(pci_device_t *pciDevice) {
     if (intReg & E1000E_INT_RXT0) {
 
     }
+}
 
-    // Clear interrupt bits.
-    e1000e_write((e1000e_t*)pciDevice->DriverObject, E1000E_REG_ICR, -1);
+static bool e1000e_callback(pci_device_t *pciDevice) {
+    // Get value of interrupt register.
+    e1000e_t *e1000eDevice = (e1000e_t*)pciDevice->DriverObject;
+    uint32_t intReg = e1000e_read(e1000eDevice, E1000E_REG_ICR);
+
+    // If no interrupt bits are set, this device wasn't the one that raised the interrupt.
+    if (intReg == 0)
+        return false;
+
+    // Clear interrupt bits and defer handling of them.
+    e1000e_write(e1000eDevice, E1000E_REG_ICR, -1);
+    __atomic_fetch_or(&e1000eDevice->PendingInterrupts, intReg, __ATOMIC_ACQ_REL);
+    workqueue_queue(&e1000eDevice->InterruptWork);
     return true;
 }
 
@@ -217,6 +227,10 @@ bool e1000e_init(pci_device_t *pciDevice) {
     // Register driver object and IRQ handler with PCI device object.
     pciDevice->DriverObject = e1000eDevice;
     pciDevice->InterruptHandler = e1000e_callback;
+    workqueue_work_init(&e1000eDevice->InterruptWork, e1000e_interrupt_work, e1000eDevice);
+
+    // Use MSI if possible, so the card doesn't share a line with other devices.
+    pci_msi_enable(pciDevice, 1, 0);
 
     // REset.
    // uint32_t *bdd = (uint32_t*)(e1000eDevice->BasePointer + 0x00);
@@ -225,7 +239,7 @@ bool e1000e_init(pci_device_t *pciDevice) {
   //  *(uint32_t*)(e1000eDevice->BasePointer + 0xD8) = 0xFFFFFFFF;
   //  *(uint32_t*)(e1000eDevice->BasePointer + 0x100) = 0;
  //   *(uint32_t*)(e1000eDevice->BasePointer + 0x400) = 0x8;
-    kprintf("E1000e: Status: 0x%X\n", *(uint32_t*)(e1000eDevice->BasePointer + 0x08));
+    klog_debug(E1000E, "Status: 0x%X\n", *(uint32_t*)(e1000eDevice->BasePointer + 0x08));
     sleep(1000);
 
     //while (*(uint32_t*)(buffer + 0x05B54) & 0x40);
@@ -240,13 +254,12 @@ bool e1000e_init(pci_device_t *pciDevice) {
     for (uint16_t i = 0; i < 0x80; i++)
         e1000e_write(e1000eDevice, 0x5200 + i * 4, 0);
 
-    kprintf("E1000e: Status: 0x%X\n", *(uint32_t*)(e1000eDevice->BasePointer + 0x08));
+    klog_debug(E1000E, "Status: 0x%X\n", *(uint32_t*)(e1000eDevice->BasePointer + 0x08));
     e1000e_write(e1000eDevice, E1000E_REG_IMS, 0xFFFFFFFF);
 
     // Get page for receive and transmit descriptors.
-    e1000eDevice->DescPage = pmm_pop_frame();
+    e1000eDevice->DescPage = pmm_pop_zeroed_frame();
     e1000eDevice->DescPtr = paging_device_alloc(e1000eDevice->DescPage, e1000eDevice->DescPage);
-    memset(e1000eDevice->DescPtr, 0, PAGE_SIZE_4K);
 
     // Initialize receive descriptors.
     e1000eDevice->ReceiveDescs = (e1000e_receive_desc_t*)e1000eDevice->DescPtr;
@@ -292,7 +305,7 @@ bool e1000e_init(pci_device_t *pciDevice) {
     e1000e_write(e1000eDevice, E1000E_REG_TCTL, 0b0110000000000111111000011111010);
     e1000e_write(e1000eDevice, E1000E_REG_TIPG, 0x0060200A);
 
-kprintf("E1000E: control 0x%X\n", e1000e_read(e1000eDevice, E1000E_REG_CTRL));
+klog_debug(E1000E, "control 0x%X\n", e1000e_read(e1000eDevice, E1000E_REG_CTRL));
 
     kprintf("sleeping for 10 seconds...\n");
     sleep(10000);
@@ -313,9 +326,9 @@ kprintf("E1000E: control 0x%X\n", e1000e_read(e1000eDevice, E1000E_REG_CTRL));
     data[12] = 0xFF;
     data[13] = 0xFF;
 
-     kprintf("E1000E: sending!\n");
+    klog_debug(E1000E, "sending!\n");
     e1000e_send_bytes(e1000eDevice, data, 100);
-    kprintf("E1000E: packet sent!\n");
+    klog_debug(E1000E, "packet sent!\n");
 
     // Create network device.
     net_device_t *netDevice = (net_device_t*)kheap_alloc(sizeof(net_device_t));
@@ -25,6 +25,7 @@
 #include <main.h>
 #include <io.h>
 #include <kprint.h>
+#include <klog.h>
 #include <tools.h>
 #include <string.h>
 #include <driver/nics/rtl8139.h>
@@ -38,6 +39,7 @@
 #include <kernel/memory/paging.h>
 
 #include <kernel/networking/networking.h>
+#include <kernel/trace.h>
 
 static inline void rtl8139_writeb(rtl8139_t *rtlDevice, uint16_t reg, uint8_t value) {
     outb(rtlDevice->BaseAddress + reg, value);
@@ -140,6 +142,10 @@ bool rtl8139_send_bytes(rtl8139_t *rtlDevice, const void *data, uint16_t length)
     return true;
 }
 
+static void rtl8139_rx_work(void *arg) {
+    rtl8139_receive_bytes((rtl8139_t*)arg);
+}
+
 static bool rtl8139_callback(pci_device_t *dev) {
     // If no interrupts were raised by the card, don't handle it.
     rtl8139_t *rtlDevice = (rtl8139_t*)dev->DriverObject;
@@ -147,18 +153,20 @@ static bool rtl8139_callback(pci_device_t *dev) {
     if (isrStatus == 0)
         return false;
 
-    kprintf("RTL8139: Current interrupt bits: 0x%X\n", isrStatus);
+    // Acknowledge interrupts.
+    klog_trace(RTL8139, "IRQ raised (0x%X)!\n", isrStatus);
+    outw(rtlDevice->BaseAddress + RTL8139_REG_ISR, isrStatus);
 
-    // Did we receive a packet?
+    // Did we receive a packet? Copying packets out of the ring is done outside of the interrupt.
     if (isrStatus & RTL8139_INT_ROK)
-        rtl8139_receive_bytes(rtlDevice);
-
-    outw(rtlDevice->BaseAddress + 0x3E, 0xFFFF);
+        workqueue_queue(&rtlDevice->RxWork);
     return true;
 }
 
 static bool rtl8139_net_send(net_device_t *netDevice, void *data, uint16_t length) {
+    trace(TRACE_EVENT_NET_TX, length, 0);
     rtl8139_send_bytes((rtl8139_t*)netDevice->Device, data, length);
+    return true;
 }
 
 bool rtl8139_init(pci_device_t *pciDevice) {
@@ -175,28 +183,29 @@ bool rtl8139_init(pci_device_t *pciDevice) {
     memset(rtlDevice, 0, sizeof(rtl8139_t));
     rtlDevice->PciDevice = pciDevice;
     pciDevice->DriverObject = rtlDevice;
-    kprintf("\e[35mRTL8139: Pointed RTL struct to DriverObject\n");
+    workqueue_work_init(&rtlDevice->RxWork, rtl8139_rx_work, rtlDevice);
+    klog_debug(RTL8139, "Pointed RTL struct to DriverObject\n");
     pciDevice->InterruptHandler = rtl8139_callback;
-    kprintf("RTL8139: Pointed RTL callback handler function to InterruptHandler\n");
+    klog_debug(RTL8139, "Pointed RTL callback handler function to InterruptHandler\n");
 
     // Setup base address
     rtlDevice->BaseAddress = pciDevice->BaseAddresses[0].BaseAddress;
 
     // Check base address is valid
     if(rtlDevice->BaseAddress == 0) {
-        kprintf("RTL8139: INVALID BAR\n");
+        klog_error(RTL8139, "INVALID BAR\n");
         kheap_free(rtlDevice);
         return false;
     }
-    kprintf("RTL8139: using BAR 0x%X\n", rtlDevice->BaseAddress);
+    klog_debug(RTL8139, "using BAR 0x%X\n", rtlDevice->BaseAddress);
 
     // Enable PCI busmastering.
     pci_enable_busmaster(pciDevice);
-    kprintf("RTL8139: Enabled PCI busmastering\n");
+    klog_debug(RTL8139, "Enabled PCI busmastering\n");
 
     // Bring card out of low power mode.
     rtl8139_writeb(rtlDevice, RTL8139_REG_CONFIG1, 0x00);
-    kprintf("RTL8139: Brought card out of low power mode.\n");
+    klog_debug(RTL8139, "Brought card out of low power mode.\n");
 
     // Read MAC address from RTL8139.
     for (uint8_t i = 0; i < 6; i++)
@@ -208,7 +217,7 @@ bool rtl8139_init(pci_device_t *pciDevice) {
     // Reset card by setting reset bit and waiting for bit to clear.
     rtl8139_writeb(rtlDevice, RTL8139_REG_CMD, RTL8139_CMD_RESET);
     while (rtl8139_readb(rtlDevice, RTL8139_REG_CMD) & RTL8139_CMD_RESET);
-    kprintf("RTL8139: Card reset!\n");	
+    klog_debug(RTL8139, "Card reset!\n");	
 
     // Get a 64KB DMA frame to use for buffers.
     if (!pmm_dma_get_free_frame(&rtlDevice->DmaFrame))
@@ -219,37 +228,37 @@ bool rtl8139_init(pci_device_t *pciDevice) {
     rtlDevice->TxBuffer1 = (uint8_t*)((uintptr_t)rtlDevice->TxBuffer0 + RTL8139_TX_BUFFER_SIZE);
     rtlDevice->TxBuffer2 = (uint8_t*)((uintptr_t)rtlDevice->TxBuffer1 + RTL8139_TX_BUFFER_SIZE);
     rtlDevice->TxBuffer3 = (uint8_t*)((uintptr_t)rtlDevice->TxBuffer2 + RTL8139_TX_BUFFER_SIZE);
-    kprintf("RTL8139: Allocated DMA space for RX and TX buffers.\n");
+    klog_debug(RTL8139, "Allocated DMA space for RX and TX buffers.\n");
 
     // Set IMR + ISR
     outw(rtlDevice->BaseAddress + 0x3C, 0xFFFF);
-    kprintf("RTL8139: Set IMR + ISR\n");
+    klog_debug(RTL8139, "Set IMR + ISR\n");
 
     // Enable RX and TX.
     rtl8139_writeb(rtlDevice, RTL8139_REG_CMD, RTL8139_CMD_TX_ENABLE | RTL8139_CMD_RX_ENABLE);
-    kprintf("RTL8139: Enabled RX and TX!\n");
+    klog_debug(RTL8139, "Enabled RX and TX!\n");
 
     // https://forum.osdev.org/viewtopic.php?t=25750&p=214461.
     // Set RX buffer physical memory location.
     rtl8139_writel(rtlDevice, RTL8139_REG_RX_BUFFER, (uint32_t)pmm_dma_get_phys((uintptr_t)rtlDevice->RxBuffer));
-    kprintf("RTL8139: Transmitted RX buffer location to card.\n");
+    klog_debug(RTL8139, "Transmitted RX buffer location to card.\n");
 
     // Configure RX buffer.
     rtl8139_writel(rtlDevice, RTL8139_REG_RCR, RTL8139_RCR_ACCEPT_ALL_PACKETS | RTL8139_RCR_ACCPET_PHYS_MATCH | RTL8139_RCR_ACCEPT_MULTICAST
         | RTL8139_RCR_ACCEPT_BROADCAST | RTL8139_RCR_ACCEPT_RUNT | RTL8139_RCR_ACCEPT_ERROR | RTL8139_RCR_WRAP | RTL8139_RCR_BUFFER_LENGTH_32K);
-    kprintf("RTL8139: Configured RX buffer.\n");
+    klog_debug(RTL8139, "Configured RX buffer.\n");
 
     // Configure TX buffers.
     rtl8139_writel(rtlDevice, RTL8139_REG_TX_BUFFER0, (uint32_t)pmm_dma_get_phys((uintptr_t)rtlDevice->TxBuffer0));
     rtl8139_writel(rtlDevice, RTL8139_REG_TX_BUFFER1, (uint32_t)pmm_dma_get_phys((uintptr_t)rtlDevice->TxBuffer1));
     rtl8139_writel(rtlDevice, RTL8139_REG_TX_BUFFER2, (uint32_t)pmm_dma_get_phys((uintptr_t)rtlDevice->TxBuffer2));
     rtl8139_writel(rtlDevice, RTL8139_REG_TX_BUFFER3, (uint32_t)pmm_dma_get_phys((uintptr_t)rtlDevice->TxBuffer3));
-    kprintf("RTL8139: Configured TX buffers.\n");
+    klog_debug(RTL8139, "Configured TX buffers.\n");
 
     // Ask for media status of RTL8139
-    kprintf("RTL8139: Media status: 0x%X\n", inb(rtlDevice->BaseAddress + 0x58));
-    kprintf("RTL8139: Mode status: 0x%X\n", inw(rtlDevice->BaseAddress + 0x64));
-    kprintf("RTL8139: CR: 0x%X\n", inb(rtlDevice->BaseAddress + 0x37));
+    klog_debug(RTL8139, "Media status: 0x%X\n", inb(rtlDevice->BaseAddress + 0x58));
+    klog_debug(RTL8139, "Mode status: 0x%X\n", inw(rtlDevice->BaseAddress + 0x64));
+    klog_debug(RTL8139, "CR: 0x%X\n", inb(rtlDevice->BaseAddress + 0x37));
 
     // Create network device.
     rtlDevice->NetDevice = (net_device_t*)kheap_alloc(sizeof(net_device_t));
@@ -32,6 +32,7 @@
 #include <driver/vga.h>
 
 #include <kernel/interrupts/irqs.h>
+#include <klog.h>
 
 #include <acpi.h>
 
@@ -39,14 +40,14 @@
 pci_device_t *PciDevices = NULL;
 
 static bool pci_irq_callback(irq_regs_t *regs, uint8_t irqNum) {
-    kprintf("PCI: IRQ %u raised!\n", irqNum);
+    klog_trace(PCI, "IRQ %u raised!\n", irqNum);
 
     // Call handlers of devices that are on the raised IRQ, until the IRQ is handled.
     pci_device_t *pciDevice = PciDevices;
     while (pciDevice != NULL) {
-        // Ensure device's IRQ matches and there is an interrupt handler.
-        if (pciDevice->InterruptNo == irqNum) {
-            kprintf("Checking device %X:%X, status: 0x%X\n", pciDevice->VendorId, pciDevice->DeviceId, pci_config_read_word(pciDevice, PCI_REG_STATUS));
+        // Ensure device's IRQ matches and there is an interrupt handler. Devices using MSI don't raise the line.
+        if (pciDevice->InterruptNo == irqNum && pciDevice->InterruptMode == PCI_INTERRUPT_MODE_LEGACY) {
+            klog_trace(PCI, "Checking device %X:%X, status: 0x%X\n", pciDevice->VendorId, pciDevice->DeviceId, pci_config_read_word(pciDevice, PCI_REG_STATUS));
             if ((pciDevice->InterruptHandler != NULL) && pciDevice->InterruptHandler(pciDevice))
                 return true;
         }
@@ -54,6 +55,7 @@ static bool pci_irq_callback(irq_regs_t *regs, uint8_t irqNum) {
         // Move to next device.
         pciDevice = pciDevice->Next;
     }
+    return false;
 }
 
 uint32_t pci_config_read_dword(pci_device_t *pciDevice, uint8_t reg) {
@@ -117,6 +119,29 @@ void pci_enable_busmaster(pci_device_t *pciDevice) {
     pci_config_write_word(pciDevice, PCI_REG_COMMAND, pci_config_read_word(pciDevice, PCI_REG_COMMAND) | PCI_CMD_BUSMASTER);
 }
 
+/**
+ * Search a device's capability list for a capability
+ * @param pciDevice The device to search
+ * @param capId     The capability ID to find
+ * @return          The offset of the capability in configuration space, or 0 if not found
+ */
+uint8_t pci_find_capability(pci_device_t *pciDevice, uint8_t capId) {
+    // Ensure device has a capability list.
+    if (!(pci_config_read_word(pciDevice, PCI_REG_STATUS) & PCI_STATUS_CAPABILITIES))
+        return 0;
+
+    // Walk list. Entries are dword-aligned and the list ends with a zero pointer.
+    uint8_t offset = pci_config_read_byte(pciDevice, PCI_REG_CAPABILITIES) & 0xFC;
+    for (uint8_t i = 0; offset != 0 && i < 48; i++) {
+        if (pci_config_read_byte(pciDevice, offset) == capId)
+            return offset;
+        offset = pci_config_read_byte(pciDevice, offset + 1) & 0xFC;
+    }
+
+    // Couldn't find it.
+    return 0;
+}
+
 /**
  * Print the description for a PCI device
  * @param dev PCIDevice struct with PCI device info
@@ -139,6 +164,8 @@ void pci_print_info(pci_device_t *pciDevice) {
     if(pciDevice->InterruptNo != 0) { 
         kprintf("  - Interrupt %u (Pin %u Line %u\e[0m\n", pciDevice->InterruptNo, pciDevice->InterruptPin, pciDevice->InterruptLine);
     }
+    if (pciDevice->MsiCapOffset || pciDevice->MsiXCapOffset)
+        kprintf("  - Supports%s%s\e[0m\n", pciDevice->MsiCapOffset ? " MSI" : "", pciDevice->MsiXCapOffset ? " MSI-X" : "");
 }
 
 /**
@@ -185,6 +212,8 @@ pci_device_t *pci_get_device(uint8_t bus, uint8_t device, uint8_t function, ACPI
     // Get interrupt info.
     pciDevice->InterruptPin = pci_config_read_byte(pciDevice, PCI_REG_INTERRUPT_PIN);
     pciDevice->InterruptLine = pci_config_read_byte(pciDevice, PCI_REG_INTERRUPT_LINE);
+    pciDevice->MsiCapOffset = pci_find_capability(pciDevice, PCI_CAP_ID_MSI);
+    pciDevice->MsiXCapOffset = pci_find_capability(pciDevice, PCI_CAP_ID_MSIX);
 
     // Get base address registers.
     for (uint8_t i = 0; i < PCI_BAR_COUNT; i++) {
@@ -264,10 +293,10 @@ static void pci_check_busses(uint8_t bus, pci_device_t *parentPciDevice) {
     uint8_t parentDevice = 0;
     if (parentPciDevice != NULL)
         parentDevice = parentPciDevice->Device;
-    kprintf("Getting _PRT for bus %u on device %u...\n", bus, parentDevice);
+    klog_debug(PCI, "Getting _PRT for bus %u on device %u...\n", bus, parentDevice);
     ACPI_STATUS status = acpi_get_prt(parentDevice << 16, &buffer);
     if (status) {
-        kprintf("PCI: An error occurred getting the IRQ routing table: 0x%X!\n", status);
+        klog_error(PCI, "An error occurred getting the IRQ routing table: 0x%X!\n", status);
         if (buffer.Pointer)
             ACPI_FREE(buffer.Pointer);
         buffer.Pointer = NULL;
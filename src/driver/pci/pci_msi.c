@@ -0,0 +1,278 @@
+/*
+ * File: pci_msi.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <driver/pci.h>
+
+#include <kernel/interrupts/irqs.h>
+#include <kernel/interrupts/smp.h>
+#include <kernel/memory/paging.h>
+
+// https://wiki.osdev.org/PCI#Message_Signaled_Interrupts
+
+// Devices and message indexes mapped to each IRQ.
+static pci_device_t *msiDevices[IRQ_MAX_COUNT];
+static uint16_t msiVectors[IRQ_MAX_COUNT];
+
+static bool pci_msi_callback(irq_regs_t *regs, uint8_t irqNum, uint32_t procIndex) {
+    // Get device that owns this IRQ. Messages are never shared, so no need to walk a list.
+    pci_device_t *pciDevice = msiDevices[irqNum];
+    if (pciDevice == NULL)
+        return false;
+
+    // Call device handler.
+    if (pciDevice->MsiHandler != NULL)
+        return pciDevice->MsiHandler(pciDevice, msiVectors[irqNum]);
+    else if (pciDevice->InterruptHandler != NULL)
+        return pciDevice->InterruptHandler(pciDevice);
+    return false;
+}
+
+static uint32_t pci_msi_address(uint32_t procIndex) {
+    // Message address targets the LAPIC of the specified processor, or all processors by logical destination.
+    if (procIndex == IRQ_PROC_ANY)
+        return PCI_MSI_ADDRESS_BASE | (0xFF << PCI_MSI_ADDRESS_DEST_SHIFT) | PCI_MSI_ADDRESS_REDIRECTION | PCI_MSI_ADDRESS_LOGICAL;
+    return PCI_MSI_ADDRESS_BASE | ((smp_get_apic_id(procIndex) & 0xFF) << PCI_MSI_ADDRESS_DEST_SHIFT);
+}
+
+static uint16_t pci_msi_data(uint8_t irq, uint32_t procIndex) {
+    // Message data is the vector with edge-triggered delivery.
+    return (procIndex == IRQ_PROC_ANY ? PCI_MSI_DATA_DELIVERY_LOWEST : PCI_MSI_DATA_DELIVERY_FIXED) | (IRQ_OFFSET + irq);
+}
+
+static void pci_msi_write_message(pci_device_t *pciDevice, uint32_t procIndex) {
+    // All MSI messages share one address, and the data for the first message.
+    uint8_t cap = pciDevice->MsiCapOffset;
+    pci_config_write_dword(pciDevice, cap + PCI_MSI_REG_ADDRESS_LOW, pci_msi_address(procIndex));
+    if (pci_config_read_word(pciDevice, cap + PCI_MSI_REG_CONTROL) & PCI_MSI_CONTROL_64BIT) {
+        pci_config_write_dword(pciDevice, cap + PCI_MSI_REG_ADDRESS_HIGH, 0);
+        pci_config_write_word(pciDevice, cap + PCI_MSI_REG_DATA_64, pci_msi_data(pciDevice->MsiIrqBase, procIndex));
+    }
+    else
+        pci_config_write_word(pciDevice, cap + PCI_MSI_REG_DATA_32, pci_msi_data(pciDevice->MsiIrqBase, procIndex));
+}
+
+static void pci_msix_write_entry(pci_device_t *pciDevice, uint16_t vector, uint32_t procIndex) {
+    // Reprogram entry while masked.
+    pciDevice->MsiXTable[vector].VectorControl = PCI_MSIX_ENTRY_MASKED;
+    pciDevice->MsiXTable[vector].AddressLow = pci_msi_address(procIndex);
+    pciDevice->MsiXTable[vector].AddressHigh = 0;
+    pciDevice->MsiXTable[vector].Data = pci_msi_data(pciDevice->MsiIrqBase + vector, procIndex);
+    pciDevice->MsiXTable[vector].VectorControl = 0;
+}
+
+static bool pci_msi_set_affinity(uint8_t irqNum, uint32_t procIndex) {
+    pci_device_t *pciDevice = msiDevices[irqNum];
+    if (pciDevice == NULL)
+        return false;
+
+    if (pciDevice->InterruptMode == PCI_INTERRUPT_MODE_MSIX) {
+        // Each MSI-X vector has its own entry.
+        pci_msix_write_entry(pciDevice, msiVectors[irqNum], procIndex);
+        return true;
+    }
+    else if (pciDevice->InterruptMode == PCI_INTERRUPT_MODE_MSI) {
+        // MSI messages all go to the same place, so the rest of the block moves too.
+        pci_msi_write_message(pciDevice, procIndex);
+        for (uint16_t i = 0; i < pciDevice->MsiIrqCount; i++)
+            if (pciDevice->MsiIrqBase + i != irqNum)
+                irqs_move_handlers(pciDevice->MsiIrqBase + i, procIndex);
+        return true;
+    }
+    return false;
+}
+
+static void pci_msi_map_irqs(pci_device_t *pciDevice, uint32_t procIndex) {
+    for (uint16_t i = 0; i < pciDevice->MsiIrqCount; i++) {
+        uint8_t irq = pciDevice->MsiIrqBase + i;
+        msiDevices[irq] = pciDevice;
+        msiVectors[irq] = i;
+        irqs_install_handler_proc(irq, pci_msi_callback, procIndex);
+        irqs_set_affinity_func(irq, pci_msi_set_affinity);
+    }
+}
+
+static void pci_msi_unmap_irqs(pci_device_t *pciDevice) {
+    for (uint16_t i = 0; i < pciDevice->MsiIrqCount; i++) {
+        uint8_t irq = pciDevice->MsiIrqBase + i;
+        irqs_set_affinity_func(irq, NULL);
+        irqs_remove_handler_proc(irq, pci_msi_callback, irqs_get_affinity(irq));
+        msiDevices[irq] = NULL;
+    }
+}
+
+static void pci_disable_intx(pci_device_t *pciDevice, bool disable) {
+    uint16_t command = pci_config_read_word(pciDevice, PCI_REG_COMMAND);
+    if (disable)
+        command |= PCI_CMD_INTERRUPT_DISABLE;
+    else
+        command &= ~PCI_CMD_INTERRUPT_DISABLE;
+    pci_config_write_word(pciDevice, PCI_REG_COMMAND, command);
+}
+
+/**
+ * Enables MSI on a device.
+ * @param pciDevice     The device.
+ * @param vectorCount   The number of messages wanted. This is rounded down to what the device supports.
+ * @param procIndex     The processor to deliver messages to.
+ * @return              True if MSI was enabled; otherwise false, with the device left on its legacy interrupt.
+ */
+bool pci_msi_enable(pci_device_t *pciDevice, uint8_t vectorCount, uint32_t procIndex) {
+    // Ensure device supports MSI and isn't already using messages.
+    uint8_t cap = pciDevice->MsiCapOffset;
+    if (cap == 0 || pciDevice->InterruptMode != PCI_INTERRUPT_MODE_LEGACY || vectorCount == 0)
+        return false;
+
+    // Determine number of messages. MSI supports power-of-two counts up to 32.
+    uint16_t control = pci_config_read_word(pciDevice, cap + PCI_MSI_REG_CONTROL);
+    uint8_t maxCount = 1 << ((control & PCI_MSI_CONTROL_MMC_MASK) >> PCI_MSI_CONTROL_MMC_SHIFT);
+    uint8_t countLog = 0;
+    while ((2 << countLog) <= vectorCount && (2 << countLog) <= maxCount)
+        countLog++;
+
+    // Allocate IRQs.
+    int16_t irq = irqs_alloc(1 << countLog);
+    if (irq < 0) {
+        kprintf("PCI: No free IRQs for MSI on %X:%X!\n", pciDevice->VendorId, pciDevice->DeviceId);
+        return false;
+    }
+    pciDevice->MsiIrqBase = (uint8_t)irq;
+    pciDevice->MsiIrqCount = 1 << countLog;
+    pci_msi_map_irqs(pciDevice, procIndex);
+
+    // Program message address and data.
+    pci_msi_write_message(pciDevice, procIndex);
+
+    // Enable MSI and disable the legacy interrupt.
+    control &= ~PCI_MSI_CONTROL_MME_MASK;
+    control |= (countLog << PCI_MSI_CONTROL_MME_SHIFT) | PCI_MSI_CONTROL_ENABLE;
+    pci_config_write_word(pciDevice, cap + PCI_MSI_REG_CONTROL, control);
+    pci_disable_intx(pciDevice, true);
+    pciDevice->InterruptMode = PCI_INTERRUPT_MODE_MSI;
+
+    kprintf("PCI: Enabled %u MSI message(s) on %X:%X at IRQ%u.\n", pciDevice->MsiIrqCount, pciDevice->VendorId, pciDevice->DeviceId, pciDevice->MsiIrqBase);
+    return true;
+}
+
+/**
+ * Enables MSI-X on a device.
+ * @param pciDevice     The device.
+ * @param vectorCount   The number of table entries wanted. This is capped to the device's table size.
+ * @param procIndex     The processor to initially deliver messages to. Use pci_msi_set_target() to spread vectors out.
+ * @return              True if MSI-X was enabled; otherwise false, with the device left on its legacy interrupt.
+ */
+bool pci_msix_enable(pci_device_t *pciDevice, uint16_t vectorCount, uint32_t procIndex) {
+    // Ensure device supports MSI-X and isn't already using messages.
+    uint8_t cap = pciDevice->MsiXCapOffset;
+    if (cap == 0 || pciDevice->InterruptMode != PCI_INTERRUPT_MODE_LEGACY || vectorCount == 0)
+        return false;
+
+    // Get table location.
+    uint16_t control = pci_config_read_word(pciDevice, cap + PCI_MSIX_REG_CONTROL);
+    uint16_t tableSize = (control & PCI_MSIX_CONTROL_TABLE_SIZE) + 1;
+    uint32_t table = pci_config_read_dword(pciDevice, cap + PCI_MSIX_REG_TABLE);
+    pci_base_register_t *bar = &pciDevice->BaseAddresses[table & PCI_MSIX_BIR_MASK];
+    if (bar->PortMapped || bar->BaseAddress == 0)
+        return false;
+
+    // Round count down to a power of two so the IRQs can be allocated as one block.
+    if (vectorCount > tableSize)
+        vectorCount = tableSize;
+    uint16_t count = 1;
+    while ((count << 1) <= vectorCount)
+        count <<= 1;
+
+    // Allocate IRQs.
+    int16_t irq = irqs_alloc(count);
+    if (irq < 0) {
+        kprintf("PCI: No free IRQs for MSI-X on %X:%X!\n", pciDevice->VendorId, pciDevice->DeviceId);
+        return false;
+    }
+
+    // Map table.
+    uint64_t tablePhys = bar->BaseAddress + (table & ~PCI_MSIX_BIR_MASK);
+    uint64_t tableEnd = tablePhys + (tableSize * sizeof(pci_msix_entry_t)) - 1;
+    uintptr_t tablePage = (uintptr_t)paging_device_alloc(MASK_PAGE_4K_64BIT(tablePhys), MASK_PAGE_4K_64BIT(tableEnd));
+    pciDevice->MsiXTable = (volatile pci_msix_entry_t*)(tablePage + (uintptr_t)MASK_PAGEFLAGS_4K_64BIT(tablePhys));
+    pciDevice->MsiIrqBase = (uint8_t)irq;
+    pciDevice->MsiIrqCount = count;
+    pci_msi_map_irqs(pciDevice, procIndex);
+
+    // Enable MSI-X with all vectors masked while the table is filled in.
+    pci_config_write_word(pciDevice, cap + PCI_MSIX_REG_CONTROL, control | PCI_MSIX_CONTROL_ENABLE | PCI_MSIX_CONTROL_MASK_ALL);
+    for (uint16_t i = 0; i < tableSize; i++) {
+        if (i < count)
+            pci_msix_write_entry(pciDevice, i, procIndex);
+        else
+            pciDevice->MsiXTable[i].VectorControl = PCI_MSIX_ENTRY_MASKED;
+    }
+
+    // Unmask function and disable the legacy interrupt.
+    pci_config_write_word(pciDevice, cap + PCI_MSIX_REG_CONTROL, (control | PCI_MSIX_CONTROL_ENABLE) & ~PCI_MSIX_CONTROL_MASK_ALL);
+    pci_disable_intx(pciDevice, true);
+    pciDevice->InterruptMode = PCI_INTERRUPT_MODE_MSIX;
+
+    kprintf("PCI: Enabled %u MSI-X vector(s) on %X:%X at IRQ%u.\n", pciDevice->MsiIrqCount, pciDevice->VendorId, pciDevice->DeviceId, pciDevice->MsiIrqBase);
+    return true;
+}
+
+/**
+ * Changes the processor a device's message is delivered to.
+ * @param pciDevice The device.
+ * @param vector    The message index. MSI shares one address across all messages, so all of them move.
+ * @param procIndex The processor to deliver to, or IRQ_PROC_ANY for lowest-priority delivery.
+ * @return          True if the target was changed.
+ */
+bool pci_msi_set_target(pci_device_t *pciDevice, uint16_t vector, uint32_t procIndex) {
+    if (pciDevice->InterruptMode == PCI_INTERRUPT_MODE_LEGACY || vector >= pciDevice->MsiIrqCount)
+        return false;
+    return irqs_set_affinity(pciDevice->MsiIrqBase + vector, procIndex);
+}
+
+/**
+ * Disables MSI or MSI-X on a device, returning it to its legacy interrupt.
+ * @param pciDevice The device.
+ */
+void pci_msi_disable(pci_device_t *pciDevice) {
+    if (pciDevice->InterruptMode == PCI_INTERRUPT_MODE_MSI) {
+        uint8_t cap = pciDevice->MsiCapOffset;
+        pci_config_write_word(pciDevice, cap + PCI_MSI_REG_CONTROL,
+            pci_config_read_word(pciDevice, cap + PCI_MSI_REG_CONTROL) & ~PCI_MSI_CONTROL_ENABLE);
+    }
+    else if (pciDevice->InterruptMode == PCI_INTERRUPT_MODE_MSIX) {
+        uint8_t cap = pciDevice->MsiXCapOffset;
+        pci_config_write_word(pciDevice, cap + PCI_MSIX_REG_CONTROL,
+            pci_config_read_word(pciDevice, cap + PCI_MSIX_REG_CONTROL) & ~PCI_MSIX_CONTROL_ENABLE);
+    }
+    else
+        return;
+
+    // Free IRQs and go back to the legacy interrupt.
+    pci_msi_unmap_irqs(pciDevice);
+    irqs_free(pciDevice->MsiIrqBase, pciDevice->MsiIrqCount);
+    pciDevice->MsiIrqCount = 0;
+    pciDevice->InterruptMode = PCI_INTERRUPT_MODE_LEGACY;
+    pci_disable_intx(pciDevice, false);
+}
@@ -206,12 +206,16 @@ static bool ps2_keyboard_callback(irq_regs_t *regs, uint8_t irqNum)
         return true;
     }
 
+    // Get keycode. Page Up and Page Down share their codes with the keypad and are told apart by the prefix.
+    uint16_t key = ps2_scancodes[data & ~0x80];
+    if (extended && key == KEYBOARD_KEY_NUM_9)
+        key = KEYBOARD_KEY_PAGE_UP;
+    else if (extended && key == KEYBOARD_KEY_NUM_3)
+        key = KEYBOARD_KEY_PAGE_DOWN;
+
     // Reset extended status.
     extended = false;
 
-    // Get keycode.
-    uint16_t key = ps2_scancodes[data & ~0x80];
-
     // Is the incoming code a make (press), or a break (release)?
     if (data & 0x80) { // Break code.
         // Handle special keys.
@@ -276,6 +280,13 @@ static bool ps2_keyboard_callback(irq_regs_t *regs, uint8_t irqNum)
                 numLock = !numLock;
                 ps2_keyboard_set_leds(numLock, capsLock, scrollLock);
                 break;
+
+            case KEYBOARD_KEY_PAGE_UP:
+            case KEYBOARD_KEY_PAGE_DOWN:
+                // Shift+Page Up/Down moves through the console history.
+                if (shiftPressed)
+                    vga_scrollback(key == KEYBOARD_KEY_PAGE_UP ? (VGA_HEIGHT - 1) : -(VGA_HEIGHT - 1));
+                break;
         }
     }
 
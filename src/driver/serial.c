@@ -26,26 +26,174 @@
 #include <tools.h>
 #include <io.h>
 #include <string.h>
+#include <kernel/lock.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/interrupts/irqs.h>
 #include <driver/serial.h>
 
 #define PORT 0x3f8   /* COM1 */
 
 static bool serialPresent = true;
 
+// Whether the FIFOs are usable, and how many more bytes polled writes can push before checking LSR.
+static bool serialFifo = false;
+static uint8_t serialPollFree = 0;
+
+// Ring buffers, used once the IRQ is installed.
+static bool serialIrqEnabled = false;
+static uint8_t serialIer = 0;
+
+// Protects the rings and UART registers. Taken from both the IRQ handler and writers.
+static lock_t serialLock = { };
+static uint8_t serialTxData[SERIAL_TX_BUFFER_SIZE];
+static uint8_t serialRxData[SERIAL_RX_BUFFER_SIZE];
+static serial_ring_t serialTx = { 0, 0, SERIAL_TX_BUFFER_SIZE, serialTxData };
+static serial_ring_t serialRx = { 0, 0, SERIAL_RX_BUFFER_SIZE, serialRxData };
+static uint32_t serialRxDropped = 0;
+
 // http://retired.beyondlogic.org/serial/serial.htm
 
 bool serial_present() {
     return serialPresent;
 }
 
+static inline uint32_t serial_ring_count(serial_ring_t *ring) {
+    return ring->Head - ring->Tail;
+}
+
+static inline bool serial_ring_put(serial_ring_t *ring, uint8_t data) {
+    if (serial_ring_count(ring) >= ring->Size)
+        return false;
+    ring->Data[ring->Head & (ring->Size - 1)] = data;
+    ring->Head++;
+    return true;
+}
+
+static inline uint8_t serial_ring_get(serial_ring_t *ring) {
+    uint8_t data = ring->Data[ring->Tail & (ring->Size - 1)];
+    ring->Tail++;
+    return data;
+}
+
+static inline bool serial_transmit_empty() {
+   return inb(SERIAL_REG_LSR(PORT)) & SERIAL_LSR_EMPTY_TRANS_HOLDING;
+}
+
+// Writes a byte directly to the UART, only checking LSR once per FIFO's worth of bytes.
+static void serial_poll_write(uint8_t data) {
+    if (serialPollFree == 0) {
+        while (!serial_transmit_empty());
+        serialPollFree = serialFifo ? SERIAL_FIFO_SIZE : 1;
+    }
+    outb(SERIAL_BUFFER(PORT), data);
+    serialPollFree--;
+}
+
+// Moves as much queued transmit data into the UART as fits. Called with the lock held.
+static void serial_tx_fill() {
+    if (serial_transmit_empty()) {
+        uint8_t count = serialFifo ? SERIAL_FIFO_SIZE : 1;
+        while (count-- && serial_ring_count(&serialTx) > 0)
+            outb(SERIAL_BUFFER(PORT), serial_ring_get(&serialTx));
+        serialPollFree = 0;
+    }
+
+    // Keep the transmit interrupt enabled only while there is more to send.
+    uint8_t ier = (serial_ring_count(&serialTx) > 0) ? (serialIer | SERIAL_IER_TRANSMIT_EMPTY) : (serialIer & ~SERIAL_IER_TRANSMIT_EMPTY);
+    if (ier != serialIer) {
+        serialIer = ier;
+        outb(SERIAL_REG_IER(PORT), serialIer);
+    }
+}
+
+// Moves received bytes from the UART into the receive ring. Called with the lock held.
+static void serial_rx_drain() {
+    while (inb(SERIAL_REG_LSR(PORT)) & SERIAL_LSR_DATA_READY) {
+        if (!serial_ring_put(&serialRx, inb(SERIAL_BUFFER(PORT))))
+            serialRxDropped++;
+    }
+}
+
+static bool serial_callback(irq_regs_t *regs, uint8_t irqNum, uint32_t procIndex) {
+    // If the UART has nothing pending, this IRQ wasn't ours.
+    uint8_t iir = inb(SERIAL_REG_IIR(PORT));
+    if (iir & SERIAL_IIR_NO_INTERRUPT)
+        return false;
+
+    spinlock_lock(&serialLock);
+    do {
+        switch (iir & SERIAL_IIR_ID_MASK) {
+            case SERIAL_IIR_RECEIVED_DATA:
+            case SERIAL_IIR_TIMEOUT:
+                serial_rx_drain();
+                break;
+
+            case SERIAL_IIR_TRANSMIT_EMPTY:
+                serial_tx_fill();
+                break;
+
+            case SERIAL_IIR_LINE_STATUS:
+                inb(SERIAL_REG_LSR(PORT));
+                break;
+
+            case SERIAL_IIR_MODEM_STATUS:
+                inb(SERIAL_REG_MSR(PORT));
+                break;
+        }
+        iir = inb(SERIAL_REG_IIR(PORT));
+    } while (!(iir & SERIAL_IIR_NO_INTERRUPT));
+    spinlock_release(&serialLock);
+    return true;
+}
+
+// Queues a byte for transmission, or writes it directly if the IRQ isn't in use yet.
+static void serial_put(uint8_t data) {
+    if (!serialIrqEnabled) {
+        serial_poll_write(data);
+        return;
+    }
+
+    spinlock_lock(&serialLock);
+    while (!serial_ring_put(&serialTx, data)) {
+        // Ring is full, push the oldest bytes out by hand to keep ordering.
+        while (!serial_transmit_empty());
+        serial_tx_fill();
+    }
+
+    // If the transmit interrupt is armed, the handler will send this byte.
+    if (!(serialIer & SERIAL_IER_TRANSMIT_EMPTY))
+        serial_tx_fill();
+    spinlock_release(&serialLock);
+}
+
+/**
+ * Sets the baud rate of the port.
+ * @param baud  The baud rate, which must divide SERIAL_MAX_BAUD.
+ * @return True if the rate was set.
+ */
+bool serial_set_baud(uint32_t baud) {
+    if (baud == 0 || baud > SERIAL_MAX_BAUD || SERIAL_MAX_BAUD % baud != 0)
+        return false;
+    uint16_t divisor = SERIAL_MAX_BAUD / baud;
+
+    spinlock_lock(&serialLock);
+    uint8_t lcr = inb(SERIAL_REG_LCR(PORT));
+    outb(SERIAL_REG_LCR(PORT), lcr | SERIAL_LCR_DLAB);
+    outb(SERIAL_REG_DLL(PORT), divisor & 0xFF);
+    outb(SERIAL_REG_DLM(PORT), divisor >> 8);
+    outb(SERIAL_REG_LCR(PORT), lcr & ~SERIAL_LCR_DLAB);
+    spinlock_release(&serialLock);
+    return true;
+}
+
 void serial_init() {
-    outb(PORT + 1, 0x00);    // Disable all interrupts
-    outb(PORT + 3, 0x80);    // Enable DLAB (set baud rate divisor)
-    outb(PORT + 0, 0x03);    // Set divisor to 3 (lo byte) 38400 baud
-    outb(PORT + 1, 0x00);    //                  (hi byte)
-    outb(PORT + 3, 0x03);    // 8 bits, no parity, one stop bit
-    outb(PORT + 2, 0xC7);    // Enable FIFO, clear them, with 14-byte threshold
-    
+    outb(SERIAL_REG_IER(PORT), 0x00);           // Disable all interrupts
+    outb(SERIAL_REG_LCR(PORT), SERIAL_LCR_8N1); // 8 bits, no parity, one stop bit
+    serial_set_baud(SERIAL_DEFAULT_BAUD);
+
+    // Enable FIFO, clear them, with 14-byte threshold. Only a 16550A reports both FIFO bits.
+    outb(SERIAL_REG_FCR(PORT), SERIAL_FCR_ENABLE | SERIAL_FCR_CLEAR_RECEIVE | SERIAL_FCR_CLEAR_TRANSMIT | SERIAL_FCR_TRIGGER_14);
+    serialFifo = (inb(SERIAL_REG_IIR(PORT)) & SERIAL_IIR_FIFO_ENABLED) == SERIAL_IIR_FIFO_ENABLED;
 
     // Place into loopback mode and test.
     outb(SERIAL_REG_MCR(PORT), SERIAL_MCR_LOOPBACK_MODE);
@@ -67,35 +215,132 @@ void serial_init() {
     serial_writes("If you're reading this, serial works.\n");
 }
 
-int is_transmit_empty() {
-   return inb(SERIAL_REG_LSR(PORT)) & SERIAL_LSR_EMPTY_TRANS_HOLDING;
+/**
+ * Switches the port over to interrupt-driven, buffered I/O.
+ */
+void serial_init_irq() {
+    if (!serialPresent)
+        return;
+
+    irqs_install_handler(IRQ_COM1, serial_callback);
+
+    // Take anything that arrived while polling, then let the UART interrupt on received data.
+    spinlock_lock(&serialLock);
+    serial_rx_drain();
+    serialIrqEnabled = true;
+    serialIer = SERIAL_IER_RECEIVED_DATA;
+    outb(SERIAL_REG_IER(PORT), serialIer);
+    spinlock_release(&serialLock);
 }
- 
+
+/**
+ * Returns to polled output and flushes queued data. The lock is not taken as it may be held by the
+ * processor that panicked.
+ */
+void serial_panic() {
+    if (!serialIrqEnabled)
+        return;
+
+    serialIrqEnabled = false;
+    serialIer = 0;
+    outb(SERIAL_REG_IER(PORT), serialIer);
+    while (serial_ring_count(&serialTx) > 0)
+        serial_poll_write(serial_ring_get(&serialTx));
+}
+
 void serial_write(char a) {
-  while (is_transmit_empty() == 0) { };
- 
-   outb(PORT,a);
+    serial_put(a);
 
    // If newline, print '\r' too.
    if (a == '\n')
-    outb(PORT,'\r');
+    serial_put('\r');
 }
 
 void serial_writes(const char* data) {
-    for (size_t i = 0; i < strlen(data); i++) {
-    serial_write(data[i]);
-	}
+    serial_write_text(data, strlen(data));
+}
+
+/**
+ * Writes text, sending "\n" as "\n\r" like serial_write(). The lock is only taken once for the whole run.
+ * @param data      The text to send.
+ * @param length    The number of characters.
+ */
+void serial_write_text(const char *data, size_t length) {
+    if (!serialIrqEnabled) {
+        for (size_t i = 0; i < length; i++) {
+            serial_poll_write(data[i]);
+            if (data[i] == '\n')
+                serial_poll_write('\r');
+        }
+        return;
+    }
+
+    spinlock_lock(&serialLock);
+    for (size_t i = 0; i < length; i++) {
+        for (uint8_t j = 0; j < ((data[i] == '\n') ? 2 : 1); j++) {
+            while (!serial_ring_put(&serialTx, j ? '\r' : data[i])) {
+                // Ring is full, push the oldest bytes out by hand to keep ordering.
+                while (!serial_transmit_empty());
+                serial_tx_fill();
+            }
+        }
+    }
+
+    // If the transmit interrupt is armed, the handler will send the text.
+    if (!(serialIer & SERIAL_IER_TRANSMIT_EMPTY))
+        serial_tx_fill();
+    spinlock_release(&serialLock);
+}
+
+/**
+ * Writes raw bytes, without newline translation.
+ * @param data      The bytes to send.
+ * @param length    The number of bytes.
+ */
+void serial_write_bytes(const void *data, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        serial_put(((const uint8_t*)data)[i]);
 }
 
 int serial_received() {
     if (!serialPresent)
         return 0;
 
+    if (serialIrqEnabled)
+        return serial_ring_count(&serialRx);
    return inb(SERIAL_REG_LSR(PORT)) & SERIAL_LSR_DATA_READY;
 }
  
 char serial_read() {
-   while (serial_received() == 0);
- 
-   return inb(PORT);
-}
\ No newline at end of file
+    if (!serialIrqEnabled) {
+        while (serial_received() == 0);
+        return inb(PORT);
+    }
+
+    // Wait for a byte. The receive interrupt wakes us, unless interrupts are off and it has to be polled.
+    while (serial_ring_count(&serialRx) == 0) {
+        if (interrupts_enabled()) {
+            asm volatile ("hlt");
+        }
+        else {
+            spinlock_lock(&serialLock);
+            serial_rx_drain();
+            spinlock_release(&serialLock);
+        }
+    }
+
+    spinlock_lock(&serialLock);
+    char c = serial_ring_get(&serialRx);
+    spinlock_release(&serialLock);
+    return c;
+}
+
+/**
+ * Reads raw bytes, waiting until all have arrived.
+ * @param data      Where to store the bytes.
+ * @param length    The number of bytes.
+ */
+void serial_read_bytes(void *data, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        ((uint8_t*)data)[i] = serial_read();
+}
@@ -26,11 +26,15 @@
 #include <tools.h>
 #include <io.h>
 #include <kprint.h>
+#include <string.h>
 #include <driver/storage/ahci/ahci.h>
 
 #include <kernel/interrupts/irqs.h>
 #include <kernel/memory/kheap.h>
+#include <kernel/memory/pmm.h>
+#include <kernel/multitasking/workqueue.h>
 #include <driver/storage/storage.h>
+#include <driver/storage/block.h>
 #include <kernel/memory/paging.h>
 #include <driver/pci.h>
 
@@ -200,6 +204,349 @@ static bool ahci_take_ownership(ahci_controller_t *ahciController) {
     return true;
 }
 
+static void ahci_port_recover(ahci_port_t *ahciPort) {
+    // Get controller and port.
+    ahci_controller_t *ahciController = ahciPort->Controller;
+    volatile ahci_port_memory_t *portMemory = ahciController->Memory->Ports + ahciPort->Number;
+
+    // Restart the port to clear the error, as per "6.2.2 Software Error Recovery". A device
+    // that is still busy needs a full reset.
+    ahci_port_cmd_stop(ahciPort);
+    portMemory->SataError.RawValue = -1;
+    portMemory->InterruptsStatus.RawValue = -1;
+    if (portMemory->TaskFileData.Status.Data.Busy || portMemory->TaskFileData.Status.Data.DataRequest)
+        ahci_port_reset(ahciPort);
+    else
+        ahci_port_cmd_start(ahciPort);
+}
+
+static void ahci_port_build_command(ahci_port_t *ahciPort, uint8_t slot, uint8_t command, uint64_t lba, uint16_t sectorCount, bool write, uint16_t prdtLength) {
+    // Build register FIS. Queued commands take the count in Features and the tag in Count.
+    ahci_fis_reg_host_to_device_t *fis = (ahci_fis_reg_host_to_device_t*)ahciPort->CommandTables[slot]->CommandFis;
+    memset(fis, 0, sizeof(ahci_fis_reg_host_to_device_t));
+    fis->FisType = AHCI_FIS_TYPE_REG_HOST_TO_DEVICE;
+    fis->IsCommand = true;
+    fis->CommandReg = command;
+    fis->Device = AHCI_DEVICE_LBA;
+    for (uint8_t i = 0; i < 3; i++) {
+        fis->Lba1[i] = (uint8_t)(lba >> (i * 8));
+        fis->Lba2[i] = (uint8_t)(lba >> (24 + i * 8));
+    }
+    if (command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED) {
+        fis->FeaturesLow = (uint8_t)sectorCount;
+        fis->FeaturesHigh = (uint8_t)(sectorCount >> 8);
+        fis->Count = slot << 3;
+    }
+    else {
+        fis->Count = sectorCount;
+
+        // 28-bit commands take the top of the LBA in the device register.
+        if (command == ATA_CMD_READ_DMA || command == ATA_CMD_WRITE_DMA)
+            fis->Device |= (lba >> 24) & 0x0F;
+    }
+
+    // Point the slot's header at its table.
+    ahci_command_header_t *header = ahciPort->CommandList + slot;
+    memset(header, 0, sizeof(ahci_command_header_t));
+    header->CommandFisLength = sizeof(ahci_fis_reg_host_to_device_t) / sizeof(uint32_t);
+    header->Write = write;
+    header->PhyRegionDescTableLength = prdtLength;
+    header->CommandTableBaseAddress = ahciPort->CommandTablesPhys[slot];
+}
+
+static uint16_t ahci_port_build_prdt(ahci_port_t *ahciPort, uint8_t slot, block_request_t *request) {
+    ahci_prdt_entry_t *prdt = ahciPort->CommandTables[slot]->PhysRegionDescTable;
+    bool addressing64 = ahciPort->Controller->Memory->Capabilities.Data.Addressing64bitSupported;
+
+    // Describe the request buffers directly, merging physically contiguous runs.
+    uint16_t entry = 0;
+    for (; request != NULL; request = request->MergeNext) {
+        uintptr_t address = (uintptr_t)request->Buffer;
+        uint32_t remaining = request->SectorCount * ATA_SECTOR_SIZE_512;
+        while (remaining > 0) {
+            uint64_t phys;
+            if (!paging_get_phys(address, &phys))
+                return 0;
+            uint32_t size = PAGE_SIZE_4K - (address & (PAGE_SIZE_4K - 1));
+            if (size > remaining)
+                size = remaining;
+
+            // Regions must start on an even address, and stay below 4GB without 64-bit addressing.
+            if ((phys & 0x1) || (!addressing64 && phys + size > 0x100000000ULL))
+                return 0;
+
+            ahci_prdt_entry_t *last = entry > 0 ? &prdt[entry - 1] : NULL;
+            if (last != NULL && last->DataBaseAddress + last->DataByteCount + 1 == phys
+                && last->DataByteCount + 1 + size <= AHCI_PRD_MAX_BYTES) {
+                last->DataByteCount += size;
+            }
+            else {
+                if (entry >= AHCI_PRDT_ENTRIES)
+                    return 0;
+                memset(&prdt[entry], 0, sizeof(ahci_prdt_entry_t));
+                prdt[entry].DataBaseAddress = phys;
+                prdt[entry].DataByteCount = size - 1;
+                entry++;
+            }
+
+            address += size;
+            remaining -= size;
+        }
+    }
+    return entry;
+}
+
+static void ahci_port_bounce_copy(ahci_port_t *ahciPort, block_request_t *request, bool toBounce) {
+    uint32_t offset = 0;
+    for (; request != NULL; request = request->MergeNext) {
+        uint32_t size = request->SectorCount * ATA_SECTOR_SIZE_512;
+        if (toBounce)
+            memcpy(ahciPort->BounceBuffer + offset, request->Buffer, size);
+        else
+            memcpy(request->Buffer, ahciPort->BounceBuffer + offset, size);
+        offset += size;
+    }
+}
+
+static bool ahci_port_start(block_device_t *blockDevice, block_request_t *request) {
+    // Get controller and port.
+    ahci_port_t *ahciPort = (ahci_port_t*)blockDevice->Device;
+    ahci_controller_t *ahciController = ahciPort->Controller;
+    volatile ahci_port_memory_t *portMemory = ahciController->Memory->Ports + ahciPort->Number;
+
+    uint32_t sectorCount = 0;
+    for (block_request_t *merged = request; merged != NULL; merged = merged->MergeNext)
+        sectorCount += merged->SectorCount;
+
+    // Only the block worker issues commands, so a free slot stays free until it is issued. The block
+    // layer never has more transfers in flight than there are slots.
+    uint8_t slot = 0;
+    while (slot < ahciPort->SlotCount && (ahciPort->ActiveSlots & (1 << slot)))
+        slot++;
+    if (slot == ahciPort->SlotCount)
+        return false;
+
+    // Fall back to the bounce buffer if the request buffers can't be described directly.
+    uint16_t prdtLength = ahci_port_build_prdt(ahciPort, slot, request);
+    if (prdtLength == 0) {
+        while (ahciPort->BounceSlot >= 0)
+            asm volatile ("hlt");
+        ahciPort->BounceSlot = slot;
+        if (request->Write)
+            ahci_port_bounce_copy(ahciPort, request, true);
+
+        ahci_prdt_entry_t *prdt = ahciPort->CommandTables[slot]->PhysRegionDescTable;
+        memset(prdt, 0, sizeof(ahci_prdt_entry_t));
+        prdt->DataBaseAddress = ahciPort->BounceBufferPhys;
+        prdt->DataByteCount = sectorCount * ATA_SECTOR_SIZE_512 - 1;
+        prdtLength = 1;
+    }
+
+    uint8_t command;
+    if (ahciPort->Ncq)
+        command = request->Write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    else if (ahciPort->Lba48)
+        command = request->Write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    else
+        command = request->Write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    ahci_port_build_command(ahciPort, slot, command, request->Sector, (uint16_t)sectorCount, request->Write, prdtLength);
+
+    // Wait out error recovery, then issue. Queued commands must be marked active before they are issued.
+    while (true) {
+        spinlock_lock(&ahciPort->SlotLock);
+        if (!ahciPort->Recovering)
+            break;
+        spinlock_release(&ahciPort->SlotLock);
+        asm volatile ("hlt");
+    }
+    ahciPort->SlotRequests[slot] = request;
+    ahciPort->ActiveSlots |= 1 << slot;
+    if (ahciPort->Ncq)
+        portMemory->SataActive = 1 << slot;
+    portMemory->CommandsIssued = 1 << slot;
+    spinlock_release(&ahciPort->SlotLock);
+    return true;
+}
+
+static void ahci_port_interrupt_work(void *arg) {
+    // Get controller and port.
+    ahci_port_t *ahciPort = (ahci_port_t*)arg;
+    ahci_controller_t *ahciController = ahciPort->Controller;
+    volatile ahci_port_memory_t *portMemory = ahciController->Memory->Ports + ahciPort->Number;
+    uint32_t status = __atomic_exchange_n(&ahciPort->PendingInterrupts, 0, __ATOMIC_ACQ_REL);
+
+    // A queued command is done once its active bit clears, others once their issue bit clears.
+    // On an error the device aborts everything still outstanding.
+    block_request_t *requests[AHCI_COMMAND_LIST_COUNT];
+    spinlock_lock(&ahciPort->SlotLock);
+    uint32_t busySlots = ahciPort->ActiveSlots & (portMemory->SataActive | portMemory->CommandsIssued);
+    uint32_t doneSlots = ahciPort->ActiveSlots & ~busySlots;
+    uint32_t failedSlots = 0;
+    if (status & AHCI_PORT_INT_ERRORS) {
+        failedSlots = busySlots;
+        ahciPort->Recovering = true;
+    }
+    for (uint8_t slot = 0; slot < ahciPort->SlotCount; slot++) {
+        if ((doneSlots | failedSlots) & (1 << slot)) {
+            requests[slot] = ahciPort->SlotRequests[slot];
+            ahciPort->SlotRequests[slot] = NULL;
+        }
+    }
+    ahciPort->ActiveSlots &= ~(doneSlots | failedSlots);
+    spinlock_release(&ahciPort->SlotLock);
+
+    if (status & AHCI_PORT_INT_ERRORS) {
+        kprintf("AHCI: Error on port %u (interrupt status 0x%X, task file 0x%X, SATA error 0x%X), failing %u commands.\n",
+            ahciPort->Number, status, portMemory->TaskFileData.Status.RawValue | (portMemory->TaskFileData.Error << 8),
+            portMemory->SataError.RawValue, __builtin_popcount(failedSlots));
+        ahci_port_recover(ahciPort);
+        ahciPort->Recovering = false;
+    }
+
+    for (uint8_t slot = 0; slot < ahciPort->SlotCount; slot++) {
+        if (!((doneSlots | failedSlots) & (1 << slot)))
+            continue;
+
+        // Copy read data out of the bounce buffer and release it.
+        bool success = (doneSlots & (1 << slot)) != 0;
+        if (ahciPort->BounceSlot == slot) {
+            if (success && !requests[slot]->Write)
+                ahci_port_bounce_copy(ahciPort, requests[slot], false);
+            ahciPort->BounceSlot = -1;
+        }
+        block_complete(requests[slot], success);
+    }
+}
+
+static bool ahci_callback(pci_device_t *pciDevice) {
+    // Get pending ports. If there are none, this controller didn't raise the interrupt.
+    ahci_controller_t *ahciController = (ahci_controller_t*)pciDevice->DriverObject;
+    uint32_t pendingPorts = ahciController->Memory->InterruptStatus;
+    if (pendingPorts == 0)
+        return false;
+
+    // Clear each port's status before the controller's, and defer handling of it.
+    for (uint8_t port = 0; port < ahciController->PortCount; port++) {
+        if (!(pendingPorts & (1 << port)))
+            continue;
+
+        volatile ahci_port_memory_t *portMemory = ahciController->Memory->Ports + port;
+        uint32_t status = portMemory->InterruptsStatus.RawValue;
+        portMemory->InterruptsStatus.RawValue = status;
+
+        ahci_port_t *ahciPort = ahciController->Ports[port];
+        if (ahciPort != NULL && ahciPort->Block.Start != NULL) {
+            __atomic_fetch_or(&ahciPort->PendingInterrupts, status, __ATOMIC_ACQ_REL);
+            workqueue_queue(&ahciPort->InterruptWork);
+        }
+    }
+    ahciController->Memory->InterruptStatus = pendingPorts;
+    return true;
+}
+
+static bool ahci_port_identify(ahci_port_t *ahciPort, ata_identify_result_2_t *outInfo) {
+    // Get controller and port.
+    ahci_controller_t *ahciController = ahciPort->Controller;
+    volatile ahci_port_memory_t *portMemory = ahciController->Memory->Ports + ahciPort->Number;
+
+    // Read the IDENTIFY data into the bounce buffer from slot 0, polling for completion.
+    ahci_prdt_entry_t *prdt = ahciPort->CommandTables[0]->PhysRegionDescTable;
+    memset(prdt, 0, sizeof(ahci_prdt_entry_t));
+    prdt->DataBaseAddress = ahciPort->BounceBufferPhys;
+    prdt->DataByteCount = ATA_SECTOR_SIZE_512 - 1;
+    ahci_port_build_command(ahciPort, 0, ATA_CMD_IDENTIFY, 0, 0, false, 1);
+    portMemory->InterruptsStatus.RawValue = -1;
+    portMemory->CommandsIssued = 1;
+
+    uint32_t timeout = AHCI_COMMAND_TIMEOUT;
+    while (portMemory->CommandsIssued & 1) {
+        // Was there an error, or was the timeout reached?
+        if ((portMemory->InterruptsStatus.RawValue & AHCI_PORT_INT_ERRORS) || timeout == 0) {
+            kprintf("AHCI: IDENTIFY failed on port %u (status 0x%X, error 0x%X)!\n", ahciPort->Number,
+                portMemory->TaskFileData.Status.RawValue, portMemory->TaskFileData.Error);
+            ahci_port_recover(ahciPort);
+            return false;
+        }
+
+        sleep(1);
+        timeout--;
+    }
+
+    memcpy((uint8_t*)outInfo, ahciPort->BounceBuffer, sizeof(ata_identify_result_2_t));
+    return true;
+}
+
+static bool ahci_port_init_disk(ahci_port_t *ahciPort) {
+    static uint8_t diskCount = 0;
+
+    // Get controller and port.
+    ahci_controller_t *ahciController = ahciPort->Controller;
+    volatile ahci_port_memory_t *portMemory = ahciController->Memory->Ports + ahciPort->Number;
+
+    // Allocate a command table for each slot, 4 to a page below 4GB.
+    const uint8_t tablesPerPage = PAGE_SIZE_4K / AHCI_COMMAND_TABLE_SIZE;
+    uint32_t tablePage = 0;
+    uint8_t *tables = NULL;
+    ahciPort->SlotCount = ahciController->Memory->Capabilities.Data.CommandSlotCount + 1;
+    for (uint8_t slot = 0; slot < ahciPort->SlotCount; slot++) {
+        if (slot % tablesPerPage == 0) {
+            tablePage = pmm_pop_zeroed_frame_nonlong();
+            tables = (uint8_t*)paging_device_alloc(tablePage, tablePage);
+        }
+        ahciPort->CommandTables[slot] = (ahci_command_table_t*)(tables + (slot % tablesPerPage) * AHCI_COMMAND_TABLE_SIZE);
+        ahciPort->CommandTablesPhys[slot] = tablePage + (slot % tablesPerPage) * AHCI_COMMAND_TABLE_SIZE;
+    }
+
+    // The bounce buffer is a 64KB DMA frame, so one region covers a whole transfer.
+    uintptr_t frame = 0;
+    if (!pmm_dma_get_free_frame(&frame)) {
+        kprintf("AHCI: No DMA frame for port %u!\n", ahciPort->Number);
+        return false;
+    }
+    ahciPort->BounceBuffer = (uint8_t*)frame;
+    ahciPort->BounceBufferPhys = (uint32_t)pmm_dma_get_phys(frame);
+    ahciPort->BounceSlot = -1;
+
+    // Identify disk.
+    ata_identify_result_2_t *info = (ata_identify_result_2_t*)kheap_alloc(sizeof(ata_identify_result_2_t));
+    if (!ahci_port_identify(ahciPort, info)) {
+        kheap_free(info);
+        return false;
+    }
+
+    // Model string is stored as big endian words.
+    char model[ATA_MODEL_LENGTH + 1];
+    for (uint8_t i = 0; i < ATA_MODEL_LENGTH; i += 2) {
+        model[i] = info->Model[i + 1];
+        model[i + 1] = info->Model[i];
+    }
+    model[ATA_MODEL_LENGTH] = '\0';
+
+    // Use NCQ if both the controller and disk support it.
+    ahciPort->Lba48 = info->CommandSets83.Lba48BitSupported;
+    ahciPort->Ncq = ahciController->Memory->Capabilities.Data.NativeCommandQueuingSupported && info->SerialAtaCapabilites76.NcqSupported;
+
+    ksnprintf(ahciPort->Block.Name, sizeof(ahciPort->Block.Name), "sata%u", diskCount++);
+    ahciPort->Block.Device = ahciPort;
+    ahciPort->Block.SectorSize = ATA_SECTOR_SIZE_512;
+    ahciPort->Block.SectorCount = ahciPort->Lba48 ? info->TotalLba48Bit : info->TotalLbaSectors28Bit;
+    ahciPort->Block.MaxSectors = AHCI_MAX_TRANSFER_SECTORS;
+    ahciPort->Block.Start = ahci_port_start;
+    ahciPort->Block.QueueDepth = 1;
+    if (ahciPort->Ncq)
+        ahciPort->Block.QueueDepth = info->MaxQueueDepth + 1U < ahciPort->SlotCount ? info->MaxQueueDepth + 1U : ahciPort->SlotCount;
+    kheap_free(info);
+
+    kprintf("AHCI: Port %u: %s, %llu sectors, %s with %u commands in flight.\n", ahciPort->Number, model,
+        ahciPort->Block.SectorCount, ahciPort->Ncq ? "NCQ" : "DMA", ahciPort->Block.QueueDepth);
+
+    // Enable completion and error interrupts.
+    workqueue_work_init(&ahciPort->InterruptWork, ahci_port_interrupt_work, ahciPort);
+    portMemory->InterruptsStatus.RawValue = -1;
+    portMemory->InterruptsEnabled.RawValue = AHCI_PORT_INT_DEVICE_TO_HOST_FIS | AHCI_PORT_INT_SET_DEVICE_BITS | AHCI_PORT_INT_ERRORS;
+    return true;
+}
+
 bool ahci_init(pci_device_t *pciDevice) {
     // ICheck that the device is an AHCI controller, and that the BAR is correct.
     if (!(pciDevice->Class == PCI_CLASS_MASS_STORAGE && pciDevice->Subclass == PCI_SUBCLASS_MASS_STORAGE_SATA && pciDevice->Interface == PCI_INTERFACE_MASS_STORAGE_SATA_VENDOR_AHCI))
@@ -228,8 +575,9 @@ bool ahci_init(pci_device_t *pciDevice) {
         return false;
     }
 
-    // Enable AHCI on controller.
+    // Enable AHCI on controller, and bus mastering so it can reach command lists and data.
     ahciController->Memory->GlobalControl.AhciEnabled = true;
+    pci_enable_busmaster(pciDevice);
 
     // Get port count and create port pointer array.
     ahciController->PortCount = ahciController->Memory->Capabilities.Data.PortCount + 1;
@@ -237,16 +585,14 @@ bool ahci_init(pci_device_t *pciDevice) {
     memset(ahciController->Ports, 0, sizeof(ahci_port_t*) * ahciController->PortCount);
 
     // Page to allocate command lists from.
-    uint32_t commandListPage = pmm_pop_frame_nonlong();
+    uint32_t commandListPage = pmm_pop_zeroed_frame_nonlong();
     ahci_command_header_t *commandLists = (ahci_command_header_t*)paging_device_alloc(commandListPage, commandListPage);
-    memset(commandLists, 0, PAGE_SIZE_4K);
     uint8_t commandListsAllocated = 0;
     const uint8_t maxCommandLists = PAGE_SIZE_4K / AHCI_COMMAND_LIST_SIZE; // 4 is the max that can be allocated from a 4KB page.
 
     // Page to allocated the recieved FIS structures from.
-    uint32_t receivedFisPage = pmm_pop_frame_nonlong();
+    uint32_t receivedFisPage = pmm_pop_zeroed_frame_nonlong();
     ahci_received_fis_t *recievedFises = (ahci_received_fis_t*)paging_device_alloc(receivedFisPage, receivedFisPage);
-    memset(recievedFises, 0, PAGE_SIZE_4K);
     uint8_t recievedFisesAllocated = 0;
     const uint8_t maxRecievedFises = PAGE_SIZE_4K / sizeof(ahci_received_fis_t); // 16 is the max that can be allocated from a 4KB page.
 
@@ -256,17 +602,15 @@ bool ahci_init(pci_device_t *pciDevice) {
         if (ahciController->Memory->PortsImplemented & (1 << port)) {
             // If no more command lists can be allocated, pop another page.
             if (commandListsAllocated == maxCommandLists) {
-                commandListPage = pmm_pop_frame_nonlong();
+                commandListPage = pmm_pop_zeroed_frame_nonlong();
                 commandLists = (ahci_command_header_t*)paging_device_alloc(commandListPage, commandListPage);
-                memset(commandLists, 0, PAGE_SIZE_4K);
                 commandListsAllocated = 0;
             }
 
             // If no more recived FIS structures can be allocated, pop another page.
             if (recievedFisesAllocated == maxRecievedFises) {
-                receivedFisPage = pmm_pop_frame_nonlong();
+                receivedFisPage = pmm_pop_zeroed_frame_nonlong();
                 recievedFises = (ahci_received_fis_t*)paging_device_alloc(receivedFisPage, receivedFisPage);
-                memset(recievedFises, 0, PAGE_SIZE_4K);
                 recievedFisesAllocated = 0;
             }
 
@@ -296,6 +640,7 @@ bool ahci_init(pci_device_t *pciDevice) {
     sleep(700);
 
     // Reset and probe ports.
+    uint32_t diskPorts = 0;
     for (uint32_t port = 0; port < ahciController->PortCount; port++) {
         // Skip over disabled ports.
         if (ahciController->Ports[port] == NULL)
@@ -310,6 +655,8 @@ bool ahci_init(pci_device_t *pciDevice) {
             switch (ahciController->Ports[port]->Type) {
                 case AHCI_DEV_TYPE_SATA:
                     kprintf("AHCI: Found SATA drive on port %u.\n", port);
+                    if (ahci_port_init_disk(ahciController->Ports[port]))
+                        diskPorts |= 1 << port;
                     break;
 
                 case AHCI_DEV_TYPE_SATA_ATAPI:
@@ -319,128 +666,16 @@ bool ahci_init(pci_device_t *pciDevice) {
         } 
     }
 
-
-    ahci_port_t *hddPort = ahciController->Ports[0];
-    
-
-    kprintf("moving on\n");
-    uint32_t cmdTablePage = pmm_pop_frame_nonlong();
-    ahci_command_table_t *cmdTable = (ahci_command_table_t*)paging_device_alloc(cmdTablePage, cmdTablePage);
-    memset(cmdTable, 0, PAGE_SIZE_4K);
-
-    uint32_t cmdTable2Page = pmm_pop_frame_nonlong();
-    ahci_command_table_t *cmdTable2 = (ahci_command_table_t*)paging_device_alloc(cmdTable2Page, cmdTable2Page);
-    memset(cmdTable2, 0, PAGE_SIZE_4K);
-    uint32_t ss = sizeof(ahci_received_fis_t);
-    
-    uint32_t dataPage = pmm_pop_frame_nonlong();
-    uint16_t *dataPtr = (uint16_t*)paging_device_alloc(dataPage, dataPage);
-    memset(dataPtr, 0, 0x1000);
-
-    uint32_t data2Page = pmm_pop_frame_nonlong();
-    uint16_t *data2Ptr = (uint16_t*)paging_device_alloc(data2Page, data2Page);
-    memset(data2Ptr, 0, 0x1000);
-
-    ata_identify_result_2_t* ata = (ata_identify_result_2_t*)dataPtr;
-    uint32_t fff = sizeof(ata_identify_result_2_t);
-
-    ahci_port_cmd_stop(hddPort);
-   /* hddPort->CommandList[0].CommandTableBaseAddress = cmdTablePage;
-    hddPort->CommandList[0].CommandFisLength = 4;
-    hddPort->CommandList[0].PhyRegionDescTableLength = 1;
-    hddPort->CommandList[0].Reset = true;
-    hddPort->CommandList[0].ClearBusyUponOk = true;
-    cmdTable->PhysRegionDescTable[0].DataBaseAddress = dataPage;
-    cmdTable->PhysRegionDescTable[0].DataByteCount = 0x1000 - 1;*/
-    ahci_fis_reg_host_to_device_t *h2d = (ahci_fis_reg_host_to_device_t*)&cmdTable->CommandFis;
-    h2d->FisType = 0x27;
-    h2d->IsCommand = false;
-    h2d->ControlReg = 0x02;
-
-    hddPort->CommandList[1].CommandTableBaseAddress = cmdTable2Page;
-    hddPort->CommandList[1].CommandFisLength = 4;
-    hddPort->CommandList[1].PhyRegionDescTableLength = 1;
-    hddPort->CommandList[1].Reset = false;
-    hddPort->CommandList[1].ClearBusyUponOk = false;
-    cmdTable2->PhysRegionDescTable[0].DataBaseAddress = data2Page;
-    cmdTable2->PhysRegionDescTable[0].DataByteCount = 0x1000 - 1;
-    ahci_fis_reg_host_to_device_t *h2d2 = (ahci_fis_reg_host_to_device_t*)&cmdTable->CommandFis;
-    h2d2->FisType = 0x27;
-    h2d2->IsCommand = false;
-    h2d2->ControlReg = 0x00;
-
-    // enable commands.
-    /*ahciController->Memory->Ports[0].CommandsIssued = 3;
-    while (true) {
-        if ((ahciController->Memory->Ports[0].CommandsIssued & 3) == 0)
-            break;
-
-        if ((ahciController->Memory->Ports[0].TaskFileData.Error))
-        {
-            kprintf("Error: 0x%X\n", ahciController->Memory->Ports[0].TaskFileData.Error);
-            break;
-        }
-
-        sleep(1000);
-        kprintf("AHCI: status 0x%X, error 0x%X\n", ahciController->Memory->Ports[0].TaskFileData.Status, ahciController->Memory->Ports[0].TaskFileData.Error);
-    }*/
-    memset(cmdTable, 0, PAGE_SIZE_4K);
-
-    // Print info.
-    kprintf("AHCI port ssts 0x%X\n", ahciController->Memory->Ports[0].SataStatus.RawValue);
-    kprintf("AHCI: status 0x%X, error 0x%X\n", ahciController->Memory->Ports[0].TaskFileData.Status.RawValue, ahciController->Memory->Ports[0].TaskFileData.Error);
-    kprintf("AHCI: Version major 0x%X, minor 0x%X\n", ahciController->Memory->Version.Major, ahciController->Memory->Version.Minor);
-    kprintf("AHCI: Total ports: %u (%u enabled)\n", ahciController->PortCount, enabledPorts);
-
-    hddPort->CommandList[0].CommandTableBaseAddress = cmdTablePage;
-    hddPort->CommandList[0].CommandFisLength = 4;
-    hddPort->CommandList[0].PhyRegionDescTableLength = 1;
-    hddPort->CommandList[0].Reset = false;
-    hddPort->CommandList[0].ClearBusyUponOk = false;
-    cmdTable->PhysRegionDescTable[0].DataBaseAddress = dataPage;
-    cmdTable->PhysRegionDescTable[0].DataByteCount = 0x1000 - 1;
-    h2d->FisType = 0x27;
-    h2d->ControlReg = 0x00;
-    h2d->IsCommand = true;
-    h2d->CommandReg = 0xEC;
-    h2d->Count = 1;
-    h2d->Device = 0x40;
-
-    // enable command.
-    ahciController->Memory->Ports[0].InterruptsStatus.RawValue = -1;
-    ahciController->Memory->Ports[0].SataError.RawValue = -1;
-    kprintf("int 0x%X\n", ahciController->Memory->Ports[0].InterruptsEnabled.RawValue);
-    ahciController->Memory->Ports[0].SataError.RawValue = -1;
-
-    ahci_port_cmd_start(hddPort);
-    ahciController->Memory->Ports[0].CommandsIssued = 1;
-    while (true) {
-        if ((ahciController->Memory->Ports[0].CommandsIssued & 1) == 0)
-            break;
-
-        if ((ahciController->Memory->Ports[0].TaskFileData.Error))
-        {
-           // kprintf("Error: 0x%X\n", ahciController->Memory->Ports[0].TaskFileData.Error);
-          //  break;
-        }
-
-        sleep(1000);
-        kprintf("AHCI: status 0x%X, error 0x%X\n", ahciController->Memory->Ports[0].TaskFileData.Status.RawValue, ahciController->Memory->Ports[0].TaskFileData.Error);
-        kprintf("AHCI: general: 0x%X\n", ata->GeneralConfig);
-        kprintf("AHCI: int status 0x%X\n", ahciController->Memory->Ports[0].InterruptsStatus.RawValue);
-        kprintf("AHCI sata error 0x%X\n", ahciController->Memory->Ports[0].SataError.RawValue);
-        ahciController->Memory->Ports[0].SataError.RawValue = -1;
-       // kprintf("in pio: %s\n", )
-    }
-
-    char model[ATA_MODEL_LENGTH+1];
-    strncpy(model, ata->Model, ATA_MODEL_LENGTH);
-    model[ATA_MODEL_LENGTH] = '\0';
-
-
-    kprintf("AHCI: Model: %s\n", model);
-    kprintf("AHCI: Integrity: 0x%X\n", ata->ChecksumValidityIndicator);
-    while(true);
-
-
+    // Register driver object and IRQ handler with PCI device object, and enable interrupts.
+    pciDevice->DriverObject = ahciController;
+    pciDevice->InterruptHandler = ahci_callback;
+    pci_msi_enable(pciDevice, 1, 0);
+    ahciController->Memory->InterruptStatus = -1;
+    ahciController->Memory->GlobalControl.InterruptsEnabled = true;
+
+    // Register disks.
+    for (uint32_t port = 0; port < ahciController->PortCount; port++)
+        if (diskPorts & (1 << port))
+            block_register(&ahciController->Ports[port]->Block);
+    return true;
 }
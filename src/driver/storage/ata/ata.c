@@ -26,11 +26,14 @@
 #include <tools.h>
 #include <io.h>
 #include <kprint.h>
+#include <string.h>
 #include <driver/storage/ata/ata.h>
 #include <driver/storage/ata/ata_commands.h>
 #include <kernel/interrupts/irqs.h>
 #include <kernel/memory/kheap.h>
-#include <driver/storage/storage.h>
+#include <kernel/memory/pmm.h>
+#include <kernel/memory/paging.h>
+#include <driver/storage/block.h>
 #include <driver/pci.h>
 
 #include <driver/storage/gpt.h>
@@ -58,8 +61,10 @@ int16_t ata_check_status(ata_channel_t *channel, bool master) {
     return ATA_CHK_STATUS_OK;
 }
 
+// DMA can be turned off to compare against PIO.
+static bool ataDmaAllowed = true;
+
 static bool ata_callback_isa(irq_regs_t *regs, uint8_t irqNum) {
-    kprintf("ATA: ISA IRQ%u raised!\n", irqNum);
     if (irqNum == IRQ_PRI_ATA)
         isaPrimary->InterruptTriggered = true;
     else if (irqNum == IRQ_SEC_ATA)
@@ -70,15 +75,18 @@ static bool ata_callback_isa(irq_regs_t *regs, uint8_t irqNum) {
 static bool ata_callback_pci(pci_device_t *device) {
     // Is the interrupt bit in the PCI status register set?
     if (pci_config_read_word(device, PCI_REG_STATUS) & ATA_PCI_STATUS_INTERRUPT) {
-        kprintf("ATA: PCI interrupt raised!\n");
         ata_device_t *ataDevice = (ata_device_t*)device->DriverObject;
 
         // Is busmastering enabled on primary channel?
         if (ataDevice->Primary.BusMasterCapable) {
             // Check if interrupt bit is set.
-            if (inb(ataDevice->Primary.BusMasterStatusPort) & ATA_PCI_BUSMASTER_STATUS_INTERRUPT)
+            if (inb(ataDevice->Primary.BusMasterStatusPort) & ATA_PCI_BUSMASTER_STATUS_INTERRUPT) {
                 ataDevice->Primary.InterruptTriggered = true;
 
+                // Reading status deasserts the level-triggered interrupt.
+                inb(ATA_REG_STATUS(ataDevice->Primary.CommandPort));
+            }
+
             // Reset interrupt bit.
             outb(ataDevice->Primary.BusMasterStatusPort, ATA_PCI_BUSMASTER_STATUS_INTERRUPT);
         }
@@ -86,9 +94,13 @@ static bool ata_callback_pci(pci_device_t *device) {
         // Is busmastering enabled on secondary channel?
         if (ataDevice->Secondary.BusMasterCapable) {
             // Check if interrupt bit is set.
-            if (inb(ataDevice->Secondary.BusMasterStatusPort) & ATA_PCI_BUSMASTER_STATUS_INTERRUPT)
+            if (inb(ataDevice->Secondary.BusMasterStatusPort) & ATA_PCI_BUSMASTER_STATUS_INTERRUPT) {
                 ataDevice->Secondary.InterruptTriggered = true;
 
+                // Reading status deasserts the level-triggered interrupt.
+                inb(ATA_REG_STATUS(ataDevice->Secondary.CommandPort));
+            }
+
             // Reset interrupt bit.
             outb(ataDevice->Secondary.BusMasterStatusPort, ATA_PCI_BUSMASTER_STATUS_INTERRUPT);
         }
@@ -132,21 +144,13 @@ uint16_t ata_read_data_word(uint16_t portCommand) {
 }
 
 void ata_read_data_pio(ata_channel_t *channel, void *outData, uint32_t size) {
-    // Get pointer to word array.
-    uint16_t *buffer = (uint16_t*)outData;
-
     // Read words from device.
-    for (uint32_t i = 0; i < size; i += 2)
-        buffer[i / 2] = inw(ATA_REG_DATA(channel->CommandPort));
+    insw(ATA_REG_DATA(channel->CommandPort), outData, size / 2);
 }
 
 void ata_write_data_pio(ata_channel_t *channel, const void *data, uint32_t size) {
-    // Get pointer to word array.
-    uint16_t *buffer = (uint16_t*)data;
-
     // Write words to device.
-    for (uint32_t i = 0; i < size; i += 2)
-        outw(ATA_REG_DATA(channel->CommandPort), buffer[i / 2]);
+    outsw(ATA_REG_DATA(channel->CommandPort), data, size / 2);
 }
 
 void ata_send_params(ata_channel_t *channel, uint8_t sectorCount, uint8_t sectorNumber, uint8_t cylinderLow, uint8_t cylinderHigh) {
@@ -356,6 +360,195 @@ static void ata_print_device_packet_info(ata_identify_packet_result_t info) {
     }
 }
 
+static bool ata_dma_build_prdt(ata_channel_t *channel, block_request_t *request) {
+    // Describe the request buffers directly, merging physically contiguous runs.
+    uint32_t entry = 0;
+    for (; request != NULL; request = request->MergeNext) {
+        uintptr_t address = (uintptr_t)request->Buffer;
+        uint32_t remaining = request->SectorCount * ATA_SECTOR_SIZE_512;
+        while (remaining > 0) {
+            uint64_t phys;
+            if (!paging_get_phys(address, &phys))
+                return false;
+            uint32_t size = PAGE_SIZE_4K - (address & (PAGE_SIZE_4K - 1));
+            if (size > remaining)
+                size = remaining;
+
+            // The controller only reaches the low 4GB with even addresses, and a region can't cross 64KB.
+            if (phys + size > 0x100000000ULL || (phys & 0x1))
+                return false;
+
+            ata_prd_t *last = entry > 0 ? &channel->Prdt[entry - 1] : NULL;
+            uint32_t lastSize = last != NULL ? (last->ByteCount == 0 ? ATA_PRD_MAX_BYTES : last->ByteCount) : 0;
+            if (last != NULL && last->Address + lastSize == phys && (phys & ~(ATA_PRD_MAX_BYTES - 1)) == (last->Address & ~(ATA_PRD_MAX_BYTES - 1))
+                && ((phys + size - 1) & ~(ATA_PRD_MAX_BYTES - 1)) == (phys & ~(ATA_PRD_MAX_BYTES - 1))) {
+                last->ByteCount = (uint16_t)(lastSize + size);
+            }
+            else {
+                // A page never crosses 64KB, so a new entry always fits.
+                if (entry >= ATA_PRDT_ENTRIES)
+                    return false;
+                channel->Prdt[entry].Address = (uint32_t)phys;
+                channel->Prdt[entry].ByteCount = (uint16_t)size;
+                channel->Prdt[entry].Flags = 0;
+                entry++;
+            }
+
+            address += size;
+            remaining -= size;
+        }
+    }
+
+    if (entry == 0)
+        return false;
+    channel->Prdt[entry - 1].Flags = ATA_PRD_END_OF_TABLE;
+    return true;
+}
+
+static int16_t ata_dma_request(ata_disk_t *disk, block_request_t *request, uint32_t sectorCount) {
+    ata_channel_t *channel = disk->Channel;
+
+    // Use the bounce buffer if the request buffers can't be described directly.
+    bool bounce = !ata_dma_build_prdt(channel, request);
+    if (bounce) {
+        channel->Prdt[0].Address = channel->DmaBufferPhys;
+        channel->Prdt[0].ByteCount = (uint16_t)(sectorCount * ATA_SECTOR_SIZE_512);
+        channel->Prdt[0].Flags = ATA_PRD_END_OF_TABLE;
+        if (request->Write) {
+            uint32_t offset = 0;
+            for (block_request_t *merged = request; merged != NULL; merged = merged->MergeNext) {
+                memcpy(channel->DmaBuffer + offset, merged->Buffer, merged->SectorCount * ATA_SECTOR_SIZE_512);
+                offset += merged->SectorCount * ATA_SECTOR_SIZE_512;
+            }
+        }
+    }
+
+    bool ext = disk->Lba48 && request->Sector + sectorCount > 0x10000000;
+    int16_t status = ata_dma_transfer(channel, disk->Master, request->Sector, (uint16_t)sectorCount, request->Write, ext);
+
+    if (bounce && !request->Write && status == ATA_CHK_STATUS_OK) {
+        uint32_t offset = 0;
+        for (block_request_t *merged = request; merged != NULL; merged = merged->MergeNext) {
+            memcpy(merged->Buffer, channel->DmaBuffer + offset, merged->SectorCount * ATA_SECTOR_SIZE_512);
+            offset += merged->SectorCount * ATA_SECTOR_SIZE_512;
+        }
+    }
+    return status;
+}
+
+static int16_t ata_pio_request(ata_disk_t *disk, block_request_t *request, uint32_t sectorCount) {
+    // Merged requests are gathered into the bounce buffer so they take one command.
+    if (request->Write && request->MergeNext != NULL) {
+        uint32_t offset = 0;
+        for (block_request_t *merged = request; merged != NULL; merged = merged->MergeNext) {
+            memcpy(disk->Buffer + offset, merged->Buffer, merged->SectorCount * ATA_SECTOR_SIZE_512);
+            offset += merged->SectorCount * ATA_SECTOR_SIZE_512;
+        }
+    }
+    uint8_t *buffer = request->MergeNext != NULL ? disk->Buffer : request->Buffer;
+
+    bool ext = disk->Lba48 && request->Sector + sectorCount > 0x10000000;
+    int16_t status = ata_pio_transfer(disk->Channel, disk->Master, request->Sector, buffer, (uint16_t)sectorCount,
+        request->Write, ext, disk->MultipleSectors);
+
+    // Scatter read data back to the merged requests.
+    if (!request->Write && request->MergeNext != NULL && status == ATA_CHK_STATUS_OK) {
+        uint32_t offset = 0;
+        for (block_request_t *merged = request; merged != NULL; merged = merged->MergeNext) {
+            memcpy(merged->Buffer, disk->Buffer + offset, merged->SectorCount * ATA_SECTOR_SIZE_512);
+            offset += merged->SectorCount * ATA_SECTOR_SIZE_512;
+        }
+    }
+    return status;
+}
+
+static bool ata_block_transfer(block_device_t *blockDevice, block_request_t *request) {
+    ata_disk_t *disk = (ata_disk_t*)blockDevice->Device;
+    uint32_t sectorCount = 0;
+    for (block_request_t *merged = request; merged != NULL; merged = merged->MergeNext)
+        sectorCount += merged->SectorCount;
+
+    // Selecting the device also clears the LBA bits of the last command.
+    ata_select_device(disk->Channel, disk->Master);
+    int16_t status;
+    if (disk->Dma && ataDmaAllowed) {
+        status = ata_dma_request(disk, request, sectorCount);
+
+        // Fall back to PIO for good if DMA doesn't work.
+        if (status != ATA_CHK_STATUS_OK) {
+            kprintf("ATA: DMA failed on %s with status %d, using PIO.\n", blockDevice->Name, status);
+            disk->Dma = false;
+            ata_select_device(disk->Channel, disk->Master);
+            status = ata_pio_request(disk, request, sectorCount);
+        }
+    }
+    else {
+        status = ata_pio_request(disk, request, sectorCount);
+    }
+
+    if (status != ATA_CHK_STATUS_OK) {
+        kprintf("ATA: %s of %u sectors at %u on %s failed with status %d!\n", request->Write ? "Write" : "Read",
+            sectorCount, (uint32_t)request->Sector, blockDevice->Name, status);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Enables or disables DMA for all disks, for comparing against PIO.
+ * @param enabled   Whether DMA may be used.
+ */
+void ata_set_dma_allowed(bool enabled) {
+    ataDmaAllowed = enabled;
+}
+
+static void ata_dma_init(ata_channel_t *channel) {
+    // PRDT must be dword aligned and not cross 64KB, a page below 4GB does both.
+    uint32_t prdtPage = pmm_pop_zeroed_frame_nonlong();
+    channel->Prdt = (ata_prd_t*)paging_device_alloc(prdtPage, prdtPage);
+    channel->PrdtPhys = prdtPage;
+
+    // The bounce buffer is a 64KB-aligned DMA frame, so one region covers a whole transfer.
+    uintptr_t frame = 0;
+    if (!pmm_dma_get_free_frame(&frame)) {
+        kprintf("ATA: No DMA frame for channel 0x%X, using PIO.\n", channel->CommandPort);
+        return;
+    }
+    channel->DmaBuffer = (uint8_t*)frame;
+    channel->DmaBufferPhys = (uint32_t)pmm_dma_get_phys(frame);
+    channel->DmaEnabled = true;
+}
+
+static void ata_register_disk(ata_channel_t *channel, bool master, ata_identify_result_t *info) {
+    static uint8_t diskCount = 0;
+
+    ata_disk_t *disk = (ata_disk_t*)kheap_alloc(sizeof(ata_disk_t));
+    memset(disk, 0, sizeof(ata_disk_t));
+    disk->Channel = channel;
+    disk->Master = master;
+    disk->Buffer = (uint8_t*)kheap_alloc(ATA_MAX_TRANSFER_SECTORS * ATA_SECTOR_SIZE_512);
+    disk->Dma = channel->DmaEnabled && (info->capabilities49 & ATA_IDENTIFY_CAP49_DMA);
+    disk->Lba48 = (info->commandFlags83.data & ATA_IDENTIFY_CMD83_LBA48) != 0;
+
+    // Use the largest block size the disk supports for PIO.
+    disk->MultipleSectors = 1;
+    if (info->maxSectorsInterrupt > 1) {
+        ata_select_device(channel, master);
+        if (ata_set_multiple_mode(channel, master, info->maxSectorsInterrupt) == ATA_CHK_STATUS_OK)
+            disk->MultipleSectors = info->maxSectorsInterrupt;
+    }
+
+    ksnprintf(disk->Block.Name, sizeof(disk->Block.Name), "ata%u", diskCount++);
+    disk->Block.Device = disk;
+    disk->Block.SectorSize = ATA_SECTOR_SIZE_512;
+    disk->Block.SectorCount = disk->Lba48 ? info->totalLba48Bit : info->totalLba28Bit;
+    disk->Block.MaxSectors = ATA_MAX_TRANSFER_SECTORS;
+    disk->Block.Transfer = ata_block_transfer;
+    block_register(&disk->Block);
+    kprintf("ATA: %s uses %s transfers, %u sectors per PIO block.\n", disk->Block.Name, disk->Dma ? "bus master DMA" : "PIO",
+        disk->MultipleSectors);
+}
+
 void ata_reset_identify(ata_channel_t *channel) {
     // Reset channel.
     bool masterPresent = false;
@@ -383,6 +576,7 @@ void ata_reset_identify(ata_channel_t *channel) {
             if (ata_identify(channel, true, &ataMaster) == ATA_CHK_STATUS_OK) {
                 kprintf("ATA: Found master device on channel 0x%X!\n", channel->CommandPort);
                 ata_print_device_info(ataMaster);
+                ata_register_disk(channel, true, &ataMaster);
             }
             else {
                 kprintf("ATA: Failed to identify master device or no device exists on channel 0x%X.\n", channel->CommandPort);
@@ -504,6 +698,11 @@ bool ata_init(pci_device_t *pciDevice) {
         ataDevice->Secondary.BusMasterCommandPort = busMasterBase + ATA_PCI_BUSMASTER_PORT_SECCMD;
         ataDevice->Secondary.BusMasterStatusPort = busMasterBase + ATA_PCI_BUSMASTER_PORT_SECSTATUS;
         ataDevice->Secondary.BusMasterPrdt = busMasterBase + ATA_PCI_BUSMASTER_PORT_SECPRDT;
+
+        // Set up DMA.
+        pci_enable_busmaster(pciDevice);
+        ata_dma_init(&ataDevice->Primary);
+        ata_dma_init(&ataDevice->Secondary);
     }
 
     // Reset and identify both channels.
@@ -24,6 +24,9 @@
 
 #include <main.h>
 #include <io.h>
+#include <kprint.h>
+#include <kernel/trace.h>
+#include <kernel/timer.h>
 #include <driver/storage/ata/ata.h>
 #include <driver/storage/ata/ata_commands.h>
 
@@ -238,56 +241,158 @@ int16_t ata_identify(ata_channel_t *channel, bool master, ata_identify_result_t
     return ata_check_status(channel, master);
 }
 
-int16_t ata_read_sector(ata_channel_t *channel, bool master, uint32_t startSectorLba, void *outData, uint8_t sectorCount) {
-    // Send READ SECTOR command.
-    ata_set_lba_high(channel, (uint8_t)((startSectorLba >> 24) & 0x0F));
-    ata_send_command(channel, sectorCount, (uint8_t)(startSectorLba & 0xFF),
-        (uint8_t)((startSectorLba >> 8) & 0xFF), (uint8_t)((startSectorLba >> 16) & 0xFF), ATA_CMD_READ_SECTOR);
-
-    // Wait for device.
-    if (!ata_wait_for_drq(channel))
-       return ata_check_status(channel, master);
+static void ata_send_lba_command(ata_channel_t *channel, uint64_t startSectorLba, uint16_t sectorCount, uint8_t command, bool ext) {
+    // 48-bit commands take the high bytes first through the same registers, 28-bit commands take the
+    // top bits of the LBA in the device register.
+    if (ext) {
+        ata_set_lba_high(channel, 0);
+        ata_send_params(channel, (uint8_t)(sectorCount >> 8), (uint8_t)((startSectorLba >> 24) & 0xFF),
+            (uint8_t)((startSectorLba >> 32) & 0xFF), (uint8_t)((startSectorLba >> 40) & 0xFF));
+    }
+    else {
+        ata_set_lba_high(channel, (uint8_t)((startSectorLba >> 24) & 0x0F));
+    }
+    ata_send_command(channel, (uint8_t)(sectorCount & 0xFF), (uint8_t)(startSectorLba & 0xFF),
+        (uint8_t)((startSectorLba >> 8) & 0xFF), (uint8_t)((startSectorLba >> 16) & 0xFF), command);
+}
 
-    // Read data.
-    ata_read_data_pio(channel, outData, (sectorCount == 0 ? 256 : sectorCount) * ATA_SECTOR_SIZE_512);
-    return ata_check_status(channel, master);
+static int16_t ata_pio_wait(ata_channel_t *channel) {
+    // Reading the alternate status four times gives the device the 400ns it needs to update status.
+    for (uint8_t i = 0; i < 4; i++)
+        inb(ATA_REG_ALT_STATUS(channel->ControlPort));
+
+    // Poll the status register until the device isn't busy. Reading it also acknowledges the interrupt.
+    uint64_t timeout = timer_ticks() + ATA_PIO_TIMEOUT;
+    uint8_t status;
+    while ((status = inb(ATA_REG_STATUS(channel->CommandPort))) & ATA_STATUS_BUSY) {
+        if (timer_ticks() >= timeout) {
+            kprintf("ATA: PIO timeout on channel 0x%X!\n", channel->CommandPort);
+            return -1;
+        }
+    }
+    return status;
 }
 
-int16_t ata_read_sector_ext(ata_channel_t *channel, bool master, uint64_t startSectorLba, void *outData, uint16_t sectorCount) {
-    // Get low and high parts of 48-bit LBA address.
-    uint32_t lbaLow = (uint32_t)(startSectorLba & 0xFFFFFFFF);
-    uint32_t lbaHigh = (uint32_t)(startSectorLba >> 32);
-
-    // Send high LBA bytes, then low LBA bytes and command.
-    ata_set_lba_high(channel, (uint8_t)((lbaHigh >> 24) & 0x0F));
-    ata_send_params(channel, (uint8_t)(sectorCount >> 8), (uint8_t)(lbaHigh & 0xFF),
-        (uint8_t)((lbaHigh >> 8) & 0xFF), (uint8_t)((lbaHigh >> 16) & 0xFF));
-    ata_set_lba_high(channel, (uint8_t)((lbaLow >> 24) & 0x0F));
-    ata_send_command(channel, (uint8_t)(sectorCount & 0xFF), (uint8_t)(lbaLow & 0xFF),
-        (uint8_t)((lbaLow >> 8) & 0xFF), (uint8_t)((lbaLow >> 16) & 0xFF), ATA_CMD_READ_SECTOR_EXT);
+int16_t ata_pio_transfer(ata_channel_t *channel, bool master, uint64_t startSectorLba, void *buffer, uint16_t sectorCount, bool write, bool ext, uint8_t sectorsPerBlock) {
+    // The device must be selected. A sector count of 0 means 256 sectors, or 65536 for 48-bit commands.
+    trace(TRACE_EVENT_DISK_START, sectorCount | (write ? TRACE_DISK_WRITE : 0), (uint32_t)startSectorLba);
+
+    // Multiple mode transfers a block of sectors per DRQ, the others one sector each.
+    uint8_t command;
+    if (sectorsPerBlock > 1) {
+        if (write)
+            command = ext ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+        else
+            command = ext ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    }
+    else {
+        sectorsPerBlock = 1;
+        if (write)
+            command = ext ? ATA_CMD_WRITE_SECTOR_EXT : ATA_CMD_WRITE_SECTOR;
+        else
+            command = ext ? ATA_CMD_READ_SECTOR_EXT : ATA_CMD_READ_SECTOR;
+    }
+    ata_send_lba_command(channel, startSectorLba, sectorCount, command, ext);
+
+    uint8_t *data = (uint8_t*)buffer;
+    uint32_t remaining = sectorCount != 0 ? sectorCount : (ext ? 0x10000 : 0x100);
+    int16_t status = ATA_CHK_STATUS_OK;
+    while (remaining > 0) {
+        // Wait for the device to ask for the next block.
+        int16_t deviceStatus = ata_pio_wait(channel);
+        if (deviceStatus < 0) {
+            status = -1;
+            break;
+        }
+        if ((deviceStatus & (ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT)) || !(deviceStatus & ATA_STATUS_DATA_REQUEST)) {
+            status = ata_check_status(channel, master);
+            if (status == ATA_CHK_STATUS_OK)
+                status = ATA_CHK_STATUS_ERROR;
+            break;
+        }
+
+        // Transfer block.
+        uint32_t blockSectors = remaining < sectorsPerBlock ? remaining : sectorsPerBlock;
+        if (write)
+            ata_write_data_pio(channel, data, blockSectors * ATA_SECTOR_SIZE_512);
+        else
+            ata_read_data_pio(channel, data, blockSectors * ATA_SECTOR_SIZE_512);
+        data += blockSectors * ATA_SECTOR_SIZE_512;
+        remaining -= blockSectors;
+    }
 
-    // Wait for device.
-    if (!ata_wait_for_drq(channel))
-       return ata_check_status(channel, master);
+    // Wait for the device to finish with the last block.
+    if (status == ATA_CHK_STATUS_OK)
+        status = ata_pio_wait(channel) < 0 ? -1 : ata_check_status(channel, master);
+    trace(TRACE_EVENT_DISK_DONE, status, 0);
+    return status;
+}
 
-    // Read data.
-    ata_read_data_pio(channel, outData, (sectorCount == 0 ? 256 : sectorCount) * ATA_SECTOR_SIZE_512);
-    return ata_check_status(channel, master);
+int16_t ata_read_sector(ata_channel_t *channel, bool master, uint32_t startSectorLba, void *outData, uint8_t sectorCount) {
+    return ata_pio_transfer(channel, master, startSectorLba, outData, sectorCount, false, false, 1);
 }
 
-int16_t ata_write_sector(ata_channel_t *channel, bool master, uint32_t startSectorLba, const void *data, uint8_t sectorCount) {
-    ata_check_status(channel, master);
+int16_t ata_read_sector_ext(ata_channel_t *channel, bool master, uint64_t startSectorLba, void *outData, uint16_t sectorCount) {
+    return ata_pio_transfer(channel, master, startSectorLba, outData, sectorCount, false, true, 1);
+}
 
-    // Send WRITE SECTOR command.
-    ata_set_lba_high(channel, (uint8_t)((startSectorLba >> 24) & 0x0F));
-    ata_send_command(channel, sectorCount, (uint8_t)(startSectorLba & 0xFF),
-        (uint8_t)((startSectorLba >> 8) & 0xFF), (uint8_t)((startSectorLba >> 16) & 0xFF), ATA_CMD_WRITE_SECTOR);
+int16_t ata_write_sector(ata_channel_t *channel, bool master, uint32_t startSectorLba, const void *data, uint8_t sectorCount) {
+    return ata_pio_transfer(channel, master, startSectorLba, (void*)data, sectorCount, true, false, 1);
+}
 
-    // Wait for device.
-    if (!ata_wait_for_drq(channel))
-       return ata_check_status(channel, master);
+int16_t ata_write_sector_ext(ata_channel_t *channel, bool master, uint64_t startSectorLba, const void *data, uint16_t sectorCount) {
+    return ata_pio_transfer(channel, master, startSectorLba, (void*)data, sectorCount, true, true, 1);
+}
 
-    // Read data.
-    ata_write_data_pio(channel, data, (sectorCount == 0 ? 256 : sectorCount) * ATA_SECTOR_SIZE_512);
+int16_t ata_set_multiple_mode(ata_channel_t *channel, bool master, uint8_t sectorsPerBlock) {
+    // Send SET MULTIPLE MODE command. The device must be selected.
+    ata_send_command(channel, sectorsPerBlock, 0x00, 0x00, 0x00, ATA_CMD_SET_MULTIPLE_MODE);
+    if (ata_pio_wait(channel) < 0)
+        return -1;
     return ata_check_status(channel, master);
 }
+
+int16_t ata_dma_transfer(ata_channel_t *channel, bool master, uint64_t startSectorLba, uint16_t sectorCount, bool write, bool ext) {
+    // The PRDT must already describe the buffer. The device must be selected.
+    trace(TRACE_EVENT_DISK_START, sectorCount | (write ? TRACE_DISK_WRITE : 0), (uint32_t)startSectorLba);
+
+    // Stop the engine, load the PRDT, set direction and clear error and interrupt bits.
+    uint8_t direction = write ? 0 : ATA_PCI_BUSMASTER_CMD_READ;
+    outb(channel->BusMasterCommandPort, 0);
+    outl(channel->BusMasterPrdt, channel->PrdtPhys);
+    outb(channel->BusMasterCommandPort, direction);
+    outb(channel->BusMasterStatusPort, inb(channel->BusMasterStatusPort) | ATA_PCI_BUSMASTER_STATUS_ERROR | ATA_PCI_BUSMASTER_STATUS_INTERRUPT);
+    channel->InterruptTriggered = false;
+
+    // Send command.
+    if (ext)
+        ata_send_lba_command(channel, startSectorLba, sectorCount, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT, true);
+    else
+        ata_send_lba_command(channel, startSectorLba, sectorCount, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA, false);
+
+    // Start the engine and wait for the completion interrupt.
+    outb(channel->BusMasterCommandPort, direction | ATA_PCI_BUSMASTER_CMD_START);
+    uint64_t timeout = timer_ticks() + ATA_DMA_TIMEOUT;
+    while (!channel->InterruptTriggered && timer_ticks() < timeout)
+        asm volatile ("hlt");
+
+    // Stop the engine and acknowledge.
+    uint8_t busMasterStatus = inb(channel->BusMasterStatusPort);
+    outb(channel->BusMasterCommandPort, direction);
+    outb(channel->BusMasterStatusPort, busMasterStatus | ATA_PCI_BUSMASTER_STATUS_ERROR | ATA_PCI_BUSMASTER_STATUS_INTERRUPT);
+
+    int16_t status;
+    if (!channel->InterruptTriggered && !(busMasterStatus & ATA_PCI_BUSMASTER_STATUS_INTERRUPT)) {
+        kprintf("ATA: DMA timeout on channel 0x%X!\n", channel->CommandPort);
+        status = -1;
+    }
+    else if (busMasterStatus & ATA_PCI_BUSMASTER_STATUS_ERROR) {
+        status = ATA_CHK_STATUS_ERROR;
+    }
+    else {
+        status = ata_check_status(channel, master);
+    }
+    channel->InterruptTriggered = false;
+    trace(TRACE_EVENT_DISK_DONE, status, 0);
+    return status;
+}
@@ -0,0 +1,591 @@
+/*
+ * File: bcache.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+#include <math.h>
+#include <driver/storage/bcache.h>
+#include <driver/storage/block.h>
+
+#include <kernel/memory/kheap.h>
+#include <kernel/memory/pmm.h>
+#include <kernel/lock.h>
+#include <kernel/tasking.h>
+#include <kernel/timer.h>
+
+// Hash index, LRU list of unreferenced buffers (most recent at the head) and list of all buffers.
+static bcache_buffer_t *bcacheHash[BCACHE_HASH_SIZE];
+static bcache_buffer_t *bcacheLruHead;
+static bcache_buffer_t *bcacheLruTail;
+static bcache_buffer_t *bcacheBuffers;
+static uint32_t bcacheBufferCount = 0;
+static uint32_t bcacheBufferLimit = BCACHE_MIN_BUFFERS;
+static lock_t bcacheLock = { };
+
+// Writes queued by a flush and not yet complete.
+static volatile uint32_t bcacheWritesPending = 0;
+
+// Statistics.
+static uint64_t bcacheLookups = 0;
+static uint64_t bcacheMisses = 0;
+static uint64_t bcacheReadAheads = 0;
+static uint64_t bcacheEvictions = 0;
+static uint64_t bcacheWritebacks = 0;
+
+static inline uint32_t bcache_hash(block_device_t *blockDevice, uint64_t block) {
+    return ((uint32_t)block ^ (uint32_t)((uintptr_t)blockDevice >> 6)) & (BCACHE_HASH_SIZE - 1);
+}
+
+static inline uint32_t bcache_block_sectors(block_device_t *blockDevice) {
+    return BCACHE_BLOCK_SIZE / blockDevice->SectorSize;
+}
+
+static inline uint64_t bcache_block_count(block_device_t *blockDevice) {
+    uint32_t blockSectors = bcache_block_sectors(blockDevice);
+    return (blockDevice->SectorCount + blockSectors - 1) / blockSectors;
+}
+
+static inline bool bcache_lru_linked(bcache_buffer_t *buffer) {
+    return buffer->LruPrev != NULL || bcacheLruHead == buffer;
+}
+
+static void bcache_lru_remove(bcache_buffer_t *buffer) {
+    if (buffer->LruPrev != NULL)
+        buffer->LruPrev->LruNext = buffer->LruNext;
+    else
+        bcacheLruHead = buffer->LruNext;
+    if (buffer->LruNext != NULL)
+        buffer->LruNext->LruPrev = buffer->LruPrev;
+    else
+        bcacheLruTail = buffer->LruPrev;
+    buffer->LruPrev = buffer->LruNext = NULL;
+}
+
+static void bcache_lru_push(bcache_buffer_t *buffer, bool recent) {
+    if (recent) {
+        buffer->LruPrev = NULL;
+        buffer->LruNext = bcacheLruHead;
+        if (bcacheLruHead != NULL)
+            bcacheLruHead->LruPrev = buffer;
+        else
+            bcacheLruTail = buffer;
+        bcacheLruHead = buffer;
+    }
+    else {
+        buffer->LruNext = NULL;
+        buffer->LruPrev = bcacheLruTail;
+        if (bcacheLruTail != NULL)
+            bcacheLruTail->LruNext = buffer;
+        else
+            bcacheLruHead = buffer;
+        bcacheLruTail = buffer;
+    }
+}
+
+static bcache_buffer_t *bcache_lookup(block_device_t *blockDevice, uint64_t block) {
+    bcache_buffer_t *buffer = bcacheHash[bcache_hash(blockDevice, block)];
+    while (buffer != NULL && (buffer->Device != blockDevice || buffer->Block != block))
+        buffer = buffer->HashNext;
+    return buffer;
+}
+
+static void bcache_unhash(bcache_buffer_t *buffer) {
+    if (buffer->Device == NULL)
+        return;
+
+    bcache_buffer_t **link = &bcacheHash[bcache_hash(buffer->Device, buffer->Block)];
+    while (*link != NULL && *link != buffer)
+        link = &(*link)->HashNext;
+    if (*link != NULL)
+        *link = buffer->HashNext;
+    buffer->HashNext = NULL;
+    buffer->Device = NULL;
+    buffer->Flags = 0;
+}
+
+static bcache_buffer_t *bcache_alloc(block_device_t *blockDevice, uint64_t block, bool force) {
+    // Grow the cache up to its limit, or past it if nothing can be evicted.
+    bcache_buffer_t *buffer = NULL;
+    if (bcacheBufferCount >= bcacheBufferLimit) {
+        // Reuse the least recently used clean buffer.
+        for (buffer = bcacheLruTail; buffer != NULL; buffer = buffer->LruPrev)
+            if (!(buffer->Flags & (BCACHE_FLAG_DIRTY | BCACHE_FLAG_BUSY)))
+                break;
+        if (buffer != NULL) {
+            if (buffer->Device != NULL)
+                bcacheEvictions++;
+            bcache_lru_remove(buffer);
+            bcache_unhash(buffer);
+        }
+        else if (!force) {
+            return NULL;
+        }
+    }
+
+    if (buffer == NULL) {
+        buffer = (bcache_buffer_t*)kheap_alloc(sizeof(bcache_buffer_t));
+        if (buffer == NULL)
+            return NULL;
+        memset(buffer, 0, sizeof(bcache_buffer_t));
+        buffer->Data = (uint8_t*)kheap_alloc(BCACHE_BLOCK_SIZE);
+        if (buffer->Data == NULL) {
+            kheap_free(buffer);
+            return NULL;
+        }
+        buffer->AllNext = bcacheBuffers;
+        bcacheBuffers = buffer;
+        bcacheBufferCount++;
+    }
+
+    // Set up buffer and add it to the index.
+    uint32_t blockSectors = bcache_block_sectors(blockDevice);
+    buffer->Device = blockDevice;
+    buffer->Block = block;
+    buffer->SectorCount = blockSectors;
+    if ((block + 1) * blockSectors > blockDevice->SectorCount)
+        buffer->SectorCount = blockDevice->SectorCount - block * blockSectors;
+    buffer->RefCount = 0;
+    buffer->Flags = 0;
+
+    uint32_t hash = bcache_hash(blockDevice, block);
+    buffer->HashNext = bcacheHash[hash];
+    bcacheHash[hash] = buffer;
+    return buffer;
+}
+
+static void bcache_read_done(block_request_t *request, bool success) {
+    bcache_buffer_t *buffer = (bcache_buffer_t*)request->Context;
+    spinlock_lock(&bcacheLock);
+    buffer->Flags = success ? BCACHE_FLAG_VALID : BCACHE_FLAG_ERROR;
+
+    // Failed buffers nobody is waiting on are dropped so the next access retries.
+    if (!success && buffer->RefCount == 0) {
+        bcache_lru_remove(buffer);
+        bcache_unhash(buffer);
+        bcache_lru_push(buffer, false);
+    }
+    spinlock_release(&bcacheLock);
+}
+
+static void bcache_write_done(block_request_t *request, bool success) {
+    bcache_buffer_t *buffer = (bcache_buffer_t*)request->Context;
+    spinlock_lock(&bcacheLock);
+    buffer->Flags &= ~BCACHE_FLAG_BUSY;
+    if (!success) {
+        kprintf("BCACHE: Writeback of block %llu on %s failed!\n", buffer->Block, buffer->Device->Name);
+        buffer->Flags |= BCACHE_FLAG_DIRTY;
+    }
+    bcacheWritebacks++;
+    bcacheWritesPending--;
+    spinlock_release(&bcacheLock);
+}
+
+static bool bcache_submit(bcache_buffer_t *buffer, bool write) {
+    // Buffer is marked busy by the caller.
+    block_request_init(&buffer->Request, buffer->Block * bcache_block_sectors(buffer->Device), buffer->SectorCount, buffer->Data, write);
+    buffer->Request.Done = write ? bcache_write_done : bcache_read_done;
+    buffer->Request.Context = buffer;
+    return block_submit(buffer->Device, &buffer->Request);
+}
+
+static void bcache_prefetch_blocks(block_device_t *blockDevice, uint64_t firstBlock, uint64_t lastBlock, bool readAhead) {
+    // Queue reads for missing blocks together so the elevator can merge them.
+    for (uint64_t block = firstBlock; block <= lastBlock; block++) {
+        spinlock_lock(&bcacheLock);
+        if (bcache_lookup(blockDevice, block) != NULL) {
+            spinlock_release(&bcacheLock);
+            continue;
+        }
+
+        // Don't write anything back just to read ahead.
+        bcache_buffer_t *buffer = bcache_alloc(blockDevice, block, false);
+        if (buffer == NULL) {
+            spinlock_release(&bcacheLock);
+            break;
+        }
+        buffer->Flags = BCACHE_FLAG_BUSY;
+        bcache_lru_push(buffer, true);
+        if (readAhead)
+            bcacheReadAheads++;
+        else
+            bcacheMisses++;
+        spinlock_release(&bcacheLock);
+
+        if (!bcache_submit(buffer, false)) {
+            spinlock_lock(&bcacheLock);
+            bcache_lru_remove(buffer);
+            bcache_unhash(buffer);
+            bcache_lru_push(buffer, false);
+            spinlock_release(&bcacheLock);
+            break;
+        }
+    }
+}
+
+static void bcache_read_ahead(block_device_t *blockDevice, uint64_t firstBlock, uint64_t lastBlock) {
+    // Grow the window while reads are sequential, and drop it on a random read.
+    spinlock_lock(&bcacheLock);
+    if (firstBlock == blockDevice->ReadAheadNext || firstBlock + 1 == blockDevice->ReadAheadNext) {
+        if (blockDevice->ReadAheadWindow == 0)
+            blockDevice->ReadAheadWindow = 4;
+        else if (blockDevice->ReadAheadWindow < BCACHE_READAHEAD_MAX)
+            blockDevice->ReadAheadWindow *= 2;
+    }
+    else {
+        blockDevice->ReadAheadWindow = 0;
+        blockDevice->ReadAheadEnd = 0;
+    }
+    blockDevice->ReadAheadNext = lastBlock + 1;
+
+    // Only queue blocks past those already read ahead.
+    uint64_t start = lastBlock + 1;
+    if (start < blockDevice->ReadAheadEnd)
+        start = blockDevice->ReadAheadEnd;
+    uint64_t end = lastBlock + blockDevice->ReadAheadWindow;
+    if (end >= bcache_block_count(blockDevice))
+        end = bcache_block_count(blockDevice) - 1;
+    bool queue = blockDevice->ReadAheadWindow > 0 && start <= end;
+    if (queue)
+        blockDevice->ReadAheadEnd = end + 1;
+    spinlock_release(&bcacheLock);
+
+    if (queue)
+        bcache_prefetch_blocks(blockDevice, start, end, true);
+}
+
+static bcache_buffer_t *bcache_get_block(block_device_t *blockDevice, uint64_t block, bool read) {
+    if (block >= bcache_block_count(blockDevice))
+        return NULL;
+
+    spinlock_lock(&bcacheLock);
+    bcacheLookups++;
+    bcache_buffer_t *buffer = bcache_lookup(blockDevice, block);
+    if (buffer == NULL) {
+        buffer = bcache_alloc(blockDevice, block, false);
+        if (buffer == NULL) {
+            // Everything is dirty, write it back and try again.
+            spinlock_release(&bcacheLock);
+            bcache_sync(NULL);
+            spinlock_lock(&bcacheLock);
+            buffer = bcache_lookup(blockDevice, block);
+            if (buffer == NULL)
+                buffer = bcache_alloc(blockDevice, block, true);
+            if (buffer == NULL) {
+                spinlock_release(&bcacheLock);
+                return NULL;
+            }
+        }
+    }
+
+    if (bcache_lru_linked(buffer))
+        bcache_lru_remove(buffer);
+    buffer->RefCount++;
+
+    // A new buffer is read here unless the caller is about to overwrite all of it.
+    bool fill = buffer->Flags == 0;
+    if (fill) {
+        buffer->Flags = BCACHE_FLAG_BUSY;
+        if (read)
+            bcacheMisses++;
+    }
+    spinlock_release(&bcacheLock);
+
+    if (fill) {
+        bool success = true;
+        if (read)
+            success = block_read(blockDevice, block * bcache_block_sectors(blockDevice), buffer->SectorCount, buffer->Data);
+        else
+            memset(buffer->Data, 0, BCACHE_BLOCK_SIZE);
+        buffer->Flags = success ? BCACHE_FLAG_VALID : BCACHE_FLAG_ERROR;
+    }
+
+    // Wait for a read already in progress.
+    while (buffer->Flags & BCACHE_FLAG_BUSY)
+        asm volatile ("hlt");
+
+    if (buffer->Flags & BCACHE_FLAG_ERROR) {
+        bcache_release(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/**
+ * Gets a cached block, reading it from the device if needed.
+ * @param blockDevice   The device. Must be a whole disk, see block_resolve().
+ * @param block         The block number, in units of BCACHE_BLOCK_SIZE.
+ * @return              The referenced buffer, or NULL if the block couldn't be read.
+ */
+bcache_buffer_t *bcache_get(block_device_t *blockDevice, uint64_t block) {
+    return bcache_get_block(blockDevice, block, true);
+}
+
+/**
+ * Checks whether a block is cached or being read into the cache, without reading it.
+ * @param blockDevice   The device. Must be a whole disk, see block_resolve().
+ * @param block         The block number, in units of BCACHE_BLOCK_SIZE.
+ * @return              True if the cache holds the block.
+ */
+bool bcache_contains(block_device_t *blockDevice, uint64_t block) {
+    spinlock_lock(&bcacheLock);
+    bool found = bcache_lookup(blockDevice, block) != NULL;
+    spinlock_release(&bcacheLock);
+    return found;
+}
+
+/**
+ * Drops a reference to a buffer.
+ * @param buffer    The buffer.
+ */
+void bcache_release(bcache_buffer_t *buffer) {
+    spinlock_lock(&bcacheLock);
+    if (--buffer->RefCount == 0) {
+        // Failed buffers are dropped and reused first.
+        if (buffer->Flags & BCACHE_FLAG_ERROR) {
+            bcache_unhash(buffer);
+            bcache_lru_push(buffer, false);
+        }
+        else {
+            bcache_lru_push(buffer, true);
+        }
+    }
+    spinlock_release(&bcacheLock);
+}
+
+/**
+ * Marks a referenced buffer as modified so it is written back later.
+ * @param buffer    The buffer.
+ */
+void bcache_mark_dirty(bcache_buffer_t *buffer) {
+    spinlock_lock(&bcacheLock);
+    if (!(buffer->Flags & BCACHE_FLAG_DIRTY))
+        buffer->DirtyTime = timer_ticks();
+    buffer->Flags |= BCACHE_FLAG_DIRTY;
+    spinlock_release(&bcacheLock);
+}
+
+/**
+ * Starts reading blocks into the cache without waiting for them.
+ * @param blockDevice   The device to read from.
+ * @param startByte     The offset to start reading at.
+ * @param length        The number of bytes to read.
+ */
+void bcache_prefetch(block_device_t *blockDevice, uint64_t startByte, uint32_t length) {
+    if (startByte + length > blockDevice->SectorCount * blockDevice->SectorSize)
+        return;
+    blockDevice = block_resolve(blockDevice, &startByte);
+    uint64_t blockCount = bcache_block_count(blockDevice);
+    uint64_t firstBlock = startByte / BCACHE_BLOCK_SIZE;
+    uint64_t lastBlock = (startByte + length - 1) / BCACHE_BLOCK_SIZE;
+    if (length == 0 || firstBlock >= blockCount)
+        return;
+    if (lastBlock >= blockCount)
+        lastBlock = blockCount - 1;
+    bcache_prefetch_blocks(blockDevice, firstBlock, lastBlock, false);
+}
+
+/**
+ * Reads bytes through the cache.
+ * @param blockDevice   The device to read from.
+ * @param startByte     The offset to start reading at.
+ * @param outBuffer     The buffer to read into.
+ * @param length        The number of bytes to read.
+ * @return              True if the read succeeded.
+ */
+bool bcache_read(block_device_t *blockDevice, uint64_t startByte, uint8_t *outBuffer, uint32_t length) {
+    if (length == 0)
+        return true;
+
+    if (startByte + length > blockDevice->SectorCount * blockDevice->SectorSize)
+        return false;
+    blockDevice = block_resolve(blockDevice, &startByte);
+    uint64_t firstBlock = startByte / BCACHE_BLOCK_SIZE;
+    uint64_t lastBlock = (startByte + length - 1) / BCACHE_BLOCK_SIZE;
+
+    // Queue everything missing up front, then read ahead of it.
+    if (lastBlock > firstBlock)
+        bcache_prefetch_blocks(blockDevice, firstBlock, lastBlock, false);
+    bcache_read_ahead(blockDevice, firstBlock, lastBlock);
+
+    uint32_t offset = startByte % BCACHE_BLOCK_SIZE;
+    for (uint64_t block = firstBlock; block <= lastBlock; block++) {
+        bcache_buffer_t *buffer = bcache_get(blockDevice, block);
+        if (buffer == NULL)
+            return false;
+
+        uint32_t size = BCACHE_BLOCK_SIZE - offset;
+        if (size > length)
+            size = length;
+        memcpy(outBuffer, buffer->Data + offset, size);
+        bcache_release(buffer);
+
+        outBuffer += size;
+        length -= size;
+        offset = 0;
+    }
+    return true;
+}
+
+/**
+ * Writes bytes into the cache. They reach the device on the next flush or sync.
+ * @param blockDevice   The device to write to.
+ * @param startByte     The offset to start writing at.
+ * @param data          The data to write.
+ * @param length        The number of bytes to write.
+ * @return              True if the write succeeded.
+ */
+bool bcache_write(block_device_t *blockDevice, uint64_t startByte, const uint8_t *data, uint32_t length) {
+    if (startByte + length > blockDevice->SectorCount * blockDevice->SectorSize)
+        return false;
+    blockDevice = block_resolve(blockDevice, &startByte);
+
+    uint32_t offset = startByte % BCACHE_BLOCK_SIZE;
+    for (uint64_t block = startByte / BCACHE_BLOCK_SIZE; length > 0; block++) {
+        uint32_t size = BCACHE_BLOCK_SIZE - offset;
+        if (size > length)
+            size = length;
+
+        // Blocks that are overwritten completely don't need to be read first.
+        bcache_buffer_t *buffer = bcache_get_block(blockDevice, block, offset != 0 || size < BCACHE_BLOCK_SIZE);
+        if (buffer == NULL)
+            return false;
+        memcpy(buffer->Data + offset, (uint8_t*)data, size);
+        bcache_mark_dirty(buffer);
+        bcache_release(buffer);
+
+        data += size;
+        length -= size;
+        offset = 0;
+    }
+    return true;
+}
+
+static bool bcache_flush(block_device_t *blockDevice, uint64_t dirtyBefore) {
+    // Queue every eligible dirty buffer at once so the elevator can merge neighbours.
+    bool success = true;
+    for (bcache_buffer_t *buffer = bcacheBuffers; buffer != NULL; buffer = buffer->AllNext) {
+        spinlock_lock(&bcacheLock);
+        bool write = (buffer->Flags & BCACHE_FLAG_DIRTY) && !(buffer->Flags & BCACHE_FLAG_BUSY) && buffer->RefCount == 0
+            && (blockDevice == NULL || buffer->Device == blockDevice) && buffer->DirtyTime <= dirtyBefore;
+        if (write) {
+            buffer->Flags = (buffer->Flags & ~BCACHE_FLAG_DIRTY) | BCACHE_FLAG_BUSY;
+            bcacheWritesPending++;
+        }
+        spinlock_release(&bcacheLock);
+
+        if (write && !bcache_submit(buffer, true))
+            bcache_write_done(&buffer->Request, false);
+    }
+
+    while (bcacheWritesPending > 0)
+        asm volatile ("hlt");
+
+    // Anything still dirty failed to write or was in use.
+    for (bcache_buffer_t *buffer = bcacheBuffers; buffer != NULL; buffer = buffer->AllNext)
+        if ((buffer->Flags & BCACHE_FLAG_DIRTY) && (blockDevice == NULL || buffer->Device == blockDevice)
+            && buffer->DirtyTime <= dirtyBefore)
+            success = false;
+    return success;
+}
+
+/**
+ * Writes back all dirty blocks, then flushes the drivers' own caches.
+ * @param blockDevice   The device to write back, or NULL for all devices.
+ * @return              True if everything was written.
+ */
+bool bcache_sync(block_device_t *blockDevice) {
+    // Partition blocks are cached under the whole disk.
+    if (blockDevice != NULL)
+        blockDevice = block_resolve(blockDevice, NULL);
+    bool success = bcache_flush(blockDevice, (uint64_t)-1);
+    for (block_device_t *device = blockDevices; device != NULL; device = device->Next)
+        if (device->Parent == NULL && (blockDevice == NULL || device == blockDevice) && !block_flush(device))
+            success = false;
+    return success;
+}
+
+/**
+ * Writes back and then drops all unused blocks of a device.
+ * @param blockDevice   The device.
+ */
+void bcache_invalidate(block_device_t *blockDevice) {
+    blockDevice = block_resolve(blockDevice, NULL);
+    bcache_sync(blockDevice);
+
+    spinlock_lock(&bcacheLock);
+    for (bcache_buffer_t *buffer = bcacheBuffers; buffer != NULL; buffer = buffer->AllNext) {
+        if (buffer->Device == blockDevice && buffer->RefCount == 0 && !(buffer->Flags & (BCACHE_FLAG_DIRTY | BCACHE_FLAG_BUSY))) {
+            bcache_lru_remove(buffer);
+            bcache_unhash(buffer);
+            bcache_lru_push(buffer, false);
+        }
+    }
+    blockDevice->ReadAheadNext = blockDevice->ReadAheadEnd = 0;
+    blockDevice->ReadAheadWindow = 0;
+    spinlock_release(&bcacheLock);
+}
+
+/**
+ * Prints cache statistics.
+ */
+void bcache_print_status(void) {
+    uint32_t dirty = 0;
+    for (bcache_buffer_t *buffer = bcacheBuffers; buffer != NULL; buffer = buffer->AllNext)
+        if (buffer->Flags & BCACHE_FLAG_DIRTY)
+            dirty++;
+
+    kprintf("%u of %u blocks of %u bytes in use, %u dirty\n", bcacheBufferCount, bcacheBufferLimit, BCACHE_BLOCK_SIZE, dirty);
+    kprintf("%llu lookups, %llu misses, %llu read ahead, %llu evicted, %llu written back\n",
+        bcacheLookups, bcacheMisses, bcacheReadAheads, bcacheEvictions, bcacheWritebacks);
+}
+
+static void bcache_flush_thread(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2) {
+    uint64_t nextFlush = timer_ticks() + BCACHE_WRITEBACK_INTERVAL;
+    while (true) {
+        if (timer_ticks() < nextFlush) {
+            asm volatile ("hlt");
+            continue;
+        }
+
+        // Write back blocks that have been dirty for a whole interval.
+        bcache_flush(NULL, timer_ticks() - BCACHE_WRITEBACK_INTERVAL);
+        nextFlush = timer_ticks() + BCACHE_WRITEBACK_INTERVAL;
+    }
+}
+
+/**
+ * Sizes the buffer cache from free memory and starts the writeback thread.
+ */
+void bcache_init(void) {
+    uint32_t frames = pmm_frames_available() + pmm_frames_available_long();
+    bcacheBufferLimit = frames / BCACHE_MEMORY_DIVISOR;
+    if (bcacheBufferLimit < BCACHE_MIN_BUFFERS)
+        bcacheBufferLimit = BCACHE_MIN_BUFFERS;
+    else if (bcacheBufferLimit > BCACHE_MAX_BUFFERS)
+        bcacheBufferLimit = BCACHE_MAX_BUFFERS;
+
+    tasking_thread_schedule_proc(tasking_thread_create_kernel("bcache_flush", bcache_flush_thread, 0, 0, 0), 0);
+    kprintf("BCACHE: Caching up to %u blocks of %u bytes.\n", bcacheBufferLimit, BCACHE_BLOCK_SIZE);
+}
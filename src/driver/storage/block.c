@@ -0,0 +1,627 @@
+/*
+ * File: block.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+#include <math.h>
+#include <driver/storage/block.h>
+#include <driver/storage/bcache.h>
+#include <driver/storage/gpt.h>
+#include <driver/storage/mbr.h>
+
+#include <kernel/memory/kheap.h>
+#include <kernel/lock.h>
+#include <kernel/tasking.h>
+#include <kernel/timer.h>
+
+// Block device list.
+block_device_t *blockDevices;
+
+static inline bool block_request_overlaps(block_request_t *a, block_request_t *b) {
+    return a->Sector < b->Sector + b->SectorCount && b->Sector < a->Sector + a->SectorCount;
+}
+
+static block_request_t *block_queue_blocker(block_device_t *blockDevice, block_request_t *request) {
+    // Requests must not pass an older overlapping request if either of them writes.
+    block_request_t *blocker = NULL;
+    block_request_t *queued = blockDevice->Queue;
+    while (queued != NULL) {
+        if (queued->Sequence < request->Sequence && (queued->Write || request->Write)
+            && block_request_overlaps(queued, request)) {
+            // Restart from the older request, it may be blocked too.
+            blocker = request = queued;
+            queued = blockDevice->Queue;
+            continue;
+        }
+        queued = queued->Next;
+    }
+    return blocker;
+}
+
+static void block_queue_remove(block_device_t *blockDevice, block_request_t *request) {
+    block_request_t **link = &blockDevice->Queue;
+    while (*link != request)
+        link = &(*link)->Next;
+    *link = request->Next;
+    request->Next = NULL;
+    blockDevice->QueueLength--;
+}
+
+static bool block_active_conflicts(block_device_t *blockDevice, block_request_t *request) {
+    // Transfers in flight may finish in any order, so a request must not overlap one if either of them writes.
+    for (block_request_t *active = blockDevice->Active; active != NULL; active = active->Next)
+        for (block_request_t *merged = active; merged != NULL; merged = merged->MergeNext)
+            if ((merged->Write || request->Write) && block_request_overlaps(merged, request))
+                return true;
+    return false;
+}
+
+static block_request_t *block_queue_next(block_device_t *blockDevice) {
+    if (blockDevice->Queue == NULL)
+        return NULL;
+
+    // Serve the oldest request first if it has waited too long, otherwise sweep
+    // upwards from the last transfer and wrap around to the lowest sector.
+    block_request_t *request = NULL;
+    block_request_t *oldest = blockDevice->Queue;
+    for (block_request_t *queued = blockDevice->Queue; queued != NULL; queued = queued->Next) {
+        if (queued->Deadline < oldest->Deadline)
+            oldest = queued;
+        if (request == NULL && queued->Sector >= blockDevice->HeadSector)
+            request = queued;
+    }
+    bool expired = oldest->Deadline <= timer_ticks();
+    if (expired)
+        request = oldest;
+    else if (request == NULL)
+        request = blockDevice->Queue;
+
+    block_request_t *blocker = block_queue_blocker(blockDevice, request);
+    if (blocker != NULL)
+        request = blocker;
+
+    // Hold everything back until the conflicting transfer finishes, so the queue order is kept.
+    if (block_active_conflicts(blockDevice, request))
+        return NULL;
+    if (expired)
+        blockDevice->Expired++;
+
+    // Merge requests that continue where this one ends.
+    block_request_t *last = request;
+    uint32_t sectorCount = request->SectorCount;
+    block_request_t *next = request->Next;
+    block_queue_remove(blockDevice, request);
+    while (next != NULL && next->Sector == last->Sector + last->SectorCount && next->Write == request->Write
+        && sectorCount + next->SectorCount <= blockDevice->MaxSectors && block_queue_blocker(blockDevice, next) == NULL
+        && !block_active_conflicts(blockDevice, next)) {
+        block_request_t *merged = next;
+        next = merged->Next;
+        block_queue_remove(blockDevice, merged);
+
+        last->MergeNext = merged;
+        last = merged;
+        sectorCount += merged->SectorCount;
+        blockDevice->Merges++;
+    }
+    last->MergeNext = NULL;
+    blockDevice->HeadSector = last->Sector + last->SectorCount;
+    return request;
+}
+
+static void block_worker_thread(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2) {
+    block_device_t *blockDevice = (block_device_t*)arg0;
+    while (true) {
+        spinlock_lock(&blockDevice->QueueLock);
+        block_request_t *request = NULL;
+        if (blockDevice->InFlight < blockDevice->QueueDepth)
+            request = block_queue_next(blockDevice);
+        if (request != NULL) {
+            request->Next = blockDevice->Active;
+            blockDevice->Active = request;
+            blockDevice->InFlight++;
+            if (blockDevice->InFlight > blockDevice->PeakInFlight)
+                blockDevice->PeakInFlight = blockDevice->InFlight;
+        }
+        spinlock_release(&blockDevice->QueueLock);
+
+        // Wait for more requests, or for the driver to finish a transfer.
+        if (request == NULL) {
+            asm volatile ("hlt");
+            continue;
+        }
+
+        if (blockDevice->Start != NULL) {
+            if (!blockDevice->Start(blockDevice, request))
+                block_complete(request, false);
+        }
+        else {
+            block_complete(request, blockDevice->Transfer(blockDevice, request));
+        }
+    }
+}
+
+/**
+ * Initializes a request with no completion callback.
+ * @param request       The request to initialize.
+ * @param sector        The first sector to transfer.
+ * @param sectorCount   The number of sectors to transfer.
+ * @param buffer        The buffer to transfer to or from.
+ * @param write         Whether the request writes to the device.
+ */
+void block_request_init(block_request_t *request, uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool write) {
+    memset(request, 0, sizeof(block_request_t));
+    request->Sector = sector;
+    request->SectorCount = sectorCount;
+    request->Buffer = buffer;
+    request->Write = write;
+}
+
+/**
+ * Queues a request. It completes asynchronously, see block_request_t.Done.
+ * @param blockDevice   The device to queue the request on. Requests for a partition are
+ *                      queued on the whole disk, and their Sector is changed to the sector on it.
+ * @param request       The request, which must stay valid until it completes.
+ * @return              False if the request is invalid and was not queued.
+ */
+bool block_submit(block_device_t *blockDevice, block_request_t *request) {
+    if (request->SectorCount == 0 || request->SectorCount > blockDevice->MaxSectors
+        || request->Sector + request->SectorCount > blockDevice->SectorCount)
+        return false;
+
+    // Partition requests are queued directly on the whole disk.
+    for (; blockDevice->Parent != NULL; blockDevice = blockDevice->Parent)
+        request->Sector += blockDevice->StartSector;
+
+    request->Device = blockDevice;
+    request->MergeNext = NULL;
+    request->Complete = false;
+    request->Success = false;
+    request->Deadline = timer_ticks() + (request->Write ? BLOCK_WRITE_DEADLINE : BLOCK_READ_DEADLINE);
+
+    // Insert sorted by sector, after any requests for the same sector.
+    spinlock_lock(&blockDevice->QueueLock);
+    request->Sequence = blockDevice->NextSequence++;
+    block_request_t **link = &blockDevice->Queue;
+    while (*link != NULL && (*link)->Sector <= request->Sector)
+        link = &(*link)->Next;
+    request->Next = *link;
+    *link = request;
+    blockDevice->QueueLength++;
+    blockDevice->Requests++;
+    spinlock_release(&blockDevice->QueueLock);
+    return true;
+}
+
+/**
+ * Waits for a request to complete. Must not be called from a completion callback.
+ * @param request   The request to wait on.
+ * @return          True if the transfer succeeded.
+ */
+bool block_wait(block_request_t *request) {
+    while (!request->Complete)
+        asm volatile ("hlt");
+    return request->Success;
+}
+
+/**
+ * Completes a transfer handed to the driver, along with every request merged into it.
+ * @param request   The first request of the transfer.
+ * @param success   Whether the transfer succeeded.
+ */
+void block_complete(block_request_t *request, bool success) {
+    block_device_t *blockDevice = request->Device;
+    spinlock_lock(&blockDevice->QueueLock);
+    block_request_t **link = &blockDevice->Active;
+    while (*link != request)
+        link = &(*link)->Next;
+    *link = request->Next;
+    request->Next = NULL;
+    blockDevice->InFlight--;
+    blockDevice->Transfers++;
+    if (!success)
+        blockDevice->Errors++;
+    spinlock_release(&blockDevice->QueueLock);
+
+    // Complete each request. The owner may free a request as soon as it is complete.
+    while (request != NULL) {
+        block_request_t *next = request->MergeNext;
+        block_done_func_t done = request->Done;
+        request->Success = success;
+        request->Complete = true;
+        if (done != NULL)
+            done(request, success);
+        request = next;
+    }
+}
+
+static bool block_transfer_sync(block_device_t *blockDevice, uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool write) {
+    if (sectorCount == 0)
+        return true;
+
+    // Split into the largest transfers the driver accepts and queue them together.
+    uint32_t requestCount = DIVIDE_ROUND_UP(sectorCount, blockDevice->MaxSectors);
+    block_request_t *requests = (block_request_t*)kheap_alloc(requestCount * sizeof(block_request_t));
+    if (requests == NULL)
+        return false;
+
+    bool success = true;
+    uint32_t submitted = 0;
+    for (; submitted < requestCount; submitted++) {
+        uint32_t offset = submitted * blockDevice->MaxSectors;
+        uint32_t count = sectorCount - offset;
+        if (count > blockDevice->MaxSectors)
+            count = blockDevice->MaxSectors;
+
+        block_request_init(&requests[submitted], sector + offset, count, buffer + offset * blockDevice->SectorSize, write);
+        if (!block_submit(blockDevice, &requests[submitted])) {
+            success = false;
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < submitted; i++)
+        success &= block_wait(&requests[i]);
+    kheap_free(requests);
+    return success;
+}
+
+/**
+ * Reads sectors and waits for the data.
+ * @param blockDevice   The device to read from.
+ * @param sector        The first sector to read.
+ * @param sectorCount   The number of sectors to read.
+ * @param outBuffer     The buffer to read into.
+ * @return              True if the read succeeded.
+ */
+bool block_read(block_device_t *blockDevice, uint64_t sector, uint32_t sectorCount, uint8_t *outBuffer) {
+    return block_transfer_sync(blockDevice, sector, sectorCount, outBuffer, false);
+}
+
+/**
+ * Writes sectors and waits for the write to finish.
+ * @param blockDevice   The device to write to.
+ * @param sector        The first sector to write.
+ * @param sectorCount   The number of sectors to write.
+ * @param data          The data to write.
+ * @return              True if the write succeeded.
+ */
+bool block_write(block_device_t *blockDevice, uint64_t sector, uint32_t sectorCount, const uint8_t *data) {
+    return block_transfer_sync(blockDevice, sector, sectorCount, (uint8_t*)data, true);
+}
+
+/**
+ * Has the driver write back anything it caches itself.
+ * @param blockDevice   The device to flush.
+ * @return              True if everything was written.
+ */
+bool block_flush(block_device_t *blockDevice) {
+    while (blockDevice->Parent != NULL)
+        blockDevice = blockDevice->Parent;
+    return blockDevice->Flush == NULL || blockDevice->Flush(blockDevice);
+}
+
+/**
+ * Gets the whole disk a device is on, so partitions share the disk's cache blocks.
+ * @param blockDevice   The device.
+ * @param startByte     An offset on the device, changed to the same offset on the whole disk. May be NULL.
+ * @return              The whole disk.
+ */
+block_device_t *block_resolve(block_device_t *blockDevice, uint64_t *startByte) {
+    for (; blockDevice->Parent != NULL; blockDevice = blockDevice->Parent)
+        if (startByte != NULL)
+            *startByte += blockDevice->StartSector * blockDevice->SectorSize;
+    return blockDevice;
+}
+
+static bool block_storage_read(storage_device_t *storageDevice, uint64_t startByte, uint8_t *outBuffer, uint32_t length) {
+    return bcache_read((block_device_t*)storageDevice->Device, startByte, outBuffer, length);
+}
+
+static bool block_segment_emit(block_device_t *blockDevice, uint64_t sector, uint32_t sectorCount, uint8_t *buffer,
+    block_request_t *requests, uint32_t capacity, uint32_t *count) {
+    if (sectorCount == 0)
+        return true;
+    if (requests == NULL) {
+        (*count)++;
+        return true;
+    }
+
+    // Blocks cached since the requests were counted leave fewer slots; read the rest through the cache.
+    if (*count >= capacity)
+        return bcache_read(blockDevice, sector * blockDevice->SectorSize, buffer, sectorCount * blockDevice->SectorSize);
+
+    block_request_init(&requests[*count], sector, sectorCount, buffer, false);
+    if (!block_submit(blockDevice, &requests[*count]))
+        return false;
+    (*count)++;
+    return true;
+}
+
+static bool block_segment_read(block_device_t *blockDevice, uint64_t baseByte, const storage_segment_t *segment,
+    block_request_t *requests, uint32_t capacity, uint32_t *count) {
+    // Walk the segment a cache block at a time. Sector-aligned pieces the cache doesn't hold are gathered
+    // into runs read straight into the caller's buffer; the rest is copied from the cache. With no request
+    // array the runs are only counted. Offsets are on the whole disk, starting at baseByte.
+    uint32_t sectorSize = blockDevice->SectorSize;
+    uint64_t position = baseByte + segment->StartByte;
+    uint64_t end = position + segment->Length;
+    uint64_t runSector = 0;
+    uint32_t runCount = 0;
+    uint8_t *runBuffer = NULL;
+    bool success = true;
+
+    while (position < end && success) {
+        uint64_t block = position / BCACHE_BLOCK_SIZE;
+        uint64_t pieceEnd = (block + 1) * BCACHE_BLOCK_SIZE;
+        if (pieceEnd > end)
+            pieceEnd = end;
+        uint32_t size = (uint32_t)(pieceEnd - position);
+        uint8_t *buffer = segment->Buffer + (position - baseByte - segment->StartByte);
+
+        if (position % sectorSize == 0 && size % sectorSize == 0 && !bcache_contains(blockDevice, block)) {
+            // Extend the current run, or end it and start another.
+            if (runCount == 0 || runCount + size / sectorSize > blockDevice->MaxSectors) {
+                success = block_segment_emit(blockDevice, runSector, runCount, runBuffer, requests, capacity, count);
+                runSector = position / sectorSize;
+                runCount = 0;
+                runBuffer = buffer;
+            }
+            runCount += size / sectorSize;
+        }
+        else {
+            success = block_segment_emit(blockDevice, runSector, runCount, runBuffer, requests, capacity, count);
+            runCount = 0;
+            if (requests != NULL && success)
+                success = bcache_read(blockDevice, position, buffer, size);
+        }
+        position = pieceEnd;
+    }
+
+    if (success)
+        success = block_segment_emit(blockDevice, runSector, runCount, runBuffer, requests, capacity, count);
+    return success;
+}
+
+static bool block_storage_read_segments(storage_device_t *storageDevice, const storage_segment_t *segments, uint32_t segmentCount) {
+    block_device_t *blockDevice = (block_device_t*)storageDevice->Device;
+    uint64_t deviceBytes = blockDevice->SectorCount * blockDevice->SectorSize;
+    for (uint32_t i = 0; i < segmentCount; i++)
+        if (segments[i].StartByte > deviceBytes || segments[i].Length > deviceBytes - segments[i].StartByte)
+            return false;
+
+    // Partitions are read through the whole disk, so both share the same cache blocks.
+    uint64_t baseByte = 0;
+    blockDevice = block_resolve(blockDevice, &baseByte);
+
+    // Count the direct runs first so their requests can be queued together and merged by the elevator.
+    uint32_t capacity = 0;
+    for (uint32_t i = 0; i < segmentCount; i++)
+        block_segment_read(blockDevice, baseByte, &segments[i], NULL, 0, &capacity);
+    block_request_t *requests = NULL;
+    if (capacity > 0) {
+        requests = (block_request_t*)kheap_alloc(capacity * sizeof(block_request_t));
+        if (requests == NULL)
+            capacity = 0;
+    }
+
+    // Without a request array everything is read through the cache.
+    bool success = true;
+    uint32_t submitted = 0;
+    for (uint32_t i = 0; i < segmentCount && success; i++) {
+        if (requests != NULL)
+            success = block_segment_read(blockDevice, baseByte, &segments[i], requests, capacity, &submitted);
+        else
+            success = bcache_read(blockDevice, baseByte + segments[i].StartByte, segments[i].Buffer, segments[i].Length);
+    }
+
+    for (uint32_t i = 0; i < submitted; i++)
+        success &= block_wait(&requests[i]);
+    if (requests != NULL)
+        kheap_free(requests);
+    return success;
+}
+
+static void block_storage_write(storage_device_t *storageDevice, uint64_t startByte, uint32_t count, const uint8_t *data) {
+    block_device_t *blockDevice = (block_device_t*)storageDevice->Device;
+    if (!bcache_write(blockDevice, startByte, data, count))
+        kprintf("BLOCK: Write of %u bytes at 0x%llX on %s failed!\n", count, startByte, blockDevice->Name);
+}
+
+static uint64_t block_storage_get_size(storage_device_t *storageDevice) {
+    block_device_t *blockDevice = (block_device_t*)storageDevice->Device;
+    return blockDevice->SectorCount * blockDevice->SectorSize;
+}
+
+/**
+ * Registers a block device, starts its worker thread and registers its cached byte-addressed storage interface.
+ * @param blockDevice   The device. Name, Device, SectorSize, SectorCount, MaxSectors and Transfer or Start must be set.
+ *                      Flush is optional. Partitions only need Name, Parent, StartSector and SectorCount.
+ */
+void block_register(block_device_t *blockDevice) {
+    if (blockDevice->Parent != NULL) {
+        blockDevice->SectorSize = blockDevice->Parent->SectorSize;
+        blockDevice->MaxSectors = blockDevice->Parent->MaxSectors;
+    }
+
+    // Sectors must pack evenly into cache blocks.
+    if (blockDevice->SectorSize == 0 || blockDevice->SectorSize > BCACHE_BLOCK_SIZE || BCACHE_BLOCK_SIZE % blockDevice->SectorSize != 0) {
+        kprintf("BLOCK: %s has unsupported sector size %u!\n", blockDevice->Name, blockDevice->SectorSize);
+        return;
+    }
+
+    blockDevice->Next = NULL;
+    blockDevice->Queue = NULL;
+    blockDevice->QueueLength = 0;
+    blockDevice->HeadSector = 0;
+    blockDevice->Active = NULL;
+    blockDevice->InFlight = 0;
+    if (blockDevice->MaxSectors == 0)
+        blockDevice->MaxSectors = 1;
+    if (blockDevice->Start == NULL || blockDevice->QueueDepth == 0)
+        blockDevice->QueueDepth = 1;
+
+    // Add device to end of list.
+    if (blockDevices != NULL) {
+        block_device_t *last = blockDevices;
+        while (last->Next != NULL)
+            last = last->Next;
+        last->Next = blockDevice;
+    }
+    else {
+        blockDevices = blockDevice;
+    }
+
+    // Start worker thread. Partitions use their parent's.
+    if (blockDevice->Parent == NULL)
+        tasking_thread_schedule_proc(tasking_thread_create_kernel("block_worker", block_worker_thread, (uintptr_t)blockDevice, 0, 0), 0);
+
+    // Register storage interface.
+    memset(&blockDevice->Storage, 0, sizeof(storage_device_t));
+    blockDevice->Storage.Device = blockDevice;
+    blockDevice->Storage.Read = block_storage_read;
+    blockDevice->Storage.Write = block_storage_write;
+    blockDevice->Storage.GetSize = block_storage_get_size;
+    blockDevice->Storage.ReadSegments = block_storage_read_segments;
+    storage_register(&blockDevice->Storage);
+
+    if (blockDevice->Parent != NULL)
+        kprintf("BLOCK: Registered %s (%llu sectors from sector %llu of %s).\n", blockDevice->Name,
+            blockDevice->SectorCount, blockDevice->StartSector, blockDevice->Parent->Name);
+    else
+        kprintf("BLOCK: Registered %s (%llu sectors of %u bytes, up to %u sectors per transfer, %u in flight).\n", blockDevice->Name,
+            blockDevice->SectorCount, blockDevice->SectorSize, blockDevice->MaxSectors, blockDevice->QueueDepth);
+}
+
+/**
+ * Registers a partition of a device as a block device of its own, named after the parent.
+ * @param parent        The whole device.
+ * @param number        The partition number, starting at 1.
+ * @param startSector   The first sector of the partition on the parent.
+ * @param sectorCount   The size of the partition in sectors.
+ * @return              The partition device, or NULL if it doesn't fit on the parent.
+ */
+block_device_t *block_register_partition(block_device_t *parent, uint32_t number, uint64_t startSector, uint64_t sectorCount) {
+    if (sectorCount == 0 || startSector >= parent->SectorCount || sectorCount > parent->SectorCount - startSector) {
+        kprintf("BLOCK: Partition %u of %s lies outside the device!\n", number, parent->Name);
+        return NULL;
+    }
+
+    block_device_t *blockDevice = (block_device_t*)kheap_alloc(sizeof(block_device_t));
+    if (blockDevice == NULL)
+        return NULL;
+    memset(blockDevice, 0, sizeof(block_device_t));
+    ksnprintf(blockDevice->Name, sizeof(blockDevice->Name), "%sp%u", parent->Name, number);
+    blockDevice->Parent = parent;
+    blockDevice->StartSector = startSector;
+    blockDevice->SectorCount = sectorCount;
+    block_register(blockDevice);
+    return blockDevice;
+}
+
+/**
+ * Reads the partition table of every whole device and registers its partitions. GPT is
+ * preferred over MBR, as a GPT disk also carries a protective MBR.
+ */
+void block_scan_partitions(void) {
+    for (block_device_t *blockDevice = blockDevices; blockDevice != NULL; blockDevice = blockDevice->Next) {
+        if (blockDevice->Parent != NULL)
+            continue;
+
+        // Skip devices that already have partitions registered.
+        bool scanned = false;
+        for (block_device_t *partition = blockDevices; partition != NULL && !scanned; partition = partition->Next)
+            scanned = partition->Parent == blockDevice;
+        if (!scanned && !gpt_init(blockDevice))
+            mbr_init(blockDevice);
+    }
+}
+
+/**
+ * Finds a block device by name.
+ * @param name  The device name.
+ * @return      The device, or NULL if there isn't one.
+ */
+block_device_t *block_find(const char *name) {
+    for (block_device_t *blockDevice = blockDevices; blockDevice != NULL; blockDevice = blockDevice->Next)
+        if (strcmp(blockDevice->Name, name) == 0)
+            return blockDevice;
+    return NULL;
+}
+
+/**
+ * Measures sequential read throughput from the start of a device, bypassing the buffer cache.
+ * @param blockDevice   The device to read from.
+ * @param megabytes     The amount to read.
+ */
+void block_benchmark(block_device_t *blockDevice, uint32_t megabytes) {
+    uint32_t chunkSectors = BLOCK_BENCHMARK_CHUNK / blockDevice->SectorSize;
+    uint64_t totalSectors = (uint64_t)megabytes * 0x100000 / blockDevice->SectorSize;
+    if (totalSectors > blockDevice->SectorCount)
+        totalSectors = blockDevice->SectorCount;
+
+    uint8_t *buffer = (uint8_t*)kheap_alloc(BLOCK_BENCHMARK_CHUNK);
+    if (buffer == NULL)
+        return;
+
+    uint64_t startTicks = timer_ticks();
+    uint64_t sector = 0;
+    while (sector < totalSectors) {
+        uint32_t count = totalSectors - sector < chunkSectors ? (uint32_t)(totalSectors - sector) : chunkSectors;
+        if (!block_read(blockDevice, sector, count, buffer)) {
+            kprintf("Read failed at sector %llu.\n", sector);
+            break;
+        }
+        sector += count;
+    }
+    uint64_t elapsed = timer_ticks() - startTicks;
+    kheap_free(buffer);
+
+    uint64_t kilobytes = sector * blockDevice->SectorSize / 1024;
+    kprintf("%s: read %llu KB in %llu ms, %llu KB/s\n", blockDevice->Name, kilobytes, elapsed,
+        elapsed > 0 ? kilobytes * 1000 / elapsed : 0);
+}
+
+/**
+ * Prints queue statistics for each block device.
+ */
+void block_print_status(void) {
+    if (blockDevices == NULL) {
+        kprintf("No block devices.\n");
+        return;
+    }
+
+    for (block_device_t *blockDevice = blockDevices; blockDevice != NULL; blockDevice = blockDevice->Next) {
+        if (blockDevice->Parent != NULL) {
+            kprintf("%s: %llu sectors from sector %llu of %s\n", blockDevice->Name, blockDevice->SectorCount,
+                blockDevice->StartSector, blockDevice->Parent->Name);
+            continue;
+        }
+
+        kprintf("%s: %llu sectors of %u bytes, %u queued, %u in flight (peak %u of %u)\n", blockDevice->Name, blockDevice->SectorCount,
+            blockDevice->SectorSize, blockDevice->QueueLength, blockDevice->InFlight, blockDevice->PeakInFlight, blockDevice->QueueDepth);
+        kprintf("  %llu requests, %llu merged, %llu transfers, %llu expired, %llu errors\n", blockDevice->Requests,
+            blockDevice->Merges, blockDevice->Transfers, blockDevice->Expired, blockDevice->Errors);
+    }
+}
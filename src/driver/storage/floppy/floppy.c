@@ -29,11 +29,15 @@
 #include <string.h>
 #include <driver/storage/floppy.h>
 
-#include <driver/storage/storage.h>
+#include <driver/storage/block.h>
 #include <kernel/memory/pmm.h>
 #include <kernel/memory/paging.h>
 #include <kernel/memory/kheap.h>
 #include <kernel/interrupts/irqs.h>
+#include <kernel/lock.h>
+#include <kernel/tasking.h>
+#include <kernel/timer.h>
+#include <kernel/trace.h>
 
 static bool irqTriggered = false;
 static bool implied_seeks = false;
@@ -121,6 +125,18 @@ void floppy_sense_interrupt(uint8_t* st0, uint8_t* cyl) {
 	*cyl = floppy_read_data();
 }
 
+/**
+ * Gets the status of a drive.
+ * @param drive The drive number.
+ * @return The ST3 value.
+ */
+uint8_t floppy_sense_drive_status(uint8_t drive) {
+	// Send command and get result.
+	floppy_write_data(FLOPPY_CMD_SENSE_DRIVE_STATUS);
+	floppy_write_data((0 << 2) | drive); // Head 0, drive.
+	return floppy_read_data();
+}
+
 /**
  * Sets drive data.
  */
@@ -158,9 +174,17 @@ bool floppy_motor_on(floppy_drive_t *floppyDrive) {
 	if (motor == -1)
 		return false;
 
-	// Turn motor on or off and wait 500ms for motor to spin up.
-	outb(FLOPPY_REG_DOR, FLOPPY_DOR_RESET | FLOPPY_DOR_IRQ_DMA | floppyDrive->Number | motor);
-	sleep(500);
+	// Only wait for spin-up if the motor was off.
+	spinlock_lock(&floppyDrive->Lock);
+	bool spinUp = !floppyDrive->MotorOn;
+	if (spinUp) {
+		outb(FLOPPY_REG_DOR, FLOPPY_DOR_RESET | FLOPPY_DOR_IRQ_DMA | floppyDrive->Number | motor);
+		floppyDrive->MotorOn = true;
+	}
+	spinlock_release(&floppyDrive->Lock);
+
+	if (spinUp)
+		sleep(FLOPPY_MOTOR_SPINUP_TIME);
 	return true;
 }
 
@@ -170,10 +194,40 @@ bool floppy_motor_off(floppy_drive_t *floppyDrive) {
 		return false;
 
 	// Turn motor off.
+	spinlock_lock(&floppyDrive->Lock);
 	outb(FLOPPY_REG_DOR, FLOPPY_DOR_RESET | FLOPPY_DOR_IRQ_DMA);
+	floppyDrive->MotorOn = false;
+	spinlock_release(&floppyDrive->Lock);
 	return true;
 }
 
+/**
+ * Waits until no other thread is using the drive and claims it.
+ * @param floppyDrive	The drive to claim.
+ */
+static void floppy_acquire(floppy_drive_t *floppyDrive) {
+	while (true) {
+		spinlock_lock(&floppyDrive->Lock);
+		bool claimed = !floppyDrive->Busy;
+		floppyDrive->Busy = true;
+		spinlock_release(&floppyDrive->Lock);
+		if (claimed)
+			return;
+		asm volatile ("hlt");
+	}
+}
+
+/**
+ * Releases the drive. The motor is left running until the idle thread turns it off.
+ * @param floppyDrive	The drive that is no longer in use.
+ */
+static void floppy_release(floppy_drive_t *floppyDrive) {
+	spinlock_lock(&floppyDrive->Lock);
+	floppyDrive->Busy = false;
+	floppyDrive->LastUsed = timer_ticks();
+	spinlock_release(&floppyDrive->Lock);
+}
+
 /**
  * Detects floppy drives in CMOS.
  * @return True if drives were found; otherwise false.
@@ -275,6 +329,7 @@ static bool floppy_recalibrate(floppy_drive_t *floppyDrive) {
 		sleep(500);
 		if (!cyl) {
 			kprintf("FLOPPY: Calibration of drive %u passed!\n", floppyDrive->Number);
+			floppyDrive->CurrentTrack = 0;
 			return true;
 		}
 	}
@@ -391,10 +446,14 @@ bool floppy_seek(floppy_drive_t *floppyDrive, uint8_t track) {
 	if (floppyDrive->Number >= 4)
 		return false;
 
+	// Nothing to do if the heads are already there.
+	if (floppyDrive->CurrentTrack == track)
+		return true;
+	floppyDrive->CurrentTrack = FLOPPY_NO_TRACK;
+
 	// Attempt seek.
 	for (uint8_t i = 0; i < FLOPPY_CMD_RETRY_COUNT; i++) {
 		// Send seek command.
-		kprintf("Seeking to track %u...\n", track);
 		floppy_write_data(FLOPPY_CMD_SEEK);
 		floppy_write_data((0 << 2) | floppyDrive->Number); // Head 0, drive.
 		floppy_write_data(track);
@@ -411,7 +470,8 @@ bool floppy_seek(floppy_drive_t *floppyDrive, uint8_t track) {
 		
 		// If we have reached the requested track, return.
 		if (cyl == track) {
-			sleep(500);
+			sleep(FLOPPY_SEEK_SETTLE_TIME);
+			floppyDrive->CurrentTrack = track;
 			return true;
 		}		
 	}
@@ -421,19 +481,27 @@ bool floppy_seek(floppy_drive_t *floppyDrive, uint8_t track) {
 	return false;
 }
 
-int8_t floppy_read_track(floppy_drive_t *floppyDrive, uint16_t track) {
+/**
+ * Reads or writes both heads of a track through the DMA buffer.
+ * @param floppyDrive	The drive. The heads must already be over the track.
+ * @param track			The track.
+ * @param write			True to write the DMA buffer to the track; false to read the track into it.
+ * @return 0 on success, 2 if the disk is write-protected, otherwise -1.
+ */
+int8_t floppy_transfer_track(floppy_drive_t *floppyDrive, uint16_t track, bool write) {
 	// Set drive info (step time = 4ms, load time = 16ms, unload time = 240ms).
 	floppy_set_transfer_speed(floppyDrive->Type);
 	floppy_set_drive_data(0xC, 0x2, 0xF, true);
 
 	for (uint8_t i = 0; i < FLOPPY_CMD_RETRY_COUNT; i++) {
 		// Initialize DMA.
-		uint32_t dmaLength = 2 * 18 * 512;
-		floppy_dma_set(floppyDrive->DmaBuffer, dmaLength, false);
+		floppy_dma_set(floppyDrive->DmaBuffer, FLOPPY_TRACK_SIZE, write);
 
-		// Send read command to disk to read both sides of track.
-		kprintf("Attempting to read track %u...\n", track);
-		floppy_write_data(FLOPPY_CMD_READ_DATA | FLOPPY_CMD_EXT_SKIP | FLOPPY_CMD_EXT_MFM | FLOPPY_CMD_EXT_MT);
+		// Send read or write command to disk for both sides of track.
+		if (write)
+			floppy_write_data(FLOPPY_CMD_WRITE_DATA | FLOPPY_CMD_EXT_MFM | FLOPPY_CMD_EXT_MT);
+		else
+			floppy_write_data(FLOPPY_CMD_READ_DATA | FLOPPY_CMD_EXT_SKIP | FLOPPY_CMD_EXT_MFM | FLOPPY_CMD_EXT_MT);
 		floppy_write_data(0 << 2 | floppyDrive->Number);
 		floppy_write_data(track); 	// Track.
 		floppy_write_data(0); 		// Head 0.
@@ -471,63 +539,242 @@ int8_t floppy_read_track(floppy_drive_t *floppyDrive, uint16_t track) {
 	}
 
 	// Failed.
-	kprintf("Get sector failed!\n");
+	kprintf("%s track %u failed!\n", write ? "Write" : "Read", track);
 	return - 1;
 }
 
-bool floppy_read_blocks(floppy_drive_t *floppyDrive, const uint64_t *blocks, uint32_t blockSize, uint32_t blockCount, uint8_t *outBuffer, uint32_t length) {
-	if (floppyDrive->Number >= 4)
+/**
+ * Drops cached tracks.
+ * @param floppyDrive	The drive, claimed by the caller.
+ * @param dirty			True to drop modified tracks as well.
+ */
+static void floppy_drop_tracks(floppy_drive_t *floppyDrive, bool dirty) {
+	for (uint8_t i = 0; i < FLOPPY_TRACK_CACHE_COUNT; i++) {
+		floppy_track_t *entry = &floppyDrive->Tracks[i];
+		if (entry->Track == FLOPPY_NO_TRACK || (entry->Dirty && !dirty))
+			continue;
+
+		// Modified tracks belong to the old disk and must not be written to the new one.
+		if (entry->Dirty)
+			kprintf("FLOPPY: Disk in drive %u changed, discarding modified track %u!\n", floppyDrive->Number, entry->Track);
+		entry->Track = FLOPPY_NO_TRACK;
+		entry->Dirty = false;
+		entry->LastUsed = 0;
+	}
+}
+
+/**
+ * Spins up the motor and checks the disk change line, dropping the track cache if the disk was changed.
+ * @param floppyDrive	The drive, claimed by the caller.
+ * @return True if the drive is ready; false if there is no disk.
+ */
+static bool floppy_prepare(floppy_drive_t *floppyDrive) {
+	if (!floppy_motor_on(floppyDrive))
+		return false;
+	if (!(inb(FLOPPY_REG_DIR) & FLOPPY_DIR_DISK_CHANGE))
+		return true;
+
+	// Stepping the heads clears the line, but only if a disk is now present. Seek away
+	// from track 0 first, as recalibrating from there does not step.
+	kprintf("FLOPPY: Disk in drive %u changed.\n", floppyDrive->Number);
+	floppy_drop_tracks(floppyDrive, true);
+	floppyDrive->CurrentTrack = FLOPPY_NO_TRACK;
+	if (!floppy_seek(floppyDrive, 1) || !floppy_recalibrate(floppyDrive) || (inb(FLOPPY_REG_DIR) & FLOPPY_DIR_DISK_CHANGE)) {
+		floppyDrive->CurrentTrack = FLOPPY_NO_TRACK;
+		kprintf("FLOPPY: No disk in drive %u!\n", floppyDrive->Number);
 		return false;
+	}
+	return true;
+}
 
-	// Turn on motor.
-	floppy_motor_on(floppyDrive);
+/**
+ * Writes a dirty cached track back to the disk. A track that cannot be written stays modified.
+ * @param floppyDrive	The drive, claimed by the caller.
+ * @param entry			The cached track.
+ * @return True if the track was written.
+ */
+static bool floppy_writeback_track(floppy_drive_t *floppyDrive, floppy_track_t *entry) {
+	// A disk change drops the track rather than writing it to the new disk.
+	int8_t status = -1;
+	if (floppy_prepare(floppyDrive) && entry->Dirty && floppy_seek(floppyDrive, entry->Track)) {
+		memcpy(floppyDrive->DmaBuffer, entry->Data, FLOPPY_TRACK_SIZE);
+		trace(TRACE_EVENT_DISK_START, (2 * FLOPPY_SECTORS_PER_TRACK) | TRACE_DISK_WRITE, entry->Track * 2 * FLOPPY_SECTORS_PER_TRACK);
+		status = floppy_transfer_track(floppyDrive, entry->Track, true);
+		trace(TRACE_EVENT_DISK_DONE, status, 0);
+	}
+
+	// Keep the data so a later flush can try again; the track only leaves the cache once written.
+	if (status) {
+		if (entry->Dirty)
+			kprintf("FLOPPY: Write-back of track %u failed!\n", entry->Track);
+		return false;
+	}
+	floppyDrive->TrackWrites++;
+	entry->Dirty = false;
+	return true;
+}
 
-	// Get each block.
-	uint32_t remainingLength = length;
-	uint32_t bufferOffset = 0;
-	uint16_t lastTrack = -1;
-	for (uint32_t block = 0; block < blockCount; block++) {
-		for (uint32_t sectorOffset = 0; sectorOffset < blockSize; sectorOffset++) {
-			uint32_t sectorLba = (blocks[block] / 512) + sectorOffset;
+/**
+ * Writes back every dirty cached track in cylinder order.
+ * @param floppyDrive	The drive, claimed by the caller.
+ * @return True if all tracks were written.
+ */
+static bool floppy_flush_tracks(floppy_drive_t *floppyDrive) {
+	// Tracks that fail stay dirty, so walk upwards from the last track tried.
+	bool success = true;
+	uint32_t minTrack = 0;
+	while (true) {
+		floppy_track_t *next = NULL;
+		for (uint8_t i = 0; i < FLOPPY_TRACK_CACHE_COUNT; i++)
+			if (floppyDrive->Tracks[i].Dirty && floppyDrive->Tracks[i].Track >= minTrack
+				&& (next == NULL || floppyDrive->Tracks[i].Track < next->Track))
+				next = &floppyDrive->Tracks[i];
+		if (next == NULL)
+			return success;
+		minTrack = next->Track + 1;
+		if (!floppy_writeback_track(floppyDrive, next))
+			success = false;
+	}
+}
 
+/**
+ * Gets a track from the cache, reading it from the disk on a miss.
+ * @param floppyDrive	The drive, claimed by the caller.
+ * @param track			The track to get.
+ * @return The cached track, or NULL if the read failed.
+ */
+static floppy_track_t *floppy_get_track(floppy_drive_t *floppyDrive, uint16_t track) {
+	// Look for the track, remembering the least recently used entry in case of a miss.
+	floppy_track_t *victim = &floppyDrive->Tracks[0];
+	for (uint8_t i = 0; i < FLOPPY_TRACK_CACHE_COUNT; i++) {
+		floppy_track_t *entry = &floppyDrive->Tracks[i];
+		if (entry->Track == track) {
+			entry->LastUsed = ++floppyDrive->TrackClock;
+			floppyDrive->TrackHits++;
+			return entry;
+		}
+		if (entry->LastUsed < victim->LastUsed)
+			victim = entry;
+	}
+
+	// Check for a disk change before trusting anything else in the cache.
+	floppyDrive->TrackMisses++;
+	if (!floppy_prepare(floppyDrive))
+		return NULL;
+
+	// Make room, writing back the evicted track if it was modified. If that fails the
+	// track is kept and this miss fails instead.
+	if (victim->Dirty && !floppy_writeback_track(floppyDrive, victim))
+		return NULL;
+	victim->Track = FLOPPY_NO_TRACK;
+
+	// Seek and DMA both heads of the track, then keep a copy.
+	if (!floppy_seek(floppyDrive, track))
+		return NULL;
+
+	trace(TRACE_EVENT_DISK_START, 2 * FLOPPY_SECTORS_PER_TRACK, track * 2 * FLOPPY_SECTORS_PER_TRACK);
+	int8_t status = floppy_transfer_track(floppyDrive, track, false);
+	trace(TRACE_EVENT_DISK_DONE, status, 0);
+	if (status)
+		return NULL;
+
+	memcpy(victim->Data, floppyDrive->DmaBuffer, FLOPPY_TRACK_SIZE);
+	victim->Track = track;
+	victim->LastUsed = ++floppyDrive->TrackClock;
+	return victim;
+}
+
+static bool floppy_block_transfer(block_device_t *blockDevice, block_request_t *request) {
+	floppy_drive_t *floppyDrive = (floppy_drive_t*)blockDevice->Device;
+	if (floppyDrive->Number >= 4)
+		return false;
+
+	// The elevator hands us merged chains in sector order, so tracks are visited
+	// in cylinder order; the track cache ensures each one is read at most once.
+	// Writes only modify the cached track, which is written back on flush or when idle.
+	floppy_acquire(floppyDrive);
+	floppyDrive->WritebackFailed = false;
+	bool write = false;
+	for (block_request_t *chained = request; chained != NULL; chained = chained->MergeNext)
+		write |= chained->Write;
+
+	// Cached tracks are only kept while the motor is on, so check the disk change line
+	// before any of them are used. With the motor off the cache holds nothing to check.
+	bool success = (!floppyDrive->MotorOn && !write) || floppy_prepare(floppyDrive);
+
+	// Writes are acknowledged before they reach the disk, so refuse them up front on a write-protected disk.
+	if (success && write && (floppy_sense_drive_status(floppyDrive->Number) & FLOPPY_ST3_WRITE_PROTECT)) {
+		kprintf("FLOPPY: Disk in drive %u is write-protected!\n", floppyDrive->Number);
+		success = false;
+	}
+	for (; request != NULL && success; request = request->MergeNext) {
+		for (uint32_t i = 0; i < request->SectorCount; i++) {
 			// Convert LBA to CHS.
 			uint16_t head = 0, track = 0, sector = 1;
-			floppy_lba_to_chs(sectorLba, &track, &head, &sector);
-
-			// Have we changed tracks?.
-			if (lastTrack != track) {
-				if (lastTrack != track && !floppy_seek(floppyDrive, track)) {
-					floppy_motor_off(floppyDrive);
-					return false;
-				}
-
-				// Get track.
-				lastTrack = track;
-				floppy_read_track(floppyDrive, track);
-			}
-			
-			uint32_t size = remainingLength;
-			if (size > 512)
-				size = 512;
+			floppy_lba_to_chs((uint32_t)request->Sector + i, &track, &head, &sector);
 
-			uint32_t headOffset = head == 1 ? (18 * 512) : 0;
-			memcpy(outBuffer + bufferOffset, floppyDrive->DmaBuffer + ((sector - 1) * 512) + headOffset, size);
+			// The motor is only spun up if a track has to be read or written back.
+			floppy_track_t *entry = floppy_get_track(floppyDrive, track);
+			if (entry == NULL) {
+				success = false;
+				break;
+			}
 
-			//int8_t error = floppy_read_chs(drive, track, head, sector, outBuffer+bufferOffset, size);
-			bufferOffset += 512;
+			uint32_t headOffset = head == 1 ? (FLOPPY_SECTORS_PER_TRACK * 512) : 0;
+			uint8_t *data = entry->Data + ((sector - 1) * 512) + headOffset;
+			if (request->Write) {
+				memcpy(data, request->Buffer + i * 512, 512);
+				entry->Dirty = true;
+			}
+			else {
+				memcpy(request->Buffer + i * 512, data, 512);
+			}
 		}
 	}
 
-	floppy_motor_off(floppyDrive);
-	return true;
+	floppy_release(floppyDrive);
+	return success;
 }
 
-static bool floppy_storage_read(storage_device_t *storageDevice, uint64_t startByte, uint8_t *outBuffer, uint32_t length) {
-	return floppy_read_blocks((floppy_drive_t*)storageDevice->Device, &startByte, 1, 1, outBuffer, length);
+static bool floppy_block_flush(block_device_t *blockDevice) {
+	floppy_drive_t *floppyDrive = (floppy_drive_t*)blockDevice->Device;
+	floppy_acquire(floppyDrive);
+	floppyDrive->WritebackFailed = false;
+	bool success = floppy_flush_tracks(floppyDrive);
+	floppy_release(floppyDrive);
+	return success;
 }
 
-static bool floppy_storage_read_blocks(storage_device_t *storageDevice, const uint64_t *blocks, uint32_t blockSize, uint32_t blockCount, uint8_t *outBuffer, uint32_t length) {
-	return floppy_read_blocks((floppy_drive_t*)storageDevice->Device, blocks, blockSize, blockCount, outBuffer, length);
+static void floppy_idle_thread(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2) {
+	floppy_drive_t *floppyDrive = (floppy_drive_t*)arg0;
+	while (true) {
+		asm volatile ("hlt");
+
+		// Once the drive has been idle for a while, write back modified tracks and
+		// later turn the motor off.
+		spinlock_lock(&floppyDrive->Lock);
+		uint64_t idle = timer_ticks() - floppyDrive->LastUsed;
+		bool flush = false;
+		if (!floppyDrive->Busy && idle >= FLOPPY_WRITEBACK_DELAY) {
+			for (uint8_t i = 0; i < FLOPPY_TRACK_CACHE_COUNT && !floppyDrive->WritebackFailed; i++)
+				flush |= floppyDrive->Tracks[i].Dirty;
+			if (flush)
+				floppyDrive->Busy = true;
+			else if (floppyDrive->MotorOn && idle >= FLOPPY_MOTOR_IDLE_TIME) {
+				// Disk changes can no longer be seen, so the cached tracks cannot be trusted.
+				outb(FLOPPY_REG_DOR, FLOPPY_DOR_RESET | FLOPPY_DOR_IRQ_DMA);
+				floppyDrive->MotorOn = false;
+				floppy_drop_tracks(floppyDrive, false);
+			}
+		}
+		spinlock_release(&floppyDrive->Lock);
+
+		// Failed tracks are left for the next flush or transfer rather than retried here.
+		if (flush) {
+			floppyDrive->WritebackFailed = !floppy_flush_tracks(floppyDrive);
+			floppy_release(floppyDrive);
+		}
+	}
 }
 
 static void floppy_drive_init(floppy_drive_t *floppyDrive) {
@@ -597,19 +844,32 @@ bool floppy_init(void) {
 		driveA->Version = version;
 		driveA->Type = driveTypeA;
 		driveA->DmaBuffer = (uint8_t*)frame;
+		driveA->CurrentTrack = FLOPPY_NO_TRACK;
 
-		// Initialize drive.
-		floppy_drive_init(driveA);
-
-		// Register storage device.
-		storage_device_t *floppyStorageDevice = (storage_device_t*)kheap_alloc(sizeof(storage_device_t));
-		memset(floppyStorageDevice, 0, sizeof(storage_device_t));
-		floppyStorageDevice->Device = driveA;
+		// Allocate the track cache.
+		for (uint8_t i = 0; i < FLOPPY_TRACK_CACHE_COUNT; i++) {
+			driveA->Tracks[i].Track = FLOPPY_NO_TRACK;
+			driveA->Tracks[i].Data = (uint8_t*)kheap_alloc(FLOPPY_TRACK_SIZE);
+		}
 
-		floppyStorageDevice->Read = floppy_storage_read;
-		floppyStorageDevice->ReadBlocks = floppy_storage_read_blocks;
-		storage_register(floppyStorageDevice);
+		// Initialize drive and start the idle thread for write-back and motor shut-off.
+		floppy_drive_init(driveA);
+		tasking_thread_schedule_proc(tasking_thread_create_kernel("floppy_idle", floppy_idle_thread, (uintptr_t)driveA, 0, 0), 0);
+
+		// Register block device. Merged requests are limited only by the disk size,
+		// so a queue of reads costs a single motor spin-up.
+		block_device_t *floppyBlockDevice = (block_device_t*)kheap_alloc(sizeof(block_device_t));
+		memset(floppyBlockDevice, 0, sizeof(block_device_t));
+		strcpy(floppyBlockDevice->Name, "fd0");
+		floppyBlockDevice->Device = driveA;
+		floppyBlockDevice->SectorSize = 512;
+		floppyBlockDevice->SectorCount = FLOPPY_TRACK_COUNT * 2 * FLOPPY_SECTORS_PER_TRACK;
+		floppyBlockDevice->MaxSectors = floppyBlockDevice->SectorCount;
+		floppyBlockDevice->Transfer = floppy_block_transfer;
+		floppyBlockDevice->Flush = floppy_block_flush;
+		block_register(floppyBlockDevice);
 	}
 
 	kprintf("FLOPPY: Initialized!\e[0m\n");
+	return true;
 }
@@ -22,13 +22,125 @@
  * SOFTWARE.
  */
 
+
 #include <main.h>
 #include <tools.h>
 #include <kprint.h>
+#include <string.h>
+#include <math.h>
 #include <driver/storage/gpt.h>
 
-#include <driver/storage/storage.h>
+#include <driver/storage/block.h>
+#include <driver/storage/mbr.h>
+#include <kernel/memory/kheap.h>
+
+static uint32_t gpt_crc32(const uint8_t *data, uint32_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static bool gpt_has_protective_mbr(block_device_t *blockDevice, uint8_t *sector) {
+    if (blockDevice->SectorSize < sizeof(mbr_t) || !block_read(blockDevice, 0, 1, sector))
+        return false;
+
+    mbr_t *mbr = (mbr_t*)sector;
+    if (mbr->Signature != MBR_SIGNATURE)
+        return false;
+    for (uint8_t i = 0; i < MBR_PARTITION_COUNT; i++)
+        if (mbr->Partitions[i].Type == MBR_TYPE_GPT_PROTECTIVE)
+            return true;
+    return false;
+}
+
+static bool gpt_read_header(block_device_t *blockDevice, uint64_t lba, uint8_t *sector, gpt_header_t *outHeader) {
+    if (!block_read(blockDevice, lba, 1, sector))
+        return false;
+
+    gpt_header_t *header = (gpt_header_t*)sector;
+    if (header->Signature != GPT_SIGNATURE || header->HeaderSize < GPT_HEADER_MIN_SIZE
+        || header->HeaderSize > blockDevice->SectorSize || header->CurrentLba != lba)
+        return false;
+
+    // The CRC is computed with its own field zeroed.
+    uint32_t crc = header->HeaderCrc32;
+    header->HeaderCrc32 = 0;
+    if (gpt_crc32(sector, header->HeaderSize) != crc)
+        return false;
+    header->HeaderCrc32 = crc;
+
+    // Entries must hold at least the fields we use, and the array must be of sane size.
+    if (header->PartitionEntrySize < sizeof(gpt_partition_t) || header->PartitionEntryCount == 0
+        || (uint64_t)header->PartitionEntryCount * header->PartitionEntrySize > GPT_MAX_ENTRY_ARRAY_SIZE)
+        return false;
+
+    memcpy((uint8_t*)outHeader, (uint8_t*)header, sizeof(gpt_header_t));
+    return true;
+}
+
+static uint8_t *gpt_read_entries(block_device_t *blockDevice, gpt_header_t *header) {
+    uint32_t length = header->PartitionEntryCount * header->PartitionEntrySize;
+    uint32_t sectorCount = DIVIDE_ROUND_UP(length, blockDevice->SectorSize);
+    uint8_t *entries = (uint8_t*)kheap_alloc(sectorCount * blockDevice->SectorSize);
+    if (entries == NULL)
+        return NULL;
+
+    if (!block_read(blockDevice, header->PartitionEntryLba, sectorCount, entries)
+        || gpt_crc32(entries, length) != header->PartitionEntryArrayCrc32) {
+        kheap_free(entries);
+        return NULL;
+    }
+    return entries;
+}
+
+/**
+ * Reads the GPT of a device and registers its partitions. The backup header and entries are
+ * used if the primary ones are damaged.
+ * @param blockDevice   The whole device.
+ * @return              True if the device has a GPT.
+ */
+bool gpt_init(block_device_t *blockDevice) {
+    uint8_t *sector = (uint8_t*)kheap_alloc(blockDevice->SectorSize);
+    if (sector == NULL)
+        return false;
+
+    // A GPT disk is marked by a protective MBR partition.
+    if (!gpt_has_protective_mbr(blockDevice, sector)) {
+        kheap_free(sector);
+        return false;
+    }
+
+    // Try the primary header, then the backup in the last sector.
+    gpt_header_t header;
+    uint8_t *entries = NULL;
+    uint64_t headerLbas[2] = { GPT_HEADER_LBA, blockDevice->SectorCount - 1 };
+    for (uint8_t i = 0; i < 2 && entries == NULL; i++) {
+        if (gpt_read_header(blockDevice, headerLbas[i], sector, &header))
+            entries = gpt_read_entries(blockDevice, &header);
+        if (entries == NULL)
+            kprintf("GPT: %s header at sector %llu is invalid.\n", i == 0 ? "Primary" : "Backup", headerLbas[i]);
+    }
+    kheap_free(sector);
+    if (entries == NULL)
+        return false;
+
+    // Register each used entry, numbered by its position in the array.
+    kprintf("GPT: Found partition table on %s.\n", blockDevice->Name);
+    for (uint32_t i = 0; i < header.PartitionEntryCount; i++) {
+        gpt_partition_t *partition = (gpt_partition_t*)(entries + i * header.PartitionEntrySize);
+        bool used = false;
+        for (uint8_t b = 0; b < sizeof(partition->TypeGuid); b++)
+            used |= partition->TypeGuid[b] != 0;
+        if (!used || partition->LastLba < partition->FirstLba)
+            continue;
 
-bool gpt_init(storage_device_t *storageDevice) {
+        block_register_partition(blockDevice, i + 1, partition->FirstLba, partition->LastLba - partition->FirstLba + 1);
+    }
 
+    kheap_free(entries);
+    return true;
 }
@@ -0,0 +1,122 @@
+/*
+ * File: mbr.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+#include <driver/storage/mbr.h>
+
+#include <driver/storage/block.h>
+#include <kernel/memory/kheap.h>
+
+static inline bool mbr_is_extended(uint8_t type) {
+    return type == MBR_TYPE_EXTENDED_CHS || type == MBR_TYPE_EXTENDED_LBA || type == MBR_TYPE_EXTENDED_LINUX;
+}
+
+/**
+ * Checks whether a sector holds a partition table, rather than boot code or an unpartitioned volume.
+ * @param mbr   The first sector of the device.
+ * @return      True if the sector has a signature and sane partition entries.
+ */
+bool mbr_is_valid(const mbr_t *mbr) {
+    if (mbr->Signature != MBR_SIGNATURE)
+        return false;
+
+    // A FAT boot sector carries the same signature, but names its file system in the BPB.
+    const uint8_t *sector = (const uint8_t*)mbr;
+    if ((sector[0] == 0xEB || sector[0] == 0xE9) && (memcmp(sector + 0x36, "FAT", 3) == 0 || memcmp(sector + 0x52, "FAT32", 5) == 0))
+        return false;
+
+    // Every entry must have a valid status, and at least one must be used.
+    bool used = false;
+    for (uint8_t i = 0; i < MBR_PARTITION_COUNT; i++) {
+        const mbr_partition_t *partition = &mbr->Partitions[i];
+        if (partition->Status != MBR_STATUS_INACTIVE && partition->Status != MBR_STATUS_ACTIVE)
+            return false;
+        if (partition->Type != MBR_TYPE_EMPTY)
+            used = true;
+    }
+    return used;
+}
+
+static void mbr_scan_extended(block_device_t *blockDevice, uint64_t extendedStart, uint8_t *sector) {
+    // Follow the chain of extended boot records, each describing one logical partition.
+    uint64_t record = extendedStart;
+    uint32_t number = MBR_FIRST_LOGICAL;
+    for (uint32_t i = 0; i < MBR_MAX_LOGICAL; i++) {
+        if (record >= blockDevice->SectorCount || !block_read(blockDevice, record, 1, sector))
+            return;
+        mbr_t *ebr = (mbr_t*)sector;
+        if (ebr->Signature != MBR_SIGNATURE)
+            return;
+
+        mbr_partition_t *logical = &ebr->Partitions[0];
+        if (logical->Type != MBR_TYPE_EMPTY && logical->SectorCount > 0)
+            block_register_partition(blockDevice, number++, record + logical->FirstLba, logical->SectorCount);
+
+        mbr_partition_t *next = &ebr->Partitions[1];
+        if (!mbr_is_extended(next->Type) || next->FirstLba == 0)
+            return;
+        record = extendedStart + next->FirstLba;
+    }
+    kprintf("MBR: Extended partition chain on %s is too long!\n", blockDevice->Name);
+}
+
+/**
+ * Reads the MBR partition table of a device and registers its primary and logical partitions.
+ * @param blockDevice   The whole device.
+ * @return              True if the device has an MBR partition table.
+ */
+bool mbr_init(block_device_t *blockDevice) {
+    if (blockDevice->SectorSize < sizeof(mbr_t))
+        return false;
+
+    uint8_t *sector = (uint8_t*)kheap_alloc(blockDevice->SectorSize);
+    if (sector == NULL)
+        return false;
+    if (!block_read(blockDevice, 0, 1, sector) || !mbr_is_valid((mbr_t*)sector)) {
+        kheap_free(sector);
+        return false;
+    }
+
+    // Copy the table, as the sector buffer is reused for extended boot records.
+    mbr_partition_t partitions[MBR_PARTITION_COUNT];
+    memcpy((uint8_t*)partitions, (uint8_t*)((mbr_t*)sector)->Partitions, sizeof(partitions));
+
+    kprintf("MBR: Found partition table on %s.\n", blockDevice->Name);
+    for (uint8_t i = 0; i < MBR_PARTITION_COUNT; i++) {
+        mbr_partition_t *partition = &partitions[i];
+        if (partition->Type == MBR_TYPE_EMPTY || partition->SectorCount == 0)
+            continue;
+
+        if (mbr_is_extended(partition->Type))
+            mbr_scan_extended(blockDevice, partition->FirstLba, sector);
+        else
+            block_register_partition(blockDevice, i + 1, partition->FirstLba, partition->SectorCount);
+    }
+
+    kheap_free(sector);
+    return true;
+}
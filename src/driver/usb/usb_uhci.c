@@ -26,6 +26,7 @@
 #include <tools.h>
 #include <io.h>
 #include <kprint.h>
+#include <klog.h>
 #include <string.h>
 #include <math.h>
 #include <driver/usb/usb_uhci.h>
@@ -236,23 +237,22 @@ static bool usb_uhci_queue_head_process(usb_uhci_controller_t *controller, usb_u
     else if(!(transferDesc->Active)) {
         // Is the transfer stalled?
         if (transferDesc->Stalled) {
-            kprintf("UHCI: stall:\n");
+            klog_warn(UHCI, "stall:\n");
             complete = true;
             outStatus = false;
-            kprintf("packet data\n");
-            kprintf("0x%X 0x%X 0x%X 0x%X\n", *t1, *t2, *t3, *t4);
-            kprintf("UHCI: packet type: 0x%X\n", transferDesc->PacketType);
+            klog_debug(UHCI, "packet data 0x%X 0x%X 0x%X 0x%X\n", *t1, *t2, *t3, *t4);
+            klog_debug(UHCI, "packet type: 0x%X\n", transferDesc->PacketType);
         }
         if (transferDesc->DataBufferError)
-            kprintf("UHCI: data buffer error\n");
+            klog_warn(UHCI, "data buffer error\n");
         if (transferDesc->BabbleDetected)
-            kprintf("UHCI: babble\n");
+            klog_warn(UHCI, "babble\n");
         if (transferDesc->NakReceived)
-            kprintf("UHCI: nak\n");
+            klog_trace(UHCI, "nak\n");
         if (transferDesc->CrcError)
-            kprintf("UHCI: crc error\n");
+            klog_warn(UHCI, "crc error\n");
         if (transferDesc->BitstuffError)
-            kprintf("UHCI: bitstuff\n");
+            klog_warn(UHCI, "bitstuff\n");
     }
 
 //if (transferDesc != NULL) {
@@ -529,9 +529,7 @@ static bool usb_uhci_callback(pci_device_t *pciDevice) {
     usb_uhci_controller_t *controller = (usb_uhci_controller_t*)pciDevice->DriverObject;
     uint16_t status = inw(USB_UHCI_USBSTS(controller->BaseAddress));
     if (status & 0x3F) {
-        kprintf("IRQ uhci\n");
-        kprintf("status: 0x%X\n", pci_config_read_word(pciDevice, PCI_REG_STATUS));
-        kprintf("usb status: 0x%X\n", status);
+        klog_trace(UHCI, "IRQ raised, PCI status: 0x%X, USB status: 0x%X\n", pci_config_read_word(pciDevice, PCI_REG_STATUS), status);
         outw(USB_UHCI_USBSTS(controller->BaseAddress), 0x3F);
         pci_config_write_word(pciDevice, PCI_REG_STATUS, 0x8);
         return true;
@@ -560,8 +558,8 @@ bool usb_uhci_init(pci_device_t *pciDevice) {
     // Enable PCI busmaster and port I/O, if not already enabled.
     uint16_t pciCmd = pci_config_read_word(pciDevice, PCI_REG_COMMAND);
     pci_config_write_word(pciDevice, PCI_REG_COMMAND, pciCmd | 0x01 | 0x04);
-    kprintf("UHCI: Original PCI command register value: 0x%X\n", pciCmd);
-    kprintf("UHCI: Current PCI command register value: 0x%X\n", pci_config_read_word(pciDevice, PCI_REG_COMMAND));
+    klog_debug(UHCI, "Original PCI command register value: 0x%X\n", pciCmd);
+    klog_debug(UHCI, "Current PCI command register value: 0x%X\n", pci_config_read_word(pciDevice, PCI_REG_COMMAND));
 
     // Get value of legacy status register.
     uint16_t legacyReg = pci_config_read_word(pciDevice, USB_UHCI_PCI_REG_LEGACY);
@@ -683,7 +681,7 @@ bool usb_uhci_init(pci_device_t *pciDevice) {
         // Reset the port and get its status.
         uint16_t portStatus = usb_uhci_reset_port(controller, port);
         sleep(20);
-        kprintf("UHCI: Port status for port %u: 0x%X\n", port, portStatus);
+        klog_debug(UHCI, "Port status for port %u: 0x%X\n", port, portStatus);
 
         // Is the port enabled?
         if (portStatus & USB_UHCI_PORTSC_ENABLED) {
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <kprint.h>
 #include <driver/vga.h>
+#include <driver/fbcon.h>
 #include <driver/speaker.h>
 
 extern uint32_t KERNEL_VIRTUAL_OFFSET;
@@ -43,6 +44,24 @@ static uint8_t terminalColor = 0;
  */
 static uint16_t* terminalBuffer;
 
+/**
+ * Shadow copy of the screen and scrollback, as a ring of rows. Scrolling moves terminalTop,
+ * the ring row shown at the top of the live screen, instead of copying.
+ */
+static uint16_t terminalHistory[VGA_HISTORY_ROWS * VGA_WIDTH];
+static volatile uint16_t terminalTop = 0;
+static uint16_t historyRows = VGA_HEIGHT;
+static volatile uint16_t viewOffset = 0;
+
+/**
+ * Screen rows changed since the last flush, one bit per row. While flushing is deferred, the
+ * timer copies these to video memory at most every VGA_FLUSH_INTERVAL ms.
+ */
+static volatile uint32_t dirtyRows = 0;
+static bool deferredFlush = false;
+static uint64_t lastFlushTick = 0;
+static uint16_t cursorPos = 0xFFFF;
+
 // -----------------------------------------------------------------------------
 // Cursor stuff
 // -----------------------------------------------------------------------------
@@ -56,6 +75,7 @@ static bool cursorEnabled = false;
 void vga_update_cursor(uint16_t x, uint16_t y) {
 	// Calculate position.
 	uint16_t pos = y * VGA_WIDTH + x;
+	cursorPos = pos;
  
 	// Set cursor position.
 	outb(VGA_CRTC_ADDRESS, VGA_REG_CURSOR_LOC_LOW);
@@ -122,6 +142,30 @@ static inline uint16_t vga_entry(char c, uint8_t color) {
 	return (uint16_t)c | (uint16_t) color << 8;
 }
 
+/**
+ * Gets a row of the shadow buffer.
+ * @param y         Row on the screen.
+ * @param offset    Number of rows scrolled back.
+ * @return          Pointer to the row's entries.
+ */
+static inline uint16_t *vga_history_row(uint16_t y, uint16_t offset) {
+	return terminalHistory + ((terminalTop + VGA_HISTORY_ROWS - offset + y) % VGA_HISTORY_ROWS) * VGA_WIDTH;
+}
+
+/**
+ * Internal function for placing entries. Writes through to video memory until flushing is deferred.
+ * @param entry Entry to write.
+ * @param x     X position in framebuffer.
+ * @param y     Y position in framebuffer.
+ */
+static inline void vga_putentry_raw(uint16_t entry, uint16_t x, uint16_t y) {
+	vga_history_row(y, 0)[x] = entry;
+	if (deferredFlush)
+		__atomic_fetch_or(&dirtyRows, 1 << y, __ATOMIC_RELEASE);
+	else
+		terminalBuffer[(y * VGA_WIDTH) + x] = entry;
+}
+
 /**
  * Internal function for placing characters.
  * @param c     Character to write.
@@ -129,7 +173,7 @@ static inline uint16_t vga_entry(char c, uint8_t color) {
  * @param y     Y position in framebuffer.
  */
 static inline void vga_putentry_int(char c, uint16_t x, uint16_t y) {
-	terminalBuffer[(y * VGA_WIDTH) + x] = vga_entry(c, terminalColor);
+	vga_putentry_raw(vga_entry(c, terminalColor), x, y);
 }
 
 /**
@@ -141,28 +185,109 @@ static inline void vga_putentry_int(char c, uint16_t x, uint16_t y) {
  * @param bg	Background color.
  */
 void vga_putentry(char c, uint16_t x, uint16_t y, vga_color_t fg, vga_color_t bg) {
-	terminalBuffer[(y * VGA_WIDTH) + x] = vga_entry(c, fg | bg << 4);
+	vga_putentry_raw(vga_entry(c, fg | bg << 4), x, y);
+}
+
+/**
+ * Copies changed rows of the shadow buffer to video memory.
+ */
+void vga_flush(void) {
+	// Take the dirty rows first, so anything written during the copy is caught next time.
+	uint32_t rows = __atomic_exchange_n(&dirtyRows, 0, __ATOMIC_ACQ_REL);
+	uint16_t offset = viewOffset;
+	for (uint16_t y = 0; y < VGA_HEIGHT; y++) {
+		if (rows & (1 << y))
+			memcpy((uint8_t*)(terminalBuffer + y * VGA_WIDTH), (uint8_t*)vga_history_row(y, offset), VGA_WIDTH * sizeof(uint16_t));
+	}
+
+	// Move the cursor, hiding it off screen while viewing history.
+	if (cursorEnabled) {
+		uint16_t pos = offset ? (VGA_WIDTH * VGA_HEIGHT) : (terminalRow * VGA_WIDTH + terminalColumn);
+		if (pos != cursorPos)
+			vga_update_cursor(pos % VGA_WIDTH, pos / VGA_WIDTH);
+	}
+}
+
+/**
+ * Flushes the shadow buffer if it is deferred and the interval has passed. Called from the timer.
+ * @param ticks Current timer ticks.
+ */
+void vga_flush_tick(uint64_t ticks) {
+	if (!deferredFlush || ticks - lastFlushTick < VGA_FLUSH_INTERVAL)
+		return;
+
+	// A busy framebuffer console is left for the next tick rather than waited on.
+	if (fbcon_active() && !fbcon_try_flush())
+		return;
+	lastFlushTick = ticks;
+	if (!fbcon_active())
+		vga_flush();
+}
+
+/**
+ * Sets whether writes are batched until the next timer flush, or go straight to video memory.
+ * @param deferred	True to defer writes.
+ */
+void vga_set_deferred(bool deferred) {
+	deferredFlush = deferred;
+	if (!deferred && fbcon_active()) {
+		fbcon_flush();
+	} else if (!deferred) {
+		dirtyRows = (1 << VGA_HEIGHT) - 1;
+		vga_flush();
+	}
+}
+
+/**
+ * Moves the view through the scrollback history.
+ * @param rows	Rows to move back, or forward if negative.
+ */
+void vga_scrollback(int16_t rows) {
+	if (fbcon_active()) {
+		fbcon_scrollback(rows);
+		if (!deferredFlush)
+			fbcon_flush();
+		return;
+	}
+
+	int32_t offset = viewOffset + rows;
+	if (offset > historyRows - VGA_HEIGHT)
+		offset = historyRows - VGA_HEIGHT;
+	if (offset < 0)
+		offset = 0;
+
+	viewOffset = offset;
+	__atomic_fetch_or(&dirtyRows, (1 << VGA_HEIGHT) - 1, __ATOMIC_RELEASE);
+	if (!deferredFlush)
+		vga_flush();
+}
+
+/**
+ * Shows the live screen and writes directly to video memory from here on.
+ */
+void vga_panic(void) {
+	if (fbcon_active())
+		fbcon_scrollback(-FBCON_HISTORY_ROWS);
+	viewOffset = 0;
+	vga_set_deferred(false);
 }
 
 /**
  * Scrolls the terminal up a line.
  */
 static void vga_scroll(void) {
-	// Shift entire screen up a row.
+	// Move the top of the screen down a row in the ring, and blank the newly-created row.
+	terminalTop = (terminalTop + 1) % VGA_HISTORY_ROWS;
+	if (historyRows < VGA_HISTORY_ROWS)
+		historyRows++;
 	terminalRow = VGA_HEIGHT - 1;
-	for (uint16_t y = 1; y < VGA_HEIGHT; y++) {
-		for (uint16_t x = 0; x < VGA_WIDTH; x++) {
-			const uint16_t index = y * VGA_WIDTH + x;
-			terminalBuffer[index - VGA_WIDTH] = terminalBuffer[index];
-		}
-	}
-	
-	// Blank newly-created row and reset column position.
-	for (uint16_t i = terminalColumn; i < VGA_WIDTH; i++) {
-		vga_putentry_int(' ', terminalColumn, terminalRow);
-		terminalColumn++;
-	}
+	memset16(vga_history_row(terminalRow, 0), vga_entry(' ', terminalColor), VGA_WIDTH);
 	terminalColumn = 0;
+
+	// Every row on screen has changed.
+	__atomic_fetch_or(&dirtyRows, (1 << VGA_HEIGHT) - 1, __ATOMIC_RELEASE);
+	if (!deferredFlush)
+		vga_flush();
 }
 
 /**
@@ -170,6 +295,18 @@ static void vga_scroll(void) {
  * @param c Character to write.
  */
 void vga_putchar(char c) {
+	// Send output to the framebuffer console instead if it is in use.
+	if (fbcon_active()) {
+		fbcon_putchar(c, terminalColor);
+		if (!deferredFlush)
+			fbcon_flush();
+		return;
+	}
+
+	// New output brings the view back to the live screen.
+	if (viewOffset != 0)
+		vga_scrollback(-viewOffset);
+
 	if (c == '\n') {
 		// Move to new line.
 		terminalColumn = 0;
@@ -206,7 +343,16 @@ void vga_putchar(char c) {
  * @param data	String to write.
  */
 void vga_writes(const char* data) {
-	for (uint32_t i = 0; i < strlen(data); i++)
+	vga_write(data, strlen(data));
+}
+
+/**
+ * Write characters to display.
+ * @param data		Characters to write.
+ * @param length	Number of characters.
+ */
+void vga_write(const char *data, size_t length) {
+	for (size_t i = 0; i < length; i++)
 		vga_putchar(data[i]);
 }
 
@@ -253,10 +399,9 @@ void vga_init(void) {
 
 	// Blank out display.
 	terminalRow = terminalColumn = 0;
-	for (uint16_t y = 0; y < VGA_HEIGHT; y++) {
-		for (uint16_t x = 0; x < VGA_WIDTH; x++)
-			vga_putentry_int(' ', x, y);
-	}
+	memset16(terminalHistory, vga_entry(' ', terminalColor), VGA_HISTORY_ROWS * VGA_WIDTH);
+	dirtyRows = (1 << VGA_HEIGHT) - 1;
+	vga_flush();
 	vga_enable_cursor();
 	kprintf("\e[91mV\e[92mG\e[94mA\e[0m: Initialized!\n");
 }
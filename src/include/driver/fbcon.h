@@ -0,0 +1,56 @@
+/*
+ * File: fbcon.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FBCON_H
+#define FBCON_H
+
+#include <main.h>
+
+// Glyph cell size. The font is 8x8 and drawn with each row doubled.
+#define FBCON_GLYPH_WIDTH       8
+#define FBCON_GLYPH_HEIGHT      16
+#define FBCON_FONT_HEIGHT       8
+
+// The font covers printable ASCII.
+#define FBCON_FONT_FIRST        0x20
+#define FBCON_FONT_LAST         0x7E
+
+// Rows of text kept for scrollback, including the visible screen.
+#define FBCON_HISTORY_ROWS      200
+
+// Scanlines of the cell used for the cursor.
+#define FBCON_CURSOR_HEIGHT     2
+
+// Only 32 bits per pixel is supported.
+#define FBCON_BPP               32
+
+extern bool fbcon_active(void);
+extern void fbcon_putchar(char c, uint8_t color);
+extern void fbcon_scrollback(int16_t rows);
+extern void fbcon_flush(void);
+extern bool fbcon_try_flush(void);
+extern void fbcon_early_init(void);
+extern bool fbcon_init(void);
+
+#endif
@@ -78,6 +78,7 @@ typedef struct {
     uint32_t TotalSectors32;
 } __attribute__((packed)) fat_bpb_header_t;
 
+// Boot sector of FAT12 and FAT16 volumes.
 typedef struct {
     // BIOS Parameter Block.
     fat_bpb_header_t BPB;
@@ -99,35 +100,108 @@ typedef struct {
 
     // Type of FAT, should be used for display only.
     char FileSystemType[8];
-} __attribute__((packed)) fat12_header_t;
+} __attribute__((packed)) fat16_header_t;
 
+// Boot sector of FAT32 volumes.
 typedef struct {
-    uint16_t Cluster1 : 12;
-    uint16_t Cluster2 : 12;
-} __attribute__((packed)) fat12_cluster_pair_t;
+    // BIOS Parameter Block.
+    fat_bpb_header_t BPB;
+
+    // Size of File Allocation Tables (FATs) in sectors.
+    uint32_t TableSize32;
+
+    // Mirroring flags and version.
+    uint16_t ExtendedFlags;
+    uint16_t Version;
+
+    // First cluster of the root directory.
+    uint32_t RootDirectoryCluster;
+
+    // Sectors of the FSInfo structure and the backup boot sector.
+    uint16_t FsInfoSector;
+    uint16_t BackupBootSector;
+    uint8_t Reserved[12];
+
+    // Physical drive number.
+    uint8_t DriveNumber;
+    uint8_t Reserved1;
+
+    // Extended boot signature. Should be either 0x29 or 0x28.
+    uint8_t ExtendedBootSignature;
+
+    // Volume serial number.
+    uint32_t SerialNumber;
+
+    // Volume label.
+    char VolumeLabel[11];
+
+    // Type of FAT, should be used for display only.
+    char FileSystemType[8];
+} __attribute__((packed)) fat32_header_t;
 
+typedef union {
+    fat_bpb_header_t BPB;
+    fat16_header_t Fat16;
+    fat32_header_t Fat32;
+} fat_header_t;
+
+// FAT types, determined by the number of clusters.
+enum {
+    FAT_TYPE_12 = 12,
+    FAT_TYPE_16 = 16,
+    FAT_TYPE_32 = 32
+};
+
+#define FAT12_MAX_CLUSTERS      4084
+#define FAT16_MAX_CLUSTERS      65524
+
+// Cluster values at or above these mark the end of a chain.
+#define FAT12_END_OF_CHAIN      0xFF8
+#define FAT16_END_OF_CHAIN      0xFFF8
+#define FAT32_END_OF_CHAIN      0x0FFFFFF8
+#define FAT32_CLUSTER_MASK      0x0FFFFFFF
+
+// First cluster of the data area.
+#define FAT_FIRST_CLUSTER       2
+
+// A run of consecutive clusters.
 typedef struct {
+    uint32_t Cluster;
+    uint32_t Length;
+} fat_extent_t;
+
+typedef struct fat_volume_t {
+    // Next mounted volume.
+    struct fat_volume_t *Next;
+
     // Underlying storage device.
     storage_device_t *Device;
 
     // Header area.
-    fat12_header_t Header;
+    fat_header_t Header;
+    uint8_t Type;
+
+    // Sizes in bytes.
+    uint32_t BytesPerSector;
+    uint32_t BytesPerCluster;
 
     // FAT starting sector and length in sectors.
     uint32_t TableStart;
     uint32_t TableLength;
 
-    // FAT.
-    fat12_cluster_pair_t *Table;
+    // First FAT, kept in memory for the life of the mount.
+    uint8_t *Table;
 
-    // Root directory starting sector and length in sectors.
+    // Root directory starting sector and length in sectors for FAT12/16, or first cluster for FAT32.
     uint32_t RootDirectoryStart;
     uint32_t RootDirectoryLength;
+    uint32_t RootDirectoryCluster;
 
     // Data area starting sector and length in sectors.
     uint32_t DataStart;
     uint32_t DataLength;
-} fat12_t;
+    uint32_t ClusterCount;
+} fat_volume_t;
 
 typedef struct {
     char FileName[11];
@@ -158,6 +232,28 @@ typedef struct {
     uint32_t Length;
 } __attribute__((packed)) fat_dir_entry_t;
 
+// An open file or directory, with its cluster chain as extents.
+typedef struct {
+    fat_volume_t *Volume;
+    uint32_t Size;
+    bool Directory;
+
+    // Set for the FAT12/16 root directory, which lives in its own area rather than in clusters.
+    bool FixedRoot;
+
+    // Cluster runs in file order.
+    fat_extent_t *Extents;
+    uint32_t ExtentCount;
+} fat_file_t;
+
+extern fat_volume_t *fatVolumes;
+
+extern fat_volume_t *fat_mount(storage_device_t *storageDevice);
+extern void fat_unmount(fat_volume_t *fat);
+extern bool fat_open(fat_volume_t *fat, const char *path, fat_file_t *outFile);
+extern bool fat_read(fat_file_t *file, uint32_t offset, uint8_t *outBuffer, uint32_t length);
+extern void fat_close(fat_file_t *file);
+extern bool fat_print_dir(fat_volume_t *fat, const char *path);
 extern bool fat_init(storage_device_t *storageDevice);
 
 #endif
@@ -28,6 +28,7 @@
 #include <main.h>
 #include <kernel/lock.h>
 #include <driver/pci.h>
+#include <kernel/multitasking/workqueue.h>
 
 #define E1000E_VENDOR_ID                0x8086
 
@@ -304,6 +305,10 @@ typedef struct {
 
     lock_t TransmitIndexLock;
     uint8_t CurrentTransmitDesc;
+
+    // Interrupt causes not yet handled by the deferred handler.
+    volatile uint32_t PendingInterrupts;
+    work_t InterruptWork;
 } e1000e_t;
 
 extern bool e1000e_init(pci_device_t *pciDevice);
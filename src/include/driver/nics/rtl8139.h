@@ -28,6 +28,7 @@
 #include <main.h>
 #include <driver/pci.h>
 #include <kernel/networking/networking.h>
+#include <kernel/multitasking/workqueue.h>
 
 // Registers
 #define RTL8139_REG_IDR0    0x00
@@ -133,6 +134,9 @@ typedef struct {
 
     bool UsesEeprom;
 
+    // Deferred receive processing.
+    work_t RxWork;
+
     // Network stack object.
     net_device_t *NetDevice;
 } rtl8139_t;
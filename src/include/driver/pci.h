@@ -84,6 +84,62 @@
 #define PCI_BAR_PREFETCHABLE		0x8
 
 #define PCI_CMD_BUSMASTER           0x04
+#define PCI_CMD_INTERRUPT_DISABLE   0x400
+
+#define PCI_STATUS_CAPABILITIES     0x10
+
+// Capability IDs.
+#define PCI_CAP_ID_MSI              0x05
+#define PCI_CAP_ID_MSIX             0x11
+
+// MSI capability registers, relative to the capability.
+#define PCI_MSI_REG_CONTROL         0x02 // 2
+#define PCI_MSI_REG_ADDRESS_LOW     0x04 // 4
+#define PCI_MSI_REG_ADDRESS_HIGH    0x08 // 4, only on 64-bit capable devices.
+#define PCI_MSI_REG_DATA_32         0x08 // 2
+#define PCI_MSI_REG_DATA_64         0x0C // 2
+
+#define PCI_MSI_CONTROL_ENABLE      0x0001
+#define PCI_MSI_CONTROL_MMC_MASK    0x000E
+#define PCI_MSI_CONTROL_MMC_SHIFT   1
+#define PCI_MSI_CONTROL_MME_MASK    0x0070
+#define PCI_MSI_CONTROL_MME_SHIFT   4
+#define PCI_MSI_CONTROL_64BIT       0x0080
+
+// MSI-X capability registers, relative to the capability.
+#define PCI_MSIX_REG_CONTROL        0x02 // 2
+#define PCI_MSIX_REG_TABLE          0x04 // 4
+#define PCI_MSIX_REG_PBA            0x08 // 4
+
+#define PCI_MSIX_CONTROL_TABLE_SIZE 0x07FF
+#define PCI_MSIX_CONTROL_MASK_ALL   0x4000
+#define PCI_MSIX_CONTROL_ENABLE     0x8000
+#define PCI_MSIX_BIR_MASK           0x7
+
+#define PCI_MSIX_ENTRY_MASKED       0x1
+
+// Message address and data fields for delivery to the LAPICs.
+#define PCI_MSI_ADDRESS_BASE            0xFEE00000
+#define PCI_MSI_ADDRESS_DEST_SHIFT      12
+#define PCI_MSI_ADDRESS_REDIRECTION     0x8
+#define PCI_MSI_ADDRESS_LOGICAL         0x4
+#define PCI_MSI_DATA_DELIVERY_FIXED     0x000
+#define PCI_MSI_DATA_DELIVERY_LOWEST    0x100
+
+// Interrupt modes.
+enum {
+    PCI_INTERRUPT_MODE_LEGACY   = 0,
+    PCI_INTERRUPT_MODE_MSI      = 1,
+    PCI_INTERRUPT_MODE_MSIX     = 2
+};
+
+// MSI-X table entry.
+typedef struct {
+    uint32_t AddressLow;
+    uint32_t AddressHigh;
+    uint32_t Data;
+    uint32_t VectorControl;
+} __attribute__((packed)) pci_msix_entry_t;
 
 typedef struct {
     bool PortMapped;
@@ -124,8 +180,20 @@ typedef struct pci_device_t {
     // Actual interrupt number in use by device.
     uint8_t InterruptNo;
 
-    // Interrupt handler.
+    // MSI and MSI-X capability offsets, zero if not supported.
+    uint8_t MsiCapOffset;
+    uint8_t MsiXCapOffset;
+
+    // Message signaled interrupt info. IRQs are MsiIrqBase through MsiIrqBase + MsiIrqCount - 1.
+    uint8_t InterruptMode;
+    uint8_t MsiIrqBase;
+    uint16_t MsiIrqCount;
+    volatile pci_msix_entry_t *MsiXTable;
+
+    // Interrupt handlers. MsiHandler is called with the index of the raised message if set,
+    // otherwise InterruptHandler is used for all interrupts.
     bool (*InterruptHandler)(struct pci_device_t *pciDevice);
+    bool (*MsiHandler)(struct pci_device_t *pciDevice, uint16_t vector);
     void *DriverObject;
 } pci_device_t;
 
@@ -151,6 +219,12 @@ extern void pci_config_write_word(pci_device_t *pciDevice, uint8_t reg, uint16_t
 extern void pci_config_write_byte(pci_device_t *pciDevice, uint8_t reg, uint8_t value);
 
 extern void pci_enable_busmaster(pci_device_t *pciDevice);
+extern uint8_t pci_find_capability(pci_device_t *pciDevice, uint8_t capId);
+
+extern bool pci_msi_enable(pci_device_t *pciDevice, uint8_t vectorCount, uint32_t procIndex);
+extern bool pci_msix_enable(pci_device_t *pciDevice, uint16_t vectorCount, uint32_t procIndex);
+extern bool pci_msi_set_target(pci_device_t *pciDevice, uint16_t vector, uint32_t procIndex);
+extern void pci_msi_disable(pci_device_t *pciDevice);
 
 extern void pci_init(void);
 
@@ -37,6 +37,55 @@
 #define SERIAL_REG_MSR(port)        (port+6)
 #define SERIAL_REG_SCRATCH(port)    (port+7)
 
+// Divisor latch, accessible while LCR DLAB is set.
+#define SERIAL_REG_DLL(port)        (port+0)
+#define SERIAL_REG_DLM(port)        (port+1)
+
+// The standard 1.8432 MHz clock gives this baud rate with a divisor of 1.
+#define SERIAL_MAX_BAUD             115200
+#define SERIAL_DEFAULT_BAUD         115200
+
+// Bytes that can be written to the 16550A transmit FIFO at once.
+#define SERIAL_FIFO_SIZE            16
+
+// Ring buffer sizes, must be powers of two.
+#define SERIAL_TX_BUFFER_SIZE       0x1000
+#define SERIAL_RX_BUFFER_SIZE       0x400
+
+// Interrupt Enable Register bits.
+enum {
+    SERIAL_IER_RECEIVED_DATA            = 0x01, // Received data available.
+    SERIAL_IER_TRANSMIT_EMPTY           = 0x02, // Transmitter holding register empty.
+    SERIAL_IER_LINE_STATUS              = 0x04, // Receiver line status.
+    SERIAL_IER_MODEM_STATUS             = 0x08  // Modem status.
+};
+
+// Interrupt Identification Register.
+enum {
+    SERIAL_IIR_NO_INTERRUPT             = 0x01, // No interrupt pending.
+    SERIAL_IIR_ID_MASK                  = 0x0E, // Mask for interrupt ID.
+    SERIAL_IIR_MODEM_STATUS             = 0x00, // Modem status changed.
+    SERIAL_IIR_TRANSMIT_EMPTY           = 0x02, // Transmitter holding register empty.
+    SERIAL_IIR_RECEIVED_DATA            = 0x04, // Received data available.
+    SERIAL_IIR_LINE_STATUS              = 0x06, // Receiver line status.
+    SERIAL_IIR_TIMEOUT                  = 0x0C, // Character timeout, data is waiting in the FIFO.
+    SERIAL_IIR_FIFO_ENABLED             = 0xC0  // Both bits set on a 16550A with working FIFOs.
+};
+
+// FIFO Control Register bits.
+enum {
+    SERIAL_FCR_ENABLE                   = 0x01, // Enable FIFOs.
+    SERIAL_FCR_CLEAR_RECEIVE            = 0x02, // Clear receive FIFO.
+    SERIAL_FCR_CLEAR_TRANSMIT           = 0x04, // Clear transmit FIFO.
+    SERIAL_FCR_TRIGGER_14               = 0xC0  // Receive interrupt at 14 bytes.
+};
+
+// Line Control Register bits.
+enum {
+    SERIAL_LCR_8N1                      = 0x03, // 8 bits, no parity, one stop bit.
+    SERIAL_LCR_DLAB                     = 0x80  // Divisor latch access.
+};
+
 // Modem Control Register bits.
 enum {
     SERIAL_MCR_FORCE_DATA_TERMINAL      = 0x01, // Force Data Terminal Ready.
@@ -71,10 +120,25 @@ enum {
     SERIAL_MSR_CARRIER_DETECT               = 0x80
 };
 
+// Ring buffer of bytes. Indexes are free-running and masked with Size - 1.
+typedef struct {
+    volatile uint32_t Head;
+    volatile uint32_t Tail;
+    uint32_t Size;
+    uint8_t *Data;
+} serial_ring_t;
+
 extern bool serial_present();
+extern bool serial_set_baud(uint32_t baud);
 extern void serial_init();
+extern void serial_init_irq();
+extern void serial_panic();
 extern void serial_write(char a);
 extern void serial_writes(const char* data);
+extern void serial_write_text(const char *data, size_t length);
+extern void serial_write_bytes(const void *data, size_t length);
+extern int serial_received();
 extern char serial_read();
+extern void serial_read_bytes(void *data, size_t length);
 
 #endif
\ No newline at end of file
@@ -26,7 +26,10 @@
 #define AHCI_H
 
 #include <main.h>
+#include <kernel/lock.h>
+#include <kernel/multitasking/workqueue.h>
 #include <driver/pci.h>
+#include <driver/storage/block.h>
 #include <driver/storage/ahci/ahci_port.h>
 
 // Generic host control registers.
@@ -63,6 +66,34 @@
 #define AHCI_REG_PORT_DEVICE_SLEEP          0x44
 #define AHCI_REG_PORT_VENDOR_SPECIFIC       0x70
 
+// Port interrupt bits.
+#define AHCI_PORT_INT_DEVICE_TO_HOST_FIS    0x00000001
+#define AHCI_PORT_INT_SET_DEVICE_BITS       0x00000008
+#define AHCI_PORT_INT_OVERFLOW              0x01000000
+#define AHCI_PORT_INT_INTERFACE_NON_FATAL   0x04000000
+#define AHCI_PORT_INT_INTERFACE_FATAL       0x08000000
+#define AHCI_PORT_INT_HOST_BUS_DATA         0x10000000
+#define AHCI_PORT_INT_HOST_BUS_FATAL        0x20000000
+#define AHCI_PORT_INT_TASK_FILE_ERROR       0x40000000
+#define AHCI_PORT_INT_ERRORS                (AHCI_PORT_INT_OVERFLOW | AHCI_PORT_INT_INTERFACE_NON_FATAL | AHCI_PORT_INT_INTERFACE_FATAL \
+    | AHCI_PORT_INT_HOST_BUS_DATA | AHCI_PORT_INT_HOST_BUS_FATAL | AHCI_PORT_INT_TASK_FILE_ERROR)
+
+#define AHCI_FIS_TYPE_REG_HOST_TO_DEVICE    0x27
+
+// Device register value selecting LBA addressing.
+#define AHCI_DEVICE_LBA                     0x40
+
+// Largest transfer per command, which also sizes the bounce buffer.
+#define AHCI_MAX_TRANSFER_SECTORS           128
+
+// Command tables are 1KB, leaving room for 56 PRDT entries after the 128-byte header.
+#define AHCI_COMMAND_TABLE_SIZE             0x400
+#define AHCI_PRDT_ENTRIES                   56
+#define AHCI_PRD_MAX_BYTES                  0x400000
+
+// Time to wait for a polled command, in ms.
+#define AHCI_COMMAND_TIMEOUT                5000
+
 
 typedef struct {
     // Number of ports.
@@ -225,7 +256,7 @@ typedef struct {
     uint8_t CommandFis[64];
     uint8_t AtapiCommand[16];
     uint8_t Reserved[48];
-    ahci_prdt_entry_t PhysRegionDescTable[1];
+    ahci_prdt_entry_t PhysRegionDescTable[AHCI_PRDT_ENTRIES];
 } __attribute__((packed)) ahci_command_table_t;
 
 // FIS Register - Host to Device.
@@ -331,9 +362,35 @@ typedef struct {
 
     ahci_command_header_t *CommandList;
     ahci_received_fis_t *ReceivedFis;
+
+    // Command table for each slot.
+    ahci_command_table_t *CommandTables[AHCI_COMMAND_LIST_COUNT];
+    uint64_t CommandTablesPhys[AHCI_COMMAND_LIST_COUNT];
+    uint8_t SlotCount;
+
+    // Disk capabilities.
+    bool Ncq;
+    bool Lba48;
+
+    // Issued slots and the transfer in each. No commands are issued while recovering from an error.
+    lock_t SlotLock;
+    uint32_t ActiveSlots;
+    block_request_t *SlotRequests[AHCI_COMMAND_LIST_COUNT];
+    volatile bool Recovering;
+
+    // Bounce buffer for transfers the PRDT can't describe, used by one slot at a time.
+    uint8_t *BounceBuffer;
+    uint32_t BounceBufferPhys;
+    volatile int8_t BounceSlot;
+
+    // Interrupt status saved by the handler and processed later.
+    volatile uint32_t PendingInterrupts;
+    work_t InterruptWork;
+
+    block_device_t Block;
 } ahci_port_t;
 
-typedef struct {
+typedef struct ahci_controller_t {
     // Register access.
     uint32_t BaseAddress;
     volatile ahci_memory_t *Memory;
@@ -27,6 +27,8 @@
 
 #include <main.h>
 #include <driver/pci.h>
+#include <driver/storage/block.h>
+#include <kernel/memory/paging.h>
 
 // Primary PATA interface ports.
 #define ATA_PRI_COMMAND_PORT    0x1F0
@@ -119,10 +121,36 @@ enum {
 #define ATA_PCI_BUSMASTER_PORT_SECSTATUS    0x0A
 #define ATA_PCI_BUSMASTER_PORT_SECPRDT      0x0C
 
+#define ATA_PCI_BUSMASTER_CMD_START        0x01
+#define ATA_PCI_BUSMASTER_CMD_READ         0x08 // Device to memory.
+
+#define ATA_PCI_BUSMASTER_STATUS_ACTIVE     0x01
+#define ATA_PCI_BUSMASTER_STATUS_ERROR      0x02
 #define ATA_PCI_BUSMASTER_STATUS_INTERRUPT  0x04
 
+// Physical region descriptors. A byte count of 0 means 64KB.
+#define ATA_PRD_END_OF_TABLE    0x8000
+#define ATA_PRD_MAX_BYTES       0x10000
+#define ATA_PRDT_ENTRIES        (PAGE_SIZE_4K / sizeof(ata_prd_t))
+
+// Time to wait for a DMA transfer to complete, in ms.
+#define ATA_DMA_TIMEOUT         5000
+
+// Time to wait for the device to become ready during a PIO transfer, in ms.
+#define ATA_PIO_TIMEOUT         5000
+
+// Identify capability bits.
+#define ATA_IDENTIFY_CAP49_DMA          0x0100
+#define ATA_IDENTIFY_CMD83_LBA48        0x0400
+
 
 // ATA driver structures.
+typedef struct {
+    uint32_t Address;
+    uint16_t ByteCount;
+    uint16_t Flags;
+} __attribute__((packed)) ata_prd_t;
+
 typedef struct {
     uint16_t CommandPort;
     uint16_t ControlPort;
@@ -133,6 +161,13 @@ typedef struct {
     uint16_t BusMasterCommandPort;
     uint16_t BusMasterStatusPort;
     uint16_t BusMasterPrdt;
+
+    // Bus master DMA state. The bounce buffer is used when a request's pages can't be reached by the controller.
+    bool DmaEnabled;
+    ata_prd_t *Prdt;
+    uint32_t PrdtPhys;
+    uint8_t *DmaBuffer;
+    uint32_t DmaBufferPhys;
 } ata_channel_t;
 
 typedef struct {
@@ -140,6 +175,25 @@ typedef struct {
     ata_channel_t Secondary;
 } ata_device_t;
 
+// Largest transfer issued with one command, in sectors.
+#define ATA_MAX_TRANSFER_SECTORS    128
+
+// A disk registered as a block device.
+typedef struct {
+    ata_channel_t *Channel;
+    bool Master;
+    bool Dma;
+    bool Lba48;
+
+    // Sectors per DRQ block for READ/WRITE MULTIPLE, 1 if multiple mode isn't used.
+    uint8_t MultipleSectors;
+
+    // Bounce buffer for merged requests.
+    uint8_t *Buffer;
+
+    block_device_t Block;
+} ata_disk_t;
+
 typedef struct {
     bool Error : 1;
     uint8_t Unused : 2;
@@ -150,6 +204,7 @@ typedef struct {
     bool Busy : 1;
 } __attribute__((packed)) ata_reg_status_t;
 
+extern void ata_set_dma_allowed(bool enabled);
 extern bool ata_init(pci_device_t *pciDevice);
 
 #endif
@@ -32,6 +32,18 @@
 #define ATA_CMD_READ_SECTOR         0x20
 #define ATA_CMD_READ_SECTOR_EXT     0x24
 #define ATA_CMD_WRITE_SECTOR        0x30
+#define ATA_CMD_WRITE_SECTOR_EXT    0x34
+#define ATA_CMD_READ_MULTIPLE       0xC4
+#define ATA_CMD_WRITE_MULTIPLE      0xC5
+#define ATA_CMD_SET_MULTIPLE_MODE   0xC6
+#define ATA_CMD_READ_MULTIPLE_EXT   0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT  0x39
+#define ATA_CMD_READ_DMA_EXT        0x25
+#define ATA_CMD_WRITE_DMA_EXT       0x35
+#define ATA_CMD_READ_DMA            0xC8
+#define ATA_CMD_WRITE_DMA           0xCA
+#define ATA_CMD_READ_FPDMA_QUEUED   0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED  0x61
 #define ATA_CMD_PACKET              0xA0
 #define ATA_CMD_IDENTIFY_PACKET     0xA1
 #define ATA_CMD_IDENTIFY            0xEC
@@ -986,5 +998,12 @@ extern uint16_t ata_read_identify_word(ata_channel_t *channel, uint8_t *checksum
 extern void ata_read_identify_words(ata_channel_t *channel, uint8_t *checksum, uint8_t firstWord, uint8_t lastWord);
 
 extern int16_t ata_identify(ata_channel_t *channel, bool master, ata_identify_result_t *outResult);
+extern int16_t ata_read_sector(ata_channel_t *channel, bool master, uint32_t startSectorLba, void *outData, uint8_t sectorCount);
+extern int16_t ata_read_sector_ext(ata_channel_t *channel, bool master, uint64_t startSectorLba, void *outData, uint16_t sectorCount);
+extern int16_t ata_write_sector(ata_channel_t *channel, bool master, uint32_t startSectorLba, const void *data, uint8_t sectorCount);
+extern int16_t ata_write_sector_ext(ata_channel_t *channel, bool master, uint64_t startSectorLba, const void *data, uint16_t sectorCount);
+extern int16_t ata_set_multiple_mode(ata_channel_t *channel, bool master, uint8_t sectorsPerBlock);
+extern int16_t ata_pio_transfer(ata_channel_t *channel, bool master, uint64_t startSectorLba, void *buffer, uint16_t sectorCount, bool write, bool ext, uint8_t sectorsPerBlock);
+extern int16_t ata_dma_transfer(ata_channel_t *channel, bool master, uint64_t startSectorLba, uint16_t sectorCount, bool write, bool ext);
 
 #endif
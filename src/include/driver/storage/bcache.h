@@ -0,0 +1,86 @@
+/*
+ * File: bcache.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <main.h>
+#include <driver/storage/block.h>
+
+// Size of a cached block in bytes. Devices with larger sectors aren't cached.
+#define BCACHE_BLOCK_SIZE           4096
+
+// Number of hash buckets. Must be a power of two.
+#define BCACHE_HASH_SIZE            512
+
+// Bounds on the number of cached blocks, which is otherwise sized from free memory.
+#define BCACHE_MIN_BUFFERS          64
+#define BCACHE_MAX_BUFFERS          4096
+#define BCACHE_MEMORY_DIVISOR       16
+
+// Largest sequential read-ahead window, in blocks.
+#define BCACHE_READAHEAD_MAX        32
+
+// Dirty blocks older than this are written back by the flush thread, in ms.
+#define BCACHE_WRITEBACK_INTERVAL   5000
+
+// Buffer flags.
+#define BCACHE_FLAG_VALID   0x01
+#define BCACHE_FLAG_DIRTY   0x02
+#define BCACHE_FLAG_BUSY    0x04
+#define BCACHE_FLAG_ERROR   0x08
+
+typedef struct bcache_buffer_t {
+    // Hash chain, LRU list of unused buffers and list of all buffers.
+    struct bcache_buffer_t *HashNext;
+    struct bcache_buffer_t *LruPrev;
+    struct bcache_buffer_t *LruNext;
+    struct bcache_buffer_t *AllNext;
+
+    block_device_t *Device;
+    uint64_t Block;
+    uint32_t SectorCount;
+    uint8_t *Data;
+
+    uint32_t RefCount;
+    volatile uint8_t Flags;
+    uint64_t DirtyTime;
+
+    // Request used for read-ahead.
+    block_request_t Request;
+} bcache_buffer_t;
+
+extern bcache_buffer_t *bcache_get(block_device_t *blockDevice, uint64_t block);
+extern bool bcache_contains(block_device_t *blockDevice, uint64_t block);
+extern void bcache_release(bcache_buffer_t *buffer);
+extern void bcache_mark_dirty(bcache_buffer_t *buffer);
+extern void bcache_prefetch(block_device_t *blockDevice, uint64_t startByte, uint32_t length);
+extern bool bcache_read(block_device_t *blockDevice, uint64_t startByte, uint8_t *outBuffer, uint32_t length);
+extern bool bcache_write(block_device_t *blockDevice, uint64_t startByte, const uint8_t *data, uint32_t length);
+extern bool bcache_sync(block_device_t *blockDevice);
+extern void bcache_invalidate(block_device_t *blockDevice);
+extern void bcache_print_status(void);
+extern void bcache_init(void);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * File: block.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <main.h>
+#include <kernel/lock.h>
+#include <driver/storage/storage.h>
+
+// Time a request may wait before it is served ahead of the elevator order, in ms.
+#define BLOCK_READ_DEADLINE     500
+#define BLOCK_WRITE_DEADLINE    5000
+
+// Size of each read issued by block_benchmark().
+#define BLOCK_BENCHMARK_CHUNK   0x100000
+
+struct block_device_t;
+struct block_request_t;
+
+typedef void (*block_done_func_t)(struct block_request_t *request, bool success);
+
+// A run of consecutive sectors to transfer to or from one buffer.
+typedef struct block_request_t {
+    // Next request in the queue, sorted by sector.
+    struct block_request_t *Next;
+
+    // Next request merged into the same transfer. Each starts where the previous one ends.
+    struct block_request_t *MergeNext;
+
+    // Set by block_submit. For partitions these become the whole disk and the sector on it,
+    // so a submitted request's Sector must not be reused as a partition sector.
+    struct block_device_t *Device;
+    uint64_t Sector;
+    uint32_t SectorCount;
+    uint8_t *Buffer;
+    bool Write;
+
+    // Called on completion from the device's worker thread, or from the driver's completion path
+    // for devices with a Start function. May be NULL.
+    block_done_func_t Done;
+    void *Context;
+
+    volatile bool Complete;
+    bool Success;
+
+    // Queue bookkeeping.
+    uint64_t Deadline;
+    uint32_t Sequence;
+} block_request_t;
+
+typedef struct block_device_t {
+    struct block_device_t *Next;
+    char Name[16];
+
+    // Driver object.
+    void *Device;
+
+    // Partitions have no queue or cache blocks of their own. Their requests are offset by StartSector
+    // and queued on Parent, and their cached reads and writes go through the whole disk's blocks.
+    struct block_device_t *Parent;
+    uint64_t StartSector;
+
+    uint32_t SectorSize;
+    uint64_t SectorCount;
+
+    // Largest transfer the driver accepts, in sectors.
+    uint32_t MaxSectors;
+
+    // Transfers a request and everything merged into it. Called from the device's worker thread.
+    bool (*Transfer)(struct block_device_t *blockDevice, block_request_t *request);
+
+    // Starts a transfer and returns without waiting, for drivers that keep several commands in flight.
+    // Used instead of Transfer if set. The driver finishes each started transfer with block_complete().
+    bool (*Start)(struct block_device_t *blockDevice, block_request_t *request);
+
+    // Writes back anything the driver caches itself. May be NULL.
+    bool (*Flush)(struct block_device_t *blockDevice);
+
+    // Number of transfers Start may have outstanding at once.
+    uint32_t QueueDepth;
+
+    // Request queue.
+    lock_t QueueLock;
+    block_request_t *Queue;
+    uint32_t QueueLength;
+    uint32_t NextSequence;
+    uint64_t HeadSector;
+
+    // Transfers handed to the driver and not yet complete, linked through Next.
+    block_request_t *Active;
+    uint32_t InFlight;
+
+    // Statistics.
+    uint64_t Requests;
+    uint64_t Merges;
+    uint64_t Transfers;
+    uint64_t Expired;
+    uint64_t Errors;
+    uint32_t PeakInFlight;
+
+    // Buffer cache read-ahead state, in cache blocks.
+    uint64_t ReadAheadNext;
+    uint64_t ReadAheadEnd;
+    uint32_t ReadAheadWindow;
+
+    // Byte-addressed interface for existing storage users.
+    storage_device_t Storage;
+} block_device_t;
+
+extern block_device_t *blockDevices;
+
+extern void block_request_init(block_request_t *request, uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool write);
+extern bool block_submit(block_device_t *blockDevice, block_request_t *request);
+extern bool block_wait(block_request_t *request);
+extern void block_complete(block_request_t *request, bool success);
+extern bool block_read(block_device_t *blockDevice, uint64_t sector, uint32_t sectorCount, uint8_t *outBuffer);
+extern bool block_write(block_device_t *blockDevice, uint64_t sector, uint32_t sectorCount, const uint8_t *data);
+extern bool block_flush(block_device_t *blockDevice);
+extern block_device_t *block_resolve(block_device_t *blockDevice, uint64_t *startByte);
+extern void block_register(block_device_t *blockDevice);
+extern block_device_t *block_register_partition(block_device_t *parent, uint32_t number, uint64_t startSector, uint64_t sectorCount);
+extern void block_scan_partitions(void);
+extern block_device_t *block_find(const char *name);
+extern void block_benchmark(block_device_t *blockDevice, uint32_t megabytes);
+extern void block_print_status(void);
+
+#endif
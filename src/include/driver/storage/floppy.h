@@ -26,6 +26,7 @@
 #define FLOPPY_H
 
 #include <main.h>
+#include <kernel/lock.h>
 
 #define FLOPPY_IRQ  6
 
@@ -110,6 +111,11 @@ enum {
     FLOPPY_MSR_RQM          = 0x80, // Indicates that the host can transfer data if set to a 1. No access is permitted if set to a 0.
 };
 
+// Floppy DIR bits.
+enum {
+    FLOPPY_DIR_DISK_CHANGE  = 0x80  // Set once the disk in the selected drive has been removed. Cleared by a seek with a disk present.
+};
+
 // Floppy ST0 masks.
 enum {
     FLOPPY_ST0_SEL_DRIVE0       = 0x00, // Drive 0 is selected.
@@ -181,9 +187,31 @@ enum {
 #define FLOPPY_IRQ_WAIT_TIME    500
 #define FLOPPY_DMALENGTH 0x4800
 #define FLOPPY_SECTORS_PER_TRACK 18
+#define FLOPPY_TRACK_COUNT 80
+#define FLOPPY_TRACK_SIZE (2 * FLOPPY_SECTORS_PER_TRACK * 512)
+#define FLOPPY_NO_TRACK 0xFFFF
 #define FLOPPY_VERSION_NONE     0xFF
 #define FLOPPY_VERSION_ENHANCED 0x90
 
+// Number of whole tracks (both heads) kept in memory.
+#define FLOPPY_TRACK_CACHE_COUNT    8
+
+// Idle times, in ms. Modified tracks are written back once the drive has been idle for
+// FLOPPY_WRITEBACK_DELAY, and the motor is turned off after FLOPPY_MOTOR_IDLE_TIME.
+#define FLOPPY_MOTOR_SPINUP_TIME    500
+#define FLOPPY_WRITEBACK_DELAY      1000
+#define FLOPPY_MOTOR_IDLE_TIME      3000
+
+// Time for the heads to settle after a seek, in ms.
+#define FLOPPY_SEEK_SETTLE_TIME     15
+
+// A cached track.
+typedef struct {
+    uint16_t Track;
+    bool Dirty;
+    uint64_t LastUsed;
+    uint8_t *Data;
+} floppy_track_t;
 
 typedef struct {
     uint16_t BaseAddress;
@@ -193,10 +221,32 @@ typedef struct {
     uint8_t Type;
 
     uint8_t *DmaBuffer;
-} floppy_drive_t;
 
+    // Cylinder the heads are over, or FLOPPY_NO_TRACK if unknown.
+    uint16_t CurrentTrack;
+
+    // Track cache. Unused entries have a track of FLOPPY_NO_TRACK. Writes modify cached
+    // tracks, which are written back whole on flush, eviction or when the drive is idle.
+    // The disk change line is only watched while the motor is on, so clean tracks are
+    // dropped when it is turned off, and all tracks are dropped when the disk is changed.
+    floppy_track_t Tracks[FLOPPY_TRACK_CACHE_COUNT];
+    uint64_t TrackClock;
+    uint64_t TrackHits;
+    uint64_t TrackMisses;
+    uint64_t TrackWrites;
+
+    // Drive state. Busy is set by the thread using the drive and its cache. The motor is
+    // left running between transfers and turned off when idle.
+    lock_t Lock;
+    bool Busy;
+    bool MotorOn;
+    uint64_t LastUsed;
+
+    // Set when a write-back by the idle thread fails. Failed tracks stay modified, and the
+    // idle thread leaves them until the drive is used or flushed again.
+    bool WritebackFailed;
+} floppy_drive_t;
 
-//extern bool floppy_read_blocks(uint8_t drive, const uint64_t *blocks, uint32_t blockSize, uint32_t blockCount, uint8_t *outBuffer, uint32_t length);
 
 
 extern bool floppy_seek(floppy_drive_t *floppyDrive, uint8_t track);
@@ -204,6 +254,7 @@ extern bool floppy_seek(floppy_drive_t *floppyDrive, uint8_t track);
 extern void floppy_write_data(uint8_t data);
 extern uint8_t floppy_read_data();
 extern void floppy_sense_interrupt(uint8_t* st0, uint8_t* cyl);
+extern uint8_t floppy_sense_drive_status(uint8_t drive);
 extern void floppy_set_motor(uint8_t drive, bool on);
 extern uint8_t floppy_version();
 extern bool floppy_init(void);
@@ -26,8 +26,57 @@
 #define GPT_H
 
 #include <main.h>
-#include <driver/storage/storage.h>
+#include <driver/storage/block.h>
 
-extern bool gpt_init(storage_device_t *storageDevice);
+// "EFI PART".
+#define GPT_SIGNATURE               0x5452415020494645ULL
+#define GPT_HEADER_LBA              1
+#define GPT_HEADER_MIN_SIZE         92
+
+// Largest partition entry array we read. The usual array is 128 entries of 128 bytes.
+#define GPT_MAX_ENTRY_ARRAY_SIZE    0x40000
+
+typedef struct {
+    uint64_t Signature;
+    uint32_t Revision;
+    uint32_t HeaderSize;
+
+    // CRC32 of the first HeaderSize bytes, computed with this field zeroed.
+    uint32_t HeaderCrc32;
+    uint32_t Reserved;
+
+    // Location of this header and the other copy. The backup lives in the last sector of the disk.
+    uint64_t CurrentLba;
+    uint64_t BackupLba;
+
+    // Sectors partitions may occupy.
+    uint64_t FirstUsableLba;
+    uint64_t LastUsableLba;
+
+    uint8_t DiskGuid[16];
+
+    // Location, size and CRC32 of the partition entry array.
+    uint64_t PartitionEntryLba;
+    uint32_t PartitionEntryCount;
+    uint32_t PartitionEntrySize;
+    uint32_t PartitionEntryArrayCrc32;
+} __attribute__((packed)) gpt_header_t;
+
+typedef struct {
+    // Partition type. All zeroes for an unused entry.
+    uint8_t TypeGuid[16];
+    uint8_t PartitionGuid[16];
+
+    // First and last sector, inclusive.
+    uint64_t FirstLba;
+    uint64_t LastLba;
+
+    uint64_t Attributes;
+
+    // Partition name in UTF-16.
+    uint16_t Name[36];
+} __attribute__((packed)) gpt_partition_t;
+
+extern bool gpt_init(block_device_t *blockDevice);
 
 #endif
@@ -0,0 +1,79 @@
+/*
+ * File: mbr.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBR_H
+#define MBR_H
+
+#include <main.h>
+#include <driver/storage/block.h>
+
+#define MBR_SIGNATURE               0xAA55
+#define MBR_PARTITION_COUNT         4
+
+// Partition status values.
+#define MBR_STATUS_INACTIVE         0x00
+#define MBR_STATUS_ACTIVE           0x80
+
+// Partition types with special meaning.
+#define MBR_TYPE_EMPTY              0x00
+#define MBR_TYPE_EXTENDED_CHS       0x05
+#define MBR_TYPE_EXTENDED_LBA       0x0F
+#define MBR_TYPE_EXTENDED_LINUX     0x85
+#define MBR_TYPE_GPT_PROTECTIVE     0xEE
+
+// Logical partitions are numbered from 5, after the four primary ones.
+#define MBR_FIRST_LOGICAL           5
+
+// Limit on the extended boot record chain, in case it loops.
+#define MBR_MAX_LOGICAL             64
+
+typedef struct {
+    // Boot indicator, either MBR_STATUS_ACTIVE or MBR_STATUS_INACTIVE.
+    uint8_t Status;
+
+    // CHS address of the first sector. Unused, as the LBA fields cover every disk we support.
+    uint8_t FirstChs[3];
+
+    // Partition type.
+    uint8_t Type;
+
+    // CHS address of the last sector.
+    uint8_t LastChs[3];
+
+    // First sector and size. In an extended boot record, the first entry is relative to the
+    // record itself, and the link to the next record is relative to the extended partition.
+    uint32_t FirstLba;
+    uint32_t SectorCount;
+} __attribute__((packed)) mbr_partition_t;
+
+typedef struct {
+    uint8_t BootCode[446];
+    mbr_partition_t Partitions[MBR_PARTITION_COUNT];
+    uint16_t Signature;
+} __attribute__((packed)) mbr_t;
+
+extern bool mbr_is_valid(const mbr_t *mbr);
+extern bool mbr_init(block_device_t *blockDevice);
+
+#endif
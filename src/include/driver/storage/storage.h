@@ -27,6 +27,13 @@
 
 #include <main.h>
 
+// A run of bytes on a device and the buffer it is read into. The buffer need not be physically contiguous.
+typedef struct {
+    uint64_t StartByte;
+    uint32_t Length;
+    uint8_t *Buffer;
+} storage_segment_t;
+
 typedef struct storage_device_t {
     struct storage_device_t *Next;
     struct storage_device_t *Prev;
@@ -37,7 +44,8 @@ typedef struct storage_device_t {
     void (*Write)(struct storage_device_t *storageDevice, uint64_t startByte, uint32_t count, const uint8_t *data);
     uint64_t (*GetSize)(struct storage_device_t *storageDevice);
 
-    bool (*ReadBlocks)(struct storage_device_t *storageDevice, uint64_t *blocks, uint32_t blockSize, uint32_t blockCount, uint8_t *outBuffer, uint32_t length);
+    // Reads a scatter-gather list. Sector-aligned runs may be transferred straight into the buffers.
+    bool (*ReadSegments)(struct storage_device_t *storageDevice, const storage_segment_t *segments, uint32_t segmentCount);
 } storage_device_t;
 
 extern storage_device_t *storageDevices;
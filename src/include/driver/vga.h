@@ -31,6 +31,12 @@
 #define VGA_WIDTH 	80
 #define VGA_HEIGHT 	25
 
+// Rows kept in the shadow buffer, including the visible screen.
+#define VGA_HISTORY_ROWS	200
+
+// Minimum time between flushes of the shadow buffer to video memory, in ms.
+#define VGA_FLUSH_INTERVAL	20
+
 #define VGA_CRTC_ADDRESS	0x3D4
 #define VGA_CRTC_DATA		0x3D5
 
@@ -71,10 +77,16 @@ extern int* vga_cursor_pos(int* p);
 extern void vga_putentry(char c, uint16_t x, uint16_t y, vga_color_t fg, vga_color_t bg);
 extern void vga_putchar(char c);
 extern void vga_writes(const char* data);
+extern void vga_write(const char *data, size_t length);
 
 extern void vga_setcolor(vga_color_t fg, vga_color_t bg);
 extern void vga_setcolor_fg(vga_color_t fg);
 extern void vga_setcolor_bg(vga_color_t bg);
+extern void vga_flush(void);
+extern void vga_flush_tick(uint64_t ticks);
+extern void vga_set_deferred(bool deferred);
+extern void vga_scrollback(int16_t rows);
+extern void vga_panic(void);
 extern void vga_init(void);
 
 #endif
@@ -10,6 +10,8 @@ extern void cpu_msr_write(uint32_t msr, uint64_t value);
 
 extern void outw(uint16_t port, uint16_t data);
 extern uint16_t inw(uint16_t);
+extern void outsw(uint16_t port, const void *data, uint32_t count);
+extern void insw(uint16_t port, void *outData, uint32_t count);
 
 extern void outl(uint16_t port, uint32_t data);
 extern uint32_t inl(uint16_t);
@@ -36,6 +36,7 @@ enum cpuid_requests {
   CPUID_GETSERIAL,
   CPUID_GETTHREAD,
   CPUID_GETEXTENDEDFEATURES,
+  CPUID_GETPERFMON=0x0A,
  
   CPUID_INTELEXTENDED=0x80000000,
   CPUID_INTELFEATURES,
@@ -0,0 +1,66 @@
+/*
+ * File: fpu.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPU_H
+#define FPU_H
+
+#include <main.h>
+#include <kernel/tasking.h>
+
+// Control register bits.
+#define FPU_CR0_MP          (1 << 1)    // Monitor coprocessor.
+#define FPU_CR0_EM          (1 << 2)    // x87 emulation.
+#define FPU_CR0_TS          (1 << 3)    // Task switched.
+#define FPU_CR0_NE          (1 << 5)    // Native x87 error reporting.
+#define FPU_CR4_OSFXSR      (1 << 9)    // FXSAVE/FXRSTOR and SSE enabled.
+#define FPU_CR4_OSXMMEXCPT  (1 << 10)   // Unmasked SSE exceptions enabled.
+#define FPU_CR4_OSXSAVE     (1 << 18)   // XSAVE and XCR0 enabled.
+
+// XCR0 state components.
+#define FPU_XCR0_X87        (1 << 0)
+#define FPU_XCR0_SSE        (1 << 1)
+#define FPU_XCR0_AVX        (1 << 2)
+#define FPU_XCR0_AVX512     ((1 << 5) | (1 << 6) | (1 << 7))
+
+// CPUID leaf for XSAVE information.
+#define FPU_CPUID_XSAVE     0xD
+
+// Default control words.
+#define FPU_DEFAULT_FCW     0x37F
+#define FPU_DEFAULT_MXCSR   0x1F80
+
+// Size of FNSAVE and FXSAVE areas.
+#define FPU_FNSAVE_SIZE     108
+#define FPU_FXSAVE_SIZE     512
+#define FPU_STATE_ALIGNMENT 64
+
+// FPU and SIMD state is switched lazily. Threads may use FPU and vector
+// instructions freely, but interrupt handlers must not use them.
+extern void fpu_switch(thread_t *nextThread, uint32_t procIndex);
+extern void fpu_thread_free(thread_t *thread);
+extern uint32_t fpu_get_state_size(void);
+extern void fpu_init_ap(void);
+extern void fpu_init(void);
+
+#endif
@@ -53,6 +53,9 @@ enum IOAPIC_DEST_MODE {
     IOAPIC_DEST_MODE_LOGICAL    = 1
 };
 
+// Logical destination covering every processor in flat mode.
+#define IOAPIC_DEST_ALL_LOGICAL     0xFF
+
 // Delivery status.
 enum IOAPIC_DELIVERY_STATUS {
     IOAPIC_DELIVERY_STATUS_IDLE         = 0,
@@ -102,6 +105,9 @@ extern uint8_t ioapic_id(void);
 extern uint8_t ioapic_version(void);
 extern uint8_t ioapic_max_interrupts(void);
 extern void ioapic_enable_interrupt(uint8_t interrupt, uint8_t vector);
+extern void ioapic_enable_interrupt_pci(uint8_t interrupt, uint8_t vector);
+extern void ioapic_disable_interrupt(uint8_t interrupt);
+extern void ioapic_set_interrupt_target(uint8_t interrupt, uint8_t destination, bool lowestPriority);
 extern void ioapic_init(void);
 
 #endif
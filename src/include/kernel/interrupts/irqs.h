@@ -31,6 +31,16 @@
 #define IRQ_OFFSET      32
 #define IRQ_ISA_COUNT       16
 
+// Maximum number of IRQs when using the APICs. IRQs past the I/O APIC's inputs
+// are handed out dynamically for MSI, stopping short of the syscall vector at 0x80.
+#define IRQ_MAX_COUNT       (0x80 - IRQ_OFFSET)
+
+// Processors tracked for per-IRQ statistics.
+#define IRQ_MAX_PROCS       16
+
+// Handler processor index for IRQs delivered to the lowest-priority processor.
+#define IRQ_PROC_ANY        0xFFFFFFFF
+
 // Common IRQs.
 // https://wiki.osdev.org/Interrupts#General_IBM-PC_Compatible_Interrupt_Information
 enum {
@@ -111,6 +121,9 @@ typedef struct {
 
 typedef bool (*irq_handler_func_t)(irq_regs_t *regs, uint8_t irqNum, uint32_t procIndex);
 
+// Reprograms the hardware delivering an IRQ to target a processor.
+typedef bool (*irq_affinity_func_t)(uint8_t irqNum, uint32_t procIndex);
+
 typedef struct irq_handler_t {
     // Pointer to next handler.
     struct irq_handler_t *Next;
@@ -123,6 +136,7 @@ typedef struct irq_handler_t {
 } irq_handler_t;
 
 extern uint8_t irqs_get_count(void);
+extern uint8_t irqs_get_max_count(void);
 extern bool irqs_irq_executing(void);
 extern void irqs_eoi(uint8_t irq);
 
@@ -133,6 +147,17 @@ extern void irqs_remove_handler(uint8_t irq, irq_handler_func_t handlerFunc);
 extern bool irqs_handler_mapped_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint32_t procIndex);
 extern bool irqs_handler_mapped(uint8_t irq, irq_handler_func_t handlerFunc);
 
+extern int16_t irqs_alloc(uint8_t count);
+extern void irqs_free(uint8_t irq, uint8_t count);
+
+extern uint32_t irqs_get_affinity(uint8_t irq);
+extern void irqs_set_affinity_func(uint8_t irq, irq_affinity_func_t affinityFunc);
+extern void irqs_move_handlers(uint8_t irq, uint32_t procIndex);
+extern bool irqs_set_affinity(uint8_t irq, uint32_t procIndex);
+extern void irqs_rebalance(void);
+extern uint64_t irqs_get_stat(uint8_t irq, uint32_t procIndex);
+extern void irqs_print_stats(void);
+
 extern void irqs_init(idt_entry_t *idt);
 
 #endif
@@ -71,6 +71,7 @@
 
 #define LAPIC_SPURIOUS_INT              0xFF
 
+#define LAPIC_LVT_MASKED            0x10000
 #define LAPIC_TIMER_MASKED          0x10000        
 
 #define LAPIC_TIMER_MODE_ONESHOT    0x00000
@@ -190,6 +191,7 @@ extern void lapic_send_startup(uint8_t apic, uint8_t vector);
 
 extern uint32_t lapic_timer_get_rate(void);
 extern void lapic_timer_start(uint32_t rate);
+extern void lapic_perf_set_vector(uint8_t vector, bool masked);
 
 extern uint32_t lapic_id(void);
 extern uint8_t lapic_version(void);
@@ -52,6 +52,7 @@ typedef struct smp_proc_t {
 
 extern uint32_t smp_get_proc_count(void);
 extern smp_proc_t *smp_get_proc(uint32_t apicId);
+extern uint32_t smp_get_apic_id(uint32_t procIndex);
 extern void smp_init(void);
 
 #endif
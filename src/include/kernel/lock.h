@@ -27,12 +27,15 @@
 
 #include <main.h>
 
+// Spinlock. Interrupts are disabled before the lock is taken and restored on release, so a
+// lock may be shared between threads and interrupt handlers on the same processor.
 typedef volatile struct {
     uintptr_t Lock;
     uintptr_t InterruptState;
 } __attribute__((packed)) lock_t;
 
 extern void spinlock_lock(lock_t *lockObject);
+extern bool spinlock_trylock(lock_t *lockObject);
 extern void spinlock_release(lock_t *lockObject);
 
 #endif
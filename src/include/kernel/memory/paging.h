@@ -103,6 +103,11 @@ enum {
     PAGING_PAGE_GLOBAL          = 0x80
 };
 
+// Page attribute table. Entries are, in order: WB, WC, UC-, UC, WB, WT, UC-, UC. This differs from
+// the power-on default only in entry 1 (PWT set, PCD and PAT clear), which is WT by default.
+#define PAGING_MSR_PAT      0x277
+#define PAGING_PAT_VALUE    0x0007040600070106
+
 #ifdef X86_64
 #define PAGING_FIRST_DEVICE_ADDRESS 0xFFFFFF00F0000000
 #define PAGING_LAST_DEVICE_ADDRESS  (PAGE_LONG_TABLES_ADDRESS - PAGE_SIZE_4K)
@@ -116,8 +121,10 @@ extern void paging_change_directory(uintptr_t directoryPhysicalAddr);
 extern void paging_flush_tlb();
 extern void paging_flush_tlb_address(uintptr_t address);
 extern void paging_map(uintptr_t virt, uint64_t phys, bool kernel, bool writeable);
+extern void paging_map_wc(uintptr_t virt, uint64_t phys);
 extern void paging_unmap(uintptr_t virtual);
 extern bool paging_get_phys(uintptr_t virtual, uint64_t *physOut);
+extern bool paging_get_flags(uintptr_t virtual, uint64_t *flagsOut);
 extern uintptr_t paging_create_app_copy(void);
 
 extern void paging_map_region(uintptr_t startAddress, uintptr_t endAddress, bool kernel, bool writeable);
@@ -126,6 +133,8 @@ extern void paging_unmap_region(uintptr_t startAddress, uintptr_t endAddress);
 extern void paging_unmap_region_phys(uintptr_t startAddress, uintptr_t endAddress);
 
 extern void *paging_device_alloc(uint64_t startPhys, uint64_t endPhys);
+extern void *paging_device_alloc_wc(uint64_t startPhys, uint64_t endPhys);
+extern void paging_pat_init(void);
 extern void paging_device_free(uintptr_t startAddress, uintptr_t endAddress);
 
 extern void paging_init();
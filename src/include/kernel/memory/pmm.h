@@ -38,6 +38,10 @@ typedef uintptr_t page_t;
 
 #define PMM_NO_OF_DMA_FRAMES	64
 
+// Number of pre-zeroed frames to keep, and low frames to always leave for other users.
+#define PMM_ZERO_POOL_SIZE		64
+#define PMM_ZERO_RESERVE		256
+
 typedef struct {
 	// Multiboot header.
 	multiboot_info_t *mbootInfo;
@@ -83,6 +87,10 @@ extern void pmm_push_frame(uint64_t frame);
 extern uint32_t pmm_frames_available_long(void);
 extern uint32_t pmm_pop_frame_nonlong(void);
 
+extern uint64_t pmm_pop_zeroed_frame(void);
+extern uint32_t pmm_pop_zeroed_frame_nonlong(void);
+extern void pmm_zero_init(void);
+
 extern void pmm_init(void);
 
 #endif
@@ -39,10 +39,76 @@
 #define SYSCALL_MSR_SYSENTER_ESP    0x175
 #define SYSCALL_MSR_SYSENTER_EIP    0x176
 
-#define SYSCALL_UPTIME 0x15
+// System call numbers.
+#define SYSCALL_UPTIME  0x15
+#define SYSCALL_BATCH   0x16
+#define SYSCALL_KPRINTF 0xAB
+#define SYSCALL_COUNT   0x100
+
+// Maximum number of calls in a single batch.
+#define SYSCALL_BATCH_MAX   64
+
+// Maximum length of a string printed by SYSCALL_KPRINTF.
+#define SYSCALL_KPRINTF_MAX 256
+
+// Shared read-only data page mapped into each user process.
+#define SYSCALL_SHARED_PAGE_ADDRESS 0x40000000
+
+// System call handler function.
+typedef uintptr_t (*syscall_handler_t)(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5);
+
+typedef struct {
+    syscall_handler_t Handler;
+    const char *Name;
+
+    // Size in bytes of the memory each argument points to, or 0 if it is not a pointer.
+    // Arguments pointing to variable-sized memory are validated by their handler instead.
+    uint16_t PointerSizes[6];
+
+    // Bitmask of pointer arguments the handler writes through.
+    uint8_t WriteArgs;
+
+    // Number of times this call has been made.
+    uint64_t Count;
+} syscall_entry_t;
+
+// Entry for SYSCALL_BATCH. Result is filled in by the kernel.
+typedef struct {
+    uintptr_t Index;
+    uintptr_t Args[6];
+    uintptr_t Result;
+} syscall_batch_entry_t;
+
+// Data exported to user mode without a kernel entry. Sequence is odd while
+// the kernel is updating the page.
+typedef struct {
+    volatile uint32_t Sequence;
+    volatile uint32_t TicksPerSecond;
+    volatile uint64_t Ticks;
+    volatile uint64_t UptimeSeconds;
+} syscall_shared_page_t;
+
+static inline uint64_t syscalls_shared_read_ticks(const syscall_shared_page_t *sharedPage) {
+    uint32_t sequence;
+    uint64_t ticks;
+    do {
+        // Wait for any update to finish, then read and ensure nothing changed underneath us.
+        while ((sequence = sharedPage->Sequence) & 1);
+        ticks = sharedPage->Ticks;
+        asm volatile ("" : : : "memory");
+    } while (sequence != sharedPage->Sequence);
+    return ticks;
+}
 
 extern uintptr_t syscalls_syscall(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5, uintptr_t index);
 
 extern void syscalls_kprintf(const char *format, ...);
+extern uintptr_t syscalls_batch(syscall_batch_entry_t *entries, uintptr_t count);
+
+extern void syscalls_shared_page_update(uint64_t ticks);
+extern void syscalls_shared_page_map(void);
+extern void syscalls_print_stats(void);
+extern void syscalls_init_ap(void);
+extern void syscalls_init(void);
 
 #endif
@@ -0,0 +1,60 @@
+/*
+ * File: workqueue.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <main.h>
+#include <kernel/lock.h>
+
+// Deferred work function.
+typedef void (*work_func_t)(void *arg);
+
+// Deferred work item. Owned by the caller and typically embedded in a driver
+// object, so it can be queued from an interrupt handler without allocating.
+typedef struct work_t {
+    struct work_t *Next;
+    work_func_t Func;
+    void *Arg;
+
+    // Set while the item is sitting in a queue.
+    volatile bool Pending;
+} work_t;
+
+typedef struct {
+    work_t *Head;
+    work_t *Tail;
+    lock_t Lock;
+
+    // Is the worker thread for this processor running?
+    volatile bool Running;
+    uint64_t Processed;
+} workqueue_proc_t;
+
+extern void workqueue_work_init(work_t *work, work_func_t func, void *arg);
+extern bool workqueue_queue_proc(work_t *work, uint32_t procIndex);
+extern bool workqueue_queue(work_t *work);
+extern void workqueue_init(void);
+
+#endif
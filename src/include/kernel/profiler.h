@@ -0,0 +1,84 @@
+/*
+ * File: profiler.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <main.h>
+#include <kernel/interrupts/irqs.h>
+
+// Samples kept per processor. Sampling stops on a processor once its buffer is full.
+#define PROFILER_SAMPLES            0x800
+
+// Frames kept per sample, including the interrupted instruction.
+#define PROFILER_MAX_FRAMES         8
+
+// Largest gap between frame pointers that is believed when walking a stack.
+#define PROFILER_MAX_FRAME_SIZE     0x10000
+
+// Unhalted core cycles between samples when using the performance counters.
+#define PROFILER_PMU_PERIOD         1000000
+
+// Version of the dump format, checked by scripts/profsym.py.
+#define PROFILER_DUMP_VERSION       1
+
+// Architectural performance monitoring MSRs.
+#define PROFILER_MSR_PMC0                   0xC1
+#define PROFILER_MSR_PERFEVTSEL0            0x186
+#define PROFILER_MSR_PERF_GLOBAL_OVF_CTRL   0x390
+
+// Event select fields.
+#define PROFILER_EVTSEL_UNHALTED_CYCLES     0x3C
+#define PROFILER_EVTSEL_USR                 (1 << 16)
+#define PROFILER_EVTSEL_OS                  (1 << 17)
+#define PROFILER_EVTSEL_INT                 (1 << 20)
+#define PROFILER_EVTSEL_EN                  (1 << 22)
+
+// Where samples are taken from.
+enum {
+    PROFILER_SOURCE_TIMER,
+    PROFILER_SOURCE_PMU
+};
+
+typedef struct {
+    uint32_t FrameCount;
+    uintptr_t Frames[PROFILER_MAX_FRAMES];
+} profiler_sample_t;
+
+// Only the owning processor adds samples, from interrupt context.
+typedef struct {
+    volatile uint32_t Count;
+    uint32_t Dropped;
+    bool PmuArmed;
+    profiler_sample_t *Samples;
+} profiler_cpu_t;
+
+extern void profiler_tick(irq_regs_t *regs, uint32_t procIndex);
+extern bool profiler_start(uint8_t source, bool stacks);
+extern void profiler_stop(void);
+extern void profiler_print_status(void);
+extern void profiler_dump(void);
+extern void profiler_init(void);
+
+#endif
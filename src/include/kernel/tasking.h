@@ -62,6 +62,10 @@ typedef struct thread_t {
 	// Scheduling relationship to other threads.
 	struct thread_t *SchedNext;
 	struct thread_t *SchedPrev;
+
+	// FPU/SIMD state, allocated on first use.
+	void *FpuState;
+	void *FpuStateAlloc;
 } thread_t;
 
 typedef struct process_t {
@@ -81,6 +85,9 @@ typedef struct process_t {
 typedef struct {
 	thread_t *CurrentThread;
 
+	// Thread whose FPU state is loaded on this processor.
+	thread_t *FpuOwner;
+
 	bool TaskingEnabled;
 } tasking_proc_t;
 
@@ -94,6 +101,7 @@ extern process_t *tasking_process_create(process_t *parent, char *name, bool use
 extern thread_t *tasking_thread_create_kernel(char *name, thread_entry_func_t func, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2);
 
 extern void tasking_thread_schedule_proc(thread_t *thread, uint32_t procIndex);
+extern tasking_proc_t *tasking_get_proc(uint32_t procIndex);
 
 extern void tasking_tick(irq_regs_t* regs, uint32_t procIndex);
 extern void tasking_init(void);
@@ -0,0 +1,91 @@
+/*
+ * File: trace.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <main.h>
+
+// Tracepoints are compiled out entirely when this is 0.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED       1
+#endif
+
+// Records kept per processor, must be a power of two. The oldest records are overwritten.
+#define TRACE_RING_RECORDS  0x1000
+
+// Time spent measuring the timestamp rate before a dump, in milliseconds.
+#define TRACE_CALIBRATE_MS  50
+
+// Version of the dump format, checked by scripts/trace2chrome.py.
+#define TRACE_DUMP_VERSION  1
+
+// Events, with the meaning of their two arguments.
+enum {
+    TRACE_EVENT_SCHED_SWITCH,   // Previous thread ID, next thread ID.
+    TRACE_EVENT_IRQ_ENTRY,      // IRQ.
+    TRACE_EVENT_IRQ_EXIT,       // IRQ.
+    TRACE_EVENT_KHEAP_ALLOC,    // Size, address.
+    TRACE_EVENT_KHEAP_FREE,     // Unused, address.
+    TRACE_EVENT_DISK_START,     // Sector count with TRACE_DISK_WRITE for writes, LBA.
+    TRACE_EVENT_DISK_DONE,      // Status.
+    TRACE_EVENT_NET_RX,         // Length.
+    TRACE_EVENT_NET_TX,         // Length.
+    TRACE_EVENT_COUNT
+};
+
+#define TRACE_DISK_WRITE    0x80000000
+
+typedef struct {
+    uint64_t Timestamp;
+    uint16_t Event;
+    uint16_t Reserved;
+    uint32_t Arg0;
+    uint64_t Arg1;
+} trace_record_t;
+
+// Only the owning processor writes to its ring, with interrupts disabled.
+typedef struct {
+    uint32_t Head;
+    trace_record_t *Records;
+} trace_ring_t;
+
+// Bitmask of events being recorded.
+extern volatile uint32_t traceMask;
+
+extern void trace_record(uint16_t event, uint32_t arg0, uint64_t arg1);
+
+#if TRACE_ENABLED
+#define trace(event, arg0, arg1) do { if (traceMask & (1 << (event))) trace_record((event), (arg0), (arg1)); } while (0)
+#else
+#define trace(event, arg0, arg1) do { } while (0)
+#endif
+
+extern bool trace_set_events(const char *spec, bool enable);
+extern void trace_clear(void);
+extern void trace_print_status(void);
+extern void trace_dump(void);
+extern void trace_init(void);
+
+#endif
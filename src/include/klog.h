@@ -0,0 +1,100 @@
+/*
+ * File: klog.h
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <main.h>
+#include <kprint.h>
+
+// Log levels, from most to least severe.
+#define KLOG_LEVEL_ERROR    0
+#define KLOG_LEVEL_WARN     1
+#define KLOG_LEVEL_INFO     2
+#define KLOG_LEVEL_DEBUG    3
+#define KLOG_LEVEL_TRACE    4
+#define KLOG_LEVEL_COUNT    5
+
+// Messages above this level are compiled out entirely.
+#ifndef KLOG_MAX_LEVEL
+#define KLOG_MAX_LEVEL      KLOG_LEVEL_INFO
+#endif
+
+// Level each subsystem starts at before the command line is applied.
+#define KLOG_DEFAULT_LEVEL  KLOG_LEVEL_INFO
+
+// Size of the copy of the kernel command line.
+#define KLOG_CMDLINE_SIZE   256
+
+// Subsystems. The name after KLOG_SUBSYS_ is the tag used in messages, the shell and the command line.
+enum {
+    KLOG_SUBSYS_KERNEL,
+    KLOG_SUBSYS_PMM,
+    KLOG_SUBSYS_KHEAP,
+    KLOG_SUBSYS_PAGING,
+    KLOG_SUBSYS_IRQS,
+    KLOG_SUBSYS_SMP,
+    KLOG_SUBSYS_TASKING,
+    KLOG_SUBSYS_PCI,
+    KLOG_SUBSYS_USB,
+    KLOG_SUBSYS_UHCI,
+    KLOG_SUBSYS_OHCI,
+    KLOG_SUBSYS_STORAGE,
+    KLOG_SUBSYS_ATA,
+    KLOG_SUBSYS_AHCI,
+    KLOG_SUBSYS_FLOPPY,
+    KLOG_SUBSYS_FAT,
+    KLOG_SUBSYS_NET,
+    KLOG_SUBSYS_L2ETH,
+    KLOG_SUBSYS_E1000E,
+    KLOG_SUBSYS_RTL8139,
+    KLOG_SUBSYS_COUNT
+};
+
+// Per-subsystem mask of enabled levels, bit n set meaning level n is printed.
+extern uint8_t klogMasks[KLOG_SUBSYS_COUNT];
+
+// Logs a message tagged with a subsystem, e.g. klog_debug(PCI, "IRQ %u raised!\n", irq).
+// Disabled levels cost a byte load and a branch, levels above KLOG_MAX_LEVEL cost nothing.
+#define klog(subsys, level, format, ...) do { \
+    if ((level) <= KLOG_MAX_LEVEL && (klogMasks[KLOG_SUBSYS_##subsys] & (1 << (level)))) \
+        kprintf(#subsys ": " format, ##__VA_ARGS__); \
+} while (0)
+
+#define klog_error(subsys, format, ...) klog(subsys, KLOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define klog_warn(subsys, format, ...)  klog(subsys, KLOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define klog_info(subsys, format, ...)  klog(subsys, KLOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define klog_debug(subsys, format, ...) klog(subsys, KLOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define klog_trace(subsys, format, ...) klog(subsys, KLOG_LEVEL_TRACE, format, ##__VA_ARGS__)
+
+// Checks whether a level is enabled, for guarding work done only to produce a message.
+#define klog_enabled(subsys, level) \
+    ((level) <= KLOG_MAX_LEVEL && (klogMasks[KLOG_SUBSYS_##subsys] & (1 << (level))))
+
+extern void klog_set_level(uint32_t subsys, uint8_t level);
+extern bool klog_parse(const char *spec);
+extern void klog_print_levels(void);
+extern void klog_init(void);
+
+#endif
@@ -3,14 +3,37 @@
 
 #include <stdarg.h>
 
+// Text is formatted into chunks of this size, each becoming one record.
+#define KPRINT_CHUNK_SIZE   128
+#define KPRINT_CSI_MAX      16
+
+// Per-processor ring buffer size, must be a power of two.
+#define KPRINT_RING_SIZE    0x4000
+#define KPRINT_RECORD_SIZE(length)  ((sizeof(kprint_record_t) + (length) + 7) & ~7)
+
+// Header of each queued record, followed by the text.
+typedef struct {
+    uint32_t Length;
+    uint32_t Sequence;
+    uint64_t Timestamp;
+} kprint_record_t;
+
+// Single producer (the owning processor), single consumer (the console thread).
+typedef struct {
+    volatile uint32_t Head;
+    volatile uint32_t Tail;
+    uint32_t Dropped;
+    uint8_t *Data;
+} kprint_ring_t;
+
 extern void kputchar(char c);
-extern void kputchar_hex(uint8_t num, bool capital, bool pad);
-extern void kputstring(const char *str, size_t max);
-extern void kprint_int(int64_t num);
-extern void kprint_uint(uint64_t num);
-extern void kprint_hex(uint64_t num, bool capital, uint8_t padLength);
 extern void kprintf(const char* format, ...);
 extern void kprintf_nolock(const char* format, ...);
 extern void kprintf_va(bool lock, const char* format, va_list args);
+extern int kvsnprintf(char *str, size_t size, const char *format, va_list args);
+extern int ksnprintf(char *str, size_t size, const char *format, ...);
+
+extern void kprint_console_init(void);
+extern void kprint_panic(void);
 
 #endif
@@ -108,6 +108,9 @@ enum {
     KEYBOARD_KEY_RIGHT_ALT,
     KEYBOARD_KEY_SYSREQ,
 
+    KEYBOARD_KEY_PAGE_UP,
+    KEYBOARD_KEY_PAGE_DOWN,
+
     KEYBOARD_KEY_UNKNOWN
 };
 
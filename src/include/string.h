@@ -1,11 +1,20 @@
 #ifndef STRING_H
 #define STRING_H
 
+// Sizes below this are handled with a simple loop.
+#define STRING_REP_THRESHOLD    32
+
+// Benchmark buffer size and bytes processed per size.
+#define STRING_BENCH_MAX_SIZE   0x10000
+#define STRING_BENCH_BYTES      0x10000000
+
 extern int32_t memcmp(const void *str1, const void *str2, size_t n);
 extern void memcpy(uint8_t *dest, uint8_t *src, size_t n);
 extern void* memmove(void *str1, const void *str2, size_t n);
 extern void* memset(void *str, int32_t c, size_t n);
 extern void* memset16 (void *ptr, uint16_t value, size_t num);
+extern void string_init(void);
+extern void string_benchmark(void);
 extern char* strcat(char *dest, const char *src);
 extern char* strncat(char *dest, const char *src, size_t n);
 extern int32_t strcmp(const char *str1, const char *str2);
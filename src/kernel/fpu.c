@@ -0,0 +1,263 @@
+/*
+ * File: fpu.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+#include <kernel/fpu.h>
+
+#include <kernel/cpuid.h>
+#include <kernel/tasking.h>
+#include <kernel/memory/kheap.h>
+#include <kernel/interrupts/exceptions.h>
+#include <kernel/interrupts/lapic.h>
+#include <kernel/interrupts/smp.h>
+
+// Save mechanism.
+static bool fpuFxsr = false;
+static bool fpuXsave = false;
+static bool fpuXsaveOpt = false;
+static uint64_t fpuXcr0 = 0;
+static uint32_t fpuStateSize = FPU_FNSAVE_SIZE;
+
+static inline uintptr_t fpu_read_cr0(void) {
+    uintptr_t cr0;
+    asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void fpu_write_cr0(uintptr_t cr0) {
+    asm volatile ("mov %0, %%cr0" : : "r"(cr0));
+}
+
+static inline uintptr_t fpu_read_cr4(void) {
+    uintptr_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void fpu_write_cr4(uintptr_t cr4) {
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+}
+
+static inline void fpu_set_ts(void) {
+    fpu_write_cr0(fpu_read_cr0() | FPU_CR0_TS);
+}
+
+static inline void fpu_clear_ts(void) {
+    asm volatile ("clts");
+}
+
+static inline void fpu_xsetbv(uint32_t index, uint64_t value) {
+    asm volatile ("xsetbv" : : "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static void fpu_cpuid(uint32_t function, uint32_t subFunction, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(function), "c"(subFunction));
+}
+
+static uint32_t fpu_get_proc_index(void) {
+    smp_proc_t *proc = smp_get_proc(lapic_id());
+    return (proc != NULL) ? proc->Index : 0;
+}
+
+static void fpu_save(void *state) {
+    uint32_t maskLow = (uint32_t)fpuXcr0;
+    uint32_t maskHigh = (uint32_t)(fpuXcr0 >> 32);
+
+#ifdef X86_64
+    if (fpuXsaveOpt)
+        asm volatile ("xsaveopt64 (%0)" : : "r"(state), "a"(maskLow), "d"(maskHigh) : "memory");
+    else if (fpuXsave)
+        asm volatile ("xsave64 (%0)" : : "r"(state), "a"(maskLow), "d"(maskHigh) : "memory");
+    else
+        asm volatile ("fxsave64 (%0)" : : "r"(state) : "memory");
+#else
+    if (fpuXsaveOpt)
+        asm volatile ("xsaveopt (%0)" : : "r"(state), "a"(maskLow), "d"(maskHigh) : "memory");
+    else if (fpuXsave)
+        asm volatile ("xsave (%0)" : : "r"(state), "a"(maskLow), "d"(maskHigh) : "memory");
+    else if (fpuFxsr)
+        asm volatile ("fxsave (%0)" : : "r"(state) : "memory");
+    else
+        asm volatile ("fnsave (%0)" : : "r"(state) : "memory");
+#endif
+}
+
+static void fpu_restore(void *state) {
+    uint32_t maskLow = (uint32_t)fpuXcr0;
+    uint32_t maskHigh = (uint32_t)(fpuXcr0 >> 32);
+
+#ifdef X86_64
+    if (fpuXsave)
+        asm volatile ("xrstor64 (%0)" : : "r"(state), "a"(maskLow), "d"(maskHigh) : "memory");
+    else
+        asm volatile ("fxrstor64 (%0)" : : "r"(state) : "memory");
+#else
+    if (fpuXsave)
+        asm volatile ("xrstor (%0)" : : "r"(state), "a"(maskLow), "d"(maskHigh) : "memory");
+    else if (fpuFxsr)
+        asm volatile ("fxrstor (%0)" : : "r"(state) : "memory");
+    else
+        asm volatile ("frstor (%0)" : : "r"(state) : "memory");
+#endif
+}
+
+static void fpu_thread_alloc(thread_t *thread) {
+    // Allocate state area, aligned as XSAVE requires.
+    thread->FpuStateAlloc = kheap_alloc(fpuStateSize + FPU_STATE_ALIGNMENT);
+    if (thread->FpuStateAlloc == NULL)
+        panic("FPU: Unable to allocate state for thread %u!\n", thread->ThreadId);
+    uint8_t *state = (uint8_t*)(((uintptr_t)thread->FpuStateAlloc + FPU_STATE_ALIGNMENT - 1) & ~((uintptr_t)FPU_STATE_ALIGNMENT - 1));
+    memset(state, 0, fpuStateSize);
+
+    // Set up initial state with all exceptions masked. An empty XSAVE header puts all other components into their initial state.
+    *(uint16_t*)state = FPU_DEFAULT_FCW;
+    if (fpuFxsr)
+        *(uint32_t*)(state + 24) = FPU_DEFAULT_MXCSR;
+    else
+        *(uint16_t*)(state + 8) = 0xFFFF;
+    thread->FpuState = state;
+}
+
+static void fpu_device_not_available_handler(ExceptionRegisters_t *regs) {
+    // Get thread that used the FPU. If tasking isn't up, the FPU simply belongs to the current context.
+    tasking_proc_t *taskingProc = tasking_get_proc(fpu_get_proc_index());
+    fpu_clear_ts();
+    if (taskingProc == NULL || taskingProc->CurrentThread == NULL)
+        return;
+
+    // If state is already loaded, nothing to do.
+    thread_t *thread = taskingProc->CurrentThread;
+    thread_t *owner = taskingProc->FpuOwner;
+    if (owner == thread)
+        return;
+
+    // Save the previous owner's state and load this thread's.
+    if (owner != NULL)
+        fpu_save(owner->FpuState);
+    if (thread->FpuState == NULL)
+        fpu_thread_alloc(thread);
+    fpu_restore(thread->FpuState);
+    taskingProc->FpuOwner = thread;
+}
+
+/**
+ * Prepares the FPU for a switch to the specified thread.
+ * @param nextThread    The thread about to run.
+ * @param procIndex     The index of the current processor.
+ */
+void fpu_switch(thread_t *nextThread, uint32_t procIndex) {
+    // Only trap the next FPU use if another thread's state is loaded.
+    tasking_proc_t *taskingProc = tasking_get_proc(procIndex);
+    if (taskingProc == NULL || taskingProc->FpuOwner == nextThread)
+        fpu_clear_ts();
+    else
+        fpu_set_ts();
+}
+
+/**
+ * Releases FPU state owned by a thread that is being destroyed.
+ * @param thread    The thread being destroyed.
+ */
+void fpu_thread_free(thread_t *thread) {
+    // Ensure no processor still thinks this thread's state is loaded.
+    for (uint32_t i = 0; i < smp_get_proc_count(); i++) {
+        tasking_proc_t *taskingProc = tasking_get_proc(i);
+        thread_t *expected = thread;
+        if (taskingProc != NULL)
+            __atomic_compare_exchange_n(&taskingProc->FpuOwner, &expected, NULL, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+
+    if (thread->FpuStateAlloc != NULL)
+        kheap_free(thread->FpuStateAlloc);
+    thread->FpuStateAlloc = NULL;
+    thread->FpuState = NULL;
+}
+
+uint32_t fpu_get_state_size(void) {
+    return fpuStateSize;
+}
+
+void fpu_init_ap(void) {
+    uint32_t eax, ebx, ecx, edx;
+    if (!cpuid_query(CPUID_GETFEATURES, &eax, &ebx, &ecx, &edx) || !(edx & CPUID_FEAT_EDX_FPU))
+        panic("FPU: No x87 FPU present!\n");
+
+    // Enable native FPU operation and reset the FPU.
+    fpu_write_cr0((fpu_read_cr0() & ~(FPU_CR0_EM | FPU_CR0_TS)) | FPU_CR0_MP | FPU_CR0_NE);
+    asm volatile ("fninit");
+
+    // Enable SSE and XSAVE if present.
+    uintptr_t cr4 = fpu_read_cr4();
+    if (fpuFxsr)
+        cr4 |= FPU_CR4_OSFXSR | FPU_CR4_OSXMMEXCPT;
+    if (fpuXsave)
+        cr4 |= FPU_CR4_OSXSAVE;
+    fpu_write_cr4(cr4);
+    if (fpuXsave)
+        fpu_xsetbv(0, fpuXcr0);
+
+    // Trap first FPU use so it gets attributed to a thread.
+    fpu_set_ts();
+}
+
+void fpu_init(void) {
+    kprintf("FPU: Initializing...\n");
+
+    // Determine save mechanism.
+    uint32_t eax, ebx, ecx, edx;
+    if (cpuid_query(CPUID_GETFEATURES, &eax, &ebx, &ecx, &edx)) {
+        fpuFxsr = (edx & CPUID_FEAT_EDX_FXSR) && (edx & CPUID_FEAT_EDX_SSE);
+        fpuXsave = fpuFxsr && (ecx & CPUID_FEAT_ECX_XSAVE);
+    }
+
+    if (fpuXsave) {
+        // Enable all supported components we know how to manage. AVX-512 requires AVX and all of its components.
+        fpu_cpuid(FPU_CPUID_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+        fpuXcr0 = eax & (FPU_XCR0_X87 | FPU_XCR0_SSE | FPU_XCR0_AVX | FPU_XCR0_AVX512);
+        if (!(fpuXcr0 & FPU_XCR0_AVX) || (fpuXcr0 & FPU_XCR0_AVX512) != FPU_XCR0_AVX512)
+            fpuXcr0 &= ~FPU_XCR0_AVX512;
+
+        fpu_cpuid(FPU_CPUID_XSAVE, 1, &eax, &ebx, &ecx, &edx);
+        fpuXsaveOpt = eax & 0x1;
+    }
+
+    // Initialize FPU on this processor. APs are initialized as they start tasking.
+    fpu_init_ap();
+
+    // Get save area size for the enabled components.
+    if (fpuXsave) {
+        fpu_cpuid(FPU_CPUID_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+        fpuStateSize = ebx;
+    }
+    else if (fpuFxsr) {
+        fpuStateSize = FPU_FXSAVE_SIZE;
+    }
+
+    exceptions_install_handler(EXCEPTION_DEVICE_NOT_AVAILABLE, fpu_device_not_available_handler);
+    kprintf("FPU: Using %s with %u byte state (XCR0 0x%llX).\n", fpuXsaveOpt ? "XSAVEOPT" : (fpuXsave ? "XSAVE" : (fpuFxsr ? "FXSAVE" : "FNSAVE")),
+        fpuStateSize, fpuXcr0);
+    kprintf("FPU: Initialized!\n");
+}
@@ -30,6 +30,7 @@
 #include <acpi.h>
 #include <kernel/acpi/acpi.h>
 #include <kernel/interrupts/interrupts.h>
+#include <kernel/interrupts/lapic.h>
 #include <kernel/memory/paging.h>
 
 // https://wiki.osdev.org/IOAPIC
@@ -133,9 +134,9 @@ void ioapic_enable_interrupt(uint8_t interrupt, uint8_t vector) {
     entry.deliveryMode = IOAPIC_DELIVERY_FIXED;
     entry.destinationMode = IOAPIC_DEST_MODE_PHYSICAL;
     entry.interruptMask = false;
-    entry.destinationField = 0;
+    entry.destinationField = lapic_id();
 
-    // Save entry to I/O APIC.
+    // Save entry to I/O APIC. Use irqs_set_affinity() to move it to another processor.
     ioapic_set_redirection_entry(interrupt, entry);
     kprintf("IOAPIC: Mapped interrupt %u to 0x%X\n", interrupt, vector);
 }
@@ -151,13 +152,33 @@ void ioapic_enable_interrupt_pci(uint8_t interrupt, uint8_t vector) {
     entry.triggerMode = 1;
     entry.interruptInputPolarity = 1;
     entry.interruptMask = false;
-    entry.destinationField = 0;
+    entry.destinationField = lapic_id();
 
     // Save entry to I/O APIC.
     ioapic_set_redirection_entry(interrupt, entry);
     kprintf("IOAPIC: Mapped interrupt %u to 0x%X\n", interrupt, vector);
 }
 
+void ioapic_set_interrupt_target(uint8_t interrupt, uint8_t destination, bool lowestPriority) {
+    // Get entry for interrupt.
+    ioapic_redirection_entry_t entry = ioapic_get_redirection_entry(interrupt);
+
+    // Lowest priority delivery uses a logical destination, which can cover several processors.
+    if (lowestPriority) {
+        entry.deliveryMode = IOAPIC_DELIVERY_LOWEST;
+        entry.destinationMode = IOAPIC_DEST_MODE_LOGICAL;
+    }
+    else {
+        entry.deliveryMode = IOAPIC_DELIVERY_FIXED;
+        entry.destinationMode = IOAPIC_DEST_MODE_PHYSICAL;
+    }
+    entry.destinationField = destination;
+
+    // Save entry to I/O APIC.
+    ioapic_set_redirection_entry(interrupt, entry);
+    kprintf("IOAPIC: Interrupt %u now targets %s 0x%X\n", interrupt, lowestPriority ? "logical" : "APIC", destination);
+}
+
 void ioapic_disable_interrupt(uint8_t interrupt) {
     // Get entry for interrupt and mask it.
     ioapic_redirection_entry_t entry = ioapic_get_redirection_entry(interrupt);
@@ -24,9 +24,11 @@
 
 #include <main.h>
 #include <kprint.h>
+#include <klog.h>
 #include <string.h>
 #include <kernel/interrupts/irqs.h>
 
+#include <kernel/lock.h>
 #include <kernel/acpi/acpi.h>
 #include <kernel/interrupts/idt.h>
 #include <kernel/interrupts/ioapic.h>
@@ -34,14 +36,27 @@
 #include <kernel/interrupts/pic.h>
 #include <kernel/interrupts/smp.h>
 #include <kernel/memory/kheap.h>
+#include <kernel/trace.h>
 
 // Common IRQ assembly handler.
 extern void _irq_common(void);
 
 // Array of IRQ handler pointers.
 static uint8_t irqCount = 0;
+static uint8_t irqMaxCount = 0;
 static irq_handler_t **irqHandlers;
 
+// Bitmap of IRQs in use by fixed lines or handed out by irqs_alloc().
+static uint32_t irqsAllocated[(IRQ_MAX_COUNT + 31) / 32];
+static lock_t irqsAllocLock = { };
+
+// Processor each IRQ is delivered to, and how to change it.
+static uint32_t irqTargets[IRQ_MAX_COUNT];
+static irq_affinity_func_t irqAffinityFuncs[IRQ_MAX_COUNT];
+
+// Number of times each IRQ has been raised on each processor.
+static uint64_t irqStats[IRQ_MAX_COUNT][IRQ_MAX_PROCS];
+
 // Do we send EOIs to the LAPIC instead of the PIC?
 static bool useLapic = false;
 
@@ -49,6 +64,10 @@ uint8_t irqs_get_count(void) {
     return irqCount;
 }
 
+uint8_t irqs_get_max_count(void) {
+    return irqMaxCount;
+}
+
 static bool irqExecuting = false;
 bool irqs_irq_executing(void) {
     return irqExecuting;
@@ -64,7 +83,7 @@ void irqs_eoi(uint8_t irq) {
 
 void irqs_install_handler_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint32_t procIndex) {
     // Ensure IRQ is valid.
-    if (irq >= irqCount)
+    if (irq >= irqMaxCount)
         panic("IRQS: IRQ out of range.\n");
 
     // Create handler object.
@@ -76,6 +95,10 @@ void irqs_install_handler_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint
     handler->HandlerFunc = handlerFunc;
     handler->ProcessorIndex = procIndex;
 
+    // The LAPIC timer is local to each processor, so it has no single target.
+    if (irq != IRQ_TIMER)
+        irqTargets[irq] = procIndex;
+
     // Add handler to end of list.
     if (irqHandlers[irq] != NULL) {
         irq_handler_t *currHandler = irqHandlers[irq];
@@ -85,7 +108,7 @@ void irqs_install_handler_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint
     }
     else
         irqHandlers[irq] = handler;
-    kprintf("IRQS: Handler 0x%p for IRQ%u installed!\n", handlerFunc, irq);
+    klog_debug(IRQS, "Handler 0x%p for IRQ%u installed!\n", handlerFunc, irq);
 }
 
 // Installs an IRQ handler.
@@ -100,7 +123,7 @@ void irqs_install_handler(uint8_t irq, irq_handler_func_t handlerFunc) {
 
 void irqs_remove_handler_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint32_t procIndex) {
     // Ensure IRQ is valid.
-    if (irq >= irqCount)
+    if (irq >= irqMaxCount)
         panic("IRQS: IRQ out of range.\n");
 
     // Try to find handler function.
@@ -115,7 +138,7 @@ void irqs_remove_handler_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint3
 
     // If handler is still NULL, we couldn't find the specified handler function.
     if (handler == NULL) {
-        kprintf("IRQS: Unable to find and remove handler 0x%p for IRQ%u!\n", handlerFunc, irq);
+        klog_warn(IRQS, "Unable to find and remove handler 0x%p for IRQ%u!\n", handlerFunc, irq);
         return;
     }
 
@@ -125,7 +148,7 @@ void irqs_remove_handler_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint3
     else
         irqHandlers[irq] = handler->Next;
     kheap_free(handler);
-    kprintf("IRQS: Handler 0x%p for IRQ%u removed!\n", handlerFunc, irq);
+    klog_debug(IRQS, "Handler 0x%p for IRQ%u removed!\n", handlerFunc, irq);
 }
 
 // Removes an IRQ handler.
@@ -140,7 +163,7 @@ void irqs_remove_handler(uint8_t irq, irq_handler_func_t handlerFunc) {
 
 bool irqs_handler_mapped_proc(uint8_t irq, irq_handler_func_t handlerFunc, uint32_t procIndex) {
     // Ensure IRQ is valid.
-    if (irq >= irqCount)
+    if (irq >= irqMaxCount)
         panic("IRQS: IRQ out of range.\n");
 
     // Try to find IRQ handler.
@@ -162,22 +185,236 @@ bool irqs_handler_mapped(uint8_t irq, irq_handler_func_t handlerFunc) {
     return irqs_handler_mapped_proc(irq, handlerFunc, index);
 }
 
+static bool irqs_allocated(uint8_t irq) {
+    return (irqsAllocated[irq / 32] & (1 << (irq % 32))) != 0;
+}
+
+static void irqs_set_allocated(uint8_t irq, bool allocated) {
+    if (allocated)
+        irqsAllocated[irq / 32] |= (1 << (irq % 32));
+    else
+        irqsAllocated[irq / 32] &= ~(1 << (irq % 32));
+}
+
+// Allocates a block of free IRQs past the I/O APIC's inputs, for use with MSI.
+// The block's vector is aligned to its size, as MSI devices modify the low bits
+// of the vector for each message. Returns the first IRQ, or -1 if none are free.
+int16_t irqs_alloc(uint8_t count) {
+    // Count must be a power of two.
+    if (count == 0 || (count & (count - 1)) != 0)
+        return -1;
+
+    // Search for a free, aligned block.
+    spinlock_lock(&irqsAllocLock);
+    for (uint16_t base = irqCount; base + count <= irqMaxCount; base++) {
+        if ((IRQ_OFFSET + base) % count != 0)
+            continue;
+
+        // Ensure all IRQs in block are free.
+        bool free = true;
+        for (uint8_t i = 0; i < count && free; i++)
+            free = !irqs_allocated(base + i);
+        if (!free)
+            continue;
+
+        // Mark block as in use.
+        for (uint8_t i = 0; i < count; i++)
+            irqs_set_allocated(base + i, true);
+        spinlock_release(&irqsAllocLock);
+        klog_debug(IRQS, "Allocated IRQ%u-%u (vector 0x%X).\n", base, base + count - 1, IRQ_OFFSET + base);
+        return base;
+    }
+
+    // No free blocks.
+    spinlock_release(&irqsAllocLock);
+    return -1;
+}
+
+// Frees a block of IRQs allocated with irqs_alloc().
+void irqs_free(uint8_t irq, uint8_t count) {
+    // Ensure IRQs are valid and not fixed lines.
+    if (irq < irqCount || irq + count > irqMaxCount)
+        panic("IRQS: Attempted to free invalid IRQ%u.\n", irq);
+
+    spinlock_lock(&irqsAllocLock);
+    for (uint8_t i = 0; i < count; i++)
+        irqs_set_allocated(irq + i, false);
+    spinlock_release(&irqsAllocLock);
+}
+
+uint32_t irqs_get_affinity(uint8_t irq) {
+    // Ensure IRQ is valid.
+    if (irq >= irqMaxCount)
+        panic("IRQS: IRQ out of range.\n");
+    return irqTargets[irq];
+}
+
+// Sets the function used to retarget an IRQ delivered by something other than the I/O APIC, such as MSI.
+void irqs_set_affinity_func(uint8_t irq, irq_affinity_func_t affinityFunc) {
+    // Ensure IRQ is valid.
+    if (irq >= irqMaxCount)
+        panic("IRQS: IRQ out of range.\n");
+    irqAffinityFuncs[irq] = affinityFunc;
+}
+
+// Moves an IRQ's handlers to another processor, without touching the hardware.
+void irqs_move_handlers(uint8_t irq, uint32_t procIndex) {
+    // Ensure IRQ is valid.
+    if (irq >= irqMaxCount)
+        panic("IRQS: IRQ out of range.\n");
+
+    irq_handler_t *handler = irqHandlers[irq];
+    while (handler != NULL) {
+        handler->ProcessorIndex = procIndex;
+        handler = handler->Next;
+    }
+    irqTargets[irq] = procIndex;
+}
+
+static bool irqs_ioapic_set_affinity(uint8_t irq, uint32_t procIndex) {
+    // Retarget I/O APIC entry. Any processor uses lowest-priority delivery to all processors.
+    if (procIndex == IRQ_PROC_ANY)
+        ioapic_set_interrupt_target(ioapic_remap_interrupt(irq), IOAPIC_DEST_ALL_LOGICAL, true);
+    else
+        ioapic_set_interrupt_target(ioapic_remap_interrupt(irq), smp_get_apic_id(procIndex), false);
+    return true;
+}
+
+/**
+ * Changes the processor an IRQ is delivered to, moving its handlers with it.
+ * @param irq       The IRQ.
+ * @param procIndex The processor index, or IRQ_PROC_ANY for lowest-priority delivery.
+ * @return          True if the IRQ was retargeted.
+ */
+bool irqs_set_affinity(uint8_t irq, uint32_t procIndex) {
+    // Ensure IRQ is valid and can be moved. The timer is per-processor.
+    if (!useLapic || irq >= irqMaxCount || irq == IRQ_TIMER)
+        return false;
+    if (procIndex != IRQ_PROC_ANY && procIndex >= smp_get_proc_count())
+        return false;
+
+    // Reprogram whatever delivers the IRQ.
+    irq_affinity_func_t affinityFunc = (irq < irqCount) ? irqs_ioapic_set_affinity : irqAffinityFuncs[irq];
+    if (affinityFunc == NULL || !affinityFunc(irq, procIndex))
+        return false;
+
+    // Move handlers.
+    irqs_move_handlers(irq, procIndex);
+    kprintf("IRQS: IRQ%u now targets %s%u.\n", irq, procIndex == IRQ_PROC_ANY ? "lowest priority processor" : "processor ",
+        procIndex == IRQ_PROC_ANY ? 0 : procIndex);
+    return true;
+}
+
+uint64_t irqs_get_stat(uint8_t irq, uint32_t procIndex) {
+    if (irq >= irqMaxCount || procIndex >= IRQ_MAX_PROCS)
+        return 0;
+    return irqStats[irq][procIndex];
+}
+
+/**
+ * Spreads IRQs with handlers across processors, busiest first, onto the least-loaded processor.
+ */
+void irqs_rebalance(void) {
+    uint32_t procCount = smp_get_proc_count();
+    if (procCount > IRQ_MAX_PROCS)
+        procCount = IRQ_MAX_PROCS;
+    if (!useLapic || procCount <= 1)
+        return;
+
+    // Get total count for each IRQ.
+    uint64_t totals[IRQ_MAX_COUNT];
+    bool placed[IRQ_MAX_COUNT];
+    for (uint8_t irq = 0; irq < irqMaxCount; irq++) {
+        totals[irq] = 0;
+        for (uint32_t proc = 0; proc < procCount; proc++)
+            totals[irq] += irqStats[irq][proc];
+
+        // Only move IRQs that are in use. Lowest-priority IRQs already balance themselves.
+        placed[irq] = irq == IRQ_TIMER || irqHandlers[irq] == NULL || irqTargets[irq] == IRQ_PROC_ANY;
+    }
+
+    // Place busiest IRQs first.
+    uint64_t loads[IRQ_MAX_PROCS] = { };
+    while (true) {
+        int16_t busiest = -1;
+        for (uint8_t irq = 0; irq < irqMaxCount; irq++)
+            if (!placed[irq] && (busiest < 0 || totals[irq] > totals[busiest]))
+                busiest = irq;
+        if (busiest < 0)
+            break;
+        placed[busiest] = true;
+
+        // Find least-loaded processor.
+        uint32_t target = 0;
+        for (uint32_t proc = 1; proc < procCount; proc++)
+            if (loads[proc] < loads[target])
+                target = proc;
+
+        // Move IRQ, counting it against its current processor if it can't be moved.
+        if (irqTargets[busiest] == target || irqs_set_affinity(busiest, target))
+            loads[target] += totals[busiest] + 1;
+        else if (irqTargets[busiest] < procCount)
+            loads[irqTargets[busiest]] += totals[busiest] + 1;
+    }
+}
+
+void irqs_print_stats(void) {
+    uint32_t procCount = smp_get_proc_count();
+    if (procCount > IRQ_MAX_PROCS)
+        procCount = IRQ_MAX_PROCS;
+
+    // Print header.
+    kprintf("IRQ  ");
+    for (uint32_t proc = 0; proc < procCount; proc++)
+        kprintf("      CPU%u", proc);
+    kprintf("  Target\n");
+
+    // Print counts for each IRQ in use.
+    for (uint8_t irq = 0; irq < irqMaxCount; irq++) {
+        if (irqHandlers[irq] == NULL)
+            continue;
+
+        kprintf("%u%s", irq, irq < 10 ? "    " : (irq < 100 ? "   " : "  "));
+        for (uint32_t proc = 0; proc < procCount; proc++) {
+            // Right-align counts in a 10 character column.
+            uint64_t count = irqStats[irq][proc];
+            uint8_t digits = 1;
+            for (uint64_t c = count; c >= 10; c /= 10)
+                digits++;
+            for (uint8_t i = digits; i < 10; i++)
+                kprintf(" ");
+            kprintf("%llu", count);
+        }
+
+        if (irq == IRQ_TIMER)
+            kprintf("  local\n");
+        else if (irqTargets[irq] == IRQ_PROC_ANY)
+            kprintf("  any\n");
+        else
+            kprintf("  CPU%u\n", irqTargets[irq]);
+    }
+}
+
 // Handler for IRQss.
 void irqs_handler(irq_regs_t *regs) {
     // Get IRQ number.
     irqExecuting = true;
     uint8_t irq = useLapic ? lapic_get_irq() : pic_get_irq();
+    trace(TRACE_EVENT_IRQ_ENTRY, irq, 0);
 
     // Get processor we are running on.
     smp_proc_t *proc = smp_get_proc(lapic_id());
     uint32_t procIndex = (proc != NULL) ? proc->Index : 0;
 
     // Ensure IRQ is within range.
-    if (irq < irqCount) {
+    if (irq < irqMaxCount) {
+        if (procIndex < IRQ_MAX_PROCS)
+            irqStats[irq][procIndex]++;
+
         // Invoke registered handlers.
         irq_handler_t *handler = irqHandlers[irq];
         while (handler != NULL) {
-            if (handler->HandlerFunc != NULL && handler->ProcessorIndex == procIndex) {
+            if (handler->HandlerFunc != NULL && (handler->ProcessorIndex == procIndex || handler->ProcessorIndex == IRQ_PROC_ANY)) {
                 if (handler->HandlerFunc(regs, irq, procIndex))
                     break;
             }
@@ -186,6 +423,7 @@ void irqs_handler(irq_regs_t *regs) {
     }
 
     // Send EOI.
+    trace(TRACE_EVENT_IRQ_EXIT, irq, 0);
     irqs_eoi(irq);
     irqExecuting = false;
 }
@@ -226,13 +464,19 @@ void irqs_init(idt_entry_t *idt) {
         irqCount = ioapic_max_interrupts();
     }
 
+    // IRQs past the I/O APIC's inputs can only be delivered by message through the LAPIC.
+    irqMaxCount = useLapic ? IRQ_MAX_COUNT : irqCount;
+    memset(irqsAllocated, 0, sizeof(irqsAllocated));
+    for (uint8_t irq = 0; irq < irqCount; irq++)
+        irqs_set_allocated(irq, true);
+
     // Allocate space for handler array.
-    kprintf("IRQS: %u possible IRQs.\n", irqCount);
-    irqHandlers = kheap_alloc(sizeof(irq_handler_t) * irqCount);
-    memset(irqHandlers, 0, sizeof(irq_handler_t) * irqCount);
+    kprintf("IRQS: %u possible IRQs, %u usable for MSI.\n", irqCount, irqMaxCount - irqCount);
+    irqHandlers = kheap_alloc(sizeof(irq_handler_t*) * irqMaxCount);
+    memset(irqHandlers, 0, sizeof(irq_handler_t*) * irqMaxCount);
 
     // Open gates in IDT.
-    for (uint8_t irq = 0; irq < irqCount; irq++)
+    for (uint8_t irq = 0; irq < irqMaxCount; irq++)
         idt_open_interrupt_gate(idt, irq + IRQ_OFFSET, (uintptr_t)_irq_common);
     kprintf("IRQS: Initialized!\n");
 }
@@ -30,6 +30,7 @@
 #include <kernel/cpuid.h>
 #include <kernel/interrupts/idt.h>
 #include <kernel/interrupts/irqs.h>
+#include <kernel/interrupts/smp.h>
 #include <kernel/memory/paging.h>
 
 extern void _irq_empty(void);
@@ -151,6 +152,11 @@ void lapic_timer_start(uint32_t rate) {
     lapic_write(LAPIC_REG_TIMER_INITIAL, rate);
 }
 
+void lapic_perf_set_vector(uint8_t vector, bool masked) {
+    // Set vector for performance counter overflows. The processor masks this again after each one.
+    lapic_write(LAPIC_REG_LVT_PERF, vector | (masked ? LAPIC_LVT_MASKED : 0));
+}
+
 uint32_t lapic_id(void) {
     // Get ID if LAPIC is configured, otherwise return 0.
     return lapicPointer != NULL ? lapic_read(LAPIC_REG_ID) >> 24 : 0;
@@ -191,10 +197,13 @@ void lapic_setup(void) {
     kprintf("LAPIC: Version: 0x%x\n", lapic_version());
     kprintf("LAPIC: Max LVT entry: 0x%x\n", lapic_max_lvt());
 
-    // Configure LAPIC.
+    // Configure LAPIC. Each processor gets its own bit in the flat logical destination,
+    // so lowest priority interrupts can be sent to all of them.
+    smp_proc_t *proc = smp_get_proc(lapic_id());
+    uint32_t index = (proc != NULL) ? proc->Index : 0;
     lapic_write(LAPIC_REG_TASK_PRIORITY, 0x00);
     lapic_write(LAPIC_REG_DEST_FORMAT, 0xFFFFFFFF);
-    lapic_write(LAPIC_REG_LOGICAL_DEST, 1 << 24);
+    lapic_write(LAPIC_REG_LOGICAL_DEST, (1 << (index % 8)) << 24);
 
     // Create spurious interrupt.
     lapic_write(LAPIC_REG_SPURIOUS_INT_VECTOR, LAPIC_SPURIOUS_INT | 0x100);
@@ -39,6 +39,7 @@
 #include <kernel/memory/kheap.h>
 #include <kernel/memory/pmm.h>
 #include <kernel/memory/paging.h>
+#include <kernel/profiler.h>
 #include <kernel/tasking.h>
 
 // https://wiki.osdev.org/SMP
@@ -73,6 +74,19 @@ smp_proc_t *smp_get_proc(uint32_t apicId) {
     return NULL;
 }
 
+uint32_t smp_get_apic_id(uint32_t procIndex) {
+    // Search for specified index and return the processor's APIC ID.
+    smp_proc_t *currentProc = processors;
+    while (currentProc != NULL) {
+        if (currentProc->Index == procIndex)
+            return currentProc->ApicId;
+        currentProc = currentProc->Next;
+    }
+
+    // If SMP isn't in use, the only processor is the one we are running on.
+    return lapic_id();
+}
+
 uint32_t smp_ap_get_stack(uint32_t apicId) {
     smp_proc_t *proc = smp_get_proc(apicId);
 
@@ -82,6 +96,9 @@ uint32_t smp_ap_get_stack(uint32_t apicId) {
 }
 
 static bool test(irq_regs_t *regs, uint8_t irqNum, uint32_t procIndex) {
+    // Take a profiler sample on this processor.
+    profiler_tick(regs, procIndex);
+
     // Change tasks every 5ms.
 	if (timer_ticks() % 5 == 0)
 		tasking_tick(regs, procIndex);
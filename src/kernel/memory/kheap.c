@@ -25,12 +25,14 @@
 #include <main.h>
 #include <tools.h>
 #include <kprint.h>
+#include <klog.h>
 #include <string.h>
 
 #include <kernel/memory/kheap.h>
 #include <kernel/memory/paging.h>
 #include <kernel/memory/pmm.h>
 #include <kernel/lock.h>
+#include <kernel/trace.h>
 
 // Based on code from https://github.com/CCareaga/heap_allocator. Licensed under the MIT.
 
@@ -212,7 +214,7 @@ static bool kheap_expand(size_t size) {
         currentKernelHeapSize += PAGE_SIZE_4K;
     }
 
-    //kprintf("KHEAP: Heap expanded by 4KB to %u bytes!\n", currentKernelHeapSize);
+    klog_trace(KHEAP, "Heap expanded by 4KB to %u bytes!\n", currentKernelHeapSize);
     return true;
 }
 
@@ -237,7 +239,7 @@ void *kheap_alloc(size_t size) {
     // If a chunk still couldn't be found, expand heap.
     if (node == NULL) {
         if (!kheap_expand(size)) {
-            kprintf("KHEAP: Failed to expand heap!\n");
+            klog_error(KHEAP, "Failed to expand heap!\n");
             return NULL;
         }
 
@@ -293,10 +295,13 @@ void *kheap_alloc(size_t size) {
 
     // Unlock and return allocation.
     spinlock_release(&kheap_lock);
+    trace(TRACE_EVENT_KHEAP_ALLOC, size, (uintptr_t)node + KHEAP_HEADER_OFFSET);
     return (uint8_t*)node + KHEAP_HEADER_OFFSET;
 }
 
 void kheap_free(void *ptr) {
+    trace(TRACE_EVENT_KHEAP_FREE, 0, (uintptr_t)ptr);
+
     // Lock.
     spinlock_lock(&kheap_lock);
 
@@ -26,8 +26,10 @@
 #include <tools.h>
 #include <kprint.h>
 #include <string.h>
+#include <io.h>
 #include <kernel/memory/paging.h>
 #include <kernel/lock.h>
+#include <kernel/cpuid.h>
 
 #include <kernel/interrupts/exceptions.h>
 #include <kernel/memory/pmm.h>
@@ -155,7 +157,7 @@ void paging_unmap_region(uintptr_t startAddress, uintptr_t endAddress) {
 
 static lock_t paging_device_alloc_lock = { };
 
-void *paging_device_alloc(uint64_t startPhys, uint64_t endPhys) {
+static void *paging_device_alloc_int(uint64_t startPhys, uint64_t endPhys, bool writeCombine) {
     // Ensure addresses are on 4KB boundaries.
     if (MASK_PAGEFLAGS_4K_64BIT(startPhys) || MASK_PAGEFLAGS_4K_64BIT(endPhys))
         panic("PAGING: Non-4KB aligned address range (0x%llX-0x%llX) specified!\n", startPhys, endPhys);
@@ -190,7 +192,13 @@ void *paging_device_alloc(uint64_t startPhys, uint64_t endPhys) {
         panic("PAGING: Out of device virtual addresses!\n");
 
     // Map range.
-    paging_map_region_phys(page, page + ((pageCount - 1) * PAGE_SIZE_4K), startPhys, false, true); // TODO change back to kernel only.
+    if (writeCombine) {
+        for (uint32_t i = 0; i < pageCount; i++)
+            paging_map_wc(page + (i * PAGE_SIZE_4K), startPhys + (i * PAGE_SIZE_4K));
+    }
+    else {
+        paging_map_region_phys(page, page + ((pageCount - 1) * PAGE_SIZE_4K), startPhys, false, true); // TODO change back to kernel only.
+    }
 
     // unlock.
     spinlock_release(&paging_device_alloc_lock);
@@ -199,6 +207,33 @@ void *paging_device_alloc(uint64_t startPhys, uint64_t endPhys) {
     return (void*)(page);
 }
 
+void *paging_device_alloc(uint64_t startPhys, uint64_t endPhys) {
+    return paging_device_alloc_int(startPhys, endPhys, false);
+}
+
+/**
+ * Maps a range of device memory as write-combining, for framebuffers.
+ * @param startPhys The first physical page to map.
+ * @param endPhys The last physical page to map.
+ * @return The virtual address of the first page.
+ */
+void *paging_device_alloc_wc(uint64_t startPhys, uint64_t endPhys) {
+    return paging_device_alloc_int(startPhys, endPhys, true);
+}
+
+/**
+ * Sets up the page attribute table so that pages with only PWT set are write-combining.
+ * Must be called on every processor, as they need matching tables.
+ */
+void paging_pat_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    if (!cpuid_query(CPUID_GETFEATURES, &eax, &ebx, &ecx, &edx) || !(edx & CPUID_FEAT_EDX_PAT))
+        return;
+
+    cpu_msr_write(PAGING_MSR_PAT, PAGING_PAT_VALUE);
+    paging_flush_tlb();
+}
+
 /**
  * Unmaps a region of virtual memory without returning pages to the page stack, or unmapping non-stack memory.
  * @param startAddress The first address to unmap.
@@ -260,6 +295,7 @@ void paging_init() {
         
     // Change to use our new page directory.
     paging_change_directory(memInfo.kernelPageDirectory);
+    paging_pat_init();
     
     // Map range from 0x1000 to 0x5000 for testing.
     kprintf("PAGING: Mapping range 0x1000 to 0x5000...\n");
@@ -24,6 +24,7 @@
 
 #include <main.h>
 #include <kprint.h>
+#include <klog.h>
 #include <string.h>
 
 #include <kernel/memory/pmm.h>
@@ -302,7 +303,7 @@ void pmm_print_memmap(void) {
             for (multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t*)mmap->entries;
                 (uint64_t)entry < (uint64_t)mmap + mmap->size; entry = (multiboot_mmap_entry_t*)((uint64_t)entry + mmap->entry_size)) {
                 // Print out info.
-                kprintf("PMM:     region start: 0x%llX length: 0x%llX type: 0x%X\n", entry->addr, entry->len, entry->type);
+                klog_debug(PMM, "    region start: 0x%llX length: 0x%llX type: 0x%X\n", entry->addr, entry->len, entry->type);
                 if (entry->type == 1)
                     memory += entry->len;
             }
@@ -319,7 +320,7 @@ void pmm_print_memmap(void) {
             entry = (multiboot_memory_map_t*)base;
 
             // Print out info.
-            kprintf("PMM:     region start: 0x%llX length: 0x%llX type: 0x%X\n", entry->addr, entry->len, (uint64_t)entry->type);
+            klog_debug(PMM, "    region start: 0x%llX length: 0x%llX type: 0x%X\n", entry->addr, entry->len, (uint64_t)entry->type);
             if (entry->type == 1 && (((uint32_t)entry->addr) > 0 || (memInfo.paeEnabled && (entry->addr & 0xF00000000))))
                 memory += entry->len;
         }
@@ -409,7 +410,7 @@ static void pmm_build_stacks(void) {
                 if (entry->addr > 0) {
                     // Add frame to stack.
                     uint64_t pageFrameBase = ALIGN_4K_64BIT(entry->addr);	
-                    kprintf("PMM: Adding pages in 0x%llX!\n", pageFrameBase);			
+                    klog_trace(PMM, "Adding pages in 0x%llX!\n", pageFrameBase);			
                     for (uint32_t i = 0; i < (entry->len / PAGE_SIZE_4K) - 1; i++) { // Give buffer incase another section of the memory map starts partway through a page.
                         uint64_t addr = pageFrameBase + (i * PAGE_SIZE_4K);
 
@@ -438,7 +439,7 @@ static void pmm_build_stacks(void) {
 
             // Add frame to stack.
             uint64_t pageFrameBase = ALIGN_4K_64BIT(entry->addr);	
-            kprintf("PMM: Adding pages in 0x%llX!\n", pageFrameBase);			
+            klog_trace(PMM, "Adding pages in 0x%llX!\n", pageFrameBase);			
             for (uint32_t i = 0; i < (entry->len / PAGE_SIZE_4K) - 1; i++) { // Give buffer incase another section of the memory map starts partway through a page.
                 uint64_t addr = pageFrameBase + (i * PAGE_SIZE_4K);
 
@@ -460,7 +461,7 @@ static void pmm_build_stacks(void) {
     else {
         // No memory map, so take the high memory amount instead.
         uint32_t pageFrameBase = ALIGN_4K(0x100000);	
-        kprintf("PMM: Adding pages in 0x%p!\n", pageFrameBase);			
+        klog_trace(PMM, "Adding pages in 0x%p!\n", pageFrameBase);			
         for (uint32_t i = 0; i < ((memInfo.mbootInfo->mem_upper * 1024) / PAGE_SIZE_4K) - 1; i++) { // Give buffer incase another section of the memory map starts partway through a page.
             uint32_t addr = pageFrameBase + (i * PAGE_SIZE_4K);
 
@@ -0,0 +1,140 @@
+/*
+ * File: pmm_zero.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+
+#include <kernel/memory/pmm.h>
+#include <kernel/memory/paging.h>
+#include <kernel/cpuid.h>
+#include <kernel/lock.h>
+#include <kernel/tasking.h>
+#include <kernel/interrupts/smp.h>
+
+// Pool of pre-zeroed page frames below 4GB.
+static uint32_t zeroPool[PMM_ZERO_POOL_SIZE];
+static uint32_t zeroPoolCount = 0;
+static lock_t zeroPoolLock = { };
+
+// Use non-temporal stores for zeroing?
+static bool zeroNonTemporal = false;
+
+static void pmm_zero_page_nt(void *page) {
+    // Zero using non-temporal stores so pool pages don't push useful data out of the cache.
+    uintptr_t *ptr = (uintptr_t*)page;
+    for (uint32_t i = 0; i < PAGE_SIZE_4K / sizeof(uintptr_t); i++)
+        asm volatile ("movnti %1, %0" : "=m"(ptr[i]) : "r"((uintptr_t)0));
+    asm volatile ("sfence" : : : "memory");
+}
+
+static void pmm_zero_frame(uint64_t frame, bool nonTemporal) {
+    void *page = paging_device_alloc(frame, frame);
+    if (nonTemporal)
+        pmm_zero_page_nt(page);
+    else
+        memset(page, 0, PAGE_SIZE_4K);
+    paging_device_free((uintptr_t)page, (uintptr_t)page);
+}
+
+static bool pmm_zero_pool_pop(uint32_t *frameOut) {
+    bool popped = false;
+    spinlock_lock(&zeroPoolLock);
+    if (zeroPoolCount > 0) {
+        *frameOut = zeroPool[--zeroPoolCount];
+        popped = true;
+    }
+    spinlock_release(&zeroPoolLock);
+    return popped;
+}
+
+static void pmm_zero_thread(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2) {
+    while (true) {
+        // Only refill if the pool is low and we won't starve others of low memory.
+        if (zeroPoolCount >= PMM_ZERO_POOL_SIZE || pmm_frames_available() <= PMM_ZERO_RESERVE) {
+            asm volatile ("hlt");
+            continue;
+        }
+
+        // Zero a frame and add it to the pool.
+        uint32_t frame = pmm_pop_frame_nonlong();
+        pmm_zero_frame(frame, zeroNonTemporal);
+        spinlock_lock(&zeroPoolLock);
+        if (zeroPoolCount < PMM_ZERO_POOL_SIZE) {
+            zeroPool[zeroPoolCount++] = frame;
+            frame = 0;
+        }
+        spinlock_release(&zeroPoolLock);
+
+        // Pool filled up by someone else, give frame back.
+        if (frame != 0)
+            pmm_push_frame(frame);
+    }
+}
+
+/**
+ * Pops a zeroed page frame below 4GB.
+ * @return 		The physical address of the page frame.
+ */
+uint32_t pmm_pop_zeroed_frame_nonlong(void) {
+    uint32_t frame;
+    if (pmm_zero_pool_pop(&frame))
+        return frame;
+
+    // Pool is empty, zero one now. The caller is about to use it, so keep it in the cache.
+    frame = pmm_pop_frame_nonlong();
+    pmm_zero_frame(frame, false);
+    return frame;
+}
+
+/**
+ * Pops a zeroed page frame.
+ * @return 		The physical address of the page frame.
+ */
+uint64_t pmm_pop_zeroed_frame(void) {
+    uint32_t poolFrame;
+    if (pmm_zero_pool_pop(&poolFrame))
+        return poolFrame;
+
+    // Pool is empty, zero one now.
+    uint64_t frame = pmm_pop_frame();
+    pmm_zero_frame(frame, false);
+    return frame;
+}
+
+/**
+ * Starts the thread that keeps the zeroed frame pool filled.
+ */
+void pmm_zero_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    if (cpuid_query(CPUID_GETFEATURES, &eax, &ebx, &ecx, &edx) && (edx & CPUID_FEAT_EDX_SSE2))
+        zeroNonTemporal = true;
+
+    // Run on the last processor, away from the BSP which handles most other work.
+    uint32_t procIndex = (smp_get_proc_count() > 0) ? smp_get_proc_count() - 1 : 0;
+    thread_t *thread = tasking_thread_create_kernel("pmm_zero", pmm_zero_thread, 0, 0, 0);
+    tasking_thread_schedule_proc(thread, procIndex);
+    kprintf("PMM: Zeroed frame pool of %u frames started on processor %u%s.\n", PMM_ZERO_POOL_SIZE, procIndex,
+        zeroNonTemporal ? " using non-temporal stores" : "");
+}
@@ -36,6 +36,8 @@
 #include <kernel/memory/paging.h>
 #include <kernel/memory/pmm.h>
 #include <kernel/interrupts/smp.h>
+#include <kernel/interrupts/lapic.h>
+#include <kernel/tasking.h>
 
 #include <kernel/lock.h>
 
@@ -66,42 +68,150 @@ uintptr_t syscalls_syscall(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintp
 #endif
 }
 
-extern lock_t kprintf_mutex;
 void syscalls_kprintf(const char *format, ...) {
-    // Get args.
+    // Format the string here so the kernel only has to copy in a bounded buffer.
+    char buffer[SYSCALL_KPRINTF_MAX];
     va_list args;
 	va_start(args, format);
+    int length = kvsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length >= SYSCALL_KPRINTF_MAX)
+        length = SYSCALL_KPRINTF_MAX - 1;
 
-	// Invoke kprintf_va via system call.
-   // spinlock_lock(&kprintf_mutex);
-    syscalls_syscall(format, args, 0, 0, 0, 0, 0xAB);
-    //spinlock_release(&kprintf_mutex);
+	// Print via system call.
+    syscalls_syscall((uintptr_t)buffer, (uintptr_t)length, 0, 0, 0, 0, SYSCALL_KPRINTF);
 }
 
-static uintptr_t syscalls_uptime_handler(uintptr_t ptrAddr) {
-    uint64_t *uptimePtr = (uint64_t)ptrAddr;
-    if (uptimePtr != NULL) {
-        *uptimePtr = timer_ticks() / 1000;
-        return 0;
-    }
-    return -1;
+// Shared data page, kernel mapping and physical frame.
+static syscall_shared_page_t *sharedPage = NULL;
+static uint64_t sharedPagePhys = 0;
+
+static bool syscalls_validate_pointer(uintptr_t address, uintptr_t length, bool write);
+
+static uintptr_t syscalls_kprintf_handler(uintptr_t bufferPtr, uintptr_t length, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5) {
+    // Copy the string in, as the caller could change it while we print.
+    char buffer[SYSCALL_KPRINTF_MAX];
+    if (length >= SYSCALL_KPRINTF_MAX || !syscalls_validate_pointer(bufferPtr, length, false))
+        return -1;
+    memcpy((uint8_t*)buffer, (uint8_t*)bufferPtr, length);
+    buffer[length] = '\0';
+
+    kprintf("%s", buffer);
+    return 0xFE;
 }
 
-uintptr_t syscalls_handler(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5, uintptr_t index) {
-    if (index == 0xAB) {
-       kprintf_va(false, arg0, arg1);
-       return 0xFE;
+static uintptr_t syscalls_uptime_handler(uintptr_t ptrAddr, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5) {
+    uint64_t *uptimePtr = (uint64_t*)ptrAddr;
+    *uptimePtr = timer_ticks() / 1000;
+    return 0;
+}
+
+static uintptr_t syscalls_batch_handler(uintptr_t entriesPtr, uintptr_t count, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5);
+
+// System call table.
+static syscall_entry_t syscallTable[SYSCALL_COUNT] = {
+    [SYSCALL_UPTIME]    = { syscalls_uptime_handler, "uptime", { sizeof(uint64_t) }, 0x01 },
+    [SYSCALL_BATCH]     = { syscalls_batch_handler, "batch", { sizeof(syscall_batch_entry_t) }, 0x01 },
+    [SYSCALL_KPRINTF]   = { syscalls_kprintf_handler, "kprintf", { 0 }, 0x00 }
+};
+
+static bool syscalls_from_user(void) {
+    // Calls made before tasking starts, or by kernel threads, may pass kernel pointers.
+    smp_proc_t *proc = smp_get_proc(lapic_id());
+    tasking_proc_t *taskingProc = tasking_get_proc((proc != NULL) ? proc->Index : 0);
+    if (taskingProc == NULL || taskingProc->CurrentThread == NULL)
+        return false;
+    return taskingProc->CurrentThread->Parent->UserMode;
+}
+
+static bool syscalls_validate_pointer(uintptr_t address, uintptr_t length, bool write) {
+    if (!syscalls_from_user())
+        return true;
+
+    // Reject null pointers, ranges that wrap around, and anything reaching kernel space.
+    if (address == 0 || address + length < address || address + length > memInfo.kernelVirtualOffset)
+        return false;
+
+    // Ensure each page of the range is mapped and accessible from user mode.
+    uint64_t flags;
+    uintptr_t endAddress = address + (length > 0 ? length - 1 : 0);
+    for (uintptr_t page = MASK_PAGE_4K(address); page <= MASK_PAGE_4K(endAddress); page += PAGE_SIZE_4K) {
+        if (!paging_get_flags(page, &flags) || !(flags & PAGING_PAGE_USER) || (write && !(flags & PAGING_PAGE_READWRITE)))
+            return false;
     }
-    
-    switch (index) {
-        case SYSCALL_UPTIME:
-            return syscalls_uptime_handler(arg0);
+    return true;
+}
 
-        default:
+static uintptr_t syscalls_dispatch(uintptr_t args[6], uintptr_t index) {
+    // Ensure call exists.
+    if (index >= SYSCALL_COUNT || syscallTable[index].Handler == NULL)
+        return -1;
+    syscall_entry_t *entry = &syscallTable[index];
+
+    // Validate fixed-size pointer arguments.
+    for (uint8_t i = 0; i < 6; i++)
+        if (entry->PointerSizes[i] > 0 && !syscalls_validate_pointer(args[i], entry->PointerSizes[i], entry->WriteArgs & (1 << i)))
             return -1;
+
+    __atomic_fetch_add(&entry->Count, 1, __ATOMIC_RELAXED);
+    return entry->Handler(args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+static uintptr_t syscalls_batch_handler(uintptr_t entriesPtr, uintptr_t count, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5) {
+    // Ensure the whole array is valid.
+    if (count > SYSCALL_BATCH_MAX || !syscalls_validate_pointer(entriesPtr, count * sizeof(syscall_batch_entry_t), true))
+        return -1;
+
+    // Run each call in order from a copy, so the caller can't change its pointers after they are
+    // validated. Only the result is written back. Batches cannot be nested.
+    syscall_batch_entry_t *entries = (syscall_batch_entry_t*)entriesPtr;
+    for (uintptr_t i = 0; i < count; i++) {
+        syscall_batch_entry_t entry;
+        memcpy((uint8_t*)&entry, (uint8_t*)&entries[i], sizeof(syscall_batch_entry_t));
+        entries[i].Result = (entry.Index == SYSCALL_BATCH) ? (uintptr_t)-1 : syscalls_dispatch(entry.Args, entry.Index);
     }
+    return count;
+}
 
-    return 0xFE;
+/**
+ * Performs several system calls with a single kernel entry.
+ * @param entries   The calls to make; the Result field of each is filled in.
+ * @param count     The number of entries, up to SYSCALL_BATCH_MAX.
+ * @return The number of calls made, or -1 on error.
+ */
+uintptr_t syscalls_batch(syscall_batch_entry_t *entries, uintptr_t count) {
+    return syscalls_syscall((uintptr_t)entries, count, 0, 0, 0, 0, SYSCALL_BATCH);
+}
+
+uintptr_t syscalls_handler(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5, uintptr_t index) {
+    uintptr_t args[6] = { arg0, arg1, arg2, arg3, arg4, arg5 };
+    return syscalls_dispatch(args, index);
+}
+
+void syscalls_shared_page_update(uint64_t ticks) {
+    if (sharedPage == NULL)
+        return;
+
+    // Mark page as being updated, update, and mark complete.
+    sharedPage->Sequence++;
+    asm volatile ("" : : : "memory");
+    sharedPage->Ticks = ticks;
+    sharedPage->UptimeSeconds = ticks / sharedPage->TicksPerSecond;
+    asm volatile ("" : : : "memory");
+    sharedPage->Sequence++;
+}
+
+void syscalls_shared_page_map(void) {
+    // Map shared page read-only into the current user address space.
+    if (sharedPage != NULL)
+        paging_map(SYSCALL_SHARED_PAGE_ADDRESS, sharedPagePhys, false, false);
+}
+
+void syscalls_print_stats(void) {
+    kprintf("SYSCALLS: Call counts:\n");
+    for (uint16_t i = 0; i < SYSCALL_COUNT; i++)
+        if (syscallTable[i].Handler != NULL)
+            kprintf("  0x%X %s: %llu\n", i, syscallTable[i].Name, syscallTable[i].Count);
 }
 
 void syscalls_init_ap(void) {
@@ -148,6 +258,12 @@ void syscalls_init(void) {
     // Initialize fast syscalls for this processor.
     syscalls_init_ap();
 
+    // Create shared data page for user processes.
+    sharedPagePhys = pmm_pop_zeroed_frame();
+    sharedPage = (syscall_shared_page_t*)paging_device_alloc(sharedPagePhys, sharedPagePhys);
+    sharedPage->TicksPerSecond = 1000;
+    syscalls_shared_page_update(timer_ticks());
+
     // Add interrupt option for syscalls.
     idt_set_gate(idt_get_bsp(), SYSCALL_INTERRUPT, (uintptr_t)_syscalls_interrupt_handler, GDT_KERNEL_CODE_OFFSET, IDT_GATE_INTERRUPT_32, GDT_PRIVILEGE_USER, true);
     kprintf("SYSCALLS: Added handler for interrupt 0x%X at 0x%p\n", SYSCALL_INTERRUPT, _syscalls_interrupt_handler);
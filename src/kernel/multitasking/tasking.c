@@ -27,10 +27,14 @@
 #include <string.h>
 
 #include <kernel/tasking.h>
+#include <kernel/multitasking/workqueue.h>
+#include <kernel/multitasking/syscalls.h>
 #include <kernel/gdt.h>
+#include <kernel/fpu.h>
 #include <kernel/memory/kheap.h>
 #include <kernel/main.h>
 #include <kernel/timer.h>
+#include <kernel/trace.h>
 #include <kernel/interrupts/interrupts.h>
 #include <kernel/interrupts/irqs.h>
 #include <kernel/interrupts/smp.h>
@@ -117,9 +121,11 @@ void tasking_kill_thread(void) {
         // Free all threads.
         thread_t *thread = currentThread->Next;
         while (thread != currentThread) {
+            fpu_thread_free(thread);
             kheap_free(thread);
             thread = thread->Next;
         }
+        fpu_thread_free(currentThread);
         kheap_free(currentThread);
 
         // Free process from memory.
@@ -127,6 +133,7 @@ void tasking_kill_thread(void) {
     }
     else {
         // Free thread from memory. The scheduler will move away from it at the next cycle.
+        fpu_thread_free(currentThread);
         kheap_free(currentThread);
     }
 
@@ -170,11 +177,10 @@ thread_t *tasking_thread_create(process_t *process, char *name, thread_entry_fun
     thread->ThreadId = tasking_new_thread_id();
     thread->EntryFunc = func;
 
-    // Pop new page for stack and map to temp address.
-    thread->StackPage = pmm_pop_frame();
+    // Pop new zeroed page for stack and map to temp address.
+    thread->StackPage = pmm_pop_zeroed_frame();
     uintptr_t stackBottom = (uintptr_t)paging_device_alloc(thread->StackPage, thread->StackPage);
     uintptr_t stackTop = stackBottom + PAGE_SIZE_4K;
-    memset((void*)stackBottom, 0, PAGE_SIZE_4K);
 
     // Set up registers.
     irq_regs_t *regs = (irq_regs_t*)(stackTop - sizeof(irq_regs_t));
@@ -200,6 +206,10 @@ thread_t *tasking_thread_create(process_t *process, char *name, thread_entry_fun
 
         // Map stack of main thread in.
         paging_map(0x0, thread->StackPage, false, true);
+
+        // Map shared data page if this is the first thread.
+        if (process->MainThread == NULL)
+            syscalls_shared_page_map();
         thread->StackPointer = PAGE_SIZE_4K - sizeof(irq_regs_t);
         regs->SP = regs->BP = PAGE_SIZE_4K;
 
@@ -291,6 +301,12 @@ void tasking_thread_schedule_proc(thread_t *thread, uint32_t procIndex) {
     threadLists[procIndex].TaskingEnabled = true;
 }
 
+tasking_proc_t *tasking_get_proc(uint32_t procIndex) {
+    if (threadLists == NULL || procIndex >= smp_get_proc_count())
+        return NULL;
+    return &threadLists[procIndex];
+}
+
 static void kernel_init_thread(void) {
     while(true) {
         syscalls_kprintf("Test %u ticks\n", timer_ticks());
@@ -317,6 +333,15 @@ static void kernel_main_thread(void) {
     kprintf("TASKING: All processors started, enabling multitasking!\n");
     tasking_unfreeze();
 
+    // Start console thread, output is queued from here on.
+    kprint_console_init();
+
+    // Start deferred work threads, drivers use these for the bottom half of their interrupt handling.
+    workqueue_init();
+
+    // Start keeping a pool of zeroed page frames.
+    pmm_zero_init();
+
     // Create userspace process.
    // kprintf("Creating userspace process...\n");
     //process_t *initProcess = tasking_process_create(kernelProcess, "init", true, "init_main", kernel_init_thread, 0, 0, 0);
@@ -356,7 +381,9 @@ void tasking_tick(irq_regs_t *regs, uint32_t procIndex) {
 
     // Save stack pointer and move to next thread in schedule.
     threadLists[procIndex].CurrentThread->StackPointer = (uintptr_t)regs;
+    trace(TRACE_EVENT_SCHED_SWITCH, threadLists[procIndex].CurrentThread->ThreadId, threadLists[procIndex].CurrentThread->SchedNext->ThreadId);
     threadLists[procIndex].CurrentThread = threadLists[procIndex].CurrentThread->SchedNext;
+    fpu_switch(threadLists[procIndex].CurrentThread, procIndex);
 
     // Jump to next task.
     tasking_exec(procIndex);
@@ -378,8 +405,10 @@ void tasking_init_ap(void) {
 #endif
     gdt_tss_set_kernel_stack(gdt_tss_get(), kernelStack);
 
-    // Initialize fast syscalls for this processor.
+    // Initialize fast syscalls, FPU and page attributes for this processor.
     syscalls_init_ap();
+    fpu_init_ap();
+    paging_pat_init();
 
     // Create idle kernel thread.
     thread_t *idleThread = tasking_thread_create_kernel("core_idle", kernel_idle_thread, proc->Index, 0, 0);
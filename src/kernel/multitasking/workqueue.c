@@ -0,0 +1,151 @@
+/*
+ * File: workqueue.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+#include <kernel/multitasking/workqueue.h>
+
+#include <kernel/tasking.h>
+#include <kernel/lock.h>
+#include <kernel/memory/kheap.h>
+#include <kernel/interrupts/lapic.h>
+#include <kernel/interrupts/smp.h>
+
+// Per-processor deferred work queues.
+static workqueue_proc_t *workQueues = NULL;
+static uint32_t workQueueCount = 0;
+
+static uint32_t workqueue_get_proc_index(void) {
+    smp_proc_t *proc = smp_get_proc(lapic_id());
+    return (proc != NULL) ? proc->Index : 0;
+}
+
+static work_t *workqueue_pop(workqueue_proc_t *queue) {
+    spinlock_lock(&queue->Lock);
+    work_t *work = queue->Head;
+    if (work != NULL) {
+        queue->Head = work->Next;
+        if (queue->Head == NULL)
+            queue->Tail = NULL;
+        work->Next = NULL;
+
+        // Clear pending before running, so the item can be queued again while it runs.
+        work->Pending = false;
+    }
+    spinlock_release(&queue->Lock);
+    return work;
+}
+
+static void workqueue_thread(uintptr_t procIndex, uintptr_t arg1, uintptr_t arg2) {
+    workqueue_proc_t *queue = &workQueues[procIndex];
+    queue->Running = true;
+
+    while (true) {
+        // Get next item. If there isn't one, wait for an interrupt as that is what queues new work.
+        work_t *work = workqueue_pop(queue);
+        if (work == NULL) {
+            asm volatile ("hlt");
+            continue;
+        }
+
+        // Run work.
+        work->Func(work->Arg);
+        queue->Processed++;
+    }
+}
+
+/**
+ * Initializes a work item.
+ * @param work      The work item to initialize.
+ * @param func      The function to run when the work is processed.
+ * @param arg       The argument passed to func.
+ */
+void workqueue_work_init(work_t *work, work_func_t func, void *arg) {
+    memset(work, 0, sizeof(work_t));
+    work->Func = func;
+    work->Arg = arg;
+}
+
+/**
+ * Queues a work item to run on the worker thread of the specified processor.
+ * Safe to call from an interrupt handler.
+ * @param work      The work item to queue.
+ * @param procIndex The index of the processor to run the work on.
+ * @return True if the item was queued; false if it was already pending.
+ */
+bool workqueue_queue_proc(work_t *work, uint32_t procIndex) {
+    // If workers are not up yet, run the work directly.
+    if (workQueues == NULL || procIndex >= workQueueCount || !workQueues[procIndex].Running) {
+        work->Func(work->Arg);
+        return true;
+    }
+
+    workqueue_proc_t *queue = &workQueues[procIndex];
+    spinlock_lock(&queue->Lock);
+
+    // If the item is already waiting to run, the pending run will handle this request too.
+    if (work->Pending) {
+        spinlock_release(&queue->Lock);
+        return false;
+    }
+
+    // Add item to end of queue.
+    work->Pending = true;
+    work->Next = NULL;
+    if (queue->Tail != NULL)
+        queue->Tail->Next = work;
+    else
+        queue->Head = work;
+    queue->Tail = work;
+    spinlock_release(&queue->Lock);
+    return true;
+}
+
+/**
+ * Queues a work item to run on the worker thread of the current processor.
+ * Safe to call from an interrupt handler.
+ * @param work      The work item to queue.
+ * @return True if the item was queued; false if it was already pending.
+ */
+bool workqueue_queue(work_t *work) {
+    return workqueue_queue_proc(work, workqueue_get_proc_index());
+}
+
+void workqueue_init(void) {
+    // Create queues for each processor.
+    workQueueCount = smp_get_proc_count();
+    if (workQueueCount == 0)
+        workQueueCount = 1;
+    workqueue_proc_t *queues = (workqueue_proc_t*)kheap_alloc(sizeof(workqueue_proc_t) * workQueueCount);
+    memset(queues, 0, sizeof(workqueue_proc_t) * workQueueCount);
+    workQueues = queues;
+
+    // Start a worker thread on each processor.
+    for (uint32_t i = 0; i < workQueueCount; i++) {
+        thread_t *thread = tasking_thread_create_kernel("kworker", workqueue_thread, i, 0, 0);
+        tasking_thread_schedule_proc(thread, i);
+    }
+    kprintf("WORKQUEUE: Started %u worker threads.\n", workQueueCount);
+}
@@ -1,6 +1,7 @@
 #include <main.h>
 #include <string.h>
 #include <kprint.h>
+#include <klog.h>
 
 #include <kernel/memory/kheap.h>
 
@@ -16,30 +17,30 @@ ethernet_frame_t* l2_ethernet_create_frame(uint8_t* MACDest, uint8_t* MACSrc,
 	if (*FrameSize < 60) {
 		*FrameSize = 60;
 	}
-	kprintf("L2Eth: frame size of 0x%X calculated, (Eth frame 0x%X | payloadSize 0x%X)\n", *FrameSize, sizeof(ethernet_frame_t), payloadSize);
+	klog_trace(L2ETH, "frame size of 0x%X calculated, (Eth frame 0x%X | payloadSize 0x%X)\n", *FrameSize, sizeof(ethernet_frame_t), payloadSize);
 
 	// Allocate the RAM for our new Ethernet frame to live in
 	ethernet_frame_t *frame = (ethernet_frame_t*)kheap_alloc(*FrameSize);
-	kprintf("L2Eth: allocated frame size of 0x%X\n", sizeof(ethernet_frame_t));
+	klog_trace(L2ETH, "allocated frame size of 0x%X\n", sizeof(ethernet_frame_t));
 	// Clear out the frame's memory space
 	memset(frame, 0, *FrameSize);
-	kprintf("L2Eth: cleared frame with 0s\n");
+	klog_trace(L2ETH, "cleared frame with 0s\n");
 
 	// Copy the 6 bytes a MAC address should be
 	// This is the destination MAC address
 	memcpy(frame->MACDest, MACDest, 6);
-	kprintf("L2Eth: copied destination MAC address to 0x%X\n", &frame->MACDest);
+	klog_trace(L2ETH, "copied destination MAC address to 0x%X\n", &frame->MACDest);
 	// This is the source MAC address
 	memcpy(frame->MACSrc, MACSrc, 6);
-	kprintf("L2Eth: copied source MAC address to 0x%X\n", &frame->MACSrc);
+	klog_trace(L2ETH, "copied source MAC address to 0x%X\n", &frame->MACSrc);
 
 	// Copy Ethertype
 	frame->Ethertype = (Ethertype << 8) | (Ethertype >> 8);
-	kprintf("L2Eth: set Ethertype to 0x%X\n", Ethertype);
+	klog_trace(L2ETH, "set Ethertype to 0x%X\n", Ethertype);
 
 	// Copy payload data to end of header
 	memcpy((void*)frame + sizeof(ethernet_frame_t), payloadPointer, payloadSize);
-	kprintf("L2Eth: copied payload to frame\n");
+	klog_trace(L2ETH, "copied payload to frame\n");
 
 	// Return pointer to our new frame
 	return frame;
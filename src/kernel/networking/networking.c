@@ -30,6 +30,7 @@
 #include <kernel/lock.h>
 #include <kernel/memory/kheap.h>
 #include <kernel/tasking.h>
+#include <kernel/trace.h>
 
 #include <kernel/networking/layers/l2-ethernet.h>
 #include <kernel/networking/protocols/arp.h>
@@ -68,6 +69,8 @@ void dumphex(const void* data, size_t size) {
 }
 
 void networking_handle_packet(net_device_t *netDevice, void *data, uint16_t length) {
+    trace(TRACE_EVENT_NET_RX, length, 0);
+
     // Create packet.
     net_packet_t *packet = (net_packet_t*)kheap_alloc(sizeof(net_packet_t));
     memset(packet, 0, sizeof(net_packet_t));
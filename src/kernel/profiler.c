@@ -0,0 +1,257 @@
+/*
+ * File: profiler.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <io.h>
+#include <kprint.h>
+#include <string.h>
+#include <kernel/profiler.h>
+#include <kernel/cpuid.h>
+#include <kernel/interrupts/irqs.h>
+#include <kernel/interrupts/lapic.h>
+#include <kernel/interrupts/smp.h>
+#include <kernel/memory/kheap.h>
+#include <driver/serial.h>
+
+extern uint32_t KERNEL_VIRTUAL_OFFSET;
+
+// Per-processor sample buffers.
+static profiler_cpu_t *profilerCpus = NULL;
+static uint32_t profilerCpuCount = 0;
+
+// Current settings.
+static volatile bool profilerRunning = false;
+static uint8_t profilerSource = PROFILER_SOURCE_TIMER;
+static bool profilerStacks = false;
+
+// Performance counter support, and the IRQ its overflows are delivered on.
+static uint8_t profilerPmuVersion = 0;
+static uint64_t profilerPmuMask = 0;
+static int16_t profilerPmuIrq = -1;
+
+// Follows saved frame pointers up a kernel stack, stopping at anything that doesn't look like a frame.
+static uint32_t profiler_walk_stack(uintptr_t bp, uintptr_t *frames, uint32_t maxFrames) {
+    uintptr_t kernelStart = (uintptr_t)&KERNEL_VIRTUAL_OFFSET;
+    uint32_t count = 0;
+    while (count < maxFrames && bp >= kernelStart && (bp & (sizeof(uintptr_t) - 1)) == 0) {
+        uintptr_t *frame = (uintptr_t*)bp;
+        if (frame[1] < kernelStart)
+            break;
+        frames[count++] = frame[1];
+
+        // Stacks grow down, so callers' frames are always higher.
+        if (frame[0] <= bp || frame[0] - bp > PROFILER_MAX_FRAME_SIZE)
+            break;
+        bp = frame[0];
+    }
+    return count;
+}
+
+// Records where a processor was interrupted.
+static void profiler_sample(irq_regs_t *regs, uint32_t procIndex) {
+    if (procIndex >= profilerCpuCount)
+        return;
+
+    profiler_cpu_t *cpu = &profilerCpus[procIndex];
+    if (cpu->Count >= PROFILER_SAMPLES) {
+        cpu->Dropped++;
+        return;
+    }
+
+    // Only kernel stacks are walked, user stacks may not be mapped or have frame pointers.
+    profiler_sample_t *sample = &cpu->Samples[cpu->Count];
+    sample->Frames[0] = regs->IP;
+    sample->FrameCount = 1;
+    if (profilerStacks && (regs->CS & 0x3) == 0)
+        sample->FrameCount += profiler_walk_stack(regs->BP, sample->Frames + 1, PROFILER_MAX_FRAMES - 1);
+    __atomic_store_n(&cpu->Count, cpu->Count + 1, __ATOMIC_RELEASE);
+}
+
+// Starts or stops the performance counter on the current processor.
+static void profiler_pmu_arm(bool enable) {
+    cpu_msr_write(PROFILER_MSR_PERFEVTSEL0, 0);
+    if (!enable) {
+        lapic_perf_set_vector(IRQ_OFFSET + profilerPmuIrq, true);
+        return;
+    }
+
+    // Count up from minus the period, overflowing into an interrupt.
+    cpu_msr_write(PROFILER_MSR_PMC0, (0 - (uint64_t)PROFILER_PMU_PERIOD) & profilerPmuMask);
+    lapic_perf_set_vector(IRQ_OFFSET + profilerPmuIrq, false);
+    cpu_msr_write(PROFILER_MSR_PERFEVTSEL0, PROFILER_EVTSEL_UNHALTED_CYCLES | PROFILER_EVTSEL_USR
+        | PROFILER_EVTSEL_OS | PROFILER_EVTSEL_INT | PROFILER_EVTSEL_EN);
+}
+
+static bool profiler_pmu_callback(irq_regs_t *regs, uint8_t irqNum, uint32_t procIndex) {
+    if (!profilerRunning || profilerSource != PROFILER_SOURCE_PMU)
+        return true;
+    profiler_sample(regs, procIndex);
+
+    // Reload counter and clear the overflow. The LVT entry was masked on delivery, so unmask it.
+    cpu_msr_write(PROFILER_MSR_PMC0, (0 - (uint64_t)PROFILER_PMU_PERIOD) & profilerPmuMask);
+    if (profilerPmuVersion >= 2)
+        cpu_msr_write(PROFILER_MSR_PERF_GLOBAL_OVF_CTRL, 1);
+    lapic_perf_set_vector(IRQ_OFFSET + profilerPmuIrq, false);
+    return true;
+}
+
+/**
+ * Called from the timer on every processor. Takes a sample when the timer is the source, otherwise
+ * brings this processor's performance counter in line with the current settings.
+ * @param regs      The interrupted registers.
+ * @param procIndex The current processor.
+ */
+void profiler_tick(irq_regs_t *regs, uint32_t procIndex) {
+    if (procIndex >= profilerCpuCount)
+        return;
+
+    if (profilerRunning && profilerSource == PROFILER_SOURCE_TIMER)
+        profiler_sample(regs, procIndex);
+
+    // Processors start and stop their own counters, as the MSRs are per-processor.
+    bool usePmu = profilerRunning && profilerSource == PROFILER_SOURCE_PMU;
+    if (profilerCpus[procIndex].PmuArmed != usePmu) {
+        profiler_pmu_arm(usePmu);
+        profilerCpus[procIndex].PmuArmed = usePmu;
+    }
+}
+
+/**
+ * Throws away any previous samples and starts profiling.
+ * @param source    PROFILER_SOURCE_TIMER or PROFILER_SOURCE_PMU.
+ * @param stacks    True to walk kernel stacks for each sample.
+ * @return True if profiling was started.
+ */
+bool profiler_start(uint8_t source, bool stacks) {
+    if (profilerCpus == NULL || (source == PROFILER_SOURCE_PMU && profilerPmuIrq < 0))
+        return false;
+
+    profilerRunning = false;
+    for (uint32_t i = 0; i < profilerCpuCount; i++) {
+        profilerCpus[i].Count = 0;
+        profilerCpus[i].Dropped = 0;
+    }
+    profilerSource = source;
+    profilerStacks = stacks;
+    profilerRunning = true;
+    return true;
+}
+
+/**
+ * Stops profiling. Counters are stopped on each processor's next timer tick.
+ */
+void profiler_stop(void) {
+    profilerRunning = false;
+}
+
+/**
+ * Prints profiling settings and how many samples each processor has taken.
+ */
+void profiler_print_status(void) {
+    kprintf("Profiler %s, source: %s%s, PMU: ", profilerRunning ? "running" : "stopped",
+        profilerSource == PROFILER_SOURCE_PMU ? "pmu" : "timer", profilerStacks ? ", with stacks" : "");
+    if (profilerPmuIrq >= 0)
+        kprintf("version %u on IRQ%u\n", profilerPmuVersion, profilerPmuIrq);
+    else
+        kprintf("unavailable\n");
+
+    for (uint32_t i = 0; i < profilerCpuCount; i++)
+        kprintf("CPU%u: %u samples, %u dropped\n", i, profilerCpus[i].Count, profilerCpus[i].Dropped);
+}
+
+// Writes a line of the dump straight to the serial port, bypassing the console.
+static void profiler_dump_line(const char *format, ...) {
+    char line[48];
+    va_list args;
+    va_start(args, format);
+    kvsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    serial_write_text(line, strlen(line));
+}
+
+/**
+ * Stops profiling and streams all samples over the serial port, for scripts/profsym.py.
+ */
+void profiler_dump(void) {
+    if (!serial_present()) {
+        kprintf("PROFILER: No serial port to dump to.\n");
+        return;
+    }
+    profiler_stop();
+
+    // Each sample is a line of frames, innermost first.
+    uint32_t total = 0;
+#ifdef X86_64
+    profiler_dump_line("\nPROFILE BEGIN %u x86_64 %u\n", PROFILER_DUMP_VERSION, profilerCpuCount);
+#else
+    profiler_dump_line("\nPROFILE BEGIN %u i686 %u\n", PROFILER_DUMP_VERSION, profilerCpuCount);
+#endif
+    for (uint32_t i = 0; i < profilerCpuCount; i++) {
+        uint32_t count = __atomic_load_n(&profilerCpus[i].Count, __ATOMIC_ACQUIRE);
+        for (uint32_t j = 0; j < count; j++) {
+            profiler_sample_t *sample = &profilerCpus[i].Samples[j];
+            profiler_dump_line("P %x", i);
+            for (uint32_t frame = 0; frame < sample->FrameCount; frame++)
+                profiler_dump_line(" %llx", (uint64_t)sample->Frames[frame]);
+            profiler_dump_line("\n");
+        }
+        total += count;
+    }
+    profiler_dump_line("PROFILE END %u\n", total);
+    kprintf("PROFILER: Dumped %u samples to serial.\n", total);
+}
+
+/**
+ * Allocates sample buffers, and sets up performance counter interrupts if the processor has
+ * architectural performance monitoring.
+ */
+void profiler_init(void) {
+    // Create a buffer for each processor.
+    uint32_t count = smp_get_proc_count();
+    if (count == 0)
+        count = 1;
+    profiler_cpu_t *cpus = (profiler_cpu_t*)kheap_alloc(sizeof(profiler_cpu_t) * count);
+    memset(cpus, 0, sizeof(profiler_cpu_t) * count);
+    for (uint32_t i = 0; i < count; i++)
+        cpus[i].Samples = (profiler_sample_t*)kheap_alloc(sizeof(profiler_sample_t) * PROFILER_SAMPLES);
+    profilerCpuCount = count;
+    profilerCpus = cpus;
+
+    // Check for a general purpose counter that can count unhalted cycles. Bit 0 of EBX is set if it can't.
+    uint32_t eax, ebx, ecx, edx;
+    if (cpuid_query(CPUID_GETPERFMON, &eax, &ebx, &ecx, &edx) && (eax & 0xFF) > 0
+        && ((eax >> 8) & 0xFF) > 0 && ((eax >> 24) & 0xFF) > 0 && !(ebx & 0x1) && lapic_enabled() && lapic_max_lvt() >= 4) {
+        // Overflows are delivered through the LAPIC, on an IRQ of their own.
+        profilerPmuIrq = irqs_alloc(1);
+        if (profilerPmuIrq >= 0) {
+            uint8_t width = (eax >> 16) & 0xFF;
+            profilerPmuVersion = eax & 0xFF;
+            profilerPmuMask = (width >= 64) ? 0xFFFFFFFFFFFFFFFF : ((1ULL << width) - 1);
+            irqs_install_handler_proc(profilerPmuIrq, profiler_pmu_callback, IRQ_PROC_ANY);
+        }
+    }
+
+    kprintf("PROFILER: %u samples per processor, performance counters %s.\n", PROFILER_SAMPLES,
+        (profilerPmuIrq >= 0) ? "available" : "unavailable");
+}
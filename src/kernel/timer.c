@@ -26,10 +26,13 @@
 #include <tools.h>
 #include <kprint.h>
 #include <kernel/timer.h>
+#include <kernel/profiler.h>
 
 #include <driver/pit.h>
 #include <kernel/interrupts/ioapic.h>
 #include <kernel/interrupts/irqs.h>
+#include <kernel/multitasking/syscalls.h>
+#include <driver/vga.h>
 
 // Variable to hold the amount of ticks since the OS started.
 static uint64_t ticks = 0;
@@ -43,6 +46,10 @@ uint64_t timer_ticks(void) {
 static bool timer_callback(irq_regs_t *regs, uint8_t irqNum, uint32_t procIndex) {	
 	// Increment the number of ticks.
 	ticks++;
+	syscalls_shared_page_update(ticks);
+	if (procIndex == 0)
+		vga_flush_tick(ticks);
+	profiler_tick(regs, procIndex);
 
 	// Change tasks every 5ms.
 	if (ticks % 5 == 0)
@@ -70,7 +77,7 @@ void timer_init(void) {
         uint32_t rate = lapic_timer_get_rate();
 
         // Disconnect PIT interrupt from I/O APIC and start timer.
-        ioapic_disable_interrupt(ioapic_remap_interrupt(IRQ_TIMER), IRQ_OFFSET + IRQ_TIMER);
+        ioapic_disable_interrupt(ioapic_remap_interrupt(IRQ_TIMER));
         lapic_timer_start(rate);
 
         // Test LAPIC timer.
@@ -0,0 +1,244 @@
+/*
+ * File: trace.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <kprint.h>
+#include <string.h>
+#include <kernel/trace.h>
+#include <kernel/cpuid.h>
+#include <kernel/timer.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/interrupts/lapic.h>
+#include <kernel/interrupts/smp.h>
+#include <kernel/memory/kheap.h>
+#include <driver/serial.h>
+
+// Event names, used by the shell and in dumps.
+static const char *traceEventNames[TRACE_EVENT_COUNT] = {
+    "sched_switch", "irq_entry", "irq_exit", "kheap_alloc", "kheap_free",
+    "disk_start", "disk_done", "net_rx", "net_tx"
+};
+
+volatile uint32_t traceMask = 0;
+
+// Per-processor rings.
+static trace_ring_t *traceRings = NULL;
+static uint32_t traceRingCount = 0;
+
+// Whether timestamps come from the TSC, or timer ticks on processors without one.
+static bool traceTsc = false;
+
+static inline uint64_t trace_timestamp(void) {
+    if (!traceTsc)
+        return timer_ticks();
+
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Records an event in the current processor's ring. Use the trace() macro instead, which skips disabled events.
+ * @param event The event.
+ * @param arg0  The first argument.
+ * @param arg1  The second argument.
+ */
+void trace_record(uint16_t event, uint32_t arg0, uint64_t arg1) {
+    if (traceRings == NULL)
+        return;
+
+    // Keep interrupts out, as they may record events of their own.
+    bool interrupts = interrupts_enabled();
+    interrupts_disable();
+
+    smp_proc_t *proc = smp_get_proc(lapic_id());
+    uint32_t procIndex = (proc != NULL) ? proc->Index : 0;
+    if (procIndex < traceRingCount) {
+        trace_ring_t *ring = &traceRings[procIndex];
+        trace_record_t *record = &ring->Records[ring->Head & (TRACE_RING_RECORDS - 1)];
+        record->Timestamp = trace_timestamp();
+        record->Event = event;
+        record->Reserved = 0;
+        record->Arg0 = arg0;
+        record->Arg1 = arg1;
+        ring->Head++;
+    }
+
+    if (interrupts)
+        interrupts_enable();
+}
+
+/**
+ * Enables or disables events.
+ * @param spec      "all", or event names separated by commas or spaces.
+ * @param enable    True to enable the events.
+ * @return True if every name was valid.
+ */
+bool trace_set_events(const char *spec, bool enable) {
+    uint32_t mask = 0;
+    while (*spec) {
+        // Skip separators.
+        if (*spec == ',' || *spec == ' ') {
+            spec++;
+            continue;
+        }
+
+        // Get name.
+        const char *name = spec;
+        while (*spec && *spec != ',' && *spec != ' ')
+            spec++;
+        size_t length = spec - name;
+
+        if (length == 3 && strncmp(name, "all", 3) == 0) {
+            mask |= (1 << TRACE_EVENT_COUNT) - 1;
+            continue;
+        }
+
+        uint16_t event;
+        for (event = 0; event < TRACE_EVENT_COUNT; event++) {
+            if (strlen(traceEventNames[event]) == length && strncmp(name, traceEventNames[event], length) == 0)
+                break;
+        }
+        if (event == TRACE_EVENT_COUNT)
+            return false;
+        mask |= 1 << event;
+    }
+
+    if (enable)
+        __atomic_fetch_or(&traceMask, mask, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&traceMask, ~mask, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * Throws away all recorded events.
+ */
+void trace_clear(void) {
+    uint32_t mask = __atomic_exchange_n(&traceMask, 0, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < traceRingCount; i++)
+        __atomic_store_n(&traceRings[i].Head, 0, __ATOMIC_RELAXED);
+    traceMask = mask;
+}
+
+/**
+ * Prints the enabled events and how much each processor has recorded.
+ */
+void trace_print_status(void) {
+#if TRACE_ENABLED
+    kprintf("Events:");
+    for (uint16_t event = 0; event < TRACE_EVENT_COUNT; event++)
+        kprintf(" %s%s", traceEventNames[event], (traceMask & (1 << event)) ? "(on)" : "");
+    kprintf("\n");
+
+    for (uint32_t i = 0; i < traceRingCount; i++) {
+        uint32_t head = traceRings[i].Head;
+        kprintf("CPU%u: %u records, %u overwritten\n", i, (head < TRACE_RING_RECORDS) ? head : TRACE_RING_RECORDS,
+            (head < TRACE_RING_RECORDS) ? 0 : (head - TRACE_RING_RECORDS));
+    }
+#else
+    kprintf("Tracing was compiled out.\n");
+#endif
+}
+
+// Writes a line of the dump straight to the serial port, bypassing the console.
+static void trace_dump_line(const char *format, ...) {
+    char line[96];
+    va_list args;
+    va_start(args, format);
+    kvsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    serial_write_text(line, strlen(line));
+}
+
+/**
+ * Streams all recorded events over the serial port, for scripts/trace2chrome.py. Recording is paused
+ * while dumping.
+ */
+void trace_dump(void) {
+    if (!serial_present()) {
+        kprintf("TRACE: No serial port to dump to.\n");
+        return;
+    }
+
+    // Stop recording.
+    uint32_t mask = __atomic_exchange_n(&traceMask, 0, __ATOMIC_RELAXED);
+
+    // Work out how many timestamp units there are per millisecond.
+    uint64_t rate = 1;
+    if (traceTsc) {
+        uint64_t startTicks = timer_ticks();
+        while (timer_ticks() == startTicks)
+            asm volatile ("hlt");
+        startTicks = timer_ticks();
+        uint64_t startTimestamp = trace_timestamp();
+        while (timer_ticks() - startTicks < TRACE_CALIBRATE_MS)
+            asm volatile ("hlt");
+        rate = (trace_timestamp() - startTimestamp) / (timer_ticks() - startTicks);
+    }
+
+    // Header and event names.
+    uint32_t total = 0;
+    trace_dump_line("\nTRACE BEGIN %u %u %llu\n", TRACE_DUMP_VERSION, traceRingCount, rate);
+    for (uint16_t event = 0; event < TRACE_EVENT_COUNT; event++)
+        trace_dump_line("TRACE EVENT %u %s\n", event, traceEventNames[event]);
+
+    // Records from each processor, oldest first.
+    for (uint32_t i = 0; i < traceRingCount; i++) {
+        trace_ring_t *ring = &traceRings[i];
+        uint32_t count = (ring->Head < TRACE_RING_RECORDS) ? ring->Head : TRACE_RING_RECORDS;
+        for (uint32_t j = ring->Head - count; j != ring->Head; j++) {
+            trace_record_t *record = &ring->Records[j & (TRACE_RING_RECORDS - 1)];
+            trace_dump_line("T %x %llx %x %x %llx\n", i, record->Timestamp, record->Event, record->Arg0, record->Arg1);
+        }
+        total += count;
+    }
+    trace_dump_line("TRACE END %u\n", total);
+    kprintf("TRACE: Dumped %u records to serial.\n", total);
+
+    traceMask = mask;
+}
+
+/**
+ * Allocates a ring for each processor. Events are recorded once enabled with trace_set_events().
+ */
+void trace_init(void) {
+#if TRACE_ENABLED
+    // Use the TSC for timestamps if there is one.
+    uint32_t eax, ebx, ecx, edx;
+    traceTsc = cpuid_query(CPUID_GETFEATURES, &eax, &ebx, &ecx, &edx) && (edx & CPUID_FEAT_EDX_TSC);
+
+    // Create a ring for each processor.
+    uint32_t count = smp_get_proc_count();
+    if (count == 0)
+        count = 1;
+    trace_ring_t *rings = (trace_ring_t*)kheap_alloc(sizeof(trace_ring_t) * count);
+    memset(rings, 0, sizeof(trace_ring_t) * count);
+    for (uint32_t i = 0; i < count; i++)
+        rings[i].Records = (trace_record_t*)kheap_alloc(sizeof(trace_record_t) * TRACE_RING_RECORDS);
+    traceRingCount = count;
+    traceRings = rings;
+    kprintf("TRACE: %u records per processor, timestamps from the %s.\n", TRACE_RING_RECORDS, traceTsc ? "TSC" : "timer");
+#endif
+}
@@ -53,6 +53,20 @@ uint16_t inw(uint16_t port)
     return data;
 }
 
+// Outputs count shorts (words) from a buffer to the specified port.
+void outsw(uint16_t port, const void *data, uint32_t count)
+{
+    uintptr_t words = count;
+    asm volatile("rep outsw" : "+S"(data), "+c"(words) : "d"(port) : "memory");
+}
+
+// Gets count shorts (words) from the specified port into a buffer.
+void insw(uint16_t port, void *outData, uint32_t count)
+{
+    uintptr_t words = count;
+    asm volatile("rep insw" : "+D"(outData), "+c"(words) : "d"(port) : "memory");
+}
+
 // -----------------------------------------------------------------------------
 
 // Outputs 4 bytes to the specified port.
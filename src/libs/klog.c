@@ -0,0 +1,229 @@
+/*
+ * File: klog.c
+ * 
+ * Copyright (c) 2017-2018 Sydney Erickson, John Davis
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <main.h>
+#include <klog.h>
+#include <string.h>
+#include <kernel/memory/pmm.h>
+
+// Mask with every level up to and including the given one enabled.
+#define KLOG_MASK(level) ((uint8_t)((1 << ((level) + 1)) - 1))
+
+uint8_t klogMasks[KLOG_SUBSYS_COUNT] = {
+    [0 ... KLOG_SUBSYS_COUNT - 1] = KLOG_MASK(KLOG_DEFAULT_LEVEL)
+};
+
+// Subsystem tags, indexed by KLOG_SUBSYS_*.
+static const char *klogSubsysNames[KLOG_SUBSYS_COUNT] = {
+    [KLOG_SUBSYS_KERNEL] = "KERNEL",
+    [KLOG_SUBSYS_PMM] = "PMM",
+    [KLOG_SUBSYS_KHEAP] = "KHEAP",
+    [KLOG_SUBSYS_PAGING] = "PAGING",
+    [KLOG_SUBSYS_IRQS] = "IRQS",
+    [KLOG_SUBSYS_SMP] = "SMP",
+    [KLOG_SUBSYS_TASKING] = "TASKING",
+    [KLOG_SUBSYS_PCI] = "PCI",
+    [KLOG_SUBSYS_USB] = "USB",
+    [KLOG_SUBSYS_UHCI] = "UHCI",
+    [KLOG_SUBSYS_OHCI] = "OHCI",
+    [KLOG_SUBSYS_STORAGE] = "STORAGE",
+    [KLOG_SUBSYS_ATA] = "ATA",
+    [KLOG_SUBSYS_AHCI] = "AHCI",
+    [KLOG_SUBSYS_FLOPPY] = "FLOPPY",
+    [KLOG_SUBSYS_FAT] = "FAT",
+    [KLOG_SUBSYS_NET] = "NET",
+    [KLOG_SUBSYS_L2ETH] = "L2ETH",
+    [KLOG_SUBSYS_E1000E] = "E1000E",
+    [KLOG_SUBSYS_RTL8139] = "RTL8139"
+};
+
+static const char *klogLevelNames[KLOG_LEVEL_COUNT] = { "error", "warn", "info", "debug", "trace" };
+
+// Copy of the kernel command line, taken before the boot mappings go away.
+static char klogCmdline[KLOG_CMDLINE_SIZE];
+
+/**
+ * Compares a length-delimited word against a name, ignoring case.
+ */
+static bool klog_word_equals(const char *word, size_t length, const char *name) {
+    if (strlen(name) != length)
+        return false;
+    for (size_t i = 0; i < length; i++)
+        if (tolower(word[i]) != tolower(name[i]))
+            return false;
+    return true;
+}
+
+/**
+ * Converts a level name or number into a level mask.
+ * @param word      The level, such as "debug", "3" or "off".
+ * @param length    The length of the word.
+ * @param maskOut   Where to store the resulting mask.
+ * @return True if the level was recognized.
+ */
+static bool klog_parse_level(const char *word, size_t length, uint8_t *maskOut) {
+    if (klog_word_equals(word, length, "off")) {
+        *maskOut = 0;
+        return true;
+    }
+    if (length == 1 && word[0] >= '0' && word[0] < '0' + KLOG_LEVEL_COUNT) {
+        *maskOut = KLOG_MASK(word[0] - '0');
+        return true;
+    }
+    for (uint8_t level = 0; level < KLOG_LEVEL_COUNT; level++) {
+        if (klog_word_equals(word, length, klogLevelNames[level])) {
+            *maskOut = KLOG_MASK(level);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Sets the highest level printed for a subsystem.
+ * @param subsys    The KLOG_SUBSYS_* index.
+ * @param level     The KLOG_LEVEL_* value.
+ */
+void klog_set_level(uint32_t subsys, uint8_t level) {
+    if (subsys >= KLOG_SUBSYS_COUNT || level >= KLOG_LEVEL_COUNT)
+        return;
+    klogMasks[subsys] = KLOG_MASK(level);
+}
+
+/**
+ * Applies a verbosity specification.
+ * @param spec  Comma or space separated entries of the form "subsys:level", or
+ *              a bare "level" applying to all subsystems, e.g. "warn,pci:trace".
+ * @return True if every entry was valid; valid entries are applied regardless.
+ */
+bool klog_parse(const char *spec) {
+    bool valid = true;
+    while (*spec != '\0') {
+        // Skip separators.
+        if (*spec == ',' || *spec == ' ') {
+            spec++;
+            continue;
+        }
+
+        // Find the end of this entry and the subsystem separator, if any.
+        const char *entry = spec;
+        const char *colon = NULL;
+        while (*spec != '\0' && *spec != ',' && *spec != ' ') {
+            if (*spec == ':' && colon == NULL)
+                colon = spec;
+            spec++;
+        }
+
+        uint8_t mask;
+        if (colon == NULL) {
+            // Bare level, apply everywhere.
+            if (klog_parse_level(entry, spec - entry, &mask)) {
+                for (uint32_t i = 0; i < KLOG_SUBSYS_COUNT; i++)
+                    klogMasks[i] = mask;
+                continue;
+            }
+        }
+        else if (klog_parse_level(colon + 1, spec - colon - 1, &mask)) {
+            uint32_t subsys = 0;
+            while (subsys < KLOG_SUBSYS_COUNT && !klog_word_equals(entry, colon - entry, klogSubsysNames[subsys]))
+                subsys++;
+            if (subsys < KLOG_SUBSYS_COUNT) {
+                klogMasks[subsys] = mask;
+                continue;
+            }
+        }
+        valid = false;
+    }
+    return valid;
+}
+
+/**
+ * Prints the current level of each subsystem.
+ */
+void klog_print_levels(void) {
+    kprintf("Compiled up to level %s.\n", klogLevelNames[KLOG_MAX_LEVEL]);
+    for (uint32_t i = 0; i < KLOG_SUBSYS_COUNT; i++) {
+        // The mask is contiguous from bit 0, so the highest set bit is the level.
+        const char *levelName = "off";
+        for (uint8_t level = 0; level < KLOG_LEVEL_COUNT; level++)
+            if (klogMasks[i] & (1 << level))
+                levelName = klogLevelNames[level];
+        kprintf("  %s: %s\n", klogSubsysNames[i], levelName);
+    }
+}
+
+/**
+ * Copies the kernel command line out of the Multiboot information.
+ */
+static void klog_copy_cmdline(void) {
+    const char *cmdline = NULL;
+
+#ifdef PMM_MULTIBOOT2
+    multiboot_tag_t *tag = (multiboot_tag_t*)((uint64_t)&memInfo.mbootInfo->firstTag);
+    uint64_t end = (uint64_t)memInfo.mbootInfo + memInfo.mbootInfo->size;
+    for (; (tag->type != MULTIBOOT_TAG_TYPE_END) && ((uint64_t)tag < end); tag = (multiboot_tag_t*)((uint8_t*)tag + ((tag->size + 7) & ~7))) {
+        if (tag->type == MULTIBOOT_TAG_TYPE_CMDLINE) {
+            cmdline = ((struct multiboot_tag_string*)tag)->string;
+            break;
+        }
+    }
+#else
+    // The command line is still identity mapped at this point, like the memory map.
+    if (memInfo.mbootInfo->flags & MULTIBOOT_INFO_CMDLINE)
+        cmdline = (const char*)memInfo.mbootInfo->cmdline;
+#endif
+
+    if (cmdline == NULL)
+        return;
+    for (size_t i = 0; i < KLOG_CMDLINE_SIZE - 1 && cmdline[i] != '\0'; i++)
+        klogCmdline[i] = cmdline[i];
+}
+
+/**
+ * Applies "klog=" options from the kernel command line. Must be called after pmm_init()
+ * and before paging_init().
+ */
+void klog_init(void) {
+    klog_copy_cmdline();
+
+    // Apply each klog= option, e.g. "klog=warn,pci:debug".
+    char *option = klogCmdline;
+    while (*option != '\0') {
+        char *optionEnd = option;
+        while (*optionEnd != '\0' && *optionEnd != ' ')
+            optionEnd++;
+
+        if (strncmp(option, "klog=", 5) == 0) {
+            char saved = *optionEnd;
+            *optionEnd = '\0';
+            if (!klog_parse(option + 5))
+                kprintf("KLOG: Ignoring invalid entries in \"%s\".\n", option);
+            *optionEnd = saved;
+        }
+
+        option = optionEnd;
+        while (*option == ' ')
+            option++;
+    }
+}
@@ -27,135 +27,210 @@
 #include <driver/serial.h>
 #include <driver/vga.h>
 #include <kernel/lock.h>
+#include <kernel/timer.h>
+#include <kernel/tasking.h>
+#include <kernel/memory/kheap.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/interrupts/lapic.h>
+#include <kernel/interrupts/smp.h>
 #include <string.h>
 
 lock_t kprintf_mutex = { };
 
-// Print a single character.
-void kputchar(char c)
-{
-    // Print the character to both the screen and the serial.
-    serial_write(c);
-    vga_putchar(c);
+// Formatting target. For kprintf full buffers are flushed as a single record, for ksnprintf
+// output past the end is dropped but still counted.
+typedef struct {
+    char *Data;
+    uint32_t Size;
+    uint32_t Length;
+    size_t Total;
+    bool Emit;
+} kprint_buffer_t;
+
+// Pairs of decimal digits, so numbers are converted two digits per division.
+static const char kprintDigitPairs[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+// Console escape sequence parser state.
+enum {
+    KPRINT_STATE_NORMAL,
+    KPRINT_STATE_ESCAPE,
+    KPRINT_STATE_CSI
+};
+
+// Per-processor ring buffers, drained by the console thread.
+static kprint_ring_t *kprintRings = NULL;
+static uint32_t kprintRingCount = 0;
+static volatile bool kprintAsync = false;
+static uint32_t kprintSequence = 0;
+
+static void kprint_emit(const char *data, uint32_t length);
+
+// Console state, only touched by whoever is currently rendering.
+static uint8_t consoleState = KPRINT_STATE_NORMAL;
+static char consoleCsi[KPRINT_CSI_MAX];
+static uint32_t consoleCsiLength = 0;
+
+
+static inline void kprint_putchar(kprint_buffer_t *buffer, char c) {
+    buffer->Total++;
+
+    // Flush buffer if full, or drop the character if formatting into a fixed buffer.
+    if (buffer->Length == buffer->Size) {
+        if (!buffer->Emit)
+            return;
+        kprint_emit(buffer->Data, buffer->Length);
+        buffer->Length = 0;
+    }
+    buffer->Data[buffer->Length++] = c;
 }
 
-// Print a hexadecimal byte.
-void kputchar_hex(uint8_t num, bool capital, bool pad)
-{
-    // Get high and low nibbles.
-    const uint8_t high = (num & 0xF0) >> 4;
-    const uint8_t low = num & 0x0F;
+// Print a run of characters.
+static void kprint_putchars(kprint_buffer_t *buffer, const char *data, size_t length) {
+    buffer->Total += length;
+    while (length > 0) {
+        if (buffer->Length == buffer->Size) {
+            if (!buffer->Emit)
+                return;
+            kprint_emit(buffer->Data, buffer->Length);
+            buffer->Length = 0;
+        }
 
-    // Our hexadecimal ASCII dictionary.
-    const char* hex_chars = capital ? "0123456789ABCDEF" : "0123456789abcdef";
+        // Copy as much as fits.
+        size_t count = buffer->Size - buffer->Length;
+        if (count > length)
+            count = length;
+        memcpy((uint8_t*)buffer->Data + buffer->Length, (uint8_t*)data, count);
+        buffer->Length += count;
+        data += count;
+        length -= count;
+    }
+}
 
-    // Print the hex number.
-    if (high != 0 || pad)
-        kputchar(hex_chars[high]);
-    kputchar(hex_chars[low]);
+// Print a character several times.
+static void kprint_pad(kprint_buffer_t *buffer, char c, size_t count) {
+    while (count--)
+        kprint_putchar(buffer, c);
 }
 
 // Print a string.
-void kputstring(const char *str, size_t max)
+static void kprint_putstring(kprint_buffer_t *buffer, const char *str, size_t max)
 {
-    // Print out string.
-    if (max == 0) {
-        while (*str) {
-            kputchar(*str);
-            str++;
-        }
-    }
-    else {
-        while (*str && max) {
-            kputchar(*str);
-            str++;
-            max--;
-        }
-    }
+    // Find length, stopping at the maximum if there is one.
+    size_t length = 0;
+    while (str[length] && (max == 0 || length < max))
+        length++;
+    kprint_putchars(buffer, str, length);
 }
 
-// Print an integer.
-void kprint_int(int64_t num)
-{
-    // If zero, just print zero.
-    if (num == 0)
-    {
-        kputchar('0');
-        return;
+/**
+ * Converts an unsigned integer to decimal, working backwards from the end of a buffer.
+ * @param end   End of the buffer, which must have room for 20 digits.
+ * @param num   Number to convert.
+ * @return Pointer to the first digit.
+ */
+static char *kprint_render_uint(char *end, uint64_t num) {
+    char *digits = end;
+
+    // 64-bit division is slow on 32-bit processors, so only use it until the number fits in 32 bits.
+    while (num > 0xFFFFFFFF) {
+        uint32_t pair = num % 100;
+        num /= 100;
+        digits -= 2;
+        digits[0] = kprintDigitPairs[pair * 2];
+        digits[1] = kprintDigitPairs[pair * 2 + 1];
     }
 
-    // Determine if negative and get absolute value.
-    bool negative = num < 0;
-    num = negative ? -num : num;
+    uint32_t num32 = (uint32_t)num;
+    while (num32 >= 100) {
+        uint32_t pair = num32 % 100;
+        num32 /= 100;
+        digits -= 2;
+        digits[0] = kprintDigitPairs[pair * 2];
+        digits[1] = kprintDigitPairs[pair * 2 + 1];
+    }
 
-    // Create buffer.
-    char buffer[1 + 20 + 1]; // Sign, maximum size of 64-bit int, null terminator.
-    buffer[sizeof(buffer) - 1] = '\0';
-
-    // Walk through the number backwards.
-    int32_t i = sizeof(buffer) - 2;
-    while (num > 0)
-    {
-        buffer[i--] = '0' + (num % 10);
-        num /= 10;
+    // Last one or two digits.
+    if (num32 >= 10) {
+        digits -= 2;
+        digits[0] = kprintDigitPairs[num32 * 2];
+        digits[1] = kprintDigitPairs[num32 * 2 + 1];
+    } else {
+        *--digits = '0' + num32;
     }
+    return digits;
+}
 
-    // Add sign if negative.
+// Print a decimal number, padded to the width with zeros or spaces.
+static void kprint_decimal(kprint_buffer_t *buffer, uint64_t num, bool negative, size_t width, bool zeroPad, bool leftJustify) {
+    // Create buffer.
+    char digits[1 + 20]; // Sign, maximum size of 64-bit int.
+    char *end = digits + sizeof(digits);
+    char *start = kprint_render_uint(end, num);
+    size_t length = (end - start) + (negative ? 1 : 0);
+    size_t padding = (width > length) ? (width - length) : 0;
+
+    // Zeros go between the sign and digits, spaces go before or after everything.
+    if (padding && !leftJustify && !zeroPad)
+        kprint_pad(buffer, ' ', padding);
     if (negative)
-        buffer[i--] = '-';
+        kprint_putchar(buffer, '-');
+    if (padding && !leftJustify && zeroPad)
+        kprint_pad(buffer, '0', padding);
+    kprint_putchars(buffer, start, end - start);
+    if (padding && leftJustify)
+        kprint_pad(buffer, ' ', padding);
+}
 
-    // Print out numeral.
-    kputstring(&buffer[i + 1], 0);
+// Print an integer.
+static void kprint_int(kprint_buffer_t *buffer, int64_t num, size_t width, bool zeroPad, bool leftJustify)
+{
+    // Get absolute value without overflowing on the most negative number.
+    bool negative = num < 0;
+    uint64_t value = negative ? (0 - (uint64_t)num) : (uint64_t)num;
+    kprint_decimal(buffer, value, negative, width, zeroPad, leftJustify);
 }
 
 // Print an unsigned integer.
-void kprint_uint(uint64_t num)
+static void kprint_uint(kprint_buffer_t *buffer, uint64_t num, size_t width, bool zeroPad, bool leftJustify)
 {
-    // If zero, just print zero.
-    if (num == 0)
-    {
-        kputchar('0');
-        return;
-    }
-
-    // Create buffer.
-    char buffer[20 + 1]; // Maximum size of unsigned 64-bit int, null terminator.
-    buffer[sizeof(buffer) - 1] = '\0';
-
-    // Walk through the number backwards.
-    int32_t i = sizeof(buffer) - 2;
-    while (num > 0)
-    {
-        buffer[i--] = '0' + (num % 10);
-        num /= 10;
-    }
-
-    // Print out numeral.
-    kputstring(&buffer[i + 1], 0);
+    kprint_decimal(buffer, num, false, width, zeroPad, leftJustify);
 }
 
-// Print unsigned int as hexadecimal.
-void kprint_hex(uint64_t num, bool capital, uint8_t width) {
-    bool first = true;
-    for (int8_t i = sizeof(num) - 1; i >= 0; i--) {
-        // Get byte.
-        const uint8_t byte = (num >> (8 * i)) & 0xFF;
+// Print unsigned int as hexadecimal. With a width, exactly that many digits (rounded up to whole bytes) are printed.
+static void kprint_hex(kprint_buffer_t *buffer, uint64_t num, bool capital, uint8_t width) {
+    // Our hexadecimal ASCII dictionary.
+    const char* hex_chars = capital ? "0123456789ABCDEF" : "0123456789abcdef";
 
-        // Are we wanting to ouput a certain width?
-        if (width && (i * 2) >= width) {
-            continue;
-        }
-        else if (width == 0) { // No width specified
-            // If we have yet to hit the first non-zero byte, just continue to the next one.
-            if (first && byte == 0 && i > 0)
-                continue;
-        }
+    // Get number of digits.
+    uint8_t count;
+    if (width) {
+        count = ((width + 1) / 2) * 2;
+        if (count > sizeof(num) * 2)
+            count = sizeof(num) * 2;
+    } else {
+        count = 1;
+        while (count < sizeof(num) * 2 && (num >> (count * 4)) != 0)
+            count++;
+    }
 
-        // Print hex byte.
-        kputchar_hex(byte, capital, !first ? true : width > 0);
-        first = false;
-        width -= 2;
+    // Convert from the lowest nibble up.
+    char digits[sizeof(num) * 2];
+    for (int8_t i = count - 1; i >= 0; i--) {
+        digits[i] = hex_chars[num & 0xF];
+        num >>= 4;
     }
+    kprint_putchars(buffer, digits, count);
 }
 
 static void kprintf_sgr(const char *sequence, uint32_t length) {
@@ -322,34 +397,195 @@ static void kprintf_sgr(const char *sequence, uint32_t length) {
     }
 }
 
-void kprintf(const char* format, ...) {
-    // Get args.
-    va_list args;
-    va_start(args, format);
+// Writes a single character to the console, handling escape sequences.
+static void kprint_console_putchar(char c) {
+    switch (consoleState) {
+        case KPRINT_STATE_NORMAL:
+            // Print the character to both the screen and the serial, unless it starts an escape sequence.
+            serial_write(c);
+            if (c == '\033')
+                consoleState = KPRINT_STATE_ESCAPE;
+            else
+                vga_putchar(c);
+            break;
 
-    // Call va_list kprintf.
-    kprintf_va(true, format, args);
+        case KPRINT_STATE_ESCAPE:
+            // Check if CSI (control sequence introducer). Other sequences only go to serial.
+            serial_write(c);
+            consoleCsiLength = 0;
+            consoleState = (c == '[') ? KPRINT_STATE_CSI : KPRINT_STATE_NORMAL;
+            break;
+
+        case KPRINT_STATE_CSI:
+            // A byte in the range of 0x40-0x7E signals the end.
+            serial_write(c);
+            if (c >= 0x40 && c <= 0x7E) {
+                if (c == 'm')
+                    kprintf_sgr(consoleCsi, consoleCsiLength);
+                consoleState = KPRINT_STATE_NORMAL;
+            }
+            else if (consoleCsiLength < KPRINT_CSI_MAX) {
+                consoleCsi[consoleCsiLength++] = c;
+            }
+            break;
+    }
 }
 
-void kprintf_nolock(const char* format, ...) {
-    // Get args.
-    va_list args;
-    va_start(args, format);
+static void kprint_console_write(const char *data, uint32_t length) {
+    // Disable cursor for increased performance.
+    vga_disable_cursor();
+    uint32_t i = 0;
+    while (i < length) {
+        // Send plain text up to the next escape sequence to the devices in one go.
+        if (consoleState == KPRINT_STATE_NORMAL) {
+            uint32_t start = i;
+            while (i < length && data[i] != '\033')
+                i++;
+            if (i > start) {
+                serial_write_text(data + start, i - start);
+                vga_write(data + start, i - start);
+            }
+            if (i == length)
+                break;
+        }
+        kprint_console_putchar(data[i++]);
+    }
+    vga_enable_cursor();
+}
 
-    // Call va_list kprintf.
-    kprintf_va(false, format, args);
+// Print a single character directly to the console.
+void kputchar(char c) {
+    kprint_console_putchar(c);
 }
 
-// https://en.wikipedia.org/wiki/Printf_format_string
-// Printf implementation.
-void kprintf_va(bool lock, const char* format, va_list args) {
-    // Lock.
-    if (lock)
-        spinlock_lock(&kprintf_mutex);
+static void kprint_ring_read(kprint_ring_t *ring, uint32_t position, void *out, uint32_t length) {
+    uint8_t *outBytes = (uint8_t*)out;
+    for (uint32_t i = 0; i < length; i++)
+        outBytes[i] = ring->Data[(position + i) & (KPRINT_RING_SIZE - 1)];
+}
 
-    // Disable cursor for increased performance.
-    vga_disable_cursor();
+static void kprint_ring_write(kprint_ring_t *ring, const char *data, uint32_t length) {
+    // This processor is the only producer, so only interrupts on it need to be kept out.
+    bool interrupts = interrupts_enabled();
+    interrupts_disable();
 
+    // If there isn't room, drop the record. The console thread will report it.
+    uint32_t head = ring->Head;
+    uint32_t recordSize = KPRINT_RECORD_SIZE(length);
+    if (KPRINT_RING_SIZE - (head - __atomic_load_n(&ring->Tail, __ATOMIC_ACQUIRE)) < recordSize) {
+        ring->Dropped++;
+    }
+    else {
+        // Copy record header and text into ring.
+        kprint_record_t record = { length, __atomic_fetch_add(&kprintSequence, 1, __ATOMIC_RELAXED), timer_ticks() };
+        for (uint32_t i = 0; i < sizeof(kprint_record_t); i++)
+            ring->Data[(head + i) & (KPRINT_RING_SIZE - 1)] = ((uint8_t*)&record)[i];
+        for (uint32_t i = 0; i < length; i++)
+            ring->Data[(head + sizeof(kprint_record_t) + i) & (KPRINT_RING_SIZE - 1)] = data[i];
+
+        // Publish record.
+        __atomic_store_n(&ring->Head, head + recordSize, __ATOMIC_RELEASE);
+    }
+
+    if (interrupts)
+        interrupts_enable();
+}
+
+static void kprint_emit(const char *data, uint32_t length) {
+    if (length == 0)
+        return;
+
+    // Queue text for the console thread if it is running, otherwise print it now.
+    if (kprintAsync) {
+        smp_proc_t *proc = smp_get_proc(lapic_id());
+        uint32_t procIndex = (proc != NULL) ? proc->Index : 0;
+        if (procIndex < kprintRingCount) {
+            kprint_ring_write(&kprintRings[procIndex], data, length);
+            return;
+        }
+    }
+    kprint_console_write(data, length);
+}
+
+// Prints the oldest queued record across all processors. Returns false if there are none.
+static bool kprint_console_drain_one(void) {
+    // Find record with the lowest sequence number.
+    kprint_ring_t *oldestRing = NULL;
+    kprint_record_t oldestRecord;
+    for (uint32_t i = 0; i < kprintRingCount; i++) {
+        kprint_ring_t *ring = &kprintRings[i];
+
+        // Report dropped messages.
+        uint32_t dropped = __atomic_exchange_n(&ring->Dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            char message[] = "\n[kprintf: dropped messages]\n";
+            kprint_console_write(message, sizeof(message) - 1);
+        }
+
+        if (__atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE) == ring->Tail)
+            continue;
+
+        kprint_record_t record;
+        kprint_ring_read(ring, ring->Tail, &record, sizeof(kprint_record_t));
+        if (oldestRing == NULL || (int32_t)(record.Sequence - oldestRecord.Sequence) < 0) {
+            oldestRing = ring;
+            oldestRecord = record;
+        }
+    }
+    if (oldestRing == NULL)
+        return false;
+
+    // Print record text.
+    char text[KPRINT_CHUNK_SIZE];
+    kprint_ring_read(oldestRing, oldestRing->Tail + sizeof(kprint_record_t), text, oldestRecord.Length);
+    kprint_console_write(text, oldestRecord.Length);
+
+    // Free space in ring.
+    __atomic_store_n(&oldestRing->Tail, oldestRing->Tail + KPRINT_RECORD_SIZE(oldestRecord.Length), __ATOMIC_RELEASE);
+    return true;
+}
+
+static void kprint_console_thread(uintptr_t arg0, uintptr_t arg1, uintptr_t arg2) {
+    while (true) {
+        // Print everything queued, then wait for the next interrupt.
+        while (kprintAsync && kprint_console_drain_one());
+        asm volatile ("hlt");
+    }
+}
+
+/**
+ * Starts the console thread. After this kprintf queues text instead of writing to the devices directly.
+ */
+void kprint_console_init(void) {
+    // Create a ring for each processor.
+    kprintRingCount = smp_get_proc_count();
+    if (kprintRingCount == 0)
+        kprintRingCount = 1;
+    kprint_ring_t *rings = (kprint_ring_t*)kheap_alloc(sizeof(kprint_ring_t) * kprintRingCount);
+    memset(rings, 0, sizeof(kprint_ring_t) * kprintRingCount);
+    for (uint32_t i = 0; i < kprintRingCount; i++)
+        rings[i].Data = (uint8_t*)kheap_alloc(KPRINT_RING_SIZE);
+    kprintRings = rings;
+
+    // Start console thread.
+    thread_t *thread = tasking_thread_create_kernel("console", kprint_console_thread, 0, 0, 0);
+    tasking_thread_schedule_proc(thread, 0);
+    kprintf("KPRINT: Console thread started with %u ring buffers.\n", kprintRingCount);
+    kprintAsync = true;
+}
+
+/**
+ * Switches back to synchronous output and prints anything still queued. Used when panicking.
+ */
+void kprint_panic(void) {
+    if (!kprintAsync)
+        return;
+
+    kprintAsync = false;
+    while (kprint_console_drain_one());
+}
+
+static void kprint_format(kprint_buffer_t *buffer, const char *format, va_list args) {
     // Iterate through format string.
     char c;
     while (*format) {
@@ -361,32 +597,35 @@ void kprintf_va(bool lock, const char* format, va_list args) {
             // Get type of formatting.
             char f = *format++;
 
-            // Ignore justify for now.
-            if (f == '-')
+            // Check for left justify and zero padding.
+            bool leftJustify = false;
+            bool zeroPad = false;
+            if (f == '-') {
+                leftJustify = true;
                 f = *format++;
-
-            // Ignore 0.
-            if (f == '0')
+            }
+            if (f == '0') {
+                zeroPad = true;
                 f = *format++;
+            }
 
             // Check width.
             size_t width = 0;
             size_t precision = 0;
-            if (f >= '0' && f <= '9') {
-                width += f - '0';
+            while (f >= '0' && f <= '9') {
+                width = width * 10 + (f - '0');
                 f = *format++;
             }
 
-            // Ignore justify for now.
+            // Precision is parsed, but not used yet.
             if (f == '.') {
                 f = *format++;
-
-                // Check width.
-                if (f >= '0' && f <= '9') {
-                    precision += f - '0';
+                while (f >= '0' && f <= '9') {
+                    precision = precision * 10 + (f - '0');
                     f = *format++;
                 }
             }
+            (void)precision;
 
 
 
@@ -400,18 +639,18 @@ void kprintf_va(bool lock, const char* format, va_list args) {
                     
                     // If we have a %, print a literal %.
                     case '%':
-                        kputchar('%');
+                        kprint_putchar(buffer, '%');
                         break;
 
                     // Print integer.
                     case 'd':
                     case 'i':
-                        kprint_int((int64_t)va_arg(args, int64_t));
+                        kprint_int(buffer, (int64_t)va_arg(args, int64_t), width, zeroPad, leftJustify);
                         break;
 
                     // Print unsigned integer.
                     case 'u':
-                        kprint_uint((uint64_t)va_arg(args, uint64_t));
+                        kprint_uint(buffer, (uint64_t)va_arg(args, uint64_t), width, zeroPad, leftJustify);
                         break;
 
                     // Print floating point.
@@ -422,22 +661,22 @@ void kprintf_va(bool lock, const char* format, va_list args) {
                     
                     // Print hexadecimal.
                     case 'x':
-                        kprint_hex((uint64_t)va_arg(args, uint64_t), false, width);
+                        kprint_hex(buffer, (uint64_t)va_arg(args, uint64_t), false, width);
                         break;
 
                     // Print hexadecimal (uppercase).
                     case 'X':
-                        kprint_hex((uint64_t)va_arg(args, uint64_t), true, width);
+                        kprint_hex(buffer, (uint64_t)va_arg(args, uint64_t), true, width);
                         break;
 
                     // Print string.
                     case 's':
-                        kputstring((const char*)va_arg(args, const char*), width);
+                        kprint_putstring(buffer, (const char*)va_arg(args, const char*), width);
                         break;
 
                     // Print character.
                     case 'c':
-                        kputchar((char)va_arg(args, int32_t));
+                        kprint_putchar(buffer, (char)va_arg(args, int32_t));
                         break;
                 }
             }
@@ -450,18 +689,18 @@ void kprintf_va(bool lock, const char* format, va_list args) {
                     
                     // If we have a %, print a literal %.
                     case '%':
-                        kputchar('%');
+                        kprint_putchar(buffer, '%');
                         break;
 
                     // Print integer.
                     case 'd':
                     case 'i':
-                        kprint_int((int32_t)va_arg(args, int32_t));
+                        kprint_int(buffer, (int32_t)va_arg(args, int32_t), width, zeroPad, leftJustify);
                         break;
 
                     // Print unsigned integer.
                     case 'u':
-                        kprint_uint((uint32_t)va_arg(args, uint32_t));
+                        kprint_uint(buffer, (uint32_t)va_arg(args, uint32_t), width, zeroPad, leftJustify);
                         break;
 
                     // Print floating point.
@@ -472,81 +711,109 @@ void kprintf_va(bool lock, const char* format, va_list args) {
                     
                     // Print hexadecimal.
                     case 'x':
-                        kprint_hex((uint32_t)va_arg(args, uint32_t), false, width);
+                        kprint_hex(buffer, (uint32_t)va_arg(args, uint32_t), false, width);
                         break;
 
                     // Print hexadecimal (uppercase).
                     case 'X':
-                        kprint_hex((uint32_t)va_arg(args, uint32_t), true, width);
+                        kprint_hex(buffer, (uint32_t)va_arg(args, uint32_t), true, width);
                         break;
 
                     // Print pointer as hex.
                     case 'p':
                     case 'P':
-                        kprint_hex((uintptr_t)va_arg(args, uintptr_t), true, false);
+                        kprint_hex(buffer, (uintptr_t)va_arg(args, uintptr_t), true, false);
                         break;
 
                     // Print string.
                     case 's':
-                        kputstring((const char*)va_arg(args, const char*), width);
+                        kprint_putstring(buffer, (const char*)va_arg(args, const char*), width);
                         break;
 
                     // Print character.
                     case 'c':
-                        kputchar((char)va_arg(args, int32_t));
+                        kprint_putchar(buffer, (char)va_arg(args, int32_t));
                         break;
                 }
             }       
         }
-        else if (c == '\033') {
-            // Escape sequence.
-            // Get current character.
-            serial_write(c);
-            c = *format++;
-            serial_write(c);
-
-            // Check if CSI (control sequence introducer).
-            if (c == '[') {
-                // Get length of sequence. A byte in the range of 0x40–0x7E signals the end.
-                bool found = false;
-                char *sequence = format;
-                uint32_t formatEnd = strlen(sequence);
-			    for (uint16_t i = 0; i < formatEnd; i++) {
-                    if (sequence[i] >= 0x40 && sequence[i] <= 0x7E) {
-                        formatEnd = i;
-                        found = true;
-                        break;
-				    }
-			    }
-
-                // Check if we even found the end.
-                if (found) {
-                    // Print to serial.
-                    for (uint32_t i = 0; i <= formatEnd; i++)
-                        serial_write(format[i]);
-
-                    // Determine type of sequence (end char).
-                    char seqTypeChar = sequence[formatEnd];
-                    switch (seqTypeChar) {
-                        case 'm':
-                            kprintf_sgr(sequence, formatEnd);
-                            format += formatEnd + 1;
-                            break;
-                    }
-                }
-            }
-        }
         else
         {
-            // Print any other characters.
-            kputchar(c);
+            // Print any other characters up to the next variable in one go. Escape sequences are passed through and handled by the console.
+            const char *run = format - 1;
+            while (*format && *format != '%')
+                format++;
+            kprint_putchars(buffer, run, format - run);
         }
     }
 
-    // Re-enable the console driver
-    vga_enable_cursor();
+}
+
+void kprintf(const char* format, ...) {
+    // Get args.
+    va_list args;
+    va_start(args, format);
+
+    // Call va_list kprintf.
+    kprintf_va(true, format, args);
+    va_end(args);
+}
+
+void kprintf_nolock(const char* format, ...) {
+    // Get args.
+    va_list args;
+    va_start(args, format);
+
+    // Call va_list kprintf.
+    kprintf_va(false, format, args);
+    va_end(args);
+}
+
+// https://en.wikipedia.org/wiki/Printf_format_string
+// Printf implementation.
+void kprintf_va(bool lock, const char* format, va_list args) {
+    // Lock if printing directly to the console. Queued output needs no lock.
+    bool locked = lock && !kprintAsync;
+    if (locked)
+        spinlock_lock(&kprintf_mutex);
+
+    char data[KPRINT_CHUNK_SIZE];
+    kprint_buffer_t buffer = { data, KPRINT_CHUNK_SIZE, 0, 0, true };
+    kprint_format(&buffer, format, args);
+    kprint_emit(buffer.Data, buffer.Length);
 
     // Release lock.
-    if (lock)
+    if (locked)
         spinlock_release(&kprintf_mutex);
 }
+
+/**
+ * Formats a string into a buffer.
+ * @param str       The buffer, which is always null-terminated unless size is 0.
+ * @param size      The size of the buffer.
+ * @param format    The format string.
+ * @param args      The arguments.
+ * @return The length of the full formatted string, which is size or more if it was truncated.
+ */
+int kvsnprintf(char *str, size_t size, const char *format, va_list args) {
+    kprint_buffer_t buffer = { str, (size > 0) ? (size - 1) : 0, 0, 0, false };
+    kprint_format(&buffer, format, args);
+    if (size > 0)
+        str[buffer.Length] = '\0';
+    return buffer.Total;
+}
+
+/**
+ * Formats a string into a buffer.
+ * @param str       The buffer, which is always null-terminated unless size is 0.
+ * @param size      The size of the buffer.
+ * @param format    The format string.
+ * @return The length of the full formatted string, which is size or more if it was truncated.
+ */
+int ksnprintf(char *str, size_t size, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = kvsnprintf(str, size, format, args);
+    va_end(args);
+    return length;
+}
@@ -24,12 +24,29 @@
 
 #include <main.h>
 #include <string.h>
+#include <kprint.h>
+#include <kernel/cpuid.h>
+#include <kernel/timer.h>
+#include <kernel/memory/kheap.h>
+
+// Use ERMS fast strings for bulk operations?
+static bool stringErms = false;
+
+// Word type that may alias any other type.
+typedef uintptr_t __attribute__((__may_alias__)) string_word_t;
 
 // Compares the first n bytes of memory area str1 and memory area str2.
 int32_t memcmp(const void *str1, const void *str2, size_t n) {
 	const uint8_t *s1 = (const uint8_t*)str1;
 	const uint8_t *s2 = (const uint8_t*)str2;
 
+	// Skip over equal words.
+	while (n >= sizeof(uintptr_t) && *(const string_word_t*)s1 == *(const string_word_t*)s2) {
+		s1 += sizeof(uintptr_t);
+		s2 += sizeof(uintptr_t);
+		n -= sizeof(uintptr_t);
+	}
+
 	// Compare bytes.
 	for (size_t i = 0; i < n; i++)
 	{
@@ -43,12 +60,28 @@ int32_t memcmp(const void *str1, const void *str2, size_t n) {
 
 // Copies n bytes from memory area src to memory area dest.
 void memcpy(uint8_t *dest, uint8_t *src, size_t n) {
-	// Copy bytes.
-	for (size_t i = 0; i < n; i++)
-	{
-		dest[i] = src[i];
-		//kprintf("Byte %i\n", i);
+	// Small copies are faster as a simple loop.
+	if (n < STRING_REP_THRESHOLD) {
+		while (n--)
+			*dest++ = *src++;
+		return;
 	}
+
+	// With ERMS, a byte string copy is the fastest option for any size.
+	if (stringErms) {
+		asm volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+		return;
+	}
+
+	// Copy words, then the remaining bytes.
+	size_t words = n / sizeof(uintptr_t);
+	n %= sizeof(uintptr_t);
+#ifdef X86_64
+	asm volatile ("rep movsq" : "+D"(dest), "+S"(src), "+c"(words) : : "memory");
+#else
+	asm volatile ("rep movsl" : "+D"(dest), "+S"(src), "+c"(words) : : "memory");
+#endif
+	asm volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
 }
 
 // Copies n bytes from memory area str1 to memory area str2,
@@ -57,16 +90,31 @@ void* memmove(void *str1, const void *str2, size_t n) {
 	uint8_t *s1 = (uint8_t*)str1;
 	const uint8_t *s2 = (const uint8_t*)str2;
 
-	// Copy bytes.
-	if (s1 < s2)
-	{
-		for (size_t i = 0; i < n; i++)
-			s1[i] = s2[i];
+	// A forward copy is safe unless the destination starts inside the source.
+	if (s1 <= s2 || s1 >= s2 + n) {
+		memcpy(s1, (uint8_t*)s2, n);
 	}
-	else
-	{
-		for (size_t i = n; i != 0; i--)
-			s1[i-1] = s2[i-1];
+	else {
+		// Copy backwards. This avoids std, as an interrupt taken mid-copy would
+		// run its handlers with the direction flag set.
+		s1 += n;
+		s2 += n;
+
+		// Copy the unaligned tail bytes, then whole words if both pointers agree on alignment.
+		if (((uintptr_t)s1 % sizeof(uintptr_t)) == ((uintptr_t)s2 % sizeof(uintptr_t))) {
+			while (n && ((uintptr_t)s1 % sizeof(uintptr_t))) {
+				*--s1 = *--s2;
+				n--;
+			}
+			while (n >= sizeof(uintptr_t)) {
+				s1 -= sizeof(uintptr_t);
+				s2 -= sizeof(uintptr_t);
+				*(uintptr_t*)s1 = *(const uintptr_t*)s2;
+				n -= sizeof(uintptr_t);
+			}
+		}
+		while (n--)
+			*--s1 = *--s2;
 	}
 	return str1;
 }
@@ -75,19 +123,88 @@ void* memmove(void *str1, const void *str2, size_t n) {
 void* memset(void *str, int32_t c, size_t n) {
 	uint8_t *s = (uint8_t*)str;
 
-	// Copy byte.
-	for (size_t i = 0; i < n; i++)
-		s[i] = (uint8_t)c;
+	// Small fills are faster as a simple loop.
+	if (n < STRING_REP_THRESHOLD) {
+		while (n--)
+			*s++ = (uint8_t)c;
+		return str;
+	}
+
+	// With ERMS, a byte string store is the fastest option for any size.
+	if (stringErms) {
+		asm volatile ("rep stosb" : "+D"(s), "+c"(n) : "a"(c) : "memory");
+		return str;
+	}
+
+	// Fill words, then the remaining bytes.
+	uintptr_t pattern = (uintptr_t)-1 / 0xFF * (uint8_t)c;
+	size_t words = n / sizeof(uintptr_t);
+	n %= sizeof(uintptr_t);
+#ifdef X86_64
+	asm volatile ("rep stosq" : "+D"(s), "+c"(words) : "a"(pattern) : "memory");
+#else
+	asm volatile ("rep stosl" : "+D"(s), "+c"(words) : "a"(pattern) : "memory");
+#endif
+	asm volatile ("rep stosb" : "+D"(s), "+c"(n) : "a"(pattern) : "memory");
 	return str;
 }
 
 void* memset16 (void *ptr, uint16_t value, size_t num) {
 	uint16_t* p = ptr;
-	while(num--)
-		*p++ = value;
+	asm volatile ("rep stosw" : "+D"(p), "+c"(num) : "a"(value) : "memory");
 	return ptr;
 }
 
+// Selects memory routines based on processor features.
+void string_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+	if (cpuid_query(CPUID_GETEXTENDEDFEATURES, &eax, &ebx, &ecx, &edx) && (ebx & CPUID_FEAT_EBX_ERMS))
+		stringErms = true;
+	kprintf("STRING: Using %s for memory operations.\n", stringErms ? "ERMS byte strings" : "word strings");
+}
+
+// Measures memory routine throughput for a range of sizes.
+void string_benchmark(void) {
+	static const size_t sizes[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+	uint8_t *src = (uint8_t*)kheap_alloc(STRING_BENCH_MAX_SIZE);
+	uint8_t *dest = (uint8_t*)kheap_alloc(STRING_BENCH_MAX_SIZE);
+	if (src == NULL || dest == NULL)
+		panic("STRING: Unable to allocate benchmark buffers!\n");
+	memset(src, 0xA5, STRING_BENCH_MAX_SIZE);
+
+	for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t size = sizes[i];
+		uint32_t iterations = STRING_BENCH_BYTES / size;
+		uint64_t rates[3];
+
+		for (uint8_t op = 0; op < 3; op++) {
+			// Wait for a tick edge so timing starts at a known point.
+			uint64_t start = timer_ticks();
+			while (timer_ticks() == start);
+			start = timer_ticks();
+
+			for (uint32_t j = 0; j < iterations; j++) {
+				if (op == 0)
+					memcpy(dest, src, size);
+				else if (op == 1)
+					memset(dest, j, size);
+				else
+					memmove(dest + 1, dest, size - 1);
+			}
+
+			// Bytes per millisecond divided by 1000 gives MB/s.
+			uint64_t elapsed = timer_ticks() - start;
+			if (elapsed == 0)
+				elapsed = 1;
+			rates[op] = ((uint64_t)iterations * size) / elapsed / 1000;
+		}
+		kprintf("STRING: %u bytes: memcpy %llu MB/s, memset %llu MB/s, memmove %llu MB/s\n", (uint32_t)size, rates[0], rates[1], rates[2]);
+	}
+
+	kheap_free(src);
+	kheap_free(dest);
+}
+
 // Appends the string pointed to by src to the end of the string pointed to by dest.
 char* strcat(char *dest, const char *src) {
 	size_t i, j;
@@ -27,6 +27,7 @@
 #include <io.h>
 #include <string.h>
 #include <kprint.h>
+#include <klog.h>
 #include <kernel/gdt.h>
 #include <kernel/interrupts/interrupts.h>
 #include <kernel/acpi/acpi.h>
@@ -36,8 +37,12 @@
 #include <kernel/tasking.h>
 #include <kernel/timer.h>
 #include <kernel/interrupts/smp.h>
+#include <kernel/interrupts/irqs.h>
 #include <kernel/cpuid.h>
+#include <kernel/trace.h>
+#include <kernel/profiler.h>
 #include <driver/vga.h>
+#include <driver/fbcon.h>
 #include <driver/storage/floppy.h>
 #include <driver/serial.h>
 #include <driver/pci.h>
@@ -46,6 +51,7 @@
 #include <libs/keyboard.h>
 #include <driver/rtc.h>
 #include <kernel/multitasking/syscalls.h>
+#include <kernel/fpu.h>
 
 #include <driver/usb/devices/usb_device.h>
 
@@ -55,6 +61,9 @@
 
 #include <driver/fs/fat.h>
 #include <driver/storage/storage.h>
+#include <driver/storage/block.h>
+#include <driver/storage/bcache.h>
+#include <driver/storage/ata/ata.h>
 
 // Displays a kernel panic message and halts the system.
 void panic(const char *format, ...) {
@@ -65,6 +74,11 @@ void panic(const char *format, ...) {
     va_list args;
 	va_start(args, format);
 
+	// Flush queued output and print directly from here on.
+	serial_panic();
+	vga_panic();
+	kprint_panic();
+
 	// Show panic.
 	kprintf_nolock("\nPANIC:\n");
 	kprintf_va(false, format, args);
@@ -91,10 +105,13 @@ void kernel_main() {
 	// Initialize the GDT.
 	gdt_init_bsp();
 
-	// Initialize memory system.
+	// Initialize memory system. Log levels and the framebuffer are taken from the Multiboot information before it is unmapped.
 	pmm_init();
+	klog_init();
+	fbcon_early_init();
     paging_init();
 	kheap_init();
+	fbcon_init();
 
 	// Initialize ACPI and interrupts.
 	acpi_init();
@@ -103,15 +120,29 @@ void kernel_main() {
 	// Initialize timer.
     timer_init();
 
+	// Let the timer batch console updates to video memory from here on.
+	vga_set_deferred(true);
+
 	kprintf("Initializing PS/2...\n");
 	ps2_init();
 
-	// Initialize SMP.
+	// Switch serial over to interrupt-driven I/O.
+	serial_init_irq();
+
+	// Initialize FPU and SIMD state handling.
+	fpu_init();
+
+	// Initialize SMP, and trace and profiler buffers for each processor.
 	smp_init();
+	trace_init();
+	profiler_init();
 
 	// Print CPUID info.
 	cpuid_print_capabilities();
 
+	// Select memory routines for this processor.
+	string_init();
+
 	// Start up tasking and create kernel task.
 	kprintf("Starting tasking...\n");
 	tasking_init();
@@ -165,12 +196,18 @@ void kernel_late() {
 	//tasking_process_add(tasking_process_create("another one", tasking_thread_create("ring3", (uintptr_t)secondprocess_thread, 0, 0, 0), false));
 
 	acpi_late_init();
+
+	// Initialize block buffer cache.
+	bcache_init();
 	
 	// Initialize floppy.
 	floppy_init();
 
 	pci_init();
 
+	// Register the partitions of every disk found.
+	block_scan_partitions();
+
 	// Print info.
 	kprintf("\e[92mKernel is located at 0x%p!\n", memInfo.kernelStart);
 	kprintf("Detected usable RAM: %uMB\n", memInfo.memoryKb / 1024);
@@ -209,8 +246,11 @@ void kernel_late() {
 		uint16_t i = 0;
 		while (i < 98) {
 			uint16_t k = keyboard_get_last_key();
-			while (k == KEYBOARD_KEY_UNKNOWN && serial_received() == 0)
+			while (k == KEYBOARD_KEY_UNKNOWN && serial_received() == 0) {
+				// Both keyboard and serial input arrive by interrupt, so sleep until the next one.
+				asm volatile ("hlt");
 				k = keyboard_get_last_key();
+			}
 
 			if (serial_received() != 0) {
 				char c = serial_read();
@@ -260,6 +300,39 @@ void kernel_late() {
 				// Mount? floppy drive.
 			fat_init(storageDevices);
 		}
+		else if (strncmp(buffer, "mount ", 6) == 0) {
+			block_device_t *blockDevice = block_find(buffer + 6);
+			if (blockDevice != NULL)
+				fat_init(&blockDevice->Storage);
+			else
+				kprintf("No block device named %s.\n", buffer + 6);
+		}
+		else if (strcmp(buffer, "ls") == 0 || strncmp(buffer, "ls ", 3) == 0) {
+			// List a directory on the most recently mounted volume.
+			if (fatVolumes == NULL)
+				kprintf("No volume mounted.\n");
+			else if (!fat_print_dir(fatVolumes, buffer[2] == ' ' ? buffer + 3 : "/"))
+				kprintf("Directory not found.\n");
+		}
+		else if (strncmp(buffer, "cat ", 4) == 0) {
+			fat_file_t file;
+			if (fatVolumes == NULL) {
+				kprintf("No volume mounted.\n");
+			}
+			else if (fat_open(fatVolumes, buffer + 4, &file)) {
+				char *text = (char*)kheap_alloc(file.Size + 1);
+				if (text != NULL && fat_read(&file, 0, (uint8_t*)text, file.Size)) {
+					text[file.Size] = '\0';
+					kprintf("%s\n", text);
+				}
+				if (text != NULL)
+					kheap_free(text);
+				fat_close(&file);
+			}
+			else {
+				kprintf("File not found.\n");
+			}
+		}
 
 		else if (strcmp(buffer, "corp") == 0)
 			kprintf("Hacking CorpNewt's computer and installing SydOS.....\n");
@@ -305,5 +378,111 @@ void kernel_late() {
 		else if (strcmp(buffer, "free") == 0) {
 			kprintf("Free page count: %u\n", pmm_frames_available_long());
 		}
+		else if (strcmp(buffer, "membench") == 0) {
+			string_benchmark();
+		}
+		else if (strcmp(buffer, "syscalls") == 0) {
+			syscalls_print_stats();
+		}
+		else if (strcmp(buffer, "loglevel") == 0) {
+			klog_print_levels();
+		}
+		else if (strncmp(buffer, "loglevel ", 9) == 0) {
+			// Levels are given as "subsys:level" or a bare level for all subsystems.
+			if (!klog_parse(buffer + 9))
+				kprintf("Usage: loglevel [subsys:]error|warn|info|debug|trace|off, ...\n");
+		}
+		else if (strcmp(buffer, "block") == 0) {
+			block_print_status();
+		}
+		else if (strncmp(buffer, "blockbench ", 11) == 0) {
+			block_device_t *blockDevice = block_find(buffer + 11);
+			if (blockDevice != NULL)
+				block_benchmark(blockDevice, 16);
+			else
+				kprintf("No block device named %s.\n", buffer + 11);
+		}
+		else if (strcmp(buffer, "ata dma on") == 0) {
+			ata_set_dma_allowed(true);
+		}
+		else if (strcmp(buffer, "ata dma off") == 0) {
+			ata_set_dma_allowed(false);
+		}
+		else if (strcmp(buffer, "bcache") == 0) {
+			bcache_print_status();
+		}
+		else if (strcmp(buffer, "sync") == 0) {
+			if (!bcache_sync(NULL))
+				kprintf("Some blocks could not be written back.\n");
+		}
+		else if (strcmp(buffer, "trace") == 0) {
+			trace_print_status();
+		}
+		else if (strncmp(buffer, "trace on ", 9) == 0) {
+			if (!trace_set_events(buffer + 9, true))
+				kprintf("Usage: trace on|off all|event, ...\n");
+		}
+		else if (strncmp(buffer, "trace off ", 10) == 0) {
+			if (!trace_set_events(buffer + 10, false))
+				kprintf("Usage: trace on|off all|event, ...\n");
+		}
+		else if (strcmp(buffer, "trace clear") == 0) {
+			trace_clear();
+		}
+		else if (strcmp(buffer, "trace dump") == 0) {
+			trace_dump();
+		}
+		else if (strcmp(buffer, "profile") == 0) {
+			profiler_print_status();
+		}
+		else if (strncmp(buffer, "profile start", 13) == 0) {
+			// Source is the timer unless "pmu" is given, stack walking is enabled with "stacks".
+			uint8_t source = PROFILER_SOURCE_TIMER;
+			bool stacks = false;
+			char *argStr = buffer + 13;
+			while (*argStr == ' ') {
+				argStr++;
+				if (strncmp(argStr, "pmu", 3) == 0)
+					source = PROFILER_SOURCE_PMU;
+				else if (strncmp(argStr, "stacks", 6) == 0)
+					stacks = true;
+				while (*argStr != ' ' && *argStr != '\0')
+					argStr++;
+			}
+			if (!profiler_start(source, stacks))
+				kprintf("Unable to start profiler.\n");
+		}
+		else if (strcmp(buffer, "profile stop") == 0) {
+			profiler_stop();
+		}
+		else if (strcmp(buffer, "profile dump") == 0) {
+			profiler_dump();
+		}
+		else if (strcmp(buffer, "irqs") == 0) {
+			irqs_print_stats();
+		}
+		else if (strcmp(buffer, "irqbalance") == 0) {
+			irqs_rebalance();
+			irqs_print_stats();
+		}
+		else if (strncmp(buffer, "irqaffinity ", 12) == 0) {
+			// Get IRQ and processor, or "any" for lowest priority delivery.
+			char *argStr = buffer + 12;
+			uint32_t irq = 0;
+			while (*argStr >= '0' && *argStr <= '9')
+				irq = irq * 10 + (*argStr++ - '0');
+			while (*argStr == ' ')
+				argStr++;
+
+			uint32_t proc = 0;
+			if (strcmp(argStr, "any") == 0)
+				proc = IRQ_PROC_ANY;
+			else
+				while (*argStr >= '0' && *argStr <= '9')
+					proc = proc * 10 + (*argStr++ - '0');
+
+			if (irq >= irqs_get_max_count() || !irqs_set_affinity(irq, proc))
+				kprintf("Unable to change affinity of IRQ%u.\n", irq);
+		}
 	}
 }
@@ -23,61 +23,64 @@
  */
 
 #include <main.h>
+#include <kprint.h>
 #include <kernel/timer.h>
 
 /**
- * Convert int to char array
+ * Convert unsigned int to char array
  * @param  value  Input integer
  * @param  result Output buffer
  * @param  base   Number base (ex: base 10)
  * @return        Char array of number
  */
-char* itoa(int32_t value, char* result, int base) {
-		// check that the base if valid
+char* utoa(uint32_t value, char* result, int base) {
+	// check that the base if valid
 	if (base < 2 || base > 36) { *result = '\0'; return result; }
 
-	char* ptr = result, *ptr1 = result, tmp_char;
-	int tmp_value;
+	// Decimal and hex go through the formatter, which converts two digits per division.
+	// 11 is enough for any 32-bit number and the null terminator.
+	if (base == 10) {
+		ksnprintf(result, 11, "%u", value);
+		return result;
+	} else if (base == 16) {
+		ksnprintf(result, 11, "%x", value);
+		return result;
+	}
 
+	// Other bases are written backwards, then reversed.
+	char* ptr = result, *ptr1 = result, tmp_char;
 	do {
-		tmp_value = value;
+		*ptr++ = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
 		value /= base;
-		*ptr++ = "zyxwvutsrqponmlkjihgfedcba9876543210123456789abcdefghijklmnopqrstuvwxyz" [35 + (tmp_value - value * base)];
-	} while ( value );
+	} while (value);
 
-		// Apply negative sign
-	if (tmp_value < 0) *ptr++ = '-';
 	*ptr-- = '\0';
-	while(ptr1 < ptr) {
+	while (ptr1 < ptr) {
 		tmp_char = *ptr;
-		*ptr--= *ptr1;
+		*ptr-- = *ptr1;
 		*ptr1++ = tmp_char;
 	}
 	return result;
 }
 
-char* utoa(uint32_t value, char* result, int base) {
-		// check that the base if valid
+/**
+ * Convert int to char array
+ * @param  value  Input integer
+ * @param  result Output buffer
+ * @param  base   Number base (ex: base 10)
+ * @return        Char array of number
+ */
+char* itoa(int32_t value, char* result, int base) {
+	// check that the base if valid
 	if (base < 2 || base > 36) { *result = '\0'; return result; }
 
-	char* ptr = result, *ptr1 = result, tmp_char;
-	int tmp_value;
-
-	do {
-		tmp_value = value;
-		value /= base;
-		*ptr++ = "zyxwvutsrqponmlkjihgfedcba9876543210123456789abcdefghijklmnopqrstuvwxyz" [35 + (tmp_value - value * base)];
-	} while ( value );
-
-		// Apply negative sign
-	if (tmp_value < 0) *ptr++ = '-';
-	*ptr-- = '\0';
-	while(ptr1 < ptr) {
-		tmp_char = *ptr;
-		*ptr--= *ptr1;
-		*ptr1++ = tmp_char;
+	// Apply negative sign, and convert the magnitude.
+	if (value < 0) {
+		*result = '-';
+		utoa(0 - (uint32_t)value, result + 1, base);
+		return result;
 	}
-	return result;
+	return utoa(value, result, base);
 }
 
 uint32_t random_seed = 1;